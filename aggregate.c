@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+
+#include "aggregate.h"
+#include "diag.h"
+#include "journal.h"
+#include "codec.h"
+#include "metrics.h"
+#include "archive.h"
+#include "manifest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#define SPLIT_BYTES (4L * 1024 * 1024)   /* files above this are split into ranges */
+#define MAX_WORKERS 64
+
+typedef struct {
+    char fname[64];
+    long start, end;     /* byte range; rows starting in [start, end) belong here */
+} WorkItem;
+
+typedef struct {
+    const WorkItem *items;
+    DaySummary *partial; /* one slot per item */
+    int n_items;
+    int next;            /* next unclaimed item, advanced atomically */
+    int failed;
+} WorkQueue;
+
+int aggregate_default_workers(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > MAX_WORKERS) n = MAX_WORKERS;
+    return (int)n;
+}
+
+static int scan_item(const WorkItem *it, DaySummary *s) {
+    CsvReader rd;
+    if (csv_reader_open(&rd, it->fname) != 0) {
+        diag("Could not open %s for reading: %s", it->fname, strerror(errno));
+        return -1;
+    }
+    /* Start on a line boundary: the line containing byte start-1 belongs
+       to the previous range. At offset 0 the reader is already past the header. */
+    if (it->start > 0 && csv_reader_seek_line(&rd, it->start) != 0) {
+        csv_reader_close(&rd);
+        return -1;
+    }
+    CsvRow row;
+    long here;
+    while (csv_reader_next(&rd, &row, &here) && here < it->end)
+        day_summary_add_row(s, &row);
+    csv_reader_close(&rd);
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    WorkQueue *q = arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED);
+        if (i >= q->n_items) break;
+        if (scan_item(&q->items[i], &q->partial[i]) != 0)
+            __atomic_store_n(&q->failed, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static int push_item(WorkItem **items, int *n, int *cap, const char *name, long start, long end) {
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        WorkItem *p = realloc(*items, (size_t)*cap * sizeof(*p));
+        if (!p) return -1;
+        *items = p;
+    }
+    snprintf((*items)[*n].fname, sizeof((*items)[*n].fname), "%s", name);
+    (*items)[*n].start = start;
+    (*items)[*n].end = end;
+    (*n)++;
+    return 0;
+}
+
+static int cmp_item(const void *a, const void *b) {
+    const WorkItem *x = a, *y = b;
+    int c = strcmp(x->fname, y->fname);
+    return c ? c : (x->start > y->start) - (x->start < y->start);
+}
+
+/* Collect the in-range files from the partition manifests, splitting large
+   ones at fixed byte offsets (the scanner moves each range start to the
+   next line boundary). The last range runs to the end of the file, which
+   may have grown since its manifest entry. An archived day is one item: it
+   is decoded whole. */
+static int collect_items(const char *from_date, const char *to_date,
+                         WorkItem **items_out, AggregateStats *stats) {
+    ManifestEntry *files = NULL;
+    int nf = manifest_list(from_date, to_date, MAN_SALES, &files);
+    if (nf < 0) return -1;
+    WorkItem *items = NULL;
+    int n = 0, cap = 0, rc = 0;
+    for (int i = 0; rc == 0 && i < nf; ++i) {
+        long size = (long)files[i].bytes;
+        stats->files++;
+        stats->bytes += size;
+        long start = 0;
+        do {
+            rc = push_item(&items, &n, &cap, files[i].path, start,
+                           start + SPLIT_BYTES < size ? start + SPLIT_BYTES : LONG_MAX);
+            start += SPLIT_BYTES;
+        } while (rc == 0 && start < size);
+    }
+    free(files);
+    ArchiveDayInfo *arch = NULL;
+    int na = rc == 0 ? archive_list_days(from_date, to_date, &arch) : 0;
+    for (int i = 0; rc == 0 && i < na; ++i) {
+        char name[32];
+        make_daily_csv_name(arch[i].date, name, sizeof(name));
+        stats->files++;
+        stats->bytes += (long)arch[i].csv_bytes;
+        rc = push_item(&items, &n, &cap, name, 0, (long)arch[i].csv_bytes);
+    }
+    free(arch);
+    if (rc != 0 || na < 0) {
+        free(items);
+        return -1;
+    }
+    qsort(items, (size_t)n, sizeof(*items), cmp_item);
+    *items_out = items;
+    return n;
+}
+
+static void summary_merge(DaySummary *dst, const DaySummary *src) {
+    dst->tx_count += src->tx_count;
+    dst->profit += src->profit;
+    for (int c = 0; c < cur_count; ++c) {
+        dst->vol_in[c] += src->vol_in[c];
+        dst->vol_out[c] += src->vol_out[c];
+    }
+}
+
+int aggregate_range(const char *from_date, const char *to_date, int workers,
+                    DaySummary *out, AggregateStats *stats) {
+    journal_flush();
+    int64_t m0 = metrics_start(MET_AGGREGATE);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    memset(out, 0, sizeof(*out));
+    memset(stats, 0, sizeof(*stats));
+
+    WorkItem *items = NULL;
+    int n = collect_items(from_date, to_date, &items, stats);
+    if (n < 0) return -1;
+
+    if (workers <= 0) workers = aggregate_default_workers();
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+    if (workers > n) workers = n > 0 ? n : 1;
+
+    WorkQueue q = { .items = items, .n_items = n, .next = 0, .failed = 0 };
+    q.partial = calloc(n > 0 ? (size_t)n : 1, sizeof(DaySummary));
+    if (!q.partial) {
+        free(items);
+        return -1;
+    }
+
+    pthread_t tids[MAX_WORKERS];
+    int started = 0;
+    for (int i = 1; i < workers; ++i) {
+        if (pthread_create(&tids[started], NULL, worker_main, &q) != 0) break;
+        started++;
+    }
+    worker_main(&q);              /* the calling thread works too */
+    for (int i = 0; i < started; ++i) pthread_join(tids[i], NULL);
+
+    for (int i = 0; i < n; ++i) summary_merge(out, &q.partial[i]);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    stats->workers = started + 1;
+    stats->items = n;
+    stats->seconds = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    free(q.partial);
+    free(items);
+    metrics_end(MET_AGGREGATE, m0);
+    return q.failed ? -1 : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "daysum.h"
+
+/* Parallel aggregation over the sales files of a date range.
+ *
+ * The range is cut into work items (whole files, or line-aligned byte ranges
+ * of large files). A pool of worker threads claims items from a shared
+ * counter and sums each into its own slot; the slots are then reduced in
+ * item order, so the result does not depend on the number of workers. */
+
+typedef struct {
+    int workers;        /* threads used */
+    int files;          /* sales files in range */
+    int items;          /* work items after splitting */
+    long bytes;         /* CSV bytes scanned */
+    double seconds;
+} AggregateStats;
+
+/* Worker count matching the online CPUs. */
+int aggregate_default_workers(void);
+
+/* Aggregate every sales_<date>.csv with from_date <= date <= to_date
+   (inclusive, YYYY-MM-DD). workers <= 0 selects the default.
+   Returns 0 on success, -1 on error. */
+int aggregate_range(const char *from_date, const char *to_date, int workers,
+                    DaySummary *out, AggregateStats *stats);
+
+#endif /* AGGREGATE_H */
@@ -0,0 +1,696 @@
+#define _GNU_SOURCE
+
+#include "archive.h"
+#include "diag.h"
+#include "codec.h"
+#include "daysum.h"
+#include "rollup.h"
+#include "segment.h"
+#include "journal.h"
+#include "manifest.h"
+#include "metrics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define ARC_MAGIC "EXARC01"
+#define ARC_VERSION 1
+#define ARC_MAX_CODES 255
+#define ARC_MAX_DAYS 31
+
+enum {
+    TAG_ROW = 0x00,          /* encoded row; | TAG_PARTIAL */
+    TAG_PARTIAL = 0x01,
+    TAG_LINE = 0x02,         /* verbatim line, '\n' added back */
+    TAG_TAIL = 0x03          /* verbatim bytes after the last '\n' */
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t ndays;
+    uint32_t ncodes;
+    uint32_t reserved;
+    uint64_t codes_off;      /* ncodes entries of char[8] */
+    uint64_t dir_off;        /* ndays ArcDay entries, by date */
+} ArcHeader;
+
+typedef struct {
+    char date[16];
+    int64_t tx_count;
+    int64_t profit;
+    int64_t csv_bytes;
+    uint64_t csv_hash;       /* FNV-1a of the day file */
+    uint64_t rows_off, rows_len;
+    uint64_t receipts_off, receipts_len;
+    uint64_t receipts_hash;
+} ArcDay;
+
+typedef struct {
+    int fd;
+    int64_t size;
+    ArcHeader h;
+    char (*codes)[8];
+    ArcDay *days;
+} Arc;
+
+/* Codes and the last rate of each, shared by encoder and decoder. */
+typedef struct {
+    int32_t prev_secs;
+    int64_t prev_tx;
+    int64_t last_from[ARC_MAX_CODES];
+    int64_t last_to[ARC_MAX_CODES];
+} RowState;
+
+void make_archive_name(const char *year_month, char *out, size_t cap) {
+    snprintf(out, cap, "%.4s/%.2s/sales_%.7s.arc", year_month, year_month + 5, year_month);
+}
+
+static uint64_t fnv(const void *p, size_t n) {
+    const unsigned char *b = p;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= b[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static uint8_t *put_signed(uint8_t *p, int64_t v) {
+    return put_varint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        uint8_t b = *(*p)++;
+        x |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int get_signed(const uint8_t **p, const uint8_t *end, int64_t *v) {
+    uint64_t u;
+    if (!get_varint(p, end, &u)) return 0;
+    *v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    return 1;
+}
+
+/* Whole file into memory. Returns 0, or -1 with errno set. */
+static int read_file(const char *fname, char **out, size_t *len) {
+    int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    metrics_add(MET_FILES_OPENED, 1);
+    struct stat st;
+    char *buf = NULL;
+    size_t got = 0;
+    if (fstat(fd, &st) == 0 && (buf = malloc((size_t)st.st_size + 1)) != NULL) {
+        while (got < (size_t)st.st_size) {
+            ssize_t n = read(fd, buf + got, (size_t)st.st_size - got);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            got += (size_t)n;
+        }
+    }
+    int ok = buf && got == (size_t)st.st_size;
+    close(fd);
+    if (!ok) {
+        free(buf);
+        errno = errno ? errno : EIO;
+        return -1;
+    }
+    metrics_add(MET_BYTES_READ, (long)got);
+    *out = buf;
+    *len = got;
+    return 0;
+}
+
+/* Archive file */
+
+static void arc_close(Arc *a) {
+    if (a->fd >= 0) close(a->fd);
+    free(a->codes);
+    free(a->days);
+    memset(a, 0, sizeof(*a));
+    a->fd = -1;
+}
+
+static int arc_open_file(const char *fname, Arc *a) {
+    memset(a, 0, sizeof(*a));
+    a->fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (a->fd < 0) return -1;
+    metrics_add(MET_FILES_OPENED, 1);
+    struct stat st;
+    int ok = fstat(a->fd, &st) == 0 && pread(a->fd, &a->h, sizeof(a->h), 0) == (ssize_t)sizeof(a->h) &&
+             memcmp(a->h.magic, ARC_MAGIC, sizeof(ARC_MAGIC)) == 0 && a->h.version == ARC_VERSION &&
+             a->h.ncodes <= ARC_MAX_CODES && a->h.ndays <= ARC_MAX_DAYS &&
+             a->h.codes_off + a->h.ncodes * 8ULL <= (uint64_t)st.st_size &&
+             a->h.dir_off + a->h.ndays * sizeof(ArcDay) <= (uint64_t)st.st_size;
+    a->size = ok ? (int64_t)st.st_size : 0;
+    if (ok) {
+        a->codes = calloc(a->h.ncodes + 1, 8);
+        a->days = calloc(a->h.ndays + 1, sizeof(ArcDay));
+        ok = a->codes && a->days &&
+             pread(a->fd, a->codes, a->h.ncodes * 8, (off_t)a->h.codes_off) == (ssize_t)(a->h.ncodes * 8) &&
+             pread(a->fd, a->days, a->h.ndays * sizeof(ArcDay), (off_t)a->h.dir_off) ==
+                 (ssize_t)(a->h.ndays * sizeof(ArcDay));
+    }
+    for (uint32_t i = 0; ok && i < a->h.ncodes; ++i) a->codes[i][7] = '\0';
+    for (uint32_t i = 0; ok && i < a->h.ndays; ++i) {
+        const ArcDay *d = &a->days[i];
+        ok = d->date[10] == '\0' && d->rows_off + d->rows_len <= (uint64_t)a->size &&
+             d->receipts_off + d->receipts_len <= (uint64_t)a->size;
+    }
+    if (!ok) {
+        diag("Archive %s is damaged", fname);
+        arc_close(a);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int arc_open(const char *year_month, Arc *a) {
+    char fname[64];
+    make_archive_name(year_month, fname, sizeof(fname));
+    return arc_open_file(fname, a);
+}
+
+static const ArcDay *arc_day(const Arc *a, const char *date_text) {
+    for (uint32_t i = 0; i < a->h.ndays; ++i)
+        if (strcmp(a->days[i].date, date_text) == 0) return &a->days[i];
+    return NULL;
+}
+
+static int arc_read(const Arc *a, uint64_t off, uint64_t len, char **out) {
+    char *buf = malloc(len + 1);
+    if (!buf) return -1;
+    if (len && pread(a->fd, buf, len, (off_t)off) != (ssize_t)len) {
+        free(buf);
+        return -1;
+    }
+    metrics_add(MET_BYTES_READ, (long)len);
+    *out = buf;
+    return 0;
+}
+
+static int loose_csv_exists(const char *date_text) {
+    char fname[64];
+    make_daily_csv_name(date_text, fname, sizeof(fname));
+    return access(fname, F_OK) == 0;
+}
+
+/* Rows */
+
+static void put_clock(char *t, int secs) {
+    int h = secs / 3600, m = secs / 60 % 60, s = secs % 60;
+    t[0] = (char)('0' + h / 10); t[1] = (char)('0' + h % 10); t[2] = ':';
+    t[3] = (char)('0' + m / 10); t[4] = (char)('0' + m % 10); t[5] = ':';
+    t[6] = (char)('0' + s / 10); t[7] = (char)('0' + s % 10); t[8] = '\0';
+}
+
+static int parse_clock(const char *t) {
+    if (strlen(t) != 8 || t[2] != ':' || t[5] != ':') return -1;
+    for (int i = 0; i < 8; ++i)
+        if (i != 2 && i != 5 && (t[i] < '0' || t[i] > '9')) return -1;
+    int m = (t[3] - '0') * 10 + (t[4] - '0'), s = (t[6] - '0') * 10 + (t[7] - '0');
+    if (m > 59 || s > 59) return -1;
+    return ((t[0] - '0') * 10 + (t[1] - '0')) * 3600 + m * 60 + s;
+}
+
+static int code_index(char (*codes)[8], uint32_t *ncodes, const char *code) {
+    for (uint32_t i = 0; i < *ncodes; ++i)
+        if (strcmp(codes[i], code) == 0) return (int)i;
+    if (*ncodes == ARC_MAX_CODES || strlen(code) >= 8) return -1;
+    snprintf(codes[*ncodes], 8, "%s", code);
+    return (int)(*ncodes)++;
+}
+
+/* Encode one line (without '\n') as a row if it formats back to exactly
+   the same bytes; returns the end of the record, or NULL to keep it verbatim. */
+static uint8_t *encode_row(uint8_t *p, const char *line, size_t len, const char *date_text,
+                           char (*codes)[8], uint32_t *ncodes, RowState *rs) {
+    char copy[512], again[512], clock[9];
+    CsvRow row;
+    if (len >= sizeof(copy)) return NULL;
+    memcpy(copy, line, len);
+    copy[len] = '\0';
+    if (!codec_parse_row(copy, len, CSV_FMT_V2, &row) || !row.has_tx_id ||
+        strcmp(row.date, date_text) != 0 || (row.partial != 0 && row.partial != 1))
+        return NULL;
+    int secs = parse_clock(row.time);
+    if (secs < 0) return NULL;
+    put_clock(clock, secs);
+    uint32_t before = *ncodes;
+    int from = code_index(codes, ncodes, row.from), to = code_index(codes, ncodes, row.to);
+    int n = from < 0 || to < 0 ? -1 :
+            codec_format_row(again, sizeof(again), date_text, clock, row.tx_id, codes[from], codes[to],
+                             row.amount_from, row.amount_to, row.rate_from_loc, row.rate_to_loc,
+                             row.partial, row.remainder_loc, row.profit_loc);
+    if (n != (int)len + 1 || memcmp(again, line, len) != 0) {
+        *ncodes = before;                /* codes added for this row go again */
+        return NULL;
+    }
+    *p++ = (uint8_t)(TAG_ROW | (row.partial ? TAG_PARTIAL : 0));
+    p = put_signed(p, secs - rs->prev_secs);
+    p = put_signed(p, row.tx_id - rs->prev_tx);
+    *p++ = (uint8_t)from;
+    *p++ = (uint8_t)to;
+    p = put_signed(p, row.amount_from);
+    p = put_signed(p, row.amount_to);
+    p = put_signed(p, row.rate_from_loc - rs->last_from[from]);
+    p = put_signed(p, row.rate_to_loc - rs->last_to[to]);
+    p = put_signed(p, row.remainder_loc);
+    p = put_signed(p, row.profit_loc);
+    rs->prev_secs = secs;
+    rs->prev_tx = row.tx_id;
+    rs->last_from[from] = row.rate_from_loc;
+    rs->last_to[to] = row.rate_to_loc;
+    return p;
+}
+
+static uint8_t *put_raw(uint8_t *p, int tag, const char *s, size_t n) {
+    if (tag >= 0) *p++ = (uint8_t)tag;
+    p = put_varint(p, n);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+/* Encode a whole day file; *out is malloc'd. Also counts its well-formed
+   rows and their profit the way csv_reader_next() reads them. */
+static int encode_day(const char *date_text, const char *text, size_t len, char (*codes)[8],
+                      uint32_t *ncodes, uint8_t **out, size_t *out_len, ArcDay *d, ArchiveStats *st) {
+    uint8_t *buf = malloc(len * 2 + 64), *p = buf;
+    if (!buf) return -1;
+    RowState rs;
+    memset(&rs, 0, sizeof(rs));
+    const char *nl = memchr(text, '\n', len);
+    size_t hlen = nl ? (size_t)(nl - text) + 1 : len;
+    p = put_raw(p, -1, text, hlen);
+    CsvFormat fmt = codec_detect_format(text, hlen);
+    for (size_t pos = hlen; pos < len;) {
+        nl = memchr(text + pos, '\n', len - pos);
+        if (!nl) {
+            p = put_raw(p, TAG_TAIL, text + pos, len - pos);
+            break;
+        }
+        const char *line = text + pos;
+        size_t n = (size_t)(nl - line);
+        pos += n + 1;
+        st->rows++;
+        char copy[512];
+        CsvRow row;
+        if (n < sizeof(copy) && !(n == 0 || (n == 1 && line[0] == '\r'))) {
+            memcpy(copy, line, n);
+            if (fmt == CSV_FMT_UNKNOWN) fmt = codec_detect_format(line, n);
+            if (codec_parse_row(copy, n, fmt, &row)) {
+                d->tx_count++;
+                d->profit += row.profit_loc;
+            }
+        }
+        uint8_t *q = encode_row(p, line, n, date_text, codes, ncodes, &rs);
+        if (!q) {
+            q = put_raw(p, TAG_LINE, line, n);
+            st->verbatim++;
+        }
+        p = q;
+    }
+    *out = buf;
+    *out_len = (size_t)(p - buf);
+    return 0;
+}
+
+static int decode_day(const Arc *a, const ArcDay *d, char **text, size_t *len) {
+    char *blk;
+    if (arc_read(a, d->rows_off, d->rows_len, &blk) != 0) return -1;
+    size_t cap = (size_t)d->csv_bytes;
+    char *out = malloc(cap + 1);
+    const uint8_t *p = (const uint8_t *)blk, *end = p + d->rows_len;
+    size_t o = 0;
+    int ok = out != NULL;
+    RowState rs;
+    memset(&rs, 0, sizeof(rs));
+    uint64_t n;
+    if (ok && (ok = get_varint(&p, end, &n) && n <= (uint64_t)(end - p) && n <= cap)) {
+        memcpy(out, p, n);
+        p += n;
+        o = n;
+    }
+    while (ok && p < end) {
+        int tag = *p++;
+        if (tag == TAG_LINE || tag == TAG_TAIL) {
+            ok = get_varint(&p, end, &n) && n <= (uint64_t)(end - p) && o + n + (tag == TAG_LINE) <= cap;
+            if (!ok) break;
+            memcpy(out + o, p, n);
+            p += n;
+            o += n;
+            if (tag == TAG_LINE) out[o++] = '\n';
+            continue;
+        }
+        int64_t dsecs, dtx, af, at, drf, drt, rem, prof;
+        ok = (tag & ~TAG_PARTIAL) == TAG_ROW && get_signed(&p, end, &dsecs) && get_signed(&p, end, &dtx) &&
+             end - p >= 2;
+        if (!ok) break;
+        int from = *p++, to = *p++;
+        ok = from < (int)a->h.ncodes && to < (int)a->h.ncodes && get_signed(&p, end, &af) &&
+             get_signed(&p, end, &at) && get_signed(&p, end, &drf) && get_signed(&p, end, &drt) &&
+             get_signed(&p, end, &rem) && get_signed(&p, end, &prof);
+        int secs = rs.prev_secs + (int32_t)dsecs;
+        ok = ok && secs >= 0 && secs < 100 * 3600;
+        if (!ok) break;
+        char clock[9], line[512];
+        put_clock(clock, secs);
+        rs.prev_secs = secs;
+        rs.prev_tx += dtx;
+        rs.last_from[from] += drf;
+        rs.last_to[to] += drt;
+        int k = codec_format_row(line, sizeof(line), d->date, clock, (int)rs.prev_tx, a->codes[from],
+                                 a->codes[to], af, at, rs.last_from[from], rs.last_to[to],
+                                 tag & TAG_PARTIAL, rem, prof);
+        ok = k > 0 && o + (size_t)k <= cap;
+        if (ok) {
+            memcpy(out + o, line, (size_t)k);
+            o += (size_t)k;
+        }
+    }
+    free(blk);
+    if (!ok || o != cap || fnv(out, o) != d->csv_hash) {
+        diag("Archived day %s is damaged", d->date);
+        free(out);
+        errno = EINVAL;
+        return -1;
+    }
+    *text = out;
+    *len = o;
+    return 0;
+}
+
+/* Readers */
+
+int archive_day_text(const char *date_text, char **text, size_t *len) {
+    int64_t m0 = metrics_start(MET_ARCHIVE_READ);
+    Arc a;
+    int rc = -1;
+    if (arc_open(date_text, &a) == 0) {
+        const ArcDay *d = arc_day(&a, date_text);
+        if (d) rc = decode_day(&a, d, text, len);
+        else errno = ENOENT;
+        arc_close(&a);
+    }
+    metrics_end(MET_ARCHIVE_READ, m0);
+    return rc;
+}
+
+int archive_day_receipts(const char *date_text, char **text, size_t *len) {
+    Arc a;
+    if (arc_open(date_text, &a) != 0) return -1;
+    const ArcDay *d = arc_day(&a, date_text);
+    int rc = -1;
+    errno = ENOENT;
+    if (d && arc_read(&a, d->receipts_off, d->receipts_len, text) == 0) {
+        *len = (size_t)d->receipts_len;
+        rc = 0;
+    }
+    arc_close(&a);
+    return rc;
+}
+
+static void fill_info(const ArcDay *d, ArchiveDayInfo *out) {
+    snprintf(out->date, sizeof(out->date), "%.10s", d->date);
+    out->tx_count = (long)d->tx_count;
+    out->profit = d->profit;
+    out->csv_bytes = d->csv_bytes;
+}
+
+int archive_find_day(const char *date_text, ArchiveDayInfo *out) {
+    Arc a;
+    if (arc_open(date_text, &a) != 0) return -1;
+    const ArcDay *d = arc_day(&a, date_text);
+    int rc = d && !loose_csv_exists(date_text) ? 0 : -1;
+    if (rc == 0) fill_info(d, out);
+    arc_close(&a);
+    return rc;
+}
+
+static int cmp_info(const void *a, const void *b) {
+    return strcmp(((const ArchiveDayInfo *)a)->date, ((const ArchiveDayInfo *)b)->date);
+}
+
+long archive_file_rows(const char *fname) {
+    Arc a;
+    long rows = 0;
+    if (arc_open_file(fname, &a) != 0) return 0;
+    for (uint32_t i = 0; i < a.h.ndays; ++i) rows += (long)a.days[i].tx_count;
+    arc_close(&a);
+    return rows;
+}
+
+int archive_list_days(const char *from_date, const char *to_date, ArchiveDayInfo **out) {
+    *out = NULL;
+    ManifestEntry *arcs = NULL;
+    int narc = manifest_list(from_date, to_date, MAN_ARCHIVE, &arcs);
+    if (narc < 0) return -1;
+    ArchiveDayInfo *v = NULL;
+    int n = 0, cap = 0, rc = 0;
+    for (int k = 0; rc == 0 && k < narc; ++k) {
+        Arc a;
+        if (arc_open_file(arcs[k].path, &a) != 0) continue;
+        for (uint32_t i = 0; i < a.h.ndays; ++i) {
+            const ArcDay *d = &a.days[i];
+            if (strcmp(d->date, from_date) < 0 || strcmp(d->date, to_date) > 0 || loose_csv_exists(d->date))
+                continue;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 64;
+                ArchiveDayInfo *g = realloc(v, (size_t)cap * sizeof(*v));
+                if (!g) {
+                    rc = -1;
+                    break;
+                }
+                v = g;
+            }
+            fill_info(d, &v[n++]);
+        }
+        arc_close(&a);
+    }
+    free(arcs);
+    if (rc != 0) {
+        free(v);
+        return -1;
+    }
+    if (n > 1) qsort(v, (size_t)n, sizeof(*v), cmp_info);
+    *out = v;
+    return n;
+}
+
+/* Compaction */
+
+static int cmp_date(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+/* Dates of the loose sales files, oldest first. */
+static int loose_days(char (**out)[11]) {
+    ManifestEntry *e = NULL;
+    int n = manifest_list("0000-00-00", "9999-99-99", MAN_SALES, &e);
+    if (n < 0) return -1;
+    char (*v)[11] = malloc((size_t)(n ? n : 1) * sizeof(*v));
+    if (!v) {
+        free(e);
+        return -1;
+    }
+    for (int i = 0; i < n; ++i) memcpy(v[i], e[i].date, sizeof(*v));
+    free(e);
+    *out = v;
+    return n;
+}
+
+static int put_block(FILE *f, const void *p, size_t n, uint64_t *off) {
+    long at = ftell(f);
+    if (at < 0 || (n && fwrite(p, 1, n, f) != n)) return -1;
+    *off = (uint64_t)at;
+    return 0;
+}
+
+static void remove_day_files(const char *date_text) {
+    char name[64];
+    make_daily_csv_name(date_text, name, sizeof(name));
+    unlink(name);
+    manifest_drop(name);
+    make_receipt_name(date_text, name, sizeof(name));
+    unlink(name);
+    manifest_drop(name);
+    make_summary_name(date_text, name, sizeof(name));
+    unlink(name);
+    make_segment_name(date_text, name, sizeof(name));
+    unlink(name);
+    make_rollup_name(date_text, name, sizeof(name));
+    unlink(name);
+}
+
+/* Rewrite one month's archive with the given loose days added. */
+static int compact_month(const char *year_month, char (*add)[11], int nadd, ArchiveStats *st) {
+    char fname[64], tmp[80];
+    make_archive_name(year_month, fname, sizeof(fname));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+
+    Arc old;
+    int have_old = arc_open(year_month, &old) == 0;
+    if (!have_old && errno != ENOENT) return -1;
+
+    char (*codes)[8] = calloc(ARC_MAX_CODES, 8);
+    ArcDay *dir = calloc(ARC_MAX_DAYS, sizeof(ArcDay));
+    FILE *f = fopen(tmp, "wb");
+    int ok = codes && dir && f;
+    if (!f) diag("Could not create %s: %s", tmp, strerror(errno));
+    uint32_t ncodes = 0, ndays = 0;
+    if (have_old && ok) {
+        memcpy(codes, old.codes, old.h.ncodes * 8);   /* old rows keep their code indexes */
+        ncodes = old.h.ncodes;
+    }
+    ArcHeader h;
+    memset(&h, 0, sizeof(h));
+    ok = ok && fwrite(&h, sizeof(h), 1, f) == 1;
+
+    /* Days already archived, unless a loose file replaces them. */
+    for (uint32_t i = 0; ok && have_old && i < old.h.ndays; ++i) {
+        const ArcDay *d = &old.days[i];
+        int replaced = 0;
+        for (int k = 0; k < nadd; ++k) replaced |= strcmp(add[k], d->date) == 0;
+        if (replaced) continue;
+        char *rows = NULL, *rec = NULL;
+        ArcDay nd = *d;
+        ok = arc_read(&old, d->rows_off, d->rows_len, &rows) == 0 &&
+             arc_read(&old, d->receipts_off, d->receipts_len, &rec) == 0 &&
+             put_block(f, rows, d->rows_len, &nd.rows_off) == 0 &&
+             put_block(f, rec, d->receipts_len, &nd.receipts_off) == 0;
+        free(rows);
+        free(rec);
+        dir[ndays++] = nd;
+    }
+    for (int k = 0; ok && k < nadd; ++k) {
+        char csv[64], rname[64], *text = NULL, *rec = NULL;
+        size_t len = 0, rlen = 0;
+        make_daily_csv_name(add[k], csv, sizeof(csv));
+        make_receipt_name(add[k], rname, sizeof(rname));
+        ok = read_file(csv, &text, &len) == 0;
+        if (ok && read_file(rname, &rec, &rlen) != 0) {
+            ok = errno == ENOENT;
+            rec = NULL;
+            rlen = 0;
+        }
+        ArcDay *d = &dir[ndays];
+        memset(d, 0, sizeof(*d));
+        snprintf(d->date, sizeof(d->date), "%s", add[k]);
+        d->csv_bytes = (int64_t)len;
+        uint8_t *enc = NULL;
+        size_t elen = 0;
+        if (ok) {
+            d->csv_hash = fnv(text, len);
+            d->receipts_len = rlen;
+            d->receipts_hash = fnv(rec, rlen);
+            ok = encode_day(add[k], text, len, codes, &ncodes, &enc, &elen, d, st) == 0 &&
+                 put_block(f, enc, elen, &d->rows_off) == 0 &&
+                 put_block(f, rec, rlen, &d->receipts_off) == 0;
+            d->rows_len = elen;
+            st->csv_bytes += (int64_t)len;
+            st->receipt_bytes += (int64_t)rlen;
+        }
+        if (!ok) diag("Could not archive %s: %s", csv, strerror(errno));
+        free(enc);
+        free(text);
+        free(rec);
+        ndays++;
+    }
+    int64_t old_bytes = have_old ? old.size : 0;
+    if (have_old) arc_close(&old);
+    /* Directory by date (the first member). */
+    if (ok && ndays > 1) qsort(dir, ndays, sizeof(*dir), cmp_date);
+    memcpy(h.magic, ARC_MAGIC, sizeof(ARC_MAGIC));
+    h.version = ARC_VERSION;
+    h.ndays = ndays;
+    h.ncodes = ncodes;
+    ok = ok && put_block(f, codes, ncodes * 8, &h.codes_off) == 0 &&
+         put_block(f, dir, ndays * sizeof(*dir), &h.dir_off) == 0 &&
+         fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+    ok = f && fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+    if (f && fclose(f) != 0) ok = 0;
+    free(codes);
+    free(dir);
+
+    /* Everything must decode back before the loose files go. */
+    Arc chk;
+    long rows = 0;
+    int64_t size = 0;
+    if (ok && arc_open_file(tmp, &chk) == 0) {
+        for (uint32_t i = 0; ok && i < chk.h.ndays; ++i) {
+            char *text = NULL, *rec = NULL;
+            size_t len;
+            ok = decode_day(&chk, &chk.days[i], &text, &len) == 0 &&
+                 arc_read(&chk, chk.days[i].receipts_off, chk.days[i].receipts_len, &rec) == 0 &&
+                 fnv(rec, chk.days[i].receipts_len) == chk.days[i].receipts_hash;
+            free(text);
+            free(rec);
+        }
+        st->archive_bytes += chk.size - old_bytes;     /* growth of an existing archive */
+        for (uint32_t i = 0; i < chk.h.ndays; ++i) rows += (long)chk.days[i].tx_count;
+        size = chk.size;
+        arc_close(&chk);
+    } else {
+        ok = 0;
+    }
+    if (!ok || rename(tmp, fname) != 0) {
+        diag("Could not write %s; its day files are kept", fname);
+        unlink(tmp);
+        return -1;
+    }
+    char part[16];
+    make_partition_name(year_month, part, sizeof(part));
+    int dfd = open(part, O_RDONLY | O_DIRECTORY | O_CLOEXEC);   /* make the rename durable */
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+    manifest_set(fname, rows, size);
+    for (int k = 0; k < nadd; ++k) remove_day_files(add[k]);
+    st->days += nadd;
+    st->months++;
+    return 0;
+}
+
+int archive_compact(const char *before_date, ArchiveStats *st) {
+    memset(st, 0, sizeof(*st));
+    journal_flush();
+    char (*days)[11] = NULL;
+    int n = loose_days(&days);
+    if (n < 0) return -1;
+    int last = n - 1;                     /* the newest day stays loose */
+    while (last > 0 && strcmp(days[last - 1], before_date) >= 0) last--;
+    int rc = 0;
+    for (int i = 0; i < last;) {
+        int j = i;
+        while (j < last && strncmp(days[j], days[i], 7) == 0) j++;
+        char ym[8];
+        snprintf(ym, sizeof(ym), "%.7s", days[i]);
+        if (compact_month(ym, days + i, j - i, st) != 0) rc = -1;
+        i = j;
+    }
+    free(days);
+    return rc;
+}
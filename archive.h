@@ -0,0 +1,63 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Monthly archives of closed days, stored as sales_<YYYY-MM>.arc.
+ *
+ * Compaction folds the day files of a month (sales_<date>.csv and
+ * receipts_<date>.txt) into one archive with a directory of its days and
+ * removes the loose files and their sidecars. Rows are delta/varint
+ * encoded: time of day and tx_id as differences from the previous row,
+ * currencies as indexes into the archive's code table, amounts as varints
+ * of minor units and rates as differences from the last rate of the same
+ * currency. Lines that would not come back byte for byte (legacy rows,
+ * odd spacing) are kept verbatim, so a day decodes to exactly the CSV it
+ * was made from and index offsets stay valid. Receipts are kept as they
+ * are.
+ *
+ * Readers go through csv_reader_open(), which decodes an archived day
+ * when its CSV is missing; a loose CSV always wins over an archived copy. */
+
+typedef struct {
+    char date[11];              /* YYYY-MM-DD */
+    long tx_count;              /* well-formed rows */
+    int64_t profit;             /* Money: sum of profit_loc */
+    int64_t csv_bytes;          /* size of the day file */
+} ArchiveDayInfo;
+
+typedef struct {
+    int days;                   /* days archived by this run */
+    int months;                 /* archive files written */
+    long rows;                  /* lines encoded */
+    long verbatim;              /* of which kept verbatim */
+    int64_t csv_bytes;          /* day files folded in */
+    int64_t receipt_bytes;
+    int64_t archive_bytes;      /* bytes the archives grew by */
+} ArchiveStats;
+
+void make_archive_name(const char *year_month, char *out, size_t cap);
+
+/* Archive every day before `before_date` (YYYY-MM-DD) except the newest
+   day with a sales file, which the state snapshot may point into. Each
+   archive is written to a temporary file, decoded and compared with the
+   originals, then renamed; only then are the loose files removed.
+   Returns 0, or -1 on error (nothing is removed for a failed month). */
+int archive_compact(const char *before_date, ArchiveStats *st);
+
+/* The day's CSV text, decoded from its archive (malloc'd, not terminated).
+   Returns 0, or -1 with errno ENOENT if the day is not archived. */
+int archive_day_text(const char *date_text, char **text, size_t *len);
+/* The day's receipts, as archived (malloc'd). Same returns. */
+int archive_day_receipts(const char *date_text, char **text, size_t *len);
+
+/* Directory entry of an archived day that has no loose CSV. Returns 0 or -1. */
+int archive_find_day(const char *date_text, ArchiveDayInfo *out);
+/* Archived days (without a loose CSV) with from <= date <= to, ascending,
+   read from the archives' directories only. Returns the count or -1. */
+int archive_list_days(const char *from_date, const char *to_date, ArchiveDayInfo **out);
+/* Rows held by an archive file, from its directory; 0 if unreadable. */
+long archive_file_rows(const char *fname);
+
+#endif /* ARCHIVE_H */
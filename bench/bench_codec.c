@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+
+/* Codec micro-benchmark: scanf-based parsing and printf-based formatting
+ * of doubles (the original implementation) against codec.c on a synthetic
+ * sales file. Amounts are written with 2 decimals and rates with 6.
+ *
+ *   build/bench_codec [rows]     (default 2000000)
+ */
+
+#include "../codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    char date[16], time[16], from[32], to[32];
+    int tx_id, partial;
+    double amount_from, amount_to, rate_from_loc, rate_to_loc, remainder_loc, profit_loc;
+} DoubleRow;
+
+static int parse_scanf(const char *line, DoubleRow *row) {
+    return sscanf(line, "%15[^,],%15[^,],%d,%31[^,],%31[^,],%lf,%lf,%lf,%lf,%d,%lf,%lf",
+                  row->date, row->time, &row->tx_id, row->from, row->to,
+                  &row->amount_from, &row->amount_to, &row->rate_from_loc, &row->rate_to_loc,
+                  &row->partial, &row->remainder_loc, &row->profit_loc) == 12;
+}
+
+#define M(v) ((double)(v) / MONEY_SCALE)
+#define R(v) ((double)(v) / RATE_SCALE)
+
+static int format_printf(char *out, size_t cap, const CsvRow *r) {
+    return snprintf(out, cap, "%s,%s,%d,%s,%s,%.2f,%.2f,%.6f,%.6f,%d,%.2f,%.2f\n",
+                    r->date, r->time, r->tx_id, r->from, r->to,
+                    M(r->amount_from), M(r->amount_to), R(r->rate_from_loc), R(r->rate_to_loc),
+                    r->partial ? 1 : 0, M(r->remainder_loc), M(r->profit_loc));
+}
+
+static int format_codec(char *out, size_t cap, const CsvRow *r) {
+    return codec_format_row(out, cap, r->date, r->time, r->tx_id, r->from, r->to,
+                            r->amount_from, r->amount_to, r->rate_from_loc, r->rate_to_loc,
+                            r->partial, r->remainder_loc, r->profit_loc);
+}
+
+static const char *CODES[] = { "LOC", "USD", "EUR", "GBP", "JPY" };
+static const Rate RATES[] = { 1000000, 1500000, 2000000, 2500000, 10000 };
+
+static void make_row(CsvRow *r, long i, unsigned *seed) {
+    int from = rand_r(seed) % 5, to = (from + 1 + rand_r(seed) % 4) % 5;
+    snprintf(r->date, sizeof(r->date), "2026-10-17");
+    snprintf(r->time, sizeof(r->time), "%02ld:%02ld:%02ld", (i / 3600) % 24, (i / 60) % 60, i % 60);
+    r->tx_id = (int)(i + 1);
+    r->has_tx_id = 1;
+    snprintf(r->from, sizeof(r->from), "%s", CODES[from]);
+    snprintf(r->to, sizeof(r->to), "%s", CODES[to]);
+    r->amount_from = rand_r(seed) % 1000000;
+    r->rate_from_loc = RATES[from] / 100 * 99;
+    r->rate_to_loc = RATES[to] / 100 * 101;
+    r->amount_to = money_div_rate(money_mul_rate(r->amount_from, r->rate_from_loc), r->rate_to_loc);
+    r->partial = rand_r(seed) % 10 == 0;
+    r->remainder_loc = r->partial ? money_percent(r->amount_to, 10) : 0;
+    r->profit_loc = money_percent(money_mul_rate(r->amount_from, RATES[from]), 1);
+}
+
+int main(int argc, char **argv) {
+    long rows = argc > 1 ? atol(argv[1]) : 2000000;
+    if (rows <= 0) rows = 2000000;
+    char fname[] = "/tmp/bench_codec_XXXXXX";
+    int fd = mkstemp(fname);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    FILE *f = fdopen(fd, "w");
+    fputs(CSV_HEADER, f);
+
+    /* Formatting: both writers on the same rows, outputs compared. */
+    unsigned seed = 12345;
+    char a[512], b[512];
+    long mismatch = 0;
+    double t_printf = 0, t_codec = 0;
+    CsvRow r;
+    for (long i = 0; i < rows; ++i) {
+        make_row(&r, i, &seed);
+        double t0 = now_sec();
+        int na = format_printf(a, sizeof(a), &r);
+        double t1 = now_sec();
+        int nb = format_codec(b, sizeof(b), &r);
+        double t2 = now_sec();
+        t_printf += t1 - t0;
+        t_codec += t2 - t1;
+        if (na != nb || memcmp(a, b, (size_t)na) != 0) mismatch++;
+        fwrite(a, 1, (size_t)na, f);
+    }
+    fclose(f);
+
+    /* Parsing: fgets + sscanf against the buffered reader. */
+    double t0 = now_sec();
+    f = fopen(fname, "r");
+    char line[512];
+    long n_scanf = 0;
+    double sum_scanf = 0;
+    DoubleRow d;
+    if (fgets(line, sizeof(line), f)) {
+        while (fgets(line, sizeof(line), f))
+            if (parse_scanf(line, &d)) {
+                n_scanf++;
+                sum_scanf += d.profit_loc;
+            }
+    }
+    fclose(f);
+    double t1 = now_sec();
+
+    CsvReader rd;
+    long n_codec = 0;
+    Money sum_codec = 0;
+    if (csv_reader_open(&rd, fname) == 0) {
+        while (csv_reader_next(&rd, &r, NULL)) {
+            n_codec++;
+            sum_codec += r.profit_loc;
+        }
+        csv_reader_close(&rd);
+    }
+    double t2 = now_sec();
+    unlink(fname);
+
+    printf("rows: %ld\n", rows);
+    printf("format  snprintf: %10.0f rows/s\n", rows / t_printf);
+    printf("format  codec:    %10.0f rows/s  (%.1fx, %ld mismatching rows)\n",
+           rows / t_codec, t_printf / t_codec, mismatch);
+    printf("parse   sscanf:   %10.0f rows/s\n", n_scanf / (t1 - t0));
+    printf("parse   codec:    %10.0f rows/s  (%.1fx)\n",
+           n_codec / (t2 - t1), (t1 - t0) / (t2 - t1));
+    char exact[32];
+    printf("check: %ld/%ld rows, profit %.6f (double sum) / %s (exact)\n",
+           n_scanf, n_codec, sum_scanf, money_fmt(exact, sum_codec));
+    return mismatch == 0 && n_scanf == n_codec ? 0 : 1;
+}
@@ -0,0 +1,506 @@
+#define _GNU_SOURCE
+
+/* Store benchmarks on a generated sales history (see gen_ledger.c).
+ *
+ *   build/bench_store <data-dir> <out-file> [iterations]   (default 1000)
+ *
+ * Times the report, lookup, logging and exchange hot paths and appends one
+ * JSON object per benchmark to <out-file>:
+ *
+ *   {"bench":"...","samples":N,"calls":N,"ops_per_sec":X,"p50_us":X,"p99_us":X}
+ *
+ * Each sample is one call, or a batch of `inner` calls for the cheap paths
+ * (latency is then the batch mean). The first line describes the run. The
+ * sample order is seeded, so runs on the same data are comparable. */
+
+#include "../utils.h"
+#include "../journal.h"
+#include "../txindex.h"
+#include "../writer.h"
+#include "../metrics.h"
+#include "../rollup.h"
+#include "../daysum.h"
+#include "../segment.h"
+#include "../manifest.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_DAYS 4096
+#define SCRATCH_DATE "2099-12-31"
+
+typedef struct {
+    const char *name;
+    double *lat;          /* seconds per call, one per sample */
+    int samples;
+    long calls;
+    double total;
+    long rows;            /* CSV rows covered, 0 if not meaningful */
+} Stat;
+
+static struct {
+    char start[16];
+    int days;
+    long rows_per_day;
+    int legacy_days;
+    unsigned long seed;
+    long first_tx_id;
+} ledger;
+
+static char dates[MAX_DAYS][16];
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int load_ledger(void) {
+    FILE *f = fopen("bench_ledger.txt", "r");
+    if (!f) {
+        fprintf(stderr, "No bench_ledger.txt in the data directory (run gen_ledger first)\n");
+        return -1;
+    }
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        sscanf(line, "start=%15s", ledger.start);
+        sscanf(line, "days=%d", &ledger.days);
+        sscanf(line, "rows_per_day=%ld", &ledger.rows_per_day);
+        sscanf(line, "legacy_days=%d", &ledger.legacy_days);
+        sscanf(line, "seed=%lu", &ledger.seed);
+        sscanf(line, "first_tx_id=%ld", &ledger.first_tx_id);
+    }
+    fclose(f);
+    if (ledger.days <= 0 || ledger.days > MAX_DAYS || ledger.rows_per_day <= 0) {
+        fprintf(stderr, "bench_ledger.txt is incomplete\n");
+        return -1;
+    }
+    struct tm day;
+    memset(&day, 0, sizeof(day));
+    if (!strptime(ledger.start, "%Y-%m-%d", &day)) return -1;
+    day.tm_hour = 12;
+    for (int d = 0; d < ledger.days; ++d) {
+        mktime(&day);
+        strftime(dates[d], sizeof(dates[d]), "%Y-%m-%d", &day);
+        day.tm_mday++;
+    }
+    return 0;
+}
+
+static void stat_init(Stat *s, const char *name, int samples) {
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->lat = calloc((size_t)(samples > 0 ? samples : 1), sizeof(*s->lat));
+}
+
+static void stat_add(Stat *s, double elapsed, int inner) {
+    s->lat[s->samples++] = elapsed / inner;
+    s->calls += inner;
+    s->total += elapsed;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double pct(const Stat *s, int p) {
+    int i = (int)((long)s->samples * p / 100);
+    if (i >= s->samples) i = s->samples - 1;
+    return s->lat[i] * 1e6;
+}
+
+static void stat_report(Stat *s, FILE *out) {
+    if (s->samples == 0) {
+        free(s->lat);
+        return;
+    }
+    qsort(s->lat, (size_t)s->samples, sizeof(*s->lat), cmp_double);
+    double ops = s->calls / s->total;
+    fprintf(out, "{\"bench\":\"%s\",\"samples\":%d,\"calls\":%ld,\"ops_per_sec\":%.1f,"
+                 "\"p50_us\":%.3f,\"p99_us\":%.3f",
+            s->name, s->samples, s->calls, ops, pct(s, 50), pct(s, 99));
+    if (s->rows) fprintf(out, ",\"rows_per_sec\":%.0f", s->rows / s->total);
+    fputs("}\n", out);
+    fprintf(stderr, "%-28s %12.1f ops/s   p50 %10.3f us   p99 %10.3f us\n",
+            s->name, ops, pct(s, 50), pct(s, 99));
+    free(s->lat);
+}
+
+static void unlink_day_files(const char *date) {
+    char name[128];
+    make_summary_name(date, name, sizeof(name));
+    unlink(name);
+    make_segment_name(date, name, sizeof(name));
+    unlink(name);
+}
+
+/* Day summaries built from the CSV (no sidecar yet), then read back. */
+static void bench_sum_date(FILE *out, int iters) {
+    Stat s;
+    stat_init(&s, "sum_profit_for_date_cold", ledger.days);
+    for (int d = 0; d < ledger.days; ++d) unlink_day_files(dates[d]);
+    for (int d = 0; d < ledger.days; ++d) {
+        int n = 0;
+        double t0 = now_sec();
+        csv_sum_profit_for_date(dates[d], &n);
+        stat_add(&s, now_sec() - t0, 1);
+        s.rows += n;
+    }
+    stat_report(&s, out);
+
+    stat_init(&s, "sum_profit_for_date_warm", iters);
+    for (int i = 0; i < iters; ++i) {
+        int n = 0;
+        const char *date = dates[rng() % (uint32_t)ledger.days];
+        double t0 = now_sec();
+        csv_sum_profit_for_date(date, &n);
+        stat_add(&s, now_sec() - t0, 1);
+        s.rows += n;
+    }
+    stat_report(&s, out);
+}
+
+static void bench_sum_month(FILE *out, int iters) {
+    char months[MAX_DAYS][8];
+    int nm = 0;
+    for (int d = 0; d < ledger.days; ++d) {
+        if (nm == 0 || strncmp(months[nm - 1], dates[d], 7) != 0) {
+            memcpy(months[nm], dates[d], 7);
+            months[nm++][7] = '\0';
+        }
+    }
+    int samples = iters / 10 > 5 ? iters / 10 : 5;
+    Stat s;
+    stat_init(&s, "sum_profit_for_month", samples);
+    for (int i = 0; i < samples; ++i) {
+        int n = 0;
+        const char *ym = months[rng() % (uint32_t)nm];
+        double t0 = now_sec();
+        csv_sum_profit_for_month(ym, &n);
+        stat_add(&s, now_sec() - t0, 1);
+        s.rows += n;
+    }
+    stat_report(&s, out);
+}
+
+/* Pair/hour rollups: built from the rows (no sidecar yet), read back, and
+   summed over a month. */
+static void bench_rollup(FILE *out, int iters) {
+    Rollup *r = malloc(sizeof(*r));
+    if (!r) return;
+    char name[128];
+    Stat s;
+    stat_init(&s, "rollup_day_cold", ledger.days);
+    for (int d = 0; d < ledger.days; ++d) {
+        make_rollup_name(dates[d], name, sizeof(name));
+        unlink(name);
+    }
+    for (int d = 0; d < ledger.days; ++d) {
+        double t0 = now_sec();
+        rollup_day(dates[d], r);
+        stat_add(&s, now_sec() - t0, 1);
+        s.rows += r->tx_count;
+    }
+    stat_report(&s, out);
+
+    stat_init(&s, "rollup_day_warm", iters);
+    for (int i = 0; i < iters; ++i) {
+        double t0 = now_sec();
+        rollup_day(dates[rng() % (uint32_t)ledger.days], r);
+        stat_add(&s, now_sec() - t0, 1);
+        s.rows += r->tx_count;
+    }
+    stat_report(&s, out);
+
+    int samples = iters / 10 > 5 ? iters / 10 : 5;
+    stat_init(&s, "rollup_month", samples);
+    for (int i = 0; i < samples; ++i) {
+        double t0 = now_sec();
+        rollup_month(dates[rng() % (uint32_t)ledger.days], r);
+        stat_add(&s, now_sec() - t0, 1);
+        s.rows += r->tx_count;
+    }
+    stat_report(&s, out);
+    free(r);
+}
+
+/* Scan of one day file for an id; only new-format days carry ids. */
+static void bench_find(FILE *out, int iters) {
+    int first = ledger.legacy_days + (ledger.legacy_days > 0);
+    if (first >= ledger.days) return;
+    int samples = iters / 10 > 5 ? iters / 10 : 5;
+    Stat s;
+    stat_init(&s, "find_transaction_by_id", samples);
+    for (int i = 0; i < samples; ++i) {
+        int d = first + (int)(rng() % (uint32_t)(ledger.days - first));
+        int id = (int)(ledger.first_tx_id + (long)d * ledger.rows_per_day +
+                       rng() % (uint32_t)ledger.rows_per_day);
+        char line[512];
+        double t0 = now_sec();
+        int found = csv_find_transaction_by_id(dates[d], id, line, sizeof(line));
+        stat_add(&s, now_sec() - t0, 1);
+        if (found != 1) fprintf(stderr, "tx %d not found on %s\n", id, dates[d]);
+    }
+    stat_report(&s, out);
+}
+
+/* Appends to a scratch day under the given journal policy. */
+static void bench_log(FILE *out, int iters, const char *name, const char *policy) {
+    JournalPolicy p;
+    if (journal_parse_policy(policy, &p) != 0) return;
+    journal_set_policy(&p);
+    Stat s;
+    stat_init(&s, name, iters);
+    for (int i = 0; i < iters; ++i) {
+        int from = (int)(rng() % cur_count), to = (from + 1 + (int)(rng() % (cur_count - 1))) % cur_count;
+        Money amt = MONEY_UNITS(1 + rng() % 1000);
+        Rate rf, rt;
+        Money profit;
+        Money got = convert_via_local(from, to, amt, &rf, &rt, &profit);
+        double t0 = now_sec();
+        csv_log_transaction(SCRATCH_DATE, 900000000 + i, from, to, amt, got, rf, rt, 0, 0, profit);
+        stat_add(&s, now_sec() - t0, 1);
+    }
+    journal_close();
+    stat_report(&s, out);
+
+    char name_csv[64];
+    make_daily_csv_name(SCRATCH_DATE, name_csv, sizeof(name_csv));
+    unlink(name_csv);
+    manifest_drop(name_csv);
+    unlink_day_files(SCRATCH_DATE);
+}
+
+/* One exchange's receipt, row and tx counter under per-row fsync: written
+   inline, then handed to the writer thread. */
+static void bench_record(FILE *out, int iters) {
+    JournalPolicy p = { .every_rows = 1, .every_ms = 0, .fsync_on = 1 };
+    for (int queued = 0; queued < 2; ++queued) {
+        journal_set_policy(&p);
+        if (queued && writer_start() != 0) return;
+        Stat s;
+        stat_init(&s, queued ? "exchange_record_queued" : "exchange_record_inline", iters);
+        for (int i = 0; i < iters; ++i) {
+            WriterRecord r;
+            memset(&r, 0, sizeof(r));
+            r.kind = WRITER_EXCHANGE;
+            r.t.id = 900000000 + i;
+            r.t.from_cur = (int)(rng() % cur_count);
+            r.t.to_cur = (r.t.from_cur + 1 + (int)(rng() % (cur_count - 1))) % cur_count;
+            r.t.amount_from = MONEY_UNITS(1 + rng() % 1000);
+            r.t.amount_to = convert_via_local(r.t.from_cur, r.t.to_cur, r.t.amount_from,
+                                              &r.rate_from_loc, &r.rate_to_loc, &r.profit_delta);
+            r.t.rate = rate_of(r.t.amount_to, r.t.amount_from);
+            snprintf(r.t.date, sizeof(r.t.date), "%s", SCRATCH_DATE);
+            snprintf(r.t.time, sizeof(r.t.time), "12:00:00");
+            double t0 = now_sec();
+            writer_push(&r);
+            stat_add(&s, now_sec() - t0, 1);
+        }
+        writer_stop();
+        journal_close();
+        stat_report(&s, out);
+
+        char name[64];
+        make_daily_csv_name(SCRATCH_DATE, name, sizeof(name));
+        unlink(name);
+        manifest_drop(name);
+        make_receipt_name(SCRATCH_DATE, name, sizeof(name));
+        unlink(name);
+        manifest_drop(name);
+        unlink_day_files(SCRATCH_DATE);
+    }
+}
+
+/* The exchange write path (receipt and row, rows:256 policy) with metrics
+   recording off and on in alternating rounds; the best round of each is
+   compared. The cost of one instrumented call (start, end and a counter) is
+   timed on its own as well, since disk noise can hide a difference of 1%. */
+static void bench_metrics_overhead(FILE *out, int iters) {
+    JournalPolicy p;
+    journal_parse_policy("rows:256", &p);
+    journal_set_policy(&p);
+    FILE *null = fopen("/dev/null", "w");
+    if (!null) return;
+    int rows = iters * 20;
+    double best[2] = { 1e9, 1e9 };
+    for (int round = 0; round < 30; ++round) {
+        int on = round & 1;
+        metrics_enabled = on;
+        double t0 = now_sec();
+        for (int i = 0; i < rows; ++i) {
+            Transaction t = { .id = 900000000 + i, .from_cur = i % cur_count, .to_cur = (i + 1) % cur_count,
+                              .amount_from = MONEY_UNITS(1 + i % 1000), .amount_to = MONEY_UNITS(2 + i % 999),
+                              .rate = RATE_SCALE, .date = SCRATCH_DATE, .time = "12:00:00" };
+            receipt_write(null, &t);
+            csv_log_row(SCRATCH_DATE, t.time, t.id, currencies[t.from_cur].name, currencies[t.to_cur].name,
+                        t.amount_from, t.amount_to, RATE_SCALE, RATE_SCALE, 0, 0, 0);
+        }
+        journal_close();
+        double el = now_sec() - t0;
+        if (el < best[on]) best[on] = el;
+        char name[64];
+        make_daily_csv_name(SCRATCH_DATE, name, sizeof(name));
+        unlink(name);
+        manifest_drop(name);
+        unlink_day_files(SCRATCH_DATE);
+    }
+    metrics_enabled = 1;
+    fclose(null);
+
+    /* Per row: receipt and csv_log_row are timed, bytes and rows counted. */
+    long calls = (long)iters * 1000;
+    double pair = 1e9, add = 1e9;
+    for (int round = 0; round < 5; ++round) {
+        double t0 = now_sec();
+        for (long i = 0; i < calls; ++i)
+            metrics_end(MET_CSV_LOG_ROW, metrics_start(MET_CSV_LOG_ROW));
+        double t1 = now_sec();
+        for (long i = 0; i < calls; ++i) metrics_add(MET_ROWS_WRITTEN, 1);
+        double t2 = now_sec();
+        if (t1 - t0 < pair) pair = t1 - t0;
+        if (t2 - t1 < add) add = t2 - t1;
+    }
+    pair = pair / calls * 1e9;
+    add = add / calls * 1e9;
+    double off_ns = best[0] / rows * 1e9, on_ns = best[1] / rows * 1e9;
+    double est = (2 * pair + 2 * add) / off_ns * 100;
+
+    fprintf(out, "{\"bench\":\"metrics_overhead\",\"rows\":%d,\"off_ns_per_row\":%.1f,"
+                 "\"on_ns_per_row\":%.1f,\"measured_pct\":%.2f,\"timed_call_ns\":%.2f,"
+                 "\"counter_ns\":%.2f,\"estimated_pct\":%.2f}\n",
+            rows, off_ns, on_ns, (on_ns / off_ns - 1) * 100, pair, add, est);
+    fprintf(stderr, "%-28s %9.1f ns/row off %9.1f on; %.2f ns/timed call, %.2f ns/counter: %.2f%% of a row\n",
+            "metrics_overhead", off_ns, on_ns, pair, add, est);
+}
+
+#define CONVERT_INNER 1000
+#define PAY_INNER 100
+
+static void bench_convert(FILE *out, int iters) {
+    int from[CONVERT_INNER], to[CONVERT_INNER];
+    Money amt[CONVERT_INNER];
+    for (int i = 0; i < CONVERT_INNER; ++i) {
+        from[i] = (int)(rng() % cur_count);
+        to[i] = (from[i] + 1 + (int)(rng() % (cur_count - 1))) % cur_count;
+        amt[i] = (Money)(rng() % 100000000);
+    }
+    Stat s;
+    stat_init(&s, "convert_via_local", iters);
+    volatile Money sink = 0;
+    for (int i = 0; i < iters; ++i) {
+        Money acc = 0;
+        double t0 = now_sec();
+        for (int k = 0; k < CONVERT_INNER; ++k) {
+            Rate rf, rt;
+            Money profit;
+            acc += convert_via_local(from[k], to[k], amt[k], &rf, &rt, &profit) + profit;
+        }
+        stat_add(&s, now_sec() - t0, CONVERT_INNER);
+        sink += acc;
+    }
+    (void)sink;
+    stat_report(&s, out);
+}
+
+/* Till planning alone, then planning plus the printed breakdown. */
+static void bench_denoms(FILE *out, int iters) {
+    int cur[PAY_INNER];
+    Money amt[PAY_INNER];
+    for (int i = 0; i < PAY_INNER; ++i) {
+        cur[i] = (int)(rng() % cur_count);
+        amt[i] = money_percent(currencies[cur[i]].start_bal, 1 + (int)(rng() % 5)) +
+                 (Money)(rng() % 10000);
+    }
+    FILE *null = fopen("/dev/null", "w");
+    if (!null) return;
+
+    Stat s;
+    stat_init(&s, "till_plan", iters);
+    volatile long sink = 0;
+    for (int i = 0; i < iters; ++i) {
+        Payout p;
+        long pieces = 0;
+        double t0 = now_sec();
+        for (int k = 0; k < PAY_INNER; ++k) {
+            till_max_payable(&currencies[cur[k]].till, amt[k], &p);
+            pieces += p.pieces;
+        }
+        stat_add(&s, now_sec() - t0, PAY_INNER);
+        sink += pieces;
+    }
+    stat_report(&s, out);
+
+    stat_init(&s, "pay_in_denoms", iters);
+    for (int i = 0; i < iters; ++i) {
+        Payout p;
+        double t0 = now_sec();
+        for (int k = 0; k < PAY_INNER; ++k) {
+            till_max_payable(&currencies[cur[k]].till, amt[k], &p);
+            pay_in_denoms(null, cur[k], &p);
+        }
+        stat_add(&s, now_sec() - t0, PAY_INNER);
+    }
+    (void)sink;
+    stat_report(&s, out);
+    fclose(null);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <data-dir> <out-file> [iterations]\n", argv[0]);
+        return 2;
+    }
+    int iters = argc > 3 ? atoi(argv[3]) : 1000;
+    if (iters <= 0) iters = 1000;
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        fprintf(stderr, "Could not open %s: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+    if (chdir(argv[1]) != 0) {
+        fprintf(stderr, "Could not enter %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    if (load_ledger() != 0) return 1;
+    init_defaults(NULL);
+
+    time_t t = time(NULL);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+    fprintf(out, "{\"bench\":\"_run\",\"time\":\"%s\",\"start\":\"%s\",\"days\":%d,"
+                 "\"rows_per_day\":%ld,\"legacy_days\":%d,\"seed\":%lu,\"iterations\":%d}\n",
+            stamp, ledger.start, ledger.days, ledger.rows_per_day, ledger.legacy_days,
+            ledger.seed, iters);
+
+    bench_sum_date(out, iters);
+    bench_sum_month(out, iters);
+    bench_rollup(out, iters);
+    bench_find(out, iters);
+    bench_log(out, iters, "log_transaction", "tx");
+    bench_log(out, iters, "log_transaction_rows256", "rows:256");
+    bench_record(out, iters);
+    bench_metrics_overhead(out, iters);
+    bench_convert(out, iters);
+    bench_denoms(out, iters);
+
+    txindex_close();
+    unlink("tx_index.bin");
+    unlink("tx_index.log");
+    fclose(out);
+    fprintf(stderr, "Results written to %s\n", argv[2]);
+    return 0;
+}
@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+
+/* Synthetic sales history for the benchmarks.
+ *
+ *   build/gen_ledger <dir> <start YYYY-MM-DD> <days> <rows-per-day> [legacy-days] [seed]
+ *
+ * Writes one sales_<date>.csv per day into <dir>/YYYY/MM/. The first `legacy-days`
+ * files use the legacy layout (no tx_id, 6-decimal amounts), the next day
+ * mixes both layouts and the rest are new-format. Rows are spread over
+ * opening hours, tx ids run on across days, and amounts, rates, partial
+ * payouts and profit follow the default rates. The parameters are kept in
+ * <dir>/bench_ledger.txt; a rerun with the same parameters does nothing.
+ * Partition manifests that were written are removed, so the next listing
+ * builds them from the new files. */
+
+#include "../codec.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LEGACY_HEADER "date,time,from_currency,to_currency,amount_from,amount_to," \
+                      "rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc\n"
+
+static const char *CODES[] = { "LOC", "USD", "EUR", "GBP", "JPY" };
+/* buy / sell in millionths of LOC, as in init_defaults() */
+static const Rate BUY[] = { 1000000, 41360000, 48380000, 55910000, 270000 };
+static const Rate SELL[] = { 1000000, 41450000, 48600000, 56260000, 280000 };
+/* typical amount handed in, in minor units */
+static const Money TYPICAL[] = { 2000000, 50000, 40000, 30000, 8000000 };
+
+static uint64_t rng_state;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+static int write_manifest(const char *path, const char *spec) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Could not write %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fputs(spec, f);
+    return fclose(f);
+}
+
+static int manifest_matches(const char *path, const char *spec) {
+    char buf[512];
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return strcmp(buf, spec) == 0;
+}
+
+/* Legacy rows carried amounts with 6 decimals. */
+static char *put_legacy_money(char *p, Money m) {
+    return fixed_put(p, m * 10000, 6);
+}
+
+static int legacy_row(char *out, const char *date, const char *tm, const char *from, const char *to,
+                      Money af, Money at, Rate rf, Rate rt, int partial, Money rem, Money profit) {
+    char *p = out + sprintf(out, "%s,%s,%s,%s,", date, tm, from, to);
+    p = put_legacy_money(p, af);
+    *p++ = ',';
+    p = put_legacy_money(p, at);
+    *p++ = ',';
+    p = fixed_put(p, rf, RATE_DECIMALS);
+    *p++ = ',';
+    p = fixed_put(p, rt, RATE_DECIMALS);
+    p += sprintf(p, ",%d,", partial);
+    p = put_legacy_money(p, rem);
+    *p++ = ',';
+    p = put_legacy_money(p, profit);
+    *p++ = '\n';
+    return (int)(p - out);
+}
+
+static int write_day(const char *dir, const char *date, long rows, int layout, long *tx_id) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%.4s", dir, date);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%.4s/%.2s", dir, date, date + 5);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%.4s/%.2s/manifest", dir, date, date + 5);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%.4s/%.2s/sales_%s.csv", dir, date, date + 5, date);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Could not create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    static char iobuf[1 << 20];
+    setvbuf(f, iobuf, _IOFBF, sizeof(iobuf));
+    fputs(layout == CSV_FMT_LEGACY ? LEGACY_HEADER : CSV_HEADER, f);
+
+    char line[512];
+    for (long i = 0; i < rows; ++i) {
+        long sec = 9 * 3600 + i * (12 * 3600) / rows;       /* 09:00 - 21:00 */
+        char tm[32];
+        snprintf(tm, sizeof(tm), "%02ld:%02ld:%02ld", sec / 3600, sec / 60 % 60, sec % 60);
+
+        /* most trades are LOC against one foreign currency */
+        int from, to;
+        if (rng() % 4) {
+            int fx = 1 + (int)(rng() % 4);
+            int sell = rng() % 2;
+            from = sell ? fx : 0;
+            to = sell ? 0 : fx;
+        } else {
+            from = 1 + (int)(rng() % 4);
+            to = 1 + (from + (int)(rng() % 3)) % 4;        /* another foreign one */
+        }
+        Money af = TYPICAL[from] / 20 + (Money)(rng() % (uint32_t)(TYPICAL[from] * 2));
+        af -= af % MONEY_SCALE;                       /* whole units, mostly */
+        if (rng() % 8 == 0) af += rng() % MONEY_SCALE;
+        Money loc_in = money_mul_rate(af, BUY[from]);
+        Money at = money_div_rate(loc_in, SELL[to]);
+        int partial = rng() % 20 == 0;
+        Money rem = 0;
+        if (partial && at > MONEY_SCALE) {
+            Money paid = at * (50 + rng() % 40) / 100;
+            rem = money_mul_rate(at - paid, SELL[to]);
+            at = paid;
+        } else {
+            partial = 0;
+        }
+        Money profit = loc_in - money_mul_rate(at, BUY[to]) - rem;
+
+        int as_legacy = layout == CSV_FMT_LEGACY ||
+                        (layout == CSV_FMT_UNKNOWN && i < rows / 2);
+        int n = as_legacy
+            ? legacy_row(line, date, tm, CODES[from], CODES[to], af, at, BUY[from], SELL[to],
+                         partial, rem, profit)
+            : codec_format_row(line, sizeof(line), date, tm, (int)*tx_id, CODES[from], CODES[to],
+                               af, at, BUY[from], SELL[to], partial, rem, profit);
+        ++*tx_id;
+        if (n > 0) fwrite(line, 1, (size_t)n, f);
+    }
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Write error on %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 5) {
+        fprintf(stderr, "usage: %s <dir> <start YYYY-MM-DD> <days> <rows-per-day> [legacy-days] [seed]\n",
+                argv[0]);
+        return 2;
+    }
+    const char *dir = argv[1];
+    struct tm day;
+    memset(&day, 0, sizeof(day));
+    if (!strptime(argv[2], "%Y-%m-%d", &day)) {
+        fprintf(stderr, "Bad start date: %s\n", argv[2]);
+        return 2;
+    }
+    int days = atoi(argv[3]);
+    long rows = atol(argv[4]);
+    int legacy_days = argc > 5 ? atoi(argv[5]) : 0;
+    unsigned long seed = argc > 6 ? strtoul(argv[6], NULL, 10) : 20250901UL;
+    if (days <= 0 || rows <= 0 || legacy_days < 0) {
+        fprintf(stderr, "days and rows-per-day must be positive\n");
+        return 2;
+    }
+
+    char spec[512], manifest[512];
+    snprintf(spec, sizeof(spec),
+             "start=%s\ndays=%d\nrows_per_day=%ld\nlegacy_days=%d\nseed=%lu\nfirst_tx_id=1\n",
+             argv[2], days, rows, legacy_days, seed);
+    snprintf(manifest, sizeof(manifest), "%s/bench_ledger.txt", dir);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if (manifest_matches(manifest, spec)) {
+        printf("%s is up to date (%d days x %ld rows)\n", dir, days, rows);
+        return 0;
+    }
+    unlink(manifest);
+
+    rng_state = seed * 2654435761UL + 1;
+    long tx_id = 1;
+    day.tm_hour = 12;                  /* clear of DST switches */
+    for (int d = 0; d < days; ++d) {
+        char date[16];
+        mktime(&day);
+        strftime(date, sizeof(date), "%Y-%m-%d", &day);
+        int layout = d < legacy_days ? CSV_FMT_LEGACY : d == legacy_days ? CSV_FMT_UNKNOWN : CSV_FMT_V2;
+        if (d == legacy_days && legacy_days == 0) layout = CSV_FMT_V2;
+        if (write_day(dir, date, rows, layout, &tx_id) != 0) return 1;
+        day.tm_mday++;
+    }
+    if (write_manifest(manifest, spec) != 0) return 1;
+    printf("Wrote %d days x %ld rows (%d legacy) to %s\n", days, rows, legacy_days, dir);
+    return 0;
+}
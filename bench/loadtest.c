@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+
+/* Load test for --serve: N concurrent cashier connections, each sending
+ * exchange orders one at a time and waiting for the reply.
+ *
+ *   build/loadtest <socket> <clients> [orders-per-client]   (default 1000)
+ *
+ * Prints one table row: clients, orders, accepted, rejected, seconds,
+ * orders/s and p50/p99 round-trip latency. Each client trades in round
+ * trips, as cashiers see customers both buying and selling: a random order
+ * (mostly foreign currency against LOC), then the amount it paid out traded
+ * back, so reserves and tills move by the spread rather than drifting dry. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *CODES[] = { "LOC", "USD", "EUR", "GBP", "JPY" };
+/* order size range in units, roughly the same LOC value per currency */
+static const int UNITS[] = { 2000, 50, 40, 35, 7000 };
+
+typedef struct {
+    const char *path;
+    int orders;
+    unsigned seed;
+    double *lat;
+    long ok, err;
+    int failed;
+} Worker;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *run_worker(void *arg) {
+    Worker *w = arg;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", w->path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "connect %s: %s\n", w->path, strerror(errno));
+        w->failed = 1;
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    char req[128], reply[512], back[32] = "";
+    int from = 0, to = 0;
+    for (int i = 0; i < w->orders; ++i) {
+        int n, returning = back[0] != '\0';
+        if (returning) {
+            int t = from;
+            from = to;
+            to = t;
+            n = snprintf(req, sizeof(req), "%s,%s,%s\n", CODES[from], CODES[to], back);
+            back[0] = '\0';
+        } else {
+            int fx = 1 + rand_r(&w->seed) % 4;
+            if (rand_r(&w->seed) % 4 == 0) {
+                from = fx;
+                to = 1 + (fx + rand_r(&w->seed) % 3) % 4;
+            } else if (rand_r(&w->seed) % 2) {
+                from = fx;
+                to = 0;
+            } else {
+                from = 0;
+                to = fx;
+            }
+            int units = 1 + rand_r(&w->seed) % UNITS[from];
+            n = snprintf(req, sizeof(req), "%s,%s,%d.%02d\n", CODES[from], CODES[to],
+                         units, rand_r(&w->seed) % 100);
+        }
+
+        double t0 = now_sec();
+        if (send(fd, req, (size_t)n, MSG_NOSIGNAL) != n) {
+            w->failed = 1;
+            break;
+        }
+        size_t have = 0;
+        char *nl = NULL;
+        while (!nl) {
+            ssize_t r = recv(fd, reply + have, sizeof(reply) - 1 - have, 0);
+            if (r <= 0) break;
+            have += (size_t)r;
+            nl = memchr(reply, '\n', have);
+        }
+        if (!nl) {
+            w->failed = 1;
+            break;
+        }
+        w->lat[i] = now_sec() - t0;
+        *nl = '\0';
+        if (strncmp(reply, "OK", 2) == 0) {
+            w->ok++;
+            /* OK <tx_id> <amount_to> ...: trade that amount back next */
+            if (!returning && sscanf(reply, "OK %*d %31s", back) != 1) back[0] = '\0';
+        } else {
+            w->err++;
+        }
+    }
+    send(fd, "QUIT\n", 5, MSG_NOSIGNAL);
+    close(fd);
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <socket> <clients> [orders-per-client]\n", argv[0]);
+        return 2;
+    }
+    int clients = atoi(argv[2]);
+    int orders = argc > 3 ? atoi(argv[3]) : 1000;
+    if (clients <= 0 || orders <= 0) {
+        fprintf(stderr, "clients and orders must be positive\n");
+        return 2;
+    }
+
+    Worker *w = calloc((size_t)clients, sizeof(*w));
+    pthread_t *th = calloc((size_t)clients, sizeof(*th));
+    double *lat = calloc((size_t)clients * (size_t)orders, sizeof(*lat));
+    if (!w || !th || !lat) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    double t0 = now_sec();
+    for (int i = 0; i < clients; ++i) {
+        w[i].path = argv[1];
+        w[i].orders = orders;
+        w[i].seed = 1000u + (unsigned)i;
+        w[i].lat = lat + (size_t)i * (size_t)orders;
+        pthread_create(&th[i], NULL, run_worker, &w[i]);
+    }
+    long ok = 0, err = 0;
+    int failed = 0;
+    for (int i = 0; i < clients; ++i) {
+        pthread_join(th[i], NULL);
+        ok += w[i].ok;
+        err += w[i].err;
+        failed |= w[i].failed;
+    }
+    double secs = now_sec() - t0;
+
+    /* unanswered slots stay 0 and are left out */
+    long n = 0;
+    for (long i = 0; i < (long)clients * orders; ++i)
+        if (lat[i] > 0) lat[n++] = lat[i];
+    qsort(lat, (size_t)n, sizeof(*lat), cmp_double);
+    double p50 = n ? lat[n / 2] * 1e6 : 0, p99 = n ? lat[n * 99 / 100] * 1e6 : 0;
+    printf("%7d %8ld %8ld %8ld %8.3f %10.0f %10.1f %10.1f\n",
+           clients, ok + err, ok, err, secs, (ok + err) / secs, p50, p99);
+    free(w);
+    free(th);
+    free(lat);
+    return failed ? 1 : 0;
+}
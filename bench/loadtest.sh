@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+# Start a server in a scratch directory and load it with a rising number of
+# concurrent cashier clients. LOADTEST_CLIENTS and LOADTEST_ORDERS override
+# the client counts and the orders per client.
+set -euo pipefail
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BIN="$ROOT/build/exchange_store_cp1"
+LOAD="$ROOT/build/loadtest"
+CLIENTS=${LOADTEST_CLIENTS:-"1 2 4 8 16 32 64"}
+ORDERS=${LOADTEST_ORDERS:-1000}
+
+DIR=$(mktemp -d)
+PID=
+cleanup() {
+  if [ -n "$PID" ]; then kill "$PID" 2>/dev/null || true; wait "$PID" 2>/dev/null || true; fi
+  rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+cd "$DIR"
+"$BIN" --serve store.sock > server.log 2>&1 &
+PID=$!
+for _ in $(seq 50); do
+  [ -S store.sock ] && break
+  sleep 0.1
+done
+
+printf "%7s %8s %8s %8s %8s %10s %10s %10s\n" clients orders ok rejected secs orders/s p50_us p99_us
+for c in $CLIENTS; do
+  "$LOAD" store.sock "$c" "$ORDERS"
+done
+
+kill -TERM "$PID"
+wait "$PID" || true
+PID=
+tail -n 7 server.log
+echo "Ledger rows: $(cat */*/sales_*.csv | grep -vc '^date,')"
@@ -0,0 +1,557 @@
+#define _GNU_SOURCE
+
+/* A busy day at the desk: many virtual cashiers on one exchange engine,
+ * linked against libexchange, with the ledger checked afterwards.
+ *
+ *   build/simulate <data-dir> [key=value ...]
+ *
+ *   cashiers=N    virtual cashiers (default 20)
+ *   rate=N        customers per cashier and hour (60)
+ *   hours=N       length of the day from 09:00 (8)
+ *   mix=SPEC      currency pairs with weights, "USD-LOC:4,EUR-GBP:1"; each pair
+ *                 is traded both ways (default: every currency against LOC at 4,
+ *                 cross pairs at 1)
+ *   partial=P     percent of customers who take only part of the payout (5)
+ *   rates=M       minutes between rate changes (30; 0 = none)
+ *   seed=N        (1)
+ *   sync=POLICY   journal policy as for --sync (default rows:1000 and 200 ms)
+ *
+ * Each cashier's customers arrive as a Poisson stream on a simulated clock
+ * (exchange_set_clock) from 2025-03-10 09:00, and are served in arrival
+ * order: the engine is single-threaded, as the server's workers are
+ * serialised on it. Every customer goes through exchange_quote,
+ * exchange_commit and exchange_record, so receipts and CSV rows go through
+ * the background writer as at the counter; when the till cannot pay in full
+ * the rest is paid in LOC. Every quarter hour the desk tops up a reserve
+ * that fell below half its opening level and banks what rose above twice
+ * it; one currency's rates move by up to 0.5% at the set interval.
+ *
+ * Afterwards the ledger is read back: reserves against the opening
+ * reserves, the adjustments and the rows; tills against reserves; the tx
+ * ids against those handed out; the profit against profit_loc and
+ * csv_sum_profit_for_date. The outcome goes to stdout and does not depend
+ * on the machine; throughput, latency percentiles and I/O volume go to
+ * stderr. Exits 1 if an invariant does not hold. */
+
+#include "../exchange.h"
+#include "../diag.h"
+#include "../journal.h"
+#include "../snapshot.h"
+#include "../manifest.h"
+#include "../ratehist.h"
+#include "../writer.h"
+#include "../metrics.h"
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PAIRS 4096
+#define MAX_DAYS 64
+#define DESK_EVERY 900              /* seconds between reserve checks */
+#define ORDER_LOC MONEY_UNITS(2000) /* largest order, in LOC value */
+#define OPENING_LOC MONEY_UNITS(500000)
+
+typedef struct {
+    int cashiers, rate, hours, partial_pct, rate_minutes;
+    uint64_t seed;
+    JournalPolicy sync;
+    int pairs;
+    int pair_a[MAX_PAIRS], pair_b[MAX_PAIRS], weight[MAX_PAIRS];
+    long weight_sum;
+} SimConfig;
+
+static uint64_t rng;
+
+/* splitmix64 */
+static uint64_t next_rand(void) {
+    uint64_t z = (rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Uniform in [0, n). */
+static long rand_below(long n) {
+    return (long)(next_rand() % (uint64_t)n);
+}
+
+/* Exponential with the given mean. */
+static double next_gap(double mean) {
+    double u = (double)((next_rand() >> 11) + 1) * 0x1.0p-53;    /* (0, 1] */
+    return -mean * log(u);
+}
+
+/* Simulated clock: seconds after sim_start. */
+static time_t sim_start;
+static double sim_now;
+
+static time_t sim_clock(void *ctx) {
+    (void)ctx;
+    return sim_start + (time_t)sim_now;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void add_pair(SimConfig *c, int a, int b, int w) {
+    if (c->pairs == MAX_PAIRS) return;
+    c->pair_a[c->pairs] = a;
+    c->pair_b[c->pairs] = b;
+    c->weight[c->pairs++] = w;
+    c->weight_sum += w;
+}
+
+/* "A-B[:w],..." Returns 0 or -1. */
+static int parse_mix(const char *spec, SimConfig *c) {
+    char buf[BUF];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    c->pairs = 0;
+    c->weight_sum = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *colon = strchr(tok, ':'), *dash = strchr(tok, '-');
+        int w = 1;
+        if (colon) {
+            *colon = '\0';
+            w = atoi(colon + 1);
+        }
+        if (!dash || w <= 0) return -1;
+        *dash = '\0';
+        int a = currency_from_code(tok), b = currency_from_code(dash + 1);
+        if (a < 0 || b < 0 || a == b) return -1;
+        add_pair(c, a, b, w);
+    }
+    return c->pairs ? 0 : -1;
+}
+
+static void default_mix(SimConfig *c) {
+    for (int i = 1; i < cur_count; ++i) add_pair(c, i, CUR_LOC, 4);
+    for (int i = 1; i < cur_count; ++i)
+        for (int j = i + 1; j < cur_count; ++j) add_pair(c, i, j, 1);
+}
+
+static int parse_args(int argc, char **argv, SimConfig *c) {
+    JournalPolicy group = { .every_rows = 1000, .every_ms = 200, .fsync_on = 1 };
+    *c = (SimConfig){ .cashiers = 20, .rate = 60, .hours = 8, .partial_pct = 5,
+                      .rate_minutes = 30, .seed = 1, .sync = group };
+    const char *mix = NULL;
+    for (int i = 2; i < argc; ++i) {
+        const char *eq = strchr(argv[i], '=');
+        if (!eq) return -1;
+        const char *v = eq + 1;
+        size_t k = (size_t)(eq - argv[i]);
+        if (k == 8 && strncmp(argv[i], "cashiers", k) == 0) c->cashiers = atoi(v);
+        else if (k == 4 && strncmp(argv[i], "rate", k) == 0) c->rate = atoi(v);
+        else if (k == 5 && strncmp(argv[i], "hours", k) == 0) c->hours = atoi(v);
+        else if (k == 3 && strncmp(argv[i], "mix", k) == 0) mix = v;
+        else if (k == 7 && strncmp(argv[i], "partial", k) == 0) c->partial_pct = atoi(v);
+        else if (k == 5 && strncmp(argv[i], "rates", k) == 0) c->rate_minutes = atoi(v);
+        else if (k == 4 && strncmp(argv[i], "seed", k) == 0) c->seed = strtoull(v, NULL, 10);
+        else if (k == 4 && strncmp(argv[i], "sync", k) == 0) {
+            if (journal_parse_policy(v, &c->sync) != 0) return -1;
+        } else return -1;
+    }
+    if (c->cashiers <= 0 || c->rate <= 0 || c->hours <= 0 || c->hours > 24 * (MAX_DAYS - 2) ||
+        c->partial_pct < 0 || c->partial_pct > 100 || c->rate_minutes < 0 || cur_count < 2)
+        return -1;
+    if (mix) return parse_mix(mix, c);
+    default_mix(c);
+    return 0;
+}
+
+/* Cashiers by their next customer's arrival: a binary min-heap. */
+typedef struct {
+    double *due;
+    int n;
+} Arrivals;
+
+/* The earliest cashier got a new due time; restore the heap. */
+static void arrivals_sift(Arrivals *a) {
+    int i = 0;
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < a->n && a->due[l] < a->due[m]) m = l;
+        if (r < a->n && a->due[r] < a->due[m]) m = r;
+        if (m == i) return;
+        double t = a->due[i];
+        a->due[i] = a->due[m];
+        a->due[m] = t;
+        i = m;
+    }
+}
+
+typedef struct {
+    long customers, executed, partial_till, partial_asked;
+    long rejected[EXCHANGE_EIO + 1];
+    long topups, bankings, refused, rate_moves;
+    Money profit;
+    Money *adjusted;            /* per currency, by the desk */
+    Money *opening;             /* reserve level the desk aims for */
+    int *ids;
+    int64_t *lat_ns;
+    long cap;
+} SimRun;
+
+static int grow(SimRun *r) {
+    long cap = r->cap ? r->cap * 2 : 4096;
+    int *ids = realloc(r->ids, (size_t)cap * sizeof(*ids));
+    if (ids) r->ids = ids;
+    int64_t *lat = realloc(r->lat_ns, (size_t)cap * sizeof(*lat));
+    if (lat) r->lat_ns = lat;
+    if (!ids || !lat) return -1;
+    r->cap = cap;
+    return 0;
+}
+
+/* Whole units of `cur` worth about `loc` LOC at its buy rate. */
+static Money units_worth(int cur, Money loc) {
+    Money m = money_div_rate(loc, currencies[cur].buy_to_loc);
+    return m / MONEY_SCALE * MONEY_SCALE;
+}
+
+static int adjust(SimRun *r, int cur, Money delta) {
+    if (exchange_adjust_reserve(cur, delta, NULL, 0) != EXCHANGE_OK) {
+        r->refused++;
+        return -1;
+    }
+    r->adjusted[cur] += delta;
+    return 0;
+}
+
+/* Top up reserves below half their opening level, bank what is above twice it. */
+static void desk_check(SimRun *r) {
+    for (int i = 0; i < cur_count; ++i) {
+        Money bal = currencies[i].bal, want = r->opening[i];
+        if (bal < want / 2) {
+            if (adjust(r, i, (want - bal) / MONEY_SCALE * MONEY_SCALE) == 0) r->topups++;
+        } else if (bal > want * 2) {
+            Payout p;
+            Money out = till_max_payable(&currencies[i].till, bal - want, &p);
+            if (out > 0 && adjust(r, i, -out) == 0) r->bankings++;
+        }
+    }
+}
+
+/* One foreign currency's rates move by up to 0.5% either way. */
+static void move_rates(SimRun *r) {
+    int cur = 1 + (int)rand_below(cur_count - 1);
+    long k = rand_below(1001) - 500;            /* in 1/100000 */
+    Rate buy = currencies[cur].buy_to_loc, sell = currencies[cur].sell_to_loc;
+    buy += buy * k / 100000;
+    sell += sell * k / 100000;
+    if (buy > 0 && sell >= buy && exchange_set_rates(cur, buy, sell, NULL, 0) == EXCHANGE_OK)
+        r->rate_moves++;
+}
+
+static void serve_customer(const SimConfig *c, SimRun *r) {
+    long w = rand_below(c->weight_sum);
+    int p = 0;
+    while (w >= c->weight[p]) w -= c->weight[p++];
+    int from = c->pair_a[p], to = c->pair_b[p];
+    if (next_rand() & 1) {
+        int t = from;
+        from = to;
+        to = t;
+    }
+    Money most = units_worth(from, ORDER_LOC) / MONEY_SCALE;
+    Money amt = MONEY_UNITS(1 + rand_below(most > 1 ? (long)most : 1));
+    int asks_part = to != CUR_LOC && rand_below(100) < c->partial_pct;
+    r->customers++;
+    if (r->executed == r->cap && grow(r) != 0) return;
+
+    refresh_current_date();
+    int64_t t0 = metrics_clock();
+    ExchangeQuote q;
+    int partial = 0;
+    Money part = 0;
+    int by_till = 0;
+    int rc = exchange_quote(from, to, amt, &q, NULL, 0);
+    if (rc == EXCHANGE_OK) {
+        Payout pay;
+        if (q.payable < q.amt_to) {
+            partial = by_till = 1;
+            part = q.payable;
+        } else if (asks_part && (part = till_max_payable(&currencies[to].till, q.amt_to / 2, &pay)) > 0) {
+            partial = 1;
+        }
+        rc = exchange_commit(from, to, amt, partial, part, &q, NULL, 0);
+    }
+    if (rc == EXCHANGE_OK) {
+        r->ids[r->executed] = exchange_record(WRITER_EXCHANGE, from, to, amt, partial, &q, NULL);
+        r->lat_ns[r->executed++] = metrics_clock() - t0;
+        r->profit += q.profit_delta;
+        if (by_till) r->partial_till++;
+        else if (partial) r->partial_asked++;
+    } else if (rc <= EXCHANGE_EIO) {
+        r->rejected[rc]++;
+    }
+}
+
+/* The rows of this run read back from the ledger. */
+typedef struct {
+    int first_id;
+    Money *flow;                /* per currency, what the rows moved */
+    Money profit;
+    long rows, unknown;
+    int *ids;
+    long n, cap;
+} Ledger;
+
+static int ledger_row(const CsvRow *row, void *ctx) {
+    Ledger *l = ctx;
+    if (!row->has_tx_id || row->tx_id < l->first_id) return 0;
+    int from = currency_from_code(row->from), to = currency_from_code(row->to);
+    if (from < 0 || to < 0) {
+        l->unknown++;
+        return 0;
+    }
+    if (l->n == l->cap) {
+        long cap = l->cap ? l->cap * 2 : 4096;
+        int *ids = realloc(l->ids, (size_t)cap * sizeof(*ids));
+        if (!ids) return 1;
+        l->ids = ids;
+        l->cap = cap;
+    }
+    l->ids[l->n++] = row->tx_id;
+    l->flow[from] += row->amount_from;
+    l->flow[to] -= row->amount_to;
+    if (row->partial) l->flow[CUR_LOC] -= row->remainder_loc;
+    l->profit += row->profit_loc;
+    l->rows++;
+    return 0;
+}
+
+static int cmp_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_i64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted values, in microseconds. */
+static double pct_us(const int64_t *v, long n, int p) {
+    if (n == 0) return 0;
+    long i = (n * p + 99) / 100 - 1;
+    return (double)v[i < 0 ? 0 : i] / 1e3;
+}
+
+/* The business dates from the start of the run to its end. */
+static int run_dates(time_t from, time_t to, char dates[][11]) {
+    struct tm tm;
+    localtime_r(&from, &tm);
+    char last[11];
+    struct tm end;
+    localtime_r(&to, &end);
+    strftime(last, sizeof(last), "%Y-%m-%d", &end);
+    int n = 0;
+    do {
+        strftime(dates[n], 11, "%Y-%m-%d", &tm);
+        tm.tm_mday++;
+        tm.tm_hour = 12;
+        tm.tm_isdst = -1;
+        mktime(&tm);
+    } while (strcmp(dates[n++], last) < 0 && n < MAX_DAYS);
+    return n;
+}
+
+static Money profit_of_days(char dates[][11], int n, long *tx) {
+    Money p = 0;
+    *tx = 0;
+    for (int i = 0; i < n; ++i) {
+        int c = 0;
+        p += csv_sum_profit_for_date(dates[i], &c);
+        *tx += c;
+    }
+    return p;
+}
+
+static int check(int ok, const char *what, const char *detail) {
+    printf("  %-20s %s%s%s\n", what, ok ? "ok" : "FAILED", detail[0] ? ": " : "", detail);
+    return ok ? 0 : 1;
+}
+
+static void print_diag(const char *msg, void *ctx) {
+    (void)ctx;
+    fprintf(stderr, "%s\n", msg);
+}
+
+int main(int argc, char **argv) {
+    diag_set_sink(print_diag, NULL);
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <data-dir> [cashiers=N rate=N hours=N mix=A-B:w,... partial=P "
+                        "rates=M seed=N sync=POLICY]\n", argv[0]);
+        return 2;
+    }
+    if (data_root_open(argv[1]) != 0) return 1;
+    init_defaults(NULL);
+    SimConfig cfg;
+    if (parse_args(argc, argv, &cfg) != 0) {
+        fprintf(stderr, "Invalid simulation settings (see the comment at the top of bench/simulate.c).\n");
+        return 2;
+    }
+    rng = cfg.seed;
+
+    struct tm start = { .tm_year = 125, .tm_mon = 2, .tm_mday = 10, .tm_hour = 9, .tm_isdst = -1 };
+    sim_start = mktime(&start);
+    exchange_set_clock(sim_clock, NULL);
+    refresh_current_date();
+    if (snapshot_recover(NULL) != 0 || ratehist_sync() < 0) return 1;
+    journal_set_policy(&cfg.sync);
+
+    double end = cfg.hours * 3600.0;
+    char dates[MAX_DAYS][11];
+    int ndates = run_dates(sim_start, sim_start + (time_t)end, dates);
+    long tx_before;
+    Money day_profit_before = profit_of_days(dates, ndates, &tx_before);
+
+    SimRun run = { 0 };
+    run.adjusted = calloc((size_t)cur_count, sizeof(Money));
+    run.opening = calloc((size_t)cur_count, sizeof(Money));
+    Money *bal0 = calloc((size_t)cur_count, sizeof(Money));
+    Money *drawer0 = calloc((size_t)cur_count, sizeof(Money));
+    Arrivals arr = { .due = malloc((size_t)cfg.cashiers * sizeof(double)), .n = cfg.cashiers };
+    if (!run.adjusted || !run.opening || !bal0 || !drawer0 || !arr.due || grow(&run) != 0) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+    for (int i = 0; i < cur_count; ++i) {
+        run.opening[i] = units_worth(i, OPENING_LOC);
+        bal0[i] = currencies[i].bal;
+        drawer0[i] = till_value(&currencies[i].till);
+    }
+    Money profit0 = profit_loc;
+    desk_check(&run);                           /* open with the reserves stocked */
+    if (writer_start() != 0) return 1;
+
+    double mean = 3600.0 / cfg.rate;
+    for (int i = 0; i < arr.n; ++i) arr.due[i] = next_gap(mean);
+    qsort(arr.due, (size_t)arr.n, sizeof(double), cmp_double);    /* sorted is a heap */
+
+    double next_desk = DESK_EVERY, next_move = cfg.rate_minutes ? cfg.rate_minutes * 60.0 : end;
+    double w0 = now_sec();
+    for (;;) {
+        double t = arr.due[0];
+        if (next_desk <= t && next_desk <= next_move && next_desk < end) {
+            sim_now = next_desk;
+            desk_check(&run);
+            next_desk += DESK_EVERY;
+        } else if (next_move <= t && next_move < end) {
+            sim_now = next_move;
+            move_rates(&run);
+            next_move += cfg.rate_minutes * 60.0;
+        } else if (t < end) {
+            sim_now = t;
+            serve_customer(&cfg, &run);
+            arr.due[0] = t + next_gap(mean);
+            arrivals_sift(&arr);
+        } else {
+            break;
+        }
+    }
+    writer_stop();
+    journal_close();
+    double wall = now_sec() - w0;
+    snapshot_write();
+
+    char a[32], b[32], c[32];
+    struct tm tm_end;
+    time_t t_end = sim_start + (time_t)end;
+    localtime_r(&t_end, &tm_end);
+    strftime(a, sizeof(a), "%Y-%m-%d %H:%M", &tm_end);
+    printf("Simulated 2025-03-10 09:00 .. %s: %d cashier(s), %d customer(s) an hour each, %d pair(s)\n",
+           a, cfg.cashiers, cfg.rate, cfg.pairs);
+    printf("Customers: %ld, executed: %ld (partial: %ld by the till, %ld asked)\n",
+           run.customers, run.executed, run.partial_till, run.partial_asked);
+    for (int e = 1; e <= EXCHANGE_EIO; ++e)
+        if (run.rejected[e]) printf("Rejected (%s): %ld\n", exchange_strerror(e), run.rejected[e]);
+    printf("Desk: %ld top-up(s), %ld banking(s), %ld refused; %ld rate change(s)\n",
+           run.topups, run.bankings, run.refused, run.rate_moves);
+
+    /* Read the run back. */
+    Ledger led = { .first_id = run.executed ? run.ids[0] : INT_MAX,
+                   .flow = calloc((size_t)cur_count, sizeof(Money)) };
+    Query q;
+    query_init(&q);
+    snprintf(q.from_date, sizeof(q.from_date), "%s", dates[0]);
+    snprintf(q.to_date, sizeof(q.to_date), "%s", dates[ndates - 1]);
+    QueryStats qs;
+    if (!led.flow || query_run(&q, ledger_row, &led, &qs) != 0) {
+        fprintf(stderr, "The ledger could not be read back.\n");
+        return 1;
+    }
+    long tx_after;
+    Money day_profit = profit_of_days(dates, ndates, &tx_after) - day_profit_before;
+    printf("Ledger: %ld row(s) of this run in %d file(s), %ld with unknown currencies\n",
+           led.rows, qs.files, led.unknown);
+
+    printf("Invariants:\n");
+    int bad = 0, off = -1, drawer_off = -1;
+    for (int i = 0; i < cur_count; ++i) {
+        if (off < 0 && currencies[i].bal != bal0[i] + run.adjusted[i] + led.flow[i]) off = i;
+        if (drawer_off < 0 && till_value(&currencies[i].till) - currencies[i].bal != drawer0[i] - bal0[i])
+            drawer_off = i;
+    }
+    char detail[BUF] = "";
+    if (off >= 0)
+        snprintf(detail, sizeof(detail), "%s reserve %s, opening + adjustments + rows = %s",
+                 currencies[off].name, money_fmt(a, currencies[off].bal),
+                 money_fmt(b, bal0[off] + run.adjusted[off] + led.flow[off]));
+    else
+        snprintf(detail, sizeof(detail), "%d currencies", cur_count);
+    bad += check(off < 0, "reserves vs ledger", detail);
+    if (drawer_off >= 0)
+        snprintf(detail, sizeof(detail), "%s till %s, reserve %s", currencies[drawer_off].name,
+                 money_fmt(a, till_value(&currencies[drawer_off].till)),
+                 money_fmt(b, currencies[drawer_off].bal));
+    else
+        detail[0] = '\0';
+    bad += check(drawer_off < 0, "tills vs reserves", detail);
+
+    qsort(run.ids, (size_t)run.executed, sizeof(int), cmp_int);
+    qsort(led.ids, (size_t)led.n, sizeof(int), cmp_int);
+    long dups = 0;
+    for (long i = 1; i < led.n; ++i) dups += led.ids[i] == led.ids[i - 1];
+    int same = led.n == run.executed &&
+               (led.n == 0 || memcmp(led.ids, run.ids, (size_t)led.n * sizeof(int)) == 0);
+    snprintf(detail, sizeof(detail), "%ld issued, %ld in the ledger, %ld duplicate(s)",
+             run.executed, led.n, dups);
+    bad += check(same && dups == 0, "tx ids", detail);
+
+    Money booked = profit_loc - profit0;
+    snprintf(detail, sizeof(detail), "%s LOC; profit_loc %s, csv_sum_profit_for_date %s (%ld tx)",
+             money_fmt(a, led.profit), money_fmt(b, booked), money_fmt(c, day_profit), tx_after - tx_before);
+    bad += check(led.profit == run.profit && booked == run.profit && day_profit == run.profit &&
+                 tx_after - tx_before == run.executed, "profit", detail);
+    printf("%s\n", bad ? "Invariants FAILED." : "All invariants hold.");
+
+    qsort(run.lat_ns, (size_t)run.executed, sizeof(int64_t), cmp_i64);
+    fprintf(stderr, "Wall time %.3f s: %.0f exchanges/s sustained (writer drained), day run %.0fx real time\n",
+            wall, run.executed / (wall > 0 ? wall : 1e-9), end / (wall > 0 ? wall : 1e-9));
+    fprintf(stderr, "Exchange latency (quote, commit, hand-off) us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+            pct_us(run.lat_ns, run.executed, 50), pct_us(run.lat_ns, run.executed, 90),
+            pct_us(run.lat_ns, run.executed, 99),
+            run.executed ? (double)run.lat_ns[(run.executed * 999 + 999) / 1000 - 1] / 1e3 : 0.0,
+            pct_us(run.lat_ns, run.executed, 100));
+    fprintf(stderr, "I/O: rows_written %llu, bytes_written %llu, files_opened %llu, rows_read %llu, bytes_read %llu\n",
+            (unsigned long long)metrics_counter(MET_ROWS_WRITTEN),
+            (unsigned long long)metrics_counter(MET_BYTES_WRITTEN),
+            (unsigned long long)metrics_counter(MET_FILES_OPENED),
+            (unsigned long long)metrics_counter(MET_ROWS_READ),
+            (unsigned long long)metrics_counter(MET_BYTES_READ));
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+
+#include "codec.h"
+#include "metrics.h"
+#include "archive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define READER_BUF (256 * 1024)
+#define MAX_FIELDS 13
+
+CsvFormat codec_detect_format(const char *line, size_t len) {
+    int fields = 1;
+    for (size_t i = 0; i < len && line[i] != '\n'; ++i)
+        if (line[i] == ',') fields++;
+    if (fields == 12) return CSV_FMT_V2;
+    if (fields == 11) return CSV_FMT_LEGACY;
+    return CSV_FMT_UNKNOWN;
+}
+
+static int is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+/* Legacy files carry 6 decimals for amounts; they are rounded to the
+   minor unit on read. */
+static int parse_money(const char *s, const char *end, Money *out) {
+    return fixed_parse(s, end, MONEY_DECIMALS, out) != 0;
+}
+
+static int parse_rate(const char *s, const char *end, Rate *out) {
+    return fixed_parse(s, end, RATE_DECIMALS, out) != 0;
+}
+
+static int parse_int(const char *s, const char *end, int *out) {
+    while (s < end && is_space(*s)) s++;
+    int neg = 0;
+    if (s < end && (*s == '-' || *s == '+')) neg = *s++ == '-';
+    if (s == end) return 0;
+    long v = 0;
+    while (s < end && *s >= '0' && *s <= '9') {
+        v = v * 10 + (*s++ - '0');
+        if (v > 2147483647L) return 0;
+    }
+    while (s < end && is_space(*s)) s++;
+    if (s != end) return 0;
+    *out = (int)(neg ? -v : v);
+    return 1;
+}
+
+static int copy_field(char *dst, size_t cap, const char *s, const char *end) {
+    size_t n = (size_t)(end - s);
+    if (n == 0 || n >= cap) return 0;
+    memcpy(dst, s, n);
+    dst[n] = '\0';
+    return 1;
+}
+
+int codec_parse_row(char *line, size_t len, CsvFormat expect, CsvRow *row) {
+    while (len && (line[len-1] == '\n' || line[len-1] == '\r')) len--;
+
+    const char *f[MAX_FIELDS + 1];
+    int n = 0;
+    f[n++] = line;
+    for (size_t i = 0; i < len; ++i) {
+        if (line[i] == ',') {
+            if (n == MAX_FIELDS) return 0;
+            line[i] = '\0';
+            f[n++] = line + i + 1;
+        }
+    }
+    f[n] = line + len + 1;   /* end of last field is f[n] - 1 */
+#define FEND(i) (f[(i) + 1] - 1)
+
+    CsvFormat fmt = expect;
+    if (!((fmt == CSV_FMT_V2 && n == 12) || (fmt == CSV_FMT_LEGACY && n == 11)))
+        fmt = n == 12 ? CSV_FMT_V2 : n == 11 ? CSV_FMT_LEGACY : CSV_FMT_UNKNOWN;
+    if (fmt == CSV_FMT_UNKNOWN) return 0;
+
+    int k = 0;
+    if (!copy_field(row->date, sizeof(row->date), f[k], FEND(k))) return 0;
+    k++;
+    if (!copy_field(row->time, sizeof(row->time), f[k], FEND(k))) return 0;
+    k++;
+    if (fmt == CSV_FMT_V2) {
+        if (!parse_int(f[k], FEND(k), &row->tx_id)) return 0;
+        row->has_tx_id = 1;
+        k++;
+    } else {
+        row->tx_id = 0;
+        row->has_tx_id = 0;
+    }
+    if (!copy_field(row->from, sizeof(row->from), f[k], FEND(k))) return 0;
+    k++;
+    if (!copy_field(row->to, sizeof(row->to), f[k], FEND(k))) return 0;
+    k++;
+    if (!parse_money(f[k], FEND(k), &row->amount_from)) return 0;
+    k++;
+    if (!parse_money(f[k], FEND(k), &row->amount_to)) return 0;
+    k++;
+    if (!parse_rate(f[k], FEND(k), &row->rate_from_loc)) return 0;
+    k++;
+    if (!parse_rate(f[k], FEND(k), &row->rate_to_loc)) return 0;
+    k++;
+    if (!parse_int(f[k], FEND(k), &row->partial)) return 0;
+    k++;
+    if (!parse_money(f[k], FEND(k), &row->remainder_loc)) return 0;
+    k++;
+    if (!parse_money(f[k], FEND(k), &row->profit_loc)) return 0;
+#undef FEND
+    return 1;
+}
+
+/* Writer */
+
+static char *put_str(char *p, const char *s) {
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+#define FIXED_MAX 22      /* "-92233720368547758.07" */
+
+int codec_format_row(char *out, size_t cap, const char *date_text, const char *time_text, int tx_id,
+                     const char *from_code, const char *to_code,
+                     Money amt_from, Money amt_to,
+                     Rate rate_from_loc, Rate rate_to_loc,
+                     int partial, Money remainder_loc, Money profit_loc_delta) {
+    size_t need = strlen(date_text) + strlen(time_text) + strlen(from_code) + strlen(to_code) +
+                  7 * FIXED_MAX + 12 + 2;
+    if (need > cap) return -1;
+    char *p = out;
+    p = put_str(p, date_text);                       *p++ = ',';
+    p = put_str(p, time_text);                       *p++ = ',';
+    p = fixed_put(p, tx_id, 0);                      *p++ = ',';
+    p = put_str(p, from_code);                       *p++ = ',';
+    p = put_str(p, to_code);                         *p++ = ',';
+    p = fixed_put(p, amt_from, MONEY_DECIMALS);      *p++ = ',';
+    p = fixed_put(p, amt_to, MONEY_DECIMALS);        *p++ = ',';
+    p = fixed_put(p, rate_from_loc, RATE_DECIMALS);  *p++ = ',';
+    p = fixed_put(p, rate_to_loc, RATE_DECIMALS);    *p++ = ',';
+    *p++ = partial ? '1' : '0';                      *p++ = ',';
+    p = fixed_put(p, remainder_loc, MONEY_DECIMALS); *p++ = ',';
+    p = fixed_put(p, profit_loc_delta, MONEY_DECIMALS);
+    *p++ = '\n';
+    *p = '\0';
+    return (int)(p - out);
+}
+
+/* Reader */
+
+/* sales_<date>.csv that is gone: its text from the month's archive. */
+static int open_archived(CsvReader *r, const char *fname) {
+    const char *base = strrchr(fname, '/');
+    base = base ? base + 1 : fname;
+    if (strncmp(base, "sales_", 6) != 0 || strlen(base) != 20 || strcmp(base + 16, ".csv") != 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    char date[11];
+    memcpy(date, base + 6, 10);
+    date[10] = '\0';
+    return archive_day_text(date, &r->mem, &r->mem_len);
+}
+
+int csv_reader_open(CsvReader *r, const char *fname) {
+    memset(r, 0, sizeof(*r));
+    r->fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (r->fd < 0) {
+        if (errno != ENOENT || open_archived(r, fname) != 0) return -1;
+    } else {
+        metrics_add(MET_FILES_OPENED, 1);
+    }
+    r->buf = malloc(READER_BUF);
+    if (!r->buf) {
+        if (r->fd >= 0) close(r->fd);
+        free(r->mem);
+        r->fd = -1;
+        r->mem = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+    r->cap = READER_BUF;
+
+    char *line;
+    size_t len;
+    long off;
+    if (csv_reader_next_line(r, &line, &len, &off)) {
+        r->fmt = codec_detect_format(line, len);
+        if (r->fmt == CSV_FMT_UNKNOWN) {
+            /* header is a comment or missing: use the first data row */
+            char *row;
+            size_t rlen;
+            long roff;
+            long after_header = csv_reader_tell(r);
+            if (csv_reader_next_line(r, &row, &rlen, &roff))
+                r->fmt = codec_detect_format(row, rlen);
+            csv_reader_seek(r, after_header);
+        }
+    }
+    return 0;
+}
+
+int csv_reader_seek(CsvReader *r, long offset) {
+    if (r->mem) {
+        if (offset < 0 || (size_t)offset > r->mem_len) return -1;
+        r->mem_pos = (size_t)offset;
+    } else if (lseek(r->fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    r->start = r->end = 0;
+    r->buf_off = offset;
+    r->eof = 0;
+    r->skipping = 0;
+    r->tail_bytes = 0;
+    return 0;
+}
+
+int csv_reader_seek_line(CsvReader *r, long offset) {
+    if (offset <= 0) return csv_reader_seek(r, 0);
+    if (csv_reader_seek(r, offset - 1) != 0) return -1;
+    char *line;
+    size_t len;
+    long off;
+    csv_reader_next_line(r, &line, &len, &off);   /* rest of the line holding offset-1 */
+    return 0;
+}
+
+long csv_reader_tell(const CsvReader *r) {
+    return r->buf_off + (long)r->start;
+}
+
+static ssize_t fill(CsvReader *r, char *dst, size_t n) {
+    if (!r->mem) return read(r->fd, dst, n);
+    if (n > r->mem_len - r->mem_pos) n = r->mem_len - r->mem_pos;
+    memcpy(dst, r->mem + r->mem_pos, n);
+    r->mem_pos += n;
+    return (ssize_t)n;
+}
+
+int csv_reader_next_line(CsvReader *r, char **line, size_t *len, long *offset) {
+    for (;;) {
+        char *base = r->buf + r->start;
+        char *nl = memchr(base, '\n', r->end - r->start);
+        if (nl) {
+            size_t n = (size_t)(nl - base);
+            long off = r->buf_off + (long)r->start;
+            *nl = '\0';
+            r->start += n + 1;
+            if (r->skipping) {           /* tail of an over-long line */
+                r->skipping = 0;
+                continue;
+            }
+            *line = base;
+            *len = n;
+            *offset = off;
+            return 1;
+        }
+        if (r->eof) {
+            /* a last line without newline is a row still being written */
+            if (r->start != r->end && !r->skipping) r->tail_bytes = r->end - r->start;
+            return 0;
+        }
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->buf_off += (long)r->start;
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->end + 1 >= r->cap) {      /* line longer than the buffer: drop it */
+            r->buf_off += (long)r->end;
+            r->end = 0;
+            r->skipping = 1;
+            r->malformed++;
+        }
+        ssize_t got = fill(r, r->buf + r->end, r->cap - r->end - 1);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            r->eof = 1;
+        } else if (got == 0) {
+            r->eof = 1;
+        } else {
+            r->end += (size_t)got;
+            r->bytes += got;
+        }
+    }
+}
+
+int csv_reader_next(CsvReader *r, CsvRow *row, long *offset) {
+    char *line;
+    size_t len;
+    long off;
+    while (csv_reader_next_line(r, &line, &len, &off)) {
+        if (len == 0 || (len == 1 && line[0] == '\r')) continue;
+        if (codec_parse_row(line, len, r->fmt, row)) {
+            r->rows++;
+            if (offset) *offset = off;
+            return 1;
+        }
+        r->malformed++;
+    }
+    return 0;
+}
+
+void csv_reader_close(CsvReader *r) {
+    metrics_add(MET_ROWS_READ, r->rows);
+    metrics_add(MET_BYTES_READ, r->bytes);
+    metrics_add(MET_PARSE_FAILURES, r->malformed);
+    r->rows = r->bytes = r->malformed = 0;
+    if (r->fd >= 0) close(r->fd);
+    free(r->buf);
+    free(r->mem);
+    r->fd = -1;
+    r->buf = NULL;
+    r->mem = NULL;
+}
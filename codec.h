@@ -0,0 +1,77 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include "utils.h"
+
+/* Sales CSV codec: a buffered line reader, an in-place single-pass row
+ * tokenizer with exact fixed-point field parsing, and the row formatter
+ * (amounts with MONEY_DECIMALS, rates with RATE_DECIMALS).
+ *
+ * The row layout is detected once per file from its header (or first row);
+ * rows whose field count matches the other layout are still accepted, so
+ * files that mix legacy and new rows keep working. */
+
+typedef enum {
+    CSV_FMT_UNKNOWN = 0,
+    CSV_FMT_V2,         /* 12 fields: date,time,tx_id,from,to,... */
+    CSV_FMT_LEGACY      /* 11 fields: no tx_id */
+} CsvFormat;
+
+/* Layout implied by a header or data line. */
+CsvFormat codec_detect_format(const char *line, size_t len);
+
+/* Parse one line in place (commas are overwritten). `expect` is the file's
+   layout or CSV_FMT_UNKNOWN. Returns 1 on success, 0 if malformed. */
+int codec_parse_row(char *line, size_t len, CsvFormat expect, CsvRow *row);
+
+/* Format a row (with trailing '\n') into out; returns its length or -1 if
+   it does not fit. */
+int codec_format_row(char *out, size_t cap, const char *date_text, const char *time_text, int tx_id,
+                     const char *from_code, const char *to_code,
+                     Money amt_from, Money amt_to,
+                     Rate rate_from_loc, Rate rate_to_loc,
+                     int partial, Money remainder_loc, Money profit_loc_delta);
+
+/* Buffered reader over one sales file. Each reader owns one buffer; rows
+   are returned without per-row allocation. A day whose file was compacted
+   away is read from its monthly archive, decoded in memory. */
+typedef struct {
+    int fd;              /* -1 for an archived day */
+    char *mem;           /* archived day's CSV text, or NULL */
+    size_t mem_len;
+    size_t mem_pos;
+    char *buf;
+    size_t cap;
+    size_t start;        /* first unread byte in buf */
+    size_t end;          /* bytes of valid data in buf */
+    long buf_off;        /* file offset of buf[0] */
+    int eof;
+    int skipping;        /* inside a line longer than the buffer */
+    size_t tail_bytes;   /* unterminated bytes left at end of file */
+    CsvFormat fmt;
+    long rows;           /* rows returned by csv_reader_next */
+    long malformed;      /* lines skipped by csv_reader_next */
+    long bytes;          /* bytes read from the file */
+} CsvReader;
+
+/* Open a sales file, detect its layout from the first line and position the
+   reader after it. A missing sales_<date>.csv is looked up in the archives.
+   Returns 0, or -1 with errno set (ENOENT if the day has no rows anywhere). */
+int csv_reader_open(CsvReader *r, const char *fname);
+/* Position at the first line starting at or after `offset` (> 0). */
+int csv_reader_seek_line(CsvReader *r, long offset);
+/* Position exactly at `offset`, which must be a line start. */
+int csv_reader_seek(CsvReader *r, long offset);
+/* File offset of the next unread line. */
+long csv_reader_tell(const CsvReader *r);
+
+/* Next complete line (terminated by '\n', which is replaced by '\0').
+   A trailing line without newline is treated as not yet written.
+   Returns 1 with line/len/offset set, 0 at end. */
+int csv_reader_next_line(CsvReader *r, char **line, size_t *len, long *offset);
+/* Next well-formed row; malformed lines are counted and skipped. */
+int csv_reader_next(CsvReader *r, CsvRow *row, long *offset);
+void csv_reader_close(CsvReader *r);
+
+#endif /* CODEC_H */
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+
+#include "currency.h"
+#include "diag.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#define HASH_BITS 9                     /* 512 slots: at most half full */
+#define HASH_SLOTS (1u << HASH_BITS)
+
+/* Same format as a config file; used when there is none. */
+static const char BUILTIN[] =
+    "# code  buy        sell       reserve  critical  note_min  denominations\n"
+    "LOC     1.000000   1.000000     50000     10000        10  200 100 50 20 10 5 2 1 0.50 0.20 0.10 0.05 0.02 0.01\n"
+    "USD    41.360000  41.450000     10000      2000         1  100 50 20 10 5 2 1 0.25 0.10 0.05 0.01\n"
+    "EUR    48.380000  48.600000      8000      1500         5  500 200 100 50 20 10 5 2 1 0.50 0.20 0.10 0.05 0.02 0.01\n"
+    "GBP    55.910000  56.260000      3000       500         5  50 20 10 5 2 1 0.50 0.20 0.10 0.05 0.02 0.01\n"
+    "JPY     0.270000   0.280000   1000000    200000      1000  10000 5000 2000 1000 500 100 50 10 5 1\n";
+
+Currency *currencies = NULL;
+int cur_count = 0;
+
+static uint64_t slot_key[HASH_SLOTS];   /* packed code, 0 = empty */
+static uint8_t slot_idx[HASH_SLOTS];
+static uint32_t fingerprint;
+
+/* Up to 7 letters/digits, upper-cased, one per byte; 0 if not a valid code. */
+static uint64_t pack_code(const char *code) {
+    uint64_t key = 0;
+    int i = 0;
+    for (; code[i]; ++i) {
+        unsigned char ch = (unsigned char)code[i];
+        if (i == MAX_NAME - 1 || !isalnum(ch)) return 0;
+        key |= (uint64_t)toupper(ch) << (8 * i);
+    }
+    return key;
+}
+
+static unsigned slot_of(uint64_t key) {
+    return (unsigned)((key * 0x9E3779B97F4A7C15ULL) >> (64 - HASH_BITS));
+}
+
+static void hash_build(void) {
+    memset(slot_key, 0, sizeof(slot_key));
+    fingerprint = 2166136261u;
+    for (int i = 0; i < cur_count; ++i) {
+        for (const char *p = currencies[i].name; ; ++p) {
+            fingerprint = (fingerprint ^ (unsigned char)*p) * 16777619u;
+            if (!*p) break;
+        }
+        uint64_t key = pack_code(currencies[i].name);
+        unsigned h = slot_of(key);
+        while (slot_key[h]) h = (h + 1) & (HASH_SLOTS - 1);
+        slot_key[h] = key;
+        slot_idx[h] = (uint8_t)i;
+    }
+}
+
+uint32_t currency_fingerprint(void) {
+    return fingerprint;
+}
+
+int currency_from_code(const char *code) {
+    char *end;
+    long idx = strtol(code, &end, 10);
+    if (end != code && *end == '\0')
+        return (idx >= 0 && idx < cur_count) ? (int)idx : -1;
+    uint64_t key = pack_code(code);
+    if (!key) return -1;
+    for (unsigned h = slot_of(key);; h = (h + 1) & (HASH_SLOTS - 1)) {
+        if (slot_key[h] == key) return slot_idx[h];
+        if (slot_key[h] == 0) return -1;
+    }
+}
+
+/* Opening stock: the balance spread evenly over the denominations, with
+   what does not divide evenly paid in the largest pieces that fit. */
+static void opening_stock(Money bal, const Money *den, int n, long *stock) {
+    Money share = bal / n, left = bal;
+    for (int i = 0; i < n; ++i) {
+        Money k = share / den[i];
+        if (k > left / den[i]) k = left / den[i];
+        stock[i] = (long)k;
+        left -= k * den[i];
+    }
+    for (int i = 0; i < n; ++i) {
+        stock[i] += (long)(left / den[i]);
+        left %= den[i];
+    }
+}
+
+static int parse_fixed(const char *s, int decimals, int64_t max, int64_t *out) {
+    return s && fixed_parse(s, s + strlen(s), decimals, out) == 1 && *out >= 0 && *out <= max;
+}
+
+/* Fill c from one config line (comment already cut off). Returns NULL or
+   the reason the line was rejected. */
+static const char *parse_currency(char *line, Currency *c) {
+    char *save = NULL;
+    const char *code = strtok_r(line, " \t\r\n", &save);
+    if (!pack_code(code) || !isalpha((unsigned char)code[0]))
+        return "code must be 1-7 letters or digits, starting with a letter";
+    for (int i = 0; code[i]; ++i) c->name[i] = (char)toupper((unsigned char)code[i]);
+
+    Money bal, note_min;
+    if (!parse_fixed(strtok_r(NULL, " \t\r\n", &save), RATE_DECIMALS, RATE_MAX, &c->buy_to_loc) ||
+        !parse_fixed(strtok_r(NULL, " \t\r\n", &save), RATE_DECIMALS, RATE_MAX, &c->sell_to_loc) ||
+        c->buy_to_loc == 0 || c->sell_to_loc == 0)
+        return "buy and sell rates must be positive with at most 6 decimals";
+    if (!parse_fixed(strtok_r(NULL, " \t\r\n", &save), MONEY_DECIMALS, MONEY_MAX, &bal) ||
+        !parse_fixed(strtok_r(NULL, " \t\r\n", &save), MONEY_DECIMALS, MONEY_MAX, &c->critical_min) ||
+        !parse_fixed(strtok_r(NULL, " \t\r\n", &save), MONEY_DECIMALS, MONEY_MAX, &note_min))
+        return "reserve, critical minimum and note minimum must be amounts with at most 2 decimals";
+
+    Money den[TILL_MAX_DENOMS];
+    int n = 0;
+    for (const char *tok; (tok = strtok_r(NULL, " \t\r\n", &save)) != NULL; ++n) {
+        if (n == TILL_MAX_DENOMS) return "too many denominations";
+        if (!parse_fixed(tok, MONEY_DECIMALS, MONEY_MAX, &den[n]) || den[n] == 0 ||
+            (n > 0 && den[n] >= den[n-1]))
+            return "denominations must be positive amounts, largest first";
+    }
+    if (n == 0) return "no denominations";
+
+    long stock[TILL_MAX_DENOMS];
+    c->start_bal = bal;
+    c->bal = bal;
+    c->note_min = note_min;
+    opening_stock(bal, den, n, stock);
+    if (till_init(&c->till, den, n, stock) != 0) return "could not set up the till";
+    return NULL;
+}
+
+static void free_list(Currency *list, int n) {
+    for (int i = 0; i < n; ++i) till_free(&list[i].till);
+    free(list);
+}
+
+int currency_load(const char *path) {
+    if (!path && access(CURRENCY_FILE, F_OK) == 0) path = CURRENCY_FILE;
+    const char *src = path ? path : "built-in currencies";
+    FILE *f = path ? fopen(path, "r") : fmemopen((void *)BUILTIN, sizeof(BUILTIN) - 1, "r");
+    if (!f) {
+        diag("Could not open %s: %s", src, strerror(errno));
+        return -1;
+    }
+    Currency *list = calloc(MAX_CUR, sizeof(Currency));
+    if (!list) {
+        diag("Memory allocation failed for currencies!");
+        fclose(f);
+        return -1;
+    }
+
+    char line[1024];
+    int n = 0, lineno = 0;
+    const char *why = NULL;
+    while (!why && fgets(line, sizeof(line), f)) {
+        ++lineno;
+        if (!strchr(line, '\n') && !feof(f)) {
+            why = "line too long";
+            break;
+        }
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        if (line[strspn(line, " \t\r\n")] == '\0') continue;
+        if (n == MAX_CUR) {
+            why = "too many currencies";
+            break;
+        }
+        why = parse_currency(line, &list[n]);
+        if (why) break;
+        ++n;
+        if (n == 1 && (strcmp(list[0].name, "LOC") != 0 || list[0].buy_to_loc != RATE_SCALE ||
+                       list[0].sell_to_loc != RATE_SCALE))
+            why = "the first currency must be LOC with both rates 1";
+        for (int i = 0; !why && i < n - 1; ++i)
+            if (strcmp(list[i].name, list[n-1].name) == 0) why = "duplicate currency code";
+    }
+    fclose(f);
+    if (!why && n == 0) why = "no currencies";
+    if (why) {
+        diag("%s:%d: %s", src, lineno, why);
+        free_list(list, n);
+        return -1;
+    }
+
+    Currency *fit = realloc(list, (size_t)n * sizeof(Currency));
+    currency_free();
+    currencies = fit ? fit : list;
+    cur_count = n;
+    hash_build();
+    return 0;
+}
+
+void currency_free(void) {
+    if (currencies) free_list(currencies, cur_count);
+    currencies = NULL;
+    cur_count = 0;
+    memset(slot_key, 0, sizeof(slot_key));
+}
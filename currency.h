@@ -0,0 +1,57 @@
+#ifndef CURRENCY_H
+#define CURRENCY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "money.h"
+#include "till.h"
+
+/* Currency registry.
+ *
+ * The currencies are loaded once at startup, from a config file or the
+ * built-in defaults, into one contiguous array; LOC, in which every rate is
+ * quoted, is always index 0. Codes resolve to indexes through an
+ * open-addressing hash keyed by the code packed into 64 bits, so a lookup
+ * is one multiply and usually one compare, however many currencies there are.
+ *
+ * Config format, one currency per line ('#' starts a comment):
+ *
+ *   code  buy  sell  reserve  critical_min  note_min  denominations...
+ *
+ * Rates are LOC per unit, amounts are in units, denominations are listed
+ * largest first and those >= note_min are notes. The first line is LOC
+ * with both rates 1. */
+
+#define MAX_CUR 255          /* indexes fit a uint8 column; 0xFF is "unknown" */
+#define MAX_NAME 8
+#define CUR_LOC 0
+#define CURRENCY_FILE "currencies.conf"
+
+typedef struct {
+    char name[MAX_NAME];
+    Rate buy_to_loc;
+    Rate sell_to_loc;
+    _Atomic Money bal;      /* reserve; read by server BAL replies without a lock */
+    Money critical_min;
+    Money start_bal;
+    Money note_min;         /* smallest denomination that is a note */
+    Till till;              /* notes and coins in the drawer */
+} Currency;
+
+extern Currency *currencies;
+extern int cur_count;
+
+/* Load the registry from `path`; with NULL, from CURRENCY_FILE if present,
+   else the built-in defaults. Replaces any registry loaded before.
+   Returns 0, or -1 with the offending line reported through diag(). */
+int currency_load(const char *path);
+void currency_free(void);
+
+/* FNV-1a of the codes in registry order; files holding per-currency
+   figures store it to notice a different registry. */
+uint32_t currency_fingerprint(void);
+
+/* Currency index for a code ("USD", case-insensitive) or index ("1"); -1 if unknown. */
+int currency_from_code(const char *code);
+
+#endif /* CURRENCY_H */
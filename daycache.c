@@ -0,0 +1,394 @@
+#define _GNU_SOURCE
+
+#include "daycache.h"
+#include "codec.h"
+#include "journal.h"
+#include "metrics.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define NO_CUR 0xFF
+/* ts, amounts, rates, remainder, profit; tx_id; from, to, partial */
+#define ROW_BYTES (7 * sizeof(int64_t) + sizeof(int32_t) + 3)
+
+typedef struct Day {
+    char date[11];
+    int exact;                  /* every line re-formats to itself */
+    int64_t bytes;              /* file bytes held, up to the end of a line */
+    dev_t dev;
+    ino_t ino;
+    uint64_t used;              /* LRU stamp */
+    size_t rows, cap;
+    void *arena;                /* cap rows of every column */
+    int64_t *ts;
+    Money *amount_from, *amount_to, *remainder, *profit;
+    Rate *rate_from, *rate_to;
+    int32_t *tx_id;
+    uint8_t *from, *to, *partial;
+    uint32_t *slot;             /* tx id table: row + 1, 0 = empty */
+    uint32_t slot_bits;
+    size_t mem;
+    struct Day *next;
+} Day;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Day *days;
+static size_t budget = (size_t)DAYCACHE_BUDGET_MB << 20;
+static size_t held;
+static uint64_t tick;
+static DayCacheStats counts;
+
+static void day_free(Day *d) {
+    held -= d->mem;
+    free(d->arena);
+    free(d->slot);
+    free(d);
+}
+
+static void unlink_day(Day *d) {
+    for (Day **p = &days; *p; p = &(*p)->next)
+        if (*p == d) {
+            *p = d->next;
+            return;
+        }
+}
+
+/* Drop least recently used days other than the current one until the
+   cache fits its budget. */
+static void trim(void) {
+    while (held > budget) {
+        Day *lru = NULL;
+        for (Day *d = days; d; d = d->next)
+            if (strncmp(d->date, current_date, 10) != 0 && (!lru || d->used < lru->used)) lru = d;
+        if (!lru) return;
+        unlink_day(lru);
+        day_free(lru);
+        counts.evictions++;
+    }
+}
+
+static uint32_t slot_of(const Day *d, int32_t id) {
+    return ((uint32_t)id * 2654435761u) >> (32 - d->slot_bits);
+}
+
+/* First row with the id wins, as a scan of the file would find it. */
+static void slot_put(Day *d, size_t row) {
+    uint32_t mask = (1u << d->slot_bits) - 1;
+    for (uint32_t h = slot_of(d, d->tx_id[row]);; h = (h + 1) & mask) {
+        if (d->slot[h] == 0) {
+            d->slot[h] = (uint32_t)row + 1;
+            return;
+        }
+        if (d->tx_id[d->slot[h] - 1] == d->tx_id[row]) return;
+    }
+}
+
+/* Room for at least one more row: a bigger arena, the columns copied over
+   and the id table rebuilt at twice the rows. Returns 0 or -1. */
+static int grow(Day *d) {
+    size_t cap = d->cap ? d->cap * 2 : 256;
+    uint32_t bits = d->slot_bits ? d->slot_bits + 1 : 9;
+    char *a = malloc(cap * ROW_BYTES);
+    uint32_t *slot = calloc((size_t)1 << bits, sizeof(*slot));
+    if (!a || !slot) {
+        free(a);
+        free(slot);
+        return -1;
+    }
+    Day old = *d;
+    char *p = a;
+#define COLUMN(name, type) \
+    d->name = (type *)p; \
+    if (old.rows) memcpy(p, old.name, old.rows * sizeof(type)); \
+    p += cap * sizeof(type)
+    COLUMN(ts, int64_t);
+    COLUMN(amount_from, Money);
+    COLUMN(amount_to, Money);
+    COLUMN(remainder, Money);
+    COLUMN(profit, Money);
+    COLUMN(rate_from, Rate);
+    COLUMN(rate_to, Rate);
+    COLUMN(tx_id, int32_t);
+    COLUMN(from, uint8_t);
+    COLUMN(to, uint8_t);
+    COLUMN(partial, uint8_t);
+#undef COLUMN
+    free(old.arena);
+    free(old.slot);
+    d->arena = a;
+    d->cap = cap;
+    d->slot = slot;
+    d->slot_bits = bits;
+    for (size_t i = 0; i < d->rows; ++i) slot_put(d, i);
+    held -= d->mem;
+    d->mem = sizeof(*d) + cap * ROW_BYTES + ((size_t)1 << bits) * sizeof(*slot);
+    held += d->mem;
+    return 0;
+}
+
+/* The wall-clock date and time as seconds, the way the segments store them. */
+static int64_t wall_seconds(const char *date, const char *time_text) {
+    struct tm tm = { 0 };
+    if (sscanf(date, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3) return 0;
+    sscanf(time_text, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return (int64_t)timegm(&tm);
+}
+
+/* Row i as its CSV line (with '\n'). Returns the length or -1. */
+static int format_row(const Day *d, size_t i, char *out, size_t cap) {
+    char date[16], time_text[16];
+    time_t t = (time_t)d->ts[i];
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+    strftime(time_text, sizeof(time_text), "%H:%M:%S", &tm);
+    if (d->from[i] == NO_CUR || d->to[i] == NO_CUR) return -1;
+    return codec_format_row(out, cap, date, time_text, d->tx_id[i], currencies[d->from[i]].name,
+                            currencies[d->to[i]].name, d->amount_from[i], d->amount_to[i],
+                            d->rate_from[i], d->rate_to[i], d->partial[i], d->remainder[i], d->profit[i]);
+}
+
+/* Take one line of the file (without its '\n'). */
+static int add_line(Day *d, const char *line, size_t len, CsvFormat fmt) {
+    if (len == 0 || (len == 1 && line[0] == '\r')) return 0;
+    char buf[512];
+    CsvRow row;
+    if (len >= sizeof(buf)) {
+        d->exact = 0;
+        return 0;
+    }
+    memcpy(buf, line, len);
+    buf[len] = '\0';
+    if (!codec_parse_row(buf, len, fmt, &row)) {
+        d->exact = 0;                   /* listed as it stands by the file path */
+        metrics_add(MET_PARSE_FAILURES, 1);
+        return 0;
+    }
+    if (d->rows == d->cap && grow(d) != 0) return -1;
+    int from = currency_from_code(row.from), to = currency_from_code(row.to);
+    size_t i = d->rows++;
+    d->ts[i] = wall_seconds(row.date, row.time);
+    d->amount_from[i] = row.amount_from;
+    d->amount_to[i] = row.amount_to;
+    d->remainder[i] = row.remainder_loc;
+    d->profit[i] = row.profit_loc;
+    d->rate_from[i] = row.rate_from_loc;
+    d->rate_to[i] = row.rate_to_loc;
+    d->tx_id[i] = row.has_tx_id ? row.tx_id : 0;
+    d->from[i] = from < 0 ? NO_CUR : (uint8_t)from;
+    d->to[i] = to < 0 ? NO_CUR : (uint8_t)to;
+    d->partial[i] = row.partial != 0;
+    if (row.has_tx_id) slot_put(d, i);
+    if (d->exact) {
+        char again[512];
+        int n = format_row(d, i, again, sizeof(again));
+        d->exact = n == (int)len + 1 && memcmp(again, line, len) == 0;
+    }
+    return 0;
+}
+
+static void reset(Day *d) {
+    d->rows = 0;
+    d->bytes = 0;
+    d->exact = 1;
+    if (d->slot) memset(d->slot, 0, ((size_t)1 << d->slot_bits) * sizeof(*d->slot));
+}
+
+/* Bring a day in line with its file. Returns 0, or -1 if the file is
+   missing (archived days are not cached) or cannot be read. */
+static int sync_file(Day *d) {
+    char fname[128];
+    make_daily_csv_name(d->date, fname, sizeof(fname));
+    struct stat st;
+    if (stat(fname, &st) != 0) return -1;
+    int known = d->ino == st.st_ino && d->dev == st.st_dev;
+    if (known && (int64_t)st.st_size == d->bytes) return 0;
+    if (!known || (int64_t)st.st_size < d->bytes) reset(d);
+
+    CsvReader rd;
+    if (csv_reader_open(&rd, fname) != 0) return -1;
+    if (d->bytes > 0 && csv_reader_seek(&rd, (long)d->bytes) != 0) {
+        csv_reader_close(&rd);
+        return -1;
+    }
+    if (d->bytes > 0) counts.extends++;
+    char *line;
+    size_t len;
+    long off, rows = 0;
+    int rc = 0;
+    while (rc == 0 && csv_reader_next_line(&rd, &line, &len, &off)) {
+        rc = add_line(d, line, len, rd.fmt);
+        rows++;
+    }
+    d->bytes = csv_reader_tell(&rd);
+    d->dev = st.st_dev;
+    d->ino = st.st_ino;
+    metrics_add(MET_ROWS_READ, rows);
+    metrics_add(MET_BYTES_READ, (long)rd.bytes);
+    csv_reader_close(&rd);
+    return rc;
+}
+
+/* The day, read in if needed and `load` allows; NULL if not cached.
+   Called with the lock held. */
+static Day *day_get(const char *date_text, int load) {
+    Day *d = days;
+    while (d && strcmp(d->date, date_text) != 0) d = d->next;
+    if (!d) {
+        if (!load || budget == 0 || strlen(date_text) != 10) return NULL;
+        if (!(d = calloc(1, sizeof(*d)))) return NULL;
+        memcpy(d->date, date_text, 10);
+        d->exact = 1;
+        d->mem = sizeof(*d);
+        held += d->mem;
+        d->next = days;
+        days = d;
+    } else {
+        counts.hits++;
+    }
+    int fresh = d->rows == 0 && d->bytes == 0;
+    if (sync_file(d) != 0) {
+        unlink_day(d);
+        day_free(d);
+        return NULL;
+    }
+    counts.loads += fresh;
+    d->used = ++tick;
+    return d;
+}
+
+void daycache_set_budget(size_t bytes) {
+    pthread_mutex_lock(&lock);
+    budget = bytes;
+    trim();
+    if (budget == 0)
+        while (days) {
+            Day *d = days;
+            days = d->next;
+            day_free(d);
+        }
+    pthread_mutex_unlock(&lock);
+}
+
+void daycache_stats(DayCacheStats *out) {
+    pthread_mutex_lock(&lock);
+    *out = counts;
+    out->days = 0;
+    out->rows = 0;
+    for (const Day *d = days; d; d = d->next) {
+        out->days++;
+        out->rows += (long)d->rows;
+    }
+    out->bytes = held;
+    out->budget = budget;
+    pthread_mutex_unlock(&lock);
+}
+
+void daycache_clear(void) {
+    pthread_mutex_lock(&lock);
+    while (days) {
+        Day *d = days;
+        days = d->next;
+        day_free(d);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void daycache_note_row(const char *date_text, const char *line, size_t len, long offset) {
+    pthread_mutex_lock(&lock);
+    Day *d = days;
+    while (d && strncmp(d->date, date_text, 10) != 0) d = d->next;
+    if (d) {
+        if (d->bytes == (int64_t)offset && len > 0 && add_line(d, line, len - 1, CSV_FMT_UNKNOWN) == 0) {
+            d->bytes += (int64_t)len;
+        } else {
+            unlink_day(d);              /* out of step: read it again when asked */
+            day_free(d);
+        }
+        trim();
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int daycache_list(const char *date_text, RowEmit emit, void *ctx) {
+    journal_flush();
+    pthread_mutex_lock(&lock);
+    Day *d = day_get(date_text, 1);
+    if (!d || !d->exact) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    char line[512];
+    for (size_t i = 0; i < d->rows; ++i) {
+        int n = format_row(d, i, line, sizeof(line));
+        if (n <= 0) continue;
+        line[n - 1] = '\0';
+        emit(line, ctx);
+    }
+    int n = (int)d->rows;
+    trim();
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+int daycache_find(const char *date_text, int tx_id, int load, char *line, size_t cap) {
+    journal_flush();
+    pthread_mutex_lock(&lock);
+    Day *d = day_get(date_text, load);
+    int found = -1;
+    if (d && d->exact) {
+        found = 0;
+        uint32_t mask = (1u << d->slot_bits) - 1;
+        for (uint32_t h = d->slot ? slot_of(d, tx_id) : 0; d->slot && d->slot[h]; h = (h + 1) & mask) {
+            size_t i = d->slot[h] - 1;
+            if (d->tx_id[i] != tx_id) continue;
+            int n = format_row(d, i, line, cap);
+            if (n > 0) line[n - 1] = '\0';
+            found = n > 0 ? 1 : -1;
+            break;
+        }
+    }
+    trim();
+    pthread_mutex_unlock(&lock);
+    return found;
+}
+
+int daycache_summary(const char *date_text, int load, DaySummary *out) {
+    journal_flush();
+    pthread_mutex_lock(&lock);
+    Day *d = day_get(date_text, load);
+    if (d) {
+        memset(out, 0, sizeof(*out));
+        out->tx_count = (long)d->rows;
+        for (size_t i = 0; i < d->rows; ++i) {
+            out->profit += d->profit[i];
+            if (d->from[i] != NO_CUR) out->vol_in[d->from[i]] += d->amount_from[i];
+            if (d->to[i] != NO_CUR) out->vol_out[d->to[i]] += d->amount_to[i];
+        }
+    }
+    trim();
+    pthread_mutex_unlock(&lock);
+    return d ? 0 : -1;
+}
+
+int daycache_rollup(const char *date_text, int load, Rollup *out) {
+    journal_flush();
+    pthread_mutex_lock(&lock);
+    Day *d = day_get(date_text, load);
+    int ok = d && d->exact;             /* hours come from the time column */
+    if (ok) {
+        rollup_init(out);
+        for (size_t i = 0; i < d->rows; ++i)
+            rollup_add(out, d->from[i], d->to[i], (int)(d->ts[i] % 86400 / 3600), d->amount_from[i],
+                       d->amount_to[i], d->rate_from[i], d->partial[i], d->profit[i]);
+    }
+    trim();
+    pthread_mutex_unlock(&lock);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,63 @@
+#ifndef DAYCACHE_H
+#define DAYCACHE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "utils.h"
+#include "daysum.h"
+#include "rollup.h"
+
+/* Session cache of whole days of sales rows.
+ *
+ * A day is read from its sales file once and kept as columns in one arena:
+ * wall-clock date+time as seconds since the epoch (as in the segments),
+ * one-byte registry indexes for the currencies, fixed-point amounts and
+ * rates, and the tx id with an open-addressing table over it. Listing a
+ * day, finding a tx id in it and the end-of-day report are then served
+ * from memory; the write path appends each row it logs to a cached day,
+ * and a file that grew some other way (another process) is read from
+ * where the cache stopped. A file that shrank or was replaced is read
+ * again from the start.
+ *
+ * Listing and lookups print rows re-formatted from the columns, so a day
+ * is only used for them when every line of its file re-formats to itself
+ * (files written by this program); other days fall back to the file.
+ *
+ * The cache holds at most the budget (DAYCACHE_BUDGET_MB by default,
+ * --day-cache); beyond it the least recently used days are dropped, never
+ * the current day. Budget 0 turns it off. All calls may come from any
+ * thread. */
+
+#define DAYCACHE_BUDGET_MB 64
+
+typedef struct {
+    int days;
+    long rows;
+    size_t bytes;
+    size_t budget;
+    long hits;                  /* served from a cached day */
+    long loads;                 /* days read in */
+    long extends;               /* cached days caught up with a grown file */
+    long evictions;
+} DayCacheStats;
+
+void daycache_set_budget(size_t bytes);
+void daycache_stats(DayCacheStats *out);
+void daycache_clear(void);
+
+/* The write path: row `line` (len bytes, with '\n') was appended at
+   `offset` of the date's file. Only days already cached are touched. */
+void daycache_note_row(const char *date_text, const char *line, size_t len, long offset);
+
+/* Pass the day's rows to emit as csv_list_transactions_for_date does.
+   Returns the rows, or -1 if the day cannot be served from memory. */
+int daycache_list(const char *date_text, RowEmit emit, void *ctx);
+/* The row of tx_id in the day as its CSV line (no newline). With load 0
+   only a day already cached is used. Returns 1 if found, 0 if the day has
+   no such row, -1 if the day cannot be served from memory. */
+int daycache_find(const char *date_text, int tx_id, int load, char *line, size_t cap);
+/* The day's summary and rollup. Returns 0, or -1 if not served. */
+int daycache_summary(const char *date_text, int load, DaySummary *out);
+int daycache_rollup(const char *date_text, int load, Rollup *out);
+
+#endif /* DAYCACHE_H */
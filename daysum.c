@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+
+#include "daysum.h"
+#include "diag.h"
+#include "segment.h"
+#include "journal.h"
+#include "codec.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SUM_MAGIC "EXSUM02"
+#define SUM_TAIL 64          /* bytes before the covered offset that must not change */
+
+typedef struct {
+    char magic[8];
+    int64_t src_size;        /* CSV bytes folded into the summary (complete lines only) */
+    int64_t file_size;       /* CSV size and mtime when the sidecar was written */
+    int64_t file_mtime;
+    uint64_t tail_hash;      /* FNV-1a of the SUM_TAIL bytes ending at src_size */
+    int64_t tx_count;
+    int64_t profit;          /* minor units */
+    uint32_t ncur;
+    uint32_t registry;       /* currency_fingerprint() the volumes were keyed by */
+} SumHeader;
+
+typedef struct {
+    char code[8];
+    int64_t vol_in;
+    int64_t vol_out;
+} SumCurrency;
+
+void make_summary_name(const char *date_text, char *out, size_t cap) {
+    snprintf(out, cap, "%.4s/%.2s/sales_%s.sum", date_text, date_text + 5, date_text);
+}
+
+void day_summary_add_row(DaySummary *s, const CsvRow *row) {
+    int from = currency_from_code(row->from);
+    int to = currency_from_code(row->to);
+    s->tx_count++;
+    s->profit += row->profit_loc;
+    if (from >= 0) s->vol_in[from] += row->amount_from;
+    if (to >= 0) s->vol_out[to] += row->amount_to;
+}
+
+uint64_t day_file_tail_hash(int fd, int64_t end) {
+    unsigned char buf[SUM_TAIL];
+    int64_t start = end > SUM_TAIL ? end - SUM_TAIL : 0;
+    ssize_t n = end > start ? pread(fd, buf, (size_t)(end - start), start) : 0;
+    uint64_t h = 1469598103934665603ULL;
+    for (ssize_t i = 0; i < n; ++i) {
+        h ^= buf[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int load_sidecar(const char *date_text, SumHeader *h, DaySummary *s) {
+    char fname[128];
+    make_summary_name(date_text, fname, sizeof(fname));
+    FILE *f = fopen(fname, "rb");
+    if (!f) return -1;
+    metrics_add(MET_FILES_OPENED, 1);
+    int ok = fread(h, sizeof(*h), 1, f) == 1 && memcmp(h->magic, SUM_MAGIC, sizeof(SUM_MAGIC)) == 0 &&
+             h->registry == currency_fingerprint();
+    memset(s, 0, sizeof(*s));
+    if (ok) {
+        s->tx_count = (long)h->tx_count;
+        s->profit = h->profit;
+        for (uint32_t i = 0; ok && i < h->ncur; ++i) {
+            SumCurrency c;
+            ok = fread(&c, sizeof(c), 1, f) == 1;
+            c.code[sizeof(c.code) - 1] = '\0';
+            int idx = ok ? currency_from_code(c.code) : -1;
+            if (idx >= 0) {
+                s->vol_in[idx] = c.vol_in;
+                s->vol_out[idx] = c.vol_out;
+            }
+        }
+    }
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+static void save_sidecar(const char *date_text, const SumHeader *h, const DaySummary *s) {
+    char fname[128], tmp[160];
+    make_summary_name(date_text, fname, sizeof(fname));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        diag("Could not create %s: %s", tmp, strerror(errno));
+        return;
+    }
+    SumHeader out = *h;
+    out.tx_count = s->tx_count;
+    out.profit = s->profit;
+    out.registry = currency_fingerprint();
+    out.ncur = 0;
+    for (int i = 0; i < cur_count; ++i) out.ncur += s->vol_in[i] != 0 || s->vol_out[i] != 0;
+    int ok = fwrite(&out, sizeof(out), 1, f) == 1;
+    for (int i = 0; ok && i < cur_count; ++i) {
+        if (s->vol_in[i] == 0 && s->vol_out[i] == 0) continue;   /* only traded currencies */
+        SumCurrency c;
+        memset(&c, 0, sizeof(c));
+        snprintf(c.code, sizeof(c.code), "%s", currencies[i].name);
+        c.vol_in = s->vol_in[i];
+        c.vol_out = s->vol_out[i];
+        ok = fwrite(&c, sizeof(c), 1, f) == 1;
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, fname) != 0) {
+        diag("Could not write %s: %s", fname, strerror(errno));
+        unlink(tmp);
+    }
+}
+
+/* Fold complete rows from byte `offset` onwards into `s`; returns the offset
+   after the last complete line. Offset 0 means just after the header. */
+static int64_t fold_csv_from(CsvReader *rd, int64_t offset, DaySummary *s) {
+    if (offset > 0 && csv_reader_seek(rd, (long)offset) != 0) return offset;
+    CsvRow row;
+    while (csv_reader_next(rd, &row, NULL)) day_summary_add_row(s, &row);
+    return csv_reader_tell(rd);         /* stops before a row still being written */
+}
+
+/* Start a fresh summary from the columnar segment when it covers a prefix
+   of the CSV; returns the number of CSV bytes it accounts for. */
+static int64_t fold_segment(const char *date_text, int fd, const struct stat *st, DaySummary *s) {
+    LedgerSegment seg;
+    if (segment_open(date_text, &seg) != 0) return 0;
+    int64_t covered = 0;
+    if (segment_covers(&seg, fd, st)) {
+        s->tx_count = (long)seg.rows;
+        s->profit = segment_sum_profit(&seg);   /* exact: integer sum */
+        for (size_t i = 0; i < seg.rows; ++i) {
+            uint8_t from = seg.cur_map[seg.from_cur[i]], to = seg.cur_map[seg.to_cur[i]];
+            if (from != SEG_NO_CUR) s->vol_in[from] += seg.amount_from[i];
+            if (to != SEG_NO_CUR) s->vol_out[to] += seg.amount_to[i];
+        }
+        covered = seg.hdr->src_size;
+    }
+    segment_close(&seg);
+    return covered;
+}
+
+int day_summary_get(const char *date_text, DaySummary *out) {
+    journal_flush();
+    memset(out, 0, sizeof(*out));
+
+    char csv_name[128];
+    make_daily_csv_name(date_text, csv_name, sizeof(csv_name));
+    CsvReader rd;
+    if (csv_reader_open(&rd, csv_name) != 0) return errno == ENOENT ? 0 : -1;
+    if (rd.mem) {                       /* archived day: closed, no sidecar */
+        fold_csv_from(&rd, 0, out);
+        csv_reader_close(&rd);
+        return 0;
+    }
+    int fd = rd.fd;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        csv_reader_close(&rd);
+        return -1;
+    }
+
+    SumHeader h;
+    DaySummary cached;
+    int64_t offset = 0;
+    if (load_sidecar(date_text, &h, &cached) == 0) {
+        if (h.file_size == (int64_t)st.st_size && h.file_mtime == (int64_t)st.st_mtime) {
+            csv_reader_close(&rd);
+            *out = cached;
+            return 0;
+        }
+        if (h.src_size <= (int64_t)st.st_size && day_file_tail_hash(fd, h.src_size) == h.tail_hash) {
+            *out = cached;                 /* rows were appended: extend */
+            offset = h.src_size;
+        }
+    }
+    if (offset == 0) offset = fold_segment(date_text, fd, &st, out);
+
+    offset = fold_csv_from(&rd, offset, out);
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SUM_MAGIC, sizeof(SUM_MAGIC));
+    h.src_size = offset;
+    h.file_size = (int64_t)st.st_size;
+    h.file_mtime = (int64_t)st.st_mtime;
+    h.tail_hash = day_file_tail_hash(fd, offset);
+    csv_reader_close(&rd);
+    save_sidecar(date_text, &h, out);
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef DAYSUM_H
+#define DAYSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "utils.h"
+
+/* Per-day summary sidecar, stored as sales_<date>.sum next to the CSV.
+ *
+ * The sidecar remembers how many CSV bytes it covers together with the CSV
+ * size and mtime at that point. It is reused as-is while the CSV is
+ * unchanged, extended from the covered offset when rows were appended, and
+ * recomputed from scratch otherwise. */
+
+typedef struct {
+    long tx_count;
+    Money profit;
+    Money vol_in[MAX_CUR];     /* amount_from received, per currency */
+    Money vol_out[MAX_CUR];    /* amount_to paid out, per currency */
+} DaySummary;
+
+void make_summary_name(const char *date_text, char *out, size_t cap);
+
+/* Fill `out` for a date, refreshing the sidecar if needed. A missing CSV
+   yields an empty summary. Returns 0 on success, -1 on read error. */
+int day_summary_get(const char *date_text, DaySummary *out);
+
+/* FNV-1a of the SUM_TAIL (64) bytes of a file ending at `end`; sidecars
+   store it to notice a file rewritten rather than appended to. */
+uint64_t day_file_tail_hash(int fd, int64_t end);
+
+/* Add the row's figures to a summary. */
+void day_summary_add_row(DaySummary *s, const CsvRow *row);
+
+#endif /* DAYSUM_H */
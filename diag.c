@@ -0,0 +1,23 @@
+#define _GNU_SOURCE
+
+#include "diag.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+static DiagSink sink_fn;
+static void *sink_ctx;
+
+void diag_set_sink(DiagSink sink, void *ctx) {
+    sink_fn = sink;
+    sink_ctx = ctx;
+}
+
+void diag(const char *fmt, ...) {
+    if (!sink_fn) return;
+    char msg[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    sink_fn(msg, sink_ctx);
+}
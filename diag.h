@@ -0,0 +1,21 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+/* Diagnostics of libexchange.
+ *
+ * The library writes nothing to the terminal. Warnings and I/O errors it
+ * meets along the way (a file it could not open, a damaged snapshot it
+ * skipped) go to a sink installed by the host, one line at a time without
+ * the newline; with no sink they are dropped. The calls that fail still
+ * report it by their return value. A sink may be called from the writer
+ * thread and server workers at the same time. */
+
+typedef void (*DiagSink)(const char *msg, void *ctx);
+
+/* Install the sink (NULL: drop messages). ctx is passed back. */
+void diag_set_sink(DiagSink sink, void *ctx);
+
+/* Format a message and hand it to the sink. */
+void diag(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif /* DIAG_H */
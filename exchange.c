@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+
+#include "exchange.h"
+#include "writer.h"
+#include "snapshot.h"
+#include "txid.h"
+#include "ratehist.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *const error_text[] = {
+    "ok", "invalid argument", "same currency", "reserve short", "till cannot pay",
+    "partial amount too large", "LOC remainder cannot be paid", "write failed"
+};
+
+const char *exchange_strerror(int err) {
+    if (err < 0 || err >= (int)(sizeof(error_text) / sizeof(error_text[0]))) return "unknown error";
+    return error_text[err];
+}
+
+/* Fill `why` (when given) and return err. */
+static int fail(char *why, size_t why_cap, int err, const char *fmt, ...) {
+    if (why && why_cap) {
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(why, why_cap, fmt, ap);
+        va_end(ap);
+    }
+    return err;
+}
+
+/* Clock */
+
+static ExchangeClock clock_fn;
+static void *clock_ctx;
+
+void exchange_set_clock(ExchangeClock clock, void *ctx) {
+    clock_fn = clock;
+    clock_ctx = ctx;
+}
+
+time_t exchange_now(void) {
+    return clock_fn ? clock_fn(clock_ctx) : time(NULL);
+}
+
+void exchange_clock_text(char *date_out, char *time_out) {
+    time_t t = exchange_now();
+    struct tm tm;
+    localtime_r(&t, &tm);
+    if (date_out) strftime(date_out, 11, "%Y-%m-%d", &tm);
+    if (time_out) strftime(time_out, 9, "%H:%M:%S", &tm);
+}
+
+/* Currency locks: an exchange holds those of its two currencies (and of
+   LOC for a partial payout) from its reserve and till checks until it has
+   moved the money, so two exchanges only wait on each other when they
+   share a currency. Locks are taken in currency-index order. */
+
+static pthread_mutex_t cur_lock[MAX_CUR];
+static pthread_once_t cur_lock_once = PTHREAD_ONCE_INIT;
+
+static void cur_lock_init(void) {
+    for (int i = 0; i < MAX_CUR; ++i) pthread_mutex_init(&cur_lock[i], NULL);
+}
+
+static void lock_currencies(int a, int b, int loc) {
+    pthread_once(&cur_lock_once, cur_lock_init);
+    for (int i = 0; i < cur_count; ++i)
+        if (i == a || i == b || (loc && i == CUR_LOC)) pthread_mutex_lock(&cur_lock[i]);
+}
+
+static void unlock_currencies(int a, int b, int loc) {
+    for (int i = 0; i < cur_count; ++i)
+        if (i == a || i == b || (loc && i == CUR_LOC)) pthread_mutex_unlock(&cur_lock[i]);
+}
+
+/* Exchanges */
+
+int exchange_quote(int from, int to, Money amt_from, ExchangeQuote *q, char *why, size_t why_cap) {
+    if (from < 0 || from >= cur_count || to < 0 || to >= cur_count || amt_from <= 0)
+        return fail(why, why_cap, EXCHANGE_EINVAL, "Unknown currency or amount not positive.");
+    if (from == to)
+        return fail(why, why_cap, EXCHANGE_ESAME, "From and To currencies are the same. Nothing to do.");
+
+    q->remainder_loc = 0;
+    q->amt_to = convert_via_local(from, to, amt_from, &q->rate_from_loc, &q->rate_to_loc, &q->profit_delta);
+    /* The LOC value, the payout and its LOC cost stay within MONEY_MAX, so
+       none of them saturated and the profit is exact. */
+    if (money_mul_rate(amt_from, q->rate_from_loc) > MONEY_MAX || q->amt_to > MONEY_MAX ||
+        money_mul_rate(q->amt_to, currencies[to].buy_to_loc) > MONEY_MAX) {
+        char a[32];
+        return fail(why, why_cap, EXCHANGE_EINVAL, "Exchange too large: a figure of it exceeds %s.",
+                    money_fmt(a, MONEY_MAX));
+    }
+
+    if (currencies[to].bal < q->amt_to) {
+        char a[32], b[32];
+        return fail(why, why_cap, EXCHANGE_ERESERVE, "Insufficient reserve of %s. Available: %s, Needed: %s",
+                    currencies[to].name, money_fmt(a, currencies[to].bal), money_fmt(b, q->amt_to));
+    }
+    /* Only a view of the till: exchange_commit checks again under the locks. */
+    Till *t = &currencies[to].till;
+    lock_currencies(to, to, 0);
+    if (till_plan(t, q->amt_to, &q->pay_to))
+        q->payable = q->amt_to;
+    else
+        q->payable = till_max_payable(t, q->amt_to, &q->pay_to);
+    unlock_currencies(to, to, 0);
+    if (q->payable != q->amt_to && (q->payable == 0 || to == CUR_LOC)) {
+        char a[32];
+        return fail(why, why_cap, EXCHANGE_ETILL,
+                    "The %s till cannot pay out %s with the notes and coins in stock.",
+                    currencies[to].name, money_fmt(a, q->amt_to));
+    }
+    return EXCHANGE_OK;
+}
+
+/* exchange_commit with the currency locks held: every check that the
+   money moves on is made again here, against the reserves and tills as
+   they are now. */
+static int commit_locked(int from, int to, Money amt_from, int partial, Money part_to,
+                         ExchangeQuote *q, char *why, size_t why_cap) {
+    if (partial) {
+        Money loc_value_total = money_mul_rate(amt_from, currencies[from].buy_to_loc);
+        Money loc_value_given_as_to = money_mul_rate(part_to, currencies[to].sell_to_loc);
+        if (loc_value_given_as_to > loc_value_total)
+            return fail(why, why_cap, EXCHANGE_EPARTIAL, "Chosen partial amount exceeds exchangeable value. Aborting.");
+        q->remainder_loc = loc_value_total - loc_value_given_as_to;
+        q->amt_to = part_to;
+        if (!till_plan(&currencies[to].till, part_to, &q->pay_to)) {
+            char a[32], b[32];
+            Payout near;
+            return fail(why, why_cap, EXCHANGE_ETILL,
+                        "The %s till cannot pay %s exactly; nearest payable amount is %s.",
+                        currencies[to].name, money_fmt(a, part_to),
+                        money_fmt(b, till_max_payable(&currencies[to].till, part_to, &near)));
+        }
+    } else if (q->payable != q->amt_to) {
+        char a[32];
+        return fail(why, why_cap, EXCHANGE_ETILL, "The %s till can pay at most %s of this exchange.",
+                    currencies[to].name, money_fmt(a, q->payable));
+    } else if (!till_plan(&currencies[to].till, q->amt_to, &q->pay_to)) {
+        char a[32];
+        return fail(why, why_cap, EXCHANGE_ETILL, "The %s till can no longer pay out %s exactly.",
+                    currencies[to].name, money_fmt(a, q->amt_to));
+    }
+    if (currencies[to].bal < q->amt_to) {
+        char a[32], b[32];
+        return fail(why, why_cap, EXCHANGE_ERESERVE, "Insufficient reserve of %s. Available: %s, Needed: %s",
+                    currencies[to].name, money_fmt(a, currencies[to].bal), money_fmt(b, q->amt_to));
+    }
+
+    if (partial) {
+        Money loc_after = currencies[CUR_LOC].bal + (from == CUR_LOC ? amt_from : 0) -
+                          (to == CUR_LOC ? q->amt_to : 0);
+        if (loc_after < q->remainder_loc) {
+            char a[32];
+            return fail(why, why_cap, EXCHANGE_ELOC,
+                        "Insufficient LOC reserve for partial payout remainder (need %s LOC).",
+                        money_fmt(a, q->remainder_loc));
+        }
+    }
+
+    /* An id for the row, so a committed exchange can always be numbered. */
+    if (txid_hold() != 0)
+        return fail(why, why_cap, EXCHANGE_EIO, "No transaction id could be leased.");
+
+    /* Take the payout out first so a LOC remainder is planned from what is left. */
+    if (till_remove(&currencies[to].till, &q->pay_to) != 0) {
+        txid_unhold();
+        return fail(why, why_cap, EXCHANGE_ETILL, "The %s till no longer holds the planned notes.",
+                    currencies[to].name);
+    }
+    memset(&q->pay_loc, 0, sizeof(q->pay_loc));
+    if (partial && q->remainder_loc > 0 &&
+        (!till_plan(&currencies[CUR_LOC].till, q->remainder_loc, &q->pay_loc) ||
+         till_remove(&currencies[CUR_LOC].till, &q->pay_loc) != 0)) {
+        char a[32];
+        till_add(&currencies[to].till, &q->pay_to);
+        txid_unhold();
+        return fail(why, why_cap, EXCHANGE_ELOC, "The LOC till cannot pay the remainder of %s exactly.",
+                    money_fmt(a, q->remainder_loc));
+    }
+
+    currencies[from].bal += amt_from;
+    currencies[to].bal   -= q->amt_to;
+    if (partial) currencies[CUR_LOC].bal -= q->remainder_loc;
+
+    Payout in;
+    till_split(&currencies[from].till, amt_from, &in);
+    till_add(&currencies[from].till, &in);
+    profit_loc += q->profit_delta;
+    return EXCHANGE_OK;
+}
+
+int exchange_commit(int from, int to, Money amt_from, int partial, Money part_to,
+                    ExchangeQuote *quote, char *why, size_t why_cap) {
+    ExchangeQuote x = *quote;               /* the caller's quote changes only on success */
+    lock_currencies(from, to, partial);
+    int rc = commit_locked(from, to, amt_from, partial, part_to, &x, why, why_cap);
+    unlock_currencies(from, to, partial);
+    if (rc == EXCHANGE_OK) *quote = x;
+    return rc;
+}
+
+int exchange_order(Order *o, ExchangeQuote *q, int *adjusted, char *why, size_t why_cap) {
+    int rc = exchange_quote(o->from, o->to, o->amount, q, why, why_cap);
+    if (rc != EXCHANGE_OK) return rc;
+    Till *t = &currencies[o->to].till;
+    Payout p;
+    int cut = 0;
+    if (!o->partial && q->payable < q->amt_to) {
+        o->partial = 1;
+        o->part_to = q->payable;
+        cut = 1;
+    } else if (o->partial && o->part_to <= q->amt_to) {
+        lock_currencies(o->to, o->to, 0);
+        if (!till_plan(t, o->part_to, &p)) {
+            o->part_to = till_max_payable(t, o->part_to, &p);
+            cut = 1;
+        }
+        unlock_currencies(o->to, o->to, 0);
+    }
+    if (o->partial && o->part_to > q->amt_to) {
+        char a[32], b[32];
+        return fail(why, why_cap, EXCHANGE_EPARTIAL, "partial amount %s exceeds payout %s",
+                    money_fmt(a, o->part_to), money_fmt(b, q->amt_to));
+    }
+    rc = exchange_commit(o->from, o->to, o->amount, o->partial, o->part_to, q, why, why_cap);
+    if (rc == EXCHANGE_OK && adjusted) *adjusted = cut;
+    return rc;
+}
+
+int exchange_record(int kind, int from, int to, Money amt_from, int partial,
+                    const ExchangeQuote *q, Transaction *t) {
+    WriterRecord r = {
+        .kind = kind,
+        .t = {
+            .id = txid_next(),
+            .from_cur = from,
+            .to_cur = to,
+            .amount_from = amt_from,
+            .amount_to = q->amt_to,
+            .rate = rate_of(q->amt_to, amt_from)
+        },
+        .rate_from_loc = q->rate_from_loc,
+        .rate_to_loc = q->rate_to_loc,
+        .partial = partial,
+        .remainder_loc = q->remainder_loc,
+        .profit_delta = q->profit_delta
+    };
+    if (r.t.id < 0) return -1;
+    snprintf(r.t.date, sizeof(r.t.date), "%.10s", current_date);
+    exchange_clock_text(NULL, r.t.time);
+    writer_push(&r);
+    if (t) *t = r.t;
+    return r.t.id;
+}
+
+int exchange_execute(int from, int to, Money amt_from, int partial, Money part_to,
+                     ExchangeQuote *q, int *tx_id, char *why, size_t why_cap) {
+    int rc = exchange_quote(from, to, amt_from, q, why, why_cap);
+    if (rc == EXCHANGE_OK) rc = exchange_commit(from, to, amt_from, partial, part_to, q, why, why_cap);
+    if (rc != EXCHANGE_OK) return rc;
+    int id = exchange_record(WRITER_EXCHANGE, from, to, amt_from, partial, q, NULL);
+    if (tx_id) *tx_id = id;
+    return EXCHANGE_OK;
+}
+
+/* Management */
+
+static int adjust_locked(int cur, Money delta, char *why, size_t why_cap) {
+    if (currencies[cur].bal + delta < 0)
+        return fail(why, why_cap, EXCHANGE_ERESERVE, "Operation would make reserve negative. Aborted.");
+    Till *t = &currencies[cur].till;
+    Payout p;
+    if (delta >= 0) {
+        till_split(t, delta, &p);
+        till_add(t, &p);
+    } else if (!till_plan(t, -delta, &p) || till_remove(t, &p) != 0) {
+        char b[32];
+        Payout near;
+        return fail(why, why_cap, EXCHANGE_ETILL,
+                    "The till cannot hand out exactly that amount (nearest: %s). Aborted.",
+                    money_fmt(b, till_max_payable(t, -delta, &near)));
+    }
+    currencies[cur].bal += delta;
+    if (snapshot_write() != 0) {        /* undo: the caller sees nothing changed */
+        currencies[cur].bal -= delta;
+        if (delta >= 0)
+            till_remove(t, &p);
+        else
+            till_add(t, &p);
+        return fail(why, why_cap, EXCHANGE_EIO, "The state snapshot could not be written; nothing changed.");
+    }
+    return EXCHANGE_OK;
+}
+
+int exchange_adjust_reserve(int cur, Money delta, char *why, size_t why_cap) {
+    if (cur < 0 || cur >= cur_count) return fail(why, why_cap, EXCHANGE_EINVAL, "Unknown currency.");
+    lock_currencies(cur, cur, 0);
+    int rc = adjust_locked(cur, delta, why, why_cap);
+    unlock_currencies(cur, cur, 0);
+    return rc;
+}
+
+int exchange_set_rates(int cur, Rate buy, Rate sell, char *why, size_t why_cap) {
+    if (cur < 0 || cur >= cur_count) return fail(why, why_cap, EXCHANGE_EINVAL, "Unknown currency.");
+    if (cur == CUR_LOC) return fail(why, why_cap, EXCHANGE_EINVAL, "LOC is the base currency; its rates stay 1.");
+    if (buy <= 0 || sell < buy) return fail(why, why_cap, EXCHANGE_EINVAL, "Rates must be > 0 with SELL >= BUY.");
+    lock_currencies(cur, cur, 0);
+    Rate old_buy = currencies[cur].buy_to_loc, old_sell = currencies[cur].sell_to_loc;
+    currencies[cur].buy_to_loc = buy;
+    currencies[cur].sell_to_loc = sell;
+    int history = ratehist_record(cur) == 0;
+    if (history && snapshot_write() == 0) {
+        unlock_currencies(cur, cur, 0);
+        return EXCHANGE_OK;
+    }
+    currencies[cur].buy_to_loc = old_buy;
+    currencies[cur].sell_to_loc = old_sell;
+    if (history) ratehist_record(cur);  /* the new rates were logged: log the old ones back */
+    unlock_currencies(cur, cur, 0);
+    return fail(why, why_cap, EXCHANGE_EIO, "The %s could not be written; the rates are unchanged.",
+                history ? "state snapshot" : "rate history");
+}
+
+int exchange_set_critical(int cur, Money min) {
+    if (cur < 0 || cur >= cur_count || min < 0) return EXCHANGE_EINVAL;
+    Money old = currencies[cur].critical_min;
+    currencies[cur].critical_min = min;
+    if (snapshot_write() == 0) return EXCHANGE_OK;
+    currencies[cur].critical_min = old;
+    return EXCHANGE_EIO;
+}
+
+int exchange_below_critical(int *out, int cap) {
+    int n = 0;
+    for (int i = 0; i < cur_count; ++i) {
+        if (currencies[i].bal >= currencies[i].critical_min) continue;
+        if (out && n < cap) out[n] = i;
+        ++n;
+    }
+    return n;
+}
+
+/* Queries and reports */
+
+int exchange_query(const char *spec, QueryEmit emit, void *ctx, QueryStats *st,
+                   char *why, size_t why_cap) {
+    Query q;
+    char reason[256];
+    query_init(&q);
+    if (query_parse(spec, &q, reason, sizeof(reason)) != 0)
+        return fail(why, why_cap, EXCHANGE_EINVAL, "%s", reason);
+    if (query_run(&q, emit, ctx, st) != 0)
+        return fail(why, why_cap, EXCHANGE_EIO, "The sales files could not be listed.");
+    return EXCHANGE_OK;
+}
+
+int exchange_report(const char *from_date, const char *to_date, int workers,
+                    DaySummary *sum, AggregateStats *st) {
+    if (strlen(from_date) != 10 || strlen(to_date) != 10 || strcmp(from_date, to_date) > 0)
+        return EXCHANGE_EINVAL;
+    return aggregate_range(from_date, to_date, workers, sum, st) == 0 ? EXCHANGE_OK : EXCHANGE_EIO;
+}
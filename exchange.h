@@ -0,0 +1,115 @@
+#ifndef EXCHANGE_H
+#define EXCHANGE_H
+
+#include <stddef.h>
+#include <time.h>
+#include "utils.h"
+#include "aggregate.h"
+#include "query.h"
+#include "diag.h"
+
+/* The exchange engine, as built into libexchange.
+ *
+ * Quotes, exchanges, reserve and rate management, queries and reports over
+ * the currency registry and the data root, without any terminal I/O: every
+ * call returns an ExchangeError and, where a caller may want to show it, a
+ * one-line reason in `why` (may be NULL). The menu, --batch and embedding
+ * services are clients of this API. Times of day come from a clock that
+ * can be replaced (tests, simulations, replays). Diagnostics along the way
+ * go to the host's sink (diag.h).
+ *
+ * The engine keeps its state in the registry (currencies[], profit_loc).
+ * Exchanges and reserve or rate changes may run from several threads: each
+ * locks only the currencies it touches; loading and snapshots need the
+ * caller to hold off other threads. */
+
+typedef enum {
+    EXCHANGE_OK = 0,
+    EXCHANGE_EINVAL,            /* bad currency, amount, rate or period */
+    EXCHANGE_ESAME,             /* from and to are the same currency */
+    EXCHANGE_ERESERVE,          /* the payout reserve is short */
+    EXCHANGE_ETILL,             /* the till cannot make the payout */
+    EXCHANGE_EPARTIAL,          /* partial payout above what the exchange is worth */
+    EXCHANGE_ELOC,              /* LOC reserve or till short for the remainder */
+    EXCHANGE_EIO                /* the ledger or snapshot could not be written */
+} ExchangeError;
+
+/* Short text of an error code. */
+const char *exchange_strerror(int err);
+
+/* Wall clock of the engine: seconds since the epoch. ctx is passed back. */
+typedef time_t (*ExchangeClock)(void *ctx);
+
+/* Replace the clock (NULL: time()). */
+void exchange_set_clock(ExchangeClock clock, void *ctx);
+time_t exchange_now(void);
+/* Local date (YYYY-MM-DD, 11 bytes) and time (HH:MM:SS, 9 bytes) of
+   exchange_now(); either may be NULL. */
+void exchange_clock_text(char *date_out, char *time_out);
+
+typedef struct {
+    Money amt_to;
+    Rate rate_from_loc;
+    Rate rate_to_loc;
+    Money profit_delta;
+    Money remainder_loc;
+    Money payable;       /* largest part of amt_to the till can hand out */
+    Payout pay_to;       /* notes/coins paid in the target currency */
+    Payout pay_loc;      /* notes/coins of the LOC remainder */
+} ExchangeQuote;
+
+/* Price an exchange and check the payout reserve and till. When the till
+   cannot make amt_to exactly, q->payable is less than q->amt_to and only a
+   partial exchange of q->payable can go ahead. */
+int exchange_quote(int from, int to, Money amt_from, ExchangeQuote *q, char *why, size_t why_cap);
+
+/* Apply a quoted exchange to the reserves, tills and profit. For a partial
+   exchange only part_to units of `to` are paid out and the rest of the
+   value goes back in LOC. On success q gets the amount paid, the LOC
+   remainder and the notes; on failure nothing changes, q included.
+   EXCHANGE_EIO when no tx id could be leased for the row (see txid_hold). */
+int exchange_commit(int from, int to, Money amt_from, int partial, Money part_to,
+                    ExchangeQuote *q, char *why, size_t why_cap);
+
+/* Quote and commit an order the way --batch and the server take it: a
+   payout the till cannot make exactly is cut to the largest amount it can
+   make and the rest of the value goes back in LOC. o->partial and
+   o->part_to are updated to what was paid; *adjusted (optional) is set
+   when the till cut the payout. */
+int exchange_order(Order *o, ExchangeQuote *q, int *adjusted, char *why, size_t why_cap);
+
+/* Number a committed exchange and hand its receipt and row to the writer
+   (written inline when the writer is not running). kind is WRITER_EXCHANGE
+   or WRITER_ROW. Returns the tx id; *t (optional) gets the transaction.
+   After exchange_commit the id is held; otherwise -1 when none could be
+   leased, and nothing is recorded. */
+int exchange_record(int kind, int from, int to, Money amt_from, int partial,
+                    const ExchangeQuote *q, Transaction *t);
+
+/* Quote, commit and record in one step. Returns EXCHANGE_OK with the tx id
+   in *tx_id. */
+int exchange_execute(int from, int to, Money amt_from, int partial, Money part_to,
+                     ExchangeQuote *q, int *tx_id, char *why, size_t why_cap);
+
+/* Management: add (delta > 0) or remove cash, set a currency's rates or
+   its critical minimum. Each change is saved in the state snapshot; rate
+   changes are also appended to the rate history. When a write fails the
+   change is undone and EXCHANGE_EIO returned. */
+int exchange_adjust_reserve(int cur, Money delta, char *why, size_t why_cap);
+int exchange_set_rates(int cur, Rate buy, Rate sell, char *why, size_t why_cap);
+int exchange_set_critical(int cur, Money min);
+
+/* Currencies whose reserve is below its critical minimum, at most cap of
+   them into out (may be NULL). Returns how many there are. */
+int exchange_below_critical(int *out, int cap);
+
+/* Run a query spec (see query_parse) and stream the matches. */
+int exchange_query(const char *spec, QueryEmit emit, void *ctx, QueryStats *st,
+                   char *why, size_t why_cap);
+
+/* Totals of the days from..to (YYYY-MM-DD, inclusive); workers as for
+   aggregate_range. */
+int exchange_report(const char *from_date, const char *to_date, int workers,
+                    DaySummary *sum, AggregateStats *st);
+
+#endif /* EXCHANGE_H */
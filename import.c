@@ -0,0 +1,646 @@
+#define _GNU_SOURCE
+
+#include "import.h"
+#include "diag.h"
+#include "aggregate.h"
+#include "archive.h"
+#include "codec.h"
+#include "daysum.h"
+#include "manifest.h"
+#include "metrics.h"
+#include "rollup.h"
+#include "segment.h"
+#include "snapshot.h"
+#include "txid.h"
+#include "txindex.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 64
+#define CHUNKS_PER_WORKER 4
+#define MIN_CHUNK (64 * 1024)
+#define LINE_CAP 512            /* longer input lines are rejected */
+#define ROW_CAP 256             /* a formatted row */
+
+typedef struct {
+    int64_t when;               /* yyyymmdd * 86400 + second of the day: sorts by date and time */
+    char date[11];
+    char time[9];
+    unsigned char from, to, partial;
+    long line;                  /* 1-based line of the input */
+    const char *text;           /* the input line, for the reject file */
+    int len;
+    Money amount_from, amount_to, remainder_loc, profit;
+    Rate rate_from, rate_to;
+} ImportRow;
+
+typedef struct {
+    int64_t when;
+    long at;                    /* index in input order */
+} SortKey;
+
+typedef struct {
+    long line;
+    const char *reason;
+    const char *text;
+    int len;
+} Reject;
+
+typedef struct {
+    const char *start, *end;    /* line-aligned part of the input */
+    long lines;                 /* lines in it, blank ones and the header included */
+    long data_lines;
+    ImportRow *rows;
+    long nrows, rows_cap;
+    Reject *rej;
+    long nrej, rej_cap;
+    int failed;                 /* out of memory */
+} Chunk;
+
+typedef struct {
+    Chunk *chunk;
+    int n;
+    int next;                   /* next chunk to claim (atomic) */
+    const char *input;
+    char today[11];
+} WorkQueue;
+
+static double seconds_since(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double)(t1.tv_sec - t0->tv_sec) + (double)(t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* Validation */
+
+static int digits(const char *s, int n) {
+    for (int i = 0; i < n; ++i)
+        if (s[i] < '0' || s[i] > '9') return 0;
+    return 1;
+}
+
+static int valid_day(const char *s) {
+    static const int mdays[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (strlen(s) != 10 || s[4] != '-' || s[7] != '-' || !digits(s, 4) || !digits(s + 5, 2) ||
+        !digits(s + 8, 2))
+        return 0;
+    int y = atoi(s), m = atoi(s + 5), d = atoi(s + 8);
+    if (m < 1 || m > 12 || d < 1) return 0;
+    int leap = y % 4 == 0 && (y % 100 != 0 || y % 400 == 0);
+    return d <= mdays[m - 1] + (m == 2 && leap);
+}
+
+static int valid_clock(const char *s) {
+    return strlen(s) == 8 && s[2] == ':' && s[5] == ':' && digits(s, 2) && digits(s + 3, 2) &&
+           digits(s + 6, 2) && atoi(s) < 24 && atoi(s + 3) < 60 && atoi(s + 6) < 60;
+}
+
+/* rate within IMPORT_RATE_TOLERANCE percent of ref */
+static int rate_near(Rate rate, Rate ref) {
+    Rate d = rate > ref ? rate - ref : ref - rate;
+    return ref > 0 && d * 100 <= ref * IMPORT_RATE_TOLERANCE;
+}
+
+/* What the row pays out (amount_to at its rate plus the LOC remainder)
+   within IMPORT_RATE_TOLERANCE percent of what it takes in, with one minor
+   unit of `to` for the rounding of amount_to. */
+static int value_near(Money value_in, Money value_out, Rate rate_to) {
+    Money d = value_in > value_out ? value_in - value_out : value_out - value_in;
+    Money slack = money_mul_rate(1, rate_to) + 1;
+    return d * 100 <= value_in * IMPORT_RATE_TOLERANCE + slack * 100;
+}
+
+/* Check one input line (without '\n'). Returns NULL with *r filled, or
+   the reason it is rejected. */
+static const char *check_row(const char *line, size_t len, const char *today, ImportRow *r) {
+    char buf[LINE_CAP];
+    if (len >= sizeof(buf)) return "line too long";
+    memcpy(buf, line, len);
+    buf[len] = '\0';
+    CsvRow row;
+    if (!codec_parse_row(buf, len, CSV_FMT_UNKNOWN, &row)) return "malformed row";
+    if (!valid_day(row.date)) return "bad date";
+    if (!valid_clock(row.time)) return "bad time";
+    if (strcmp(row.date, today) > 0) return "date in the future";
+    int from = currency_from_code(row.from), to = currency_from_code(row.to);
+    if (from < 0 || to < 0) return "unknown currency";
+    if (from == to) return "same currency";
+    if (row.amount_from <= 0 || row.amount_to <= 0) return "amount not positive";
+    if ((row.partial != 0 && row.partial != 1) || row.remainder_loc < 0) return "bad partial fields";
+    if (!rate_near(row.rate_from_loc, currencies[from].buy_to_loc) ||
+        !rate_near(row.rate_to_loc, currencies[to].sell_to_loc))
+        return "rate out of range";
+    Money value_in = money_mul_rate(row.amount_from, row.rate_from_loc);
+    Money value_out = money_mul_rate(row.amount_to, row.rate_to_loc);
+    if (row.amount_from > MONEY_MAX || row.amount_to > MONEY_MAX || row.remainder_loc > MONEY_MAX ||
+        row.profit_loc > MONEY_MAX || row.profit_loc < -MONEY_MAX || value_in > MONEY_MAX ||
+        value_out > MONEY_MAX)
+        return "amount above the maximum";
+    if (!value_near(value_in, value_out + row.remainder_loc, row.rate_to_loc))
+        return "amount_to does not match the rates";
+
+    r->when = (int64_t)(atoi(row.date) * 10000 + atoi(row.date + 5) * 100 + atoi(row.date + 8)) * 86400 +
+              atoi(row.time) * 3600 + atoi(row.time + 3) * 60 + atoi(row.time + 6);
+    memcpy(r->date, row.date, sizeof(r->date));
+    memcpy(r->time, row.time, sizeof(r->time));
+    r->from = (unsigned char)from;
+    r->to = (unsigned char)to;
+    r->partial = (unsigned char)row.partial;
+    r->amount_from = row.amount_from;
+    r->amount_to = row.amount_to;
+    r->remainder_loc = row.remainder_loc;
+    r->profit = row.profit_loc;
+    r->rate_from = row.rate_from_loc;
+    r->rate_to = row.rate_to_loc;
+    return NULL;
+}
+
+static int push_row(Chunk *c, const ImportRow *r) {
+    if (c->nrows == c->rows_cap) {
+        long cap = c->rows_cap ? c->rows_cap * 2 : 1024;
+        ImportRow *v = realloc(c->rows, (size_t)cap * sizeof(*v));
+        if (!v) return -1;
+        c->rows = v;
+        c->rows_cap = cap;
+    }
+    c->rows[c->nrows++] = *r;
+    return 0;
+}
+
+static int push_reject(Chunk *c, long line, const char *reason, const char *text, size_t len) {
+    if (c->nrej == c->rej_cap) {
+        long cap = c->rej_cap ? c->rej_cap * 2 : 64;
+        Reject *v = realloc(c->rej, (size_t)cap * sizeof(*v));
+        if (!v) return -1;
+        c->rej = v;
+        c->rej_cap = cap;
+    }
+    c->rej[c->nrej++] = (Reject){ .line = line, .reason = reason, .text = text, .len = (int)len };
+    return 0;
+}
+
+/* Lines are numbered within the chunk here and rebased after the join. */
+static void check_chunk(const WorkQueue *q, Chunk *c) {
+    for (const char *p = c->start; p < c->end;) {
+        const char *nl = memchr(p, '\n', (size_t)(c->end - p));
+        const char *eol = nl ? nl : c->end;
+        size_t len = (size_t)(eol - p);
+        while (len && p[len - 1] == '\r') len--;
+        long line = ++c->lines;
+        int header = p == q->input && len >= 5 && memcmp(p, "date,", 5) == 0;
+        if (len > 0 && !header) {
+            ImportRow r;
+            const char *why = check_row(p, len, q->today, &r);
+            r.line = line;
+            r.text = p;
+            r.len = (int)(len < LINE_CAP ? len : LINE_CAP);
+            c->data_lines++;
+            if (why ? push_reject(c, line, why, p, (size_t)r.len) : push_row(c, &r)) {
+                c->failed = 1;
+                return;
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+static void *worker_main(void *arg) {
+    WorkQueue *q = arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED);
+        if (i >= q->n) return NULL;
+        check_chunk(q, &q->chunk[i]);
+    }
+}
+
+/* Files */
+
+/* Whole file into memory (malloc'd). A missing file is empty with *text
+   NULL when missing_ok. Returns 0 or -1. */
+static int read_all(const char *fname, int missing_ok, char **text, size_t *len) {
+    *text = NULL;
+    *len = 0;
+    int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return missing_ok && errno == ENOENT ? 0 : -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    char *buf = malloc((size_t)st.st_size + 1);
+    size_t got = 0;
+    while (buf && got < (size_t)st.st_size) {
+        ssize_t n = read(fd, buf + got, (size_t)st.st_size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+    if (!buf || got < (size_t)st.st_size) {
+        free(buf);
+        return -1;
+    }
+    metrics_add(MET_BYTES_READ, (long)got);
+    *text = buf;
+    *len = got;
+    return 0;
+}
+
+static int write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/* Append to the day file, or replace it through a temporary file. */
+static int write_day(const char *fname, const char *date_text, const char *data, size_t len, int append) {
+    char tmp[160];
+    snprintf(tmp, sizeof(tmp), "%s.import", fname);
+    const char *target = append ? fname : tmp;
+    int fd = open(target, append ? O_WRONLY | O_APPEND | O_CLOEXEC
+                                 : O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    int ok = write_all(fd, data, len) == 0;
+    ok = fsync(fd) == 0 && ok;
+    ok = close(fd) == 0 && ok;
+    if (append) return ok ? 0 : -1;
+    if (!ok || rename(tmp, fname) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    char part[16];
+    make_partition_name(date_text, part, sizeof(part));
+    int dir = open(part, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+    return 0;
+}
+
+/* Time field of a sales line: the text between its first two commas. */
+static void line_time(const char *line, size_t len, char out[9]) {
+    const char *a = memchr(line, ',', len);
+    size_t n = 0;
+    if (a) {
+        const char *end = line + len;
+        for (const char *p = a + 1; p < end && *p != ',' && n < 8; ++p) out[n++] = *p;
+    }
+    out[n] = '\0';
+}
+
+static int put_row(char *out, size_t cap, const ImportRow *r, int tx_id) {
+    return codec_format_row(out, cap, r->date, r->time, tx_id, currencies[r->from].name,
+                            currencies[r->to].name, r->amount_from, r->amount_to, r->rate_from,
+                            r->rate_to, r->partial, r->remainder_loc, r->profit);
+}
+
+static void drop_sidecars(const char *date_text) {
+    char name[128];
+    make_summary_name(date_text, name, sizeof(name));
+    unlink(name);
+    make_segment_name(date_text, name, sizeof(name));
+    unlink(name);
+    make_rollup_name(date_text, name, sizeof(name));
+    unlink(name);
+}
+
+/* Merge n rows of one day (sorted, ids from first_id) into its file with
+   one write. Returns 0 or -1. */
+static int merge_day(const ImportRow *rows, long n, int first_id, ImportStats *st) {
+    const char *date = rows[0].date;
+    char fname[128];
+    make_daily_csv_name(date, fname, sizeof(fname));
+    char *old = NULL;
+    size_t old_len = 0;
+    if (partition_prepare(date) != 0 || read_all(fname, 1, &old, &old_len) != 0) {
+        diag("Import: cannot read %s: %s", fname, strerror(errno));
+        return -1;
+    }
+
+    /* Append when the new rows all come at or after the last row. */
+    size_t header_len = 0;
+    int append = 0;
+    if (old_len > 0) {
+        const char *nl = memchr(old, '\n', old_len);
+        header_len = nl ? (size_t)(nl - old) + 1 : old_len;
+        if (old[old_len - 1] == '\n') {
+            const char *last = memrchr(old, '\n', old_len - 1);
+            size_t start = last ? (size_t)(last - old) + 1 : 0;
+            char t[9];
+            line_time(old + start, old_len - 1 - start, t);
+            append = start == 0 || strcmp(rows[0].time, t) >= 0;
+        }
+    }
+
+    size_t cap = old_len + strlen(CSV_HEADER) + (size_t)n * ROW_CAP + 1;
+    char *out = malloc(cap);
+    if (!out) {
+        free(old);
+        diag("Import: out of memory for %s", fname);
+        return -1;
+    }
+    size_t used = 0, base = append ? old_len : 0;
+    if (old_len == 0) {
+        used = strlen(CSV_HEADER);
+        memcpy(out, CSV_HEADER, used);
+    } else if (!append) {
+        memcpy(out, old, header_len);
+        used = header_len;
+        if (out[used - 1] != '\n') out[used++] = '\n';
+    }
+    size_t pos = append ? old_len : header_len;     /* next existing line */
+    int rc = 0;
+    for (long k = 0; k <= n && rc == 0; ++k) {
+        /* existing lines that sort before (or with) the next new row */
+        while (pos < old_len) {
+            const char *line = old + pos;
+            const char *nl = memchr(line, '\n', old_len - pos);
+            size_t len = nl ? (size_t)(nl - line) : old_len - pos;
+            char t[9];
+            line_time(line, len, t);
+            if (k < n && strcmp(t, rows[k].time) > 0) break;
+            memcpy(out + used, line, len);
+            used += len;
+            out[used++] = '\n';                     /* a torn last line gets its newline */
+            pos += len + (nl ? 1 : 0);
+        }
+        if (k == n) break;
+        int w = put_row(out + used, cap - used, &rows[k], first_id + (int)k);
+        if (w < 0) {
+            rc = -1;
+            break;
+        }
+        if (old_len == 0 || append) txindex_add(first_id + (int)k, date, (long)(base + used));
+        used += (size_t)w;
+    }
+    free(old);
+    if (rc == 0 && write_day(fname, date, out, used, append) != 0) rc = -1;
+    free(out);
+    if (rc != 0) {
+        diag("Import: cannot write %s: %s", fname, strerror(errno));
+        return -1;
+    }
+
+    metrics_add(MET_ROWS_WRITTEN, n);
+    metrics_add(MET_BYTES_WRITTEN, (long)used);
+    if (old_len == 0) {
+        st->created++;
+        manifest_set(fname, n, (int64_t)used);
+    } else if (append) {
+        st->appended++;
+        manifest_note_day(date, n, (int64_t)(old_len + used));
+    } else {
+        st->rewritten++;
+        drop_sidecars(date);
+        manifest_set(fname, -1, (int64_t)used);
+    }
+    return 0;
+}
+
+/* Import */
+
+static int cmp_key(const void *a, const void *b) {
+    const SortKey *x = a, *y = b;
+    if (x->when != y->when) return x->when < y->when ? -1 : 1;
+    return (x->at > y->at) - (x->at < y->at);
+}
+
+static int cmp_reject(const void *a, const void *b) {
+    const Reject *x = a, *y = b;
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+static int write_rejects(const char *path, const Reject *rej, long n) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fputs("line,reason,row\n", f);
+    for (long i = 0; i < n; ++i)
+        fprintf(f, "%ld,%s,%.*s\n", rej[i].line, rej[i].reason, rej[i].len, rej[i].text);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* Cut the input into line-aligned chunks. Returns the count. */
+static int split_input(const char *buf, size_t len, int want, Chunk *chunk) {
+    if ((size_t)want > len / MIN_CHUNK + 1) want = (int)(len / MIN_CHUNK + 1);
+    size_t start = 0;
+    for (int i = 0; i < want; ++i) {
+        size_t end = len * (size_t)(i + 1) / (size_t)want;
+        if (end < start) end = start;
+        if (i + 1 < want && end < len) {
+            const char *nl = memchr(buf + end, '\n', len - end);
+            end = nl ? (size_t)(nl - buf) + 1 : len;
+        }
+        memset(&chunk[i], 0, sizeof(chunk[i]));
+        chunk[i].start = buf + start;
+        chunk[i].end = buf + end;
+        start = end;
+    }
+    return want;
+}
+
+int import_file(const char *path, const char *reject_path, int workers, ImportStats *st) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    memset(st, 0, sizeof(*st));
+    char *input = NULL;
+    size_t input_len = 0;
+    if (read_all(path, 0, &input, &input_len) != 0) {
+        diag("Import: cannot read %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (workers <= 0) workers = aggregate_default_workers();
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+    WorkQueue q = { .input = input };
+    snprintf(q.today, sizeof(q.today), "%.10s", current_date);
+    Chunk *chunk = calloc((size_t)workers * CHUNKS_PER_WORKER, sizeof(*chunk));
+    if (!chunk) {
+        free(input);
+        diag("Import: out of memory");
+        return -1;
+    }
+    q.chunk = chunk;
+    q.n = split_input(input, input_len, workers * CHUNKS_PER_WORKER, chunk);
+    if (workers > q.n) workers = q.n;
+    st->workers = workers;
+
+    pthread_t tids[MAX_WORKERS];
+    int started = 0;
+    for (int i = 1; i < workers; ++i) {
+        if (pthread_create(&tids[started], NULL, worker_main, &q) != 0) break;
+        started++;
+    }
+    worker_main(&q);              /* the calling thread works too */
+    for (int i = 0; i < started; ++i) pthread_join(tids[i], NULL);
+
+    long nrows = 0, nrej = 0;
+    int failed = 0;
+    for (int i = 0; i < q.n; ++i) {
+        nrows += chunk[i].nrows;
+        nrej += chunk[i].nrej;
+        st->lines += chunk[i].data_lines;
+        failed |= chunk[i].failed;
+    }
+    ImportRow *rows = malloc((size_t)(nrows ? nrows : 1) * sizeof(*rows));
+    Reject *rej = malloc((size_t)(nrows + nrej ? nrows + nrej : 1) * sizeof(*rej));
+    long base = 0, nr = 0, nj = 0;
+    for (int i = 0; i < q.n; ++i) {
+        Chunk *c = &chunk[i];
+        for (long k = 0; rows && k < c->nrows; ++k) {
+            rows[nr] = c->rows[k];
+            rows[nr++].line += base;
+        }
+        for (long k = 0; rej && k < c->nrej; ++k) {
+            rej[nj] = c->rej[k];
+            rej[nj++].line += base;
+        }
+        base += c->lines;
+        free(c->rows);
+        free(c->rej);
+    }
+    free(chunk);
+    if (failed || !rows || !rej) {
+        free(rows);
+        free(rej);
+        free(input);
+        diag("Import: out of memory");
+        return -1;
+    }
+    metrics_add(MET_ROWS_READ, st->lines);
+    st->validate_seconds = seconds_since(&t0);
+
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    /* Sort keys rather than rows; the rows are then gathered in order. */
+    SortKey *key = malloc((size_t)(nrows ? nrows : 1) * sizeof(*key));
+    ImportRow *sorted = malloc((size_t)(nrows ? nrows : 1) * sizeof(*sorted));
+    if (!key || !sorted) {
+        free(key);
+        free(sorted);
+        free(rows);
+        free(rej);
+        free(input);
+        diag("Import: out of memory");
+        return -1;
+    }
+    for (long i = 0; i < nrows; ++i) key[i] = (SortKey){ .when = rows[i].when, .at = i };
+    qsort(key, (size_t)nrows, sizeof(*key), cmp_key);
+    for (long i = 0; i < nrows; ++i) sorted[i] = rows[key[i].at];
+    free(key);
+    free(rows);
+    rows = sorted;
+
+    /* Days folded into an archive stay closed. */
+    long kept = 0;
+    for (long i = 0; i < nrows;) {
+        long j = i;
+        while (j < nrows && rows[j].when / 86400 == rows[i].when / 86400) ++j;
+        char fname[128];
+        struct stat sb;
+        ArchiveDayInfo info;
+        make_daily_csv_name(rows[i].date, fname, sizeof(fname));
+        int archived = stat(fname, &sb) != 0 && archive_find_day(rows[i].date, &info) == 0;
+        for (long k = i; k < j; ++k) {
+            if (archived)
+                rej[nj++] = (Reject){ .line = rows[k].line, .reason = "day is archived",
+                                      .text = rows[k].text, .len = rows[k].len };
+            else
+                rows[kept++] = rows[k];
+        }
+        i = j;
+    }
+    nrows = kept;
+
+    /* Rows move the reserves in time order from the current balances; one
+       whose payout they cannot cover, or that lifts a reserve above
+       MONEY_MAX, is rejected rather than applied. */
+    Money bal[MAX_CUR];
+    for (int c = 0; c < cur_count; ++c) bal[c] = currencies[c].bal;
+    kept = 0;
+    for (long i = 0; i < nrows; ++i) {
+        const ImportRow *r = &rows[i];
+        bal[r->to] -= r->amount_to;
+        bal[CUR_LOC] -= r->remainder_loc;
+        bal[r->from] += r->amount_from;
+        const char *why = bal[r->to] < 0 || bal[CUR_LOC] < 0 ? "reserve cannot cover the payout"
+                        : bal[r->from] > MONEY_MAX          ? "reserve above the maximum"
+                                                            : NULL;
+        if (!why) {
+            rows[kept++] = *r;
+            continue;
+        }
+        bal[r->from] -= r->amount_from;
+        bal[CUR_LOC] += r->remainder_loc;
+        bal[r->to] += r->amount_to;
+        rej[nj++] = (Reject){ .line = r->line, .reason = why, .text = r->text, .len = r->len };
+    }
+    nrows = kept;
+    st->accepted = nrows;
+    st->rejected = nj;
+
+    int rc = 0;
+    long done = 0;
+    if (nrows > 0) {
+        st->first_id = txid_reserve((int)nrows);
+        if (st->first_id < 0) {
+            st->first_id = 0;
+            rc = -1;
+            nrows = 0;                  /* nothing is written without ids */
+        } else
+            st->last_id = st->first_id + (int)nrows - 1;
+    }
+    while (done < nrows) {
+        long j = done;
+        while (j < nrows && rows[j].when / 86400 == rows[done].when / 86400) ++j;
+        if (merge_day(rows + done, j - done, st->first_id + (int)done, st) != 0) {
+            rc = -1;
+            break;
+        }
+        done = j;
+    }
+
+    /* Reserves, tills and profit move as for a manual entry (menu 9). */
+    for (long i = 0; i < done; ++i) {
+        CsvRow row = { .tx_id = st->first_id + (int)i, .has_tx_id = 1,
+                       .amount_from = rows[i].amount_from, .amount_to = rows[i].amount_to,
+                       .partial = rows[i].partial, .remainder_loc = rows[i].remainder_loc,
+                       .profit_loc = rows[i].profit };
+        snprintf(row.from, sizeof(row.from), "%s", currencies[rows[i].from].name);
+        snprintf(row.to, sizeof(row.to), "%s", currencies[rows[i].to].name);
+        if (ledger_apply_row(&row) != 0) st->short_rows++;
+    }
+    if (done > 0) {
+        if ((st->rewritten ? txindex_rebuild() < 0 : txindex_flush() != 0) ||
+            snapshot_rebase() != 0) {
+            diag("Import: the rows are in the day files but the transaction index or "
+                 "state snapshot could not be updated; run --rebuild-index.");
+            rc = -1;
+        }
+    }
+
+    qsort(rej, (size_t)nj, sizeof(*rej), cmp_reject);
+    if (write_rejects(reject_path, rej, nj) != 0) {
+        diag("Import: cannot write %s: %s", reject_path, strerror(errno));
+        rc = -1;
+    }
+    free(rows);
+    free(rej);
+    free(input);
+    st->write_seconds = seconds_since(&t1);
+    st->seconds = seconds_since(&t0);
+    return rc;
+}
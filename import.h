@@ -0,0 +1,55 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+/* Bulk import of transactions from an external file (a branch's paper
+ * log, a partner's export).
+ *
+ * The input has the sales CSV layout, with or without the tx_id column and
+ * with or without a header; its tx ids are ignored. Worker threads check
+ * line-aligned chunks of the file: the row parses, the date and time are
+ * real, the day is not in the future or archived, both currencies are in
+ * the registry and differ, the amounts are positive and the LOC rates are
+ * within IMPORT_RATE_TOLERANCE percent of the current BUY (from) and SELL
+ * (to) rates, the LOC value paid out (amount_to at its rate plus the
+ * remainder) is within the same tolerance of the value taken in, and no
+ * figure exceeds MONEY_MAX. Accepted rows are sorted by date and time;
+ * replayed from the current reserves in that order, one whose payout a
+ * reserve cannot cover is rejected. The rest are numbered from one
+ * block of tx ids and merged into their day files with one write per file:
+ * appended when they all come at or after the day's last row, otherwise
+ * the day is merged in time order into a temporary file that is renamed
+ * over the old one (its sidecars are dropped and the transaction index is
+ * rebuilt). Reserves, tills and profit move as for a manual entry and a
+ * state snapshot is written at the new end of the ledger.
+ *
+ * Rejected lines are written to the reject file as "line,reason,row".
+ * Day files are replaced under any other writer, so the caller takes the
+ * data root's session lock exclusively first (data_root_lock): an import
+ * is refused while a desk, batch or server session holds it, and sessions
+ * are refused while an import runs. */
+
+#define IMPORT_RATE_TOLERANCE 20    /* percent either side of the current rate */
+
+typedef struct {
+    long lines;                 /* data lines read (no header, no blank lines) */
+    long accepted;
+    long rejected;
+    int created;                /* day files written */
+    int appended;
+    int rewritten;
+    int first_id;               /* ids given to the accepted rows */
+    int last_id;
+    long short_rows;            /* payouts the tills could not make exactly */
+    int workers;
+    double validate_seconds;
+    double write_seconds;       /* sort, merge, index and snapshot */
+    double seconds;
+} ImportStats;
+
+/* Import the rows of `path`, rejects to `reject_path`. workers as for
+   aggregate_range. Needs the state recovered (snapshot_recover) first.
+   Returns 0, or -1 with a message if the input could not be read or a
+   day file could not be written (days already written stay imported). */
+int import_file(const char *path, const char *reject_path, int workers, ImportStats *st);
+
+#endif /* IMPORT_H */
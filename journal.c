@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+
+#include "journal.h"
+#include "diag.h"
+#include "utils.h"
+#include "txindex.h"
+#include "metrics.h"
+#include "manifest.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define JOURNAL_BUF (64 * 1024)
+
+static struct {
+    int fd;
+    char date[16];
+    char fname[128];
+    long file_size;          /* bytes already written to the file */
+    char buf[JOURNAL_BUF];
+    size_t used;
+    int pending_rows;        /* rows appended since the last commit */
+    long unlisted_rows;      /* rows not yet in the partition manifest */
+    struct timespec last_commit;
+} J = { .fd = -1 };
+/* The writer thread commits on the ms:T timer while the menu thread may
+   flush for a report; calls nest (commit -> flush), so it is recursive. */
+static pthread_mutex_t lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static JournalPolicy policy = { .every_rows = 1, .every_ms = 0, .fsync_on = 1 };
+
+int journal_parse_policy(const char *spec, JournalPolicy *out) {
+    JournalPolicy p = { 0, 0, 1 };
+    char *end;
+    if (strcmp(spec, "tx") == 0) {
+        p.every_rows = 1;
+    } else if (strcmp(spec, "none") == 0) {
+        p.fsync_on = 0;
+    } else if (strncmp(spec, "rows:", 5) == 0) {
+        long n = strtol(spec + 5, &end, 10);
+        if (end == spec + 5 || *end || n <= 0 || n > 1000000) return -1;
+        p.every_rows = (int)n;
+    } else if (strncmp(spec, "ms:", 3) == 0) {
+        long n = strtol(spec + 3, &end, 10);
+        if (end == spec + 3 || *end || n <= 0 || n > 3600000) return -1;
+        p.every_ms = (int)n;
+    } else {
+        return -1;
+    }
+    *out = p;
+    return 0;
+}
+
+void journal_set_policy(const JournalPolicy *p) { policy = *p; }
+void journal_get_policy(JournalPolicy *out) { *out = policy; }
+
+static long ms_since(const struct timespec *t) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - t->tv_sec) * 1000 + (now.tv_nsec - t->tv_nsec) / 1000000;
+}
+
+static int write_all(int fd, const char *p, size_t n) {
+    metrics_add(MET_BYTES_WRITTEN, (long)n);
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/* Append n bytes at the end of the day file. A short write is cut back
+   off, so the file ends at J.file_size again and a retry writes the same
+   rows once. */
+static int append_bytes(const char *p, size_t n) {
+    if (write_all(J.fd, p, n) == 0) {
+        J.file_size += (long)n;
+        return 0;
+    }
+    int err = errno;
+    if (ftruncate(J.fd, J.file_size) != 0)
+        diag("Could not cut a partial write from %s: %s", J.fname, strerror(errno));
+    errno = err;
+    return -1;
+}
+
+int journal_flush(void) {
+    pthread_mutex_lock(&lock);
+    int rc = 0;
+    if (J.fd >= 0 && J.used > 0) {
+        if (append_bytes(J.buf, J.used) != 0) {
+            diag("Journal write failed (%s): %s", J.fname, strerror(errno));
+            rc = -1;
+        } else {
+            J.used = 0;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+int journal_commit(void) {
+    pthread_mutex_lock(&lock);
+    if (J.fd < 0) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    int64_t t0 = metrics_start(MET_JOURNAL_COMMIT);
+    int rc = journal_flush();
+    if (rc == 0 && policy.fsync_on && J.pending_rows > 0 && fsync(J.fd) != 0) {
+        diag("Journal fsync failed (%s): %s", J.fname, strerror(errno));
+        rc = -1;
+    }
+    if (rc == 0) {                       /* unsynced rows stay pending for the next commit */
+        J.pending_rows = 0;
+        clock_gettime(CLOCK_MONOTONIC, &J.last_commit);
+        rc = txindex_flush();
+    }
+    if (rc == 0 && J.unlisted_rows > 0) {
+        manifest_note_day(J.date, J.unlisted_rows, J.file_size);
+        J.unlisted_rows = 0;
+    }
+    metrics_end(MET_JOURNAL_COMMIT, t0);
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+long journal_commit_due(void) {
+    pthread_mutex_lock(&lock);
+    long due = -1;
+    if (J.fd >= 0 && policy.every_ms > 0 && J.pending_rows > 0) {
+        due = policy.every_ms - ms_since(&J.last_commit);
+        if (due < 0) due = 0;
+    }
+    pthread_mutex_unlock(&lock);
+    return due;
+}
+
+int journal_position(char *date_out, size_t cap, long *end_offset) {
+    pthread_mutex_lock(&lock);
+    int rc = -1;
+    if (J.fd >= 0) {
+        snprintf(date_out, cap, "%s", J.date);
+        *end_offset = J.file_size + (long)J.used;
+        rc = 0;
+    }
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+void journal_close(void) {
+    pthread_mutex_lock(&lock);
+    if (J.fd >= 0) {
+        journal_commit();
+        close(J.fd);
+        J.fd = -1;
+        J.date[0] = '\0';
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static int journal_open(const char *date_text) {
+    make_daily_csv_name(date_text, J.fname, sizeof(J.fname));
+    if (partition_prepare(date_text) != 0) return -1;
+    J.fd = open(J.fname, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (J.fd < 0) {
+        diag("CSV open failed (%s): %s", J.fname, strerror(errno));
+        return -1;
+    }
+    metrics_add(MET_FILES_OPENED, 1);
+    struct stat st;
+    J.file_size = fstat(J.fd, &st) == 0 ? (long)st.st_size : 0;
+    snprintf(J.date, sizeof(J.date), "%s", date_text);
+    J.used = 0;
+    J.pending_rows = 0;
+    J.unlisted_rows = 0;
+    clock_gettime(CLOCK_MONOTONIC, &J.last_commit);
+    manifest_sync(J.fname);              /* a new day file is listed right away */
+
+    if (J.file_size == 0) {
+        size_t n = strlen(CSV_HEADER);
+        memcpy(J.buf, CSV_HEADER, n);
+        J.used = n;
+    }
+    return 0;
+}
+
+/* journal_append under the lock. */
+static long append_row(const char *date_text, const char *row, size_t len) {
+    if (J.fd >= 0 && strcmp(J.date, date_text) != 0)
+        journal_close();   /* date rolled over: finish the old day first */
+    if (J.fd < 0 && journal_open(date_text) != 0)
+        return -1;
+
+    if (J.used + len > sizeof(J.buf) && journal_flush() != 0)
+        return -1;
+
+    long offset = J.file_size + (long)J.used;
+    if (len > sizeof(J.buf)) {
+        if (append_bytes(row, len) != 0) return -1;
+    } else {
+        memcpy(J.buf + J.used, row, len);
+        J.used += len;
+    }
+    J.pending_rows++;
+    J.unlisted_rows++;
+    metrics_add(MET_ROWS_WRITTEN, 1);
+
+    if ((policy.every_rows > 0 && J.pending_rows >= policy.every_rows) ||
+        (policy.every_ms > 0 && ms_since(&J.last_commit) >= policy.every_ms))
+        journal_commit();
+    return offset;
+}
+
+long journal_append(const char *date_text, const char *row, size_t len) {
+    pthread_mutex_lock(&lock);
+    long offset = append_row(date_text, row, len);
+    pthread_mutex_unlock(&lock);
+    return offset;
+}
@@ -0,0 +1,46 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+
+/* Append-only writer for the daily sales CSV.
+ *
+ * The day file stays open for the whole session; rows are collected in an
+ * in-memory buffer and committed (write + fsync) in groups according to the
+ * sync policy. Appending a row for a different date rotates the journal to
+ * that day's file. The calls are serialized by a lock, so the writer
+ * thread can commit on its timer while another thread reads. */
+
+typedef struct {
+    int every_rows;   /* commit after this many pending rows (0 = off) */
+    int every_ms;     /* commit when the last commit is this old (0 = off) */
+    int fsync_on;     /* 0 = commit only writes, never fsyncs */
+} JournalPolicy;
+
+/* Parse "tx", "rows:N", "ms:T" or "none" into a policy. Returns 0 on success. */
+int journal_parse_policy(const char *spec, JournalPolicy *out);
+void journal_set_policy(const JournalPolicy *p);
+void journal_get_policy(JournalPolicy *out);
+
+/* Append one complete CSV line (including '\n') to the file for date_text.
+   Returns the byte offset of the row within that file, or -1 on error. */
+long journal_append(const char *date_text, const char *row, size_t len);
+
+/* Write out buffered rows and fsync (if enabled by the policy). On a
+   failed write the partial bytes are cut off and the rows stay buffered;
+   on a failed fsync they stay pending, so the next commit retries both. */
+int journal_commit(void);
+/* Milliseconds until the ms:T bound is due for the rows now pending (0 if
+   overdue), or -1 when none are pending or the policy has no time bound.
+   The writer thread sleeps this long at most, so an idle desk commits
+   its last exchange on time. */
+long journal_commit_due(void);
+/* Write out buffered rows so readers of the file see them; no fsync. */
+int journal_flush(void);
+/* Date of the open day file and its end offset, buffered rows included.
+   Returns 0, or -1 if no day file is open. */
+int journal_position(char *date_out, size_t cap, long *end_offset);
+/* Commit and close the current day file. Safe to call more than once. */
+void journal_close(void);
+
+#endif /* JOURNAL_H */
@@ -6,199 +6,292 @@
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <errno.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "utils.h"
+#include "diag.h"
+#include "journal.h"
+#include "segment.h"
+#include "txindex.h"
+#include "aggregate.h"
+#include "query.h"
+#include "rollup.h"
+#include "server.h"
+#include "snapshot.h"
+#include "writer.h"
+#include "txid.h"
+#include "metrics.h"
+#include "archive.h"
+#include "manifest.h"
+#include "exchange.h"
+#include "prompt.h"
+#include "ratehist.h"
+#include "daycache.h"
+#include "import.h"
 
+/* Prompt for a line of text; returns 0 on EOF. */
+static int read_line(const char *prompt, char *buf, size_t cap) {
+    printf("%s ", prompt);
+    fflush(stdout);
+    if (!fgets(buf, (int)cap, stdin)) return 0;
+    size_t L = strlen(buf);
+    while (L && (buf[L-1] == '\n' || buf[L-1] == '\r')) buf[--L] = '\0';
+    return 1;
+}
+
+/* List the registry six to a line and read an index or a code. */
 static int choose_currency(const char *prompt) {
     printf("%s\n", prompt);
+    for (int i = 0; i < cur_count; ++i) {
+        int eol = i % 6 == 5 || i == cur_count - 1;
+        printf("  %3d) %-*s%s", i, eol ? 0 : 7, currencies[i].name, eol ? "\n" : "");
+    }
     fflush(stdout);
-    for (int i = 0; i < MAX_CUR; ++i) {
-        printf("  %d) %s\n", i, CUR_NAME[i]);
+    char buf[BUF];
+    for (;;) {
+        if (!read_line("Select currency (index or code):", buf, sizeof(buf))) {
+            fprintf(stderr, "Input closed.\n");
+            exit(1);
+        }
+        int c = currency_from_code(buf);
+        if (c >= 0) return c;
+        printf("Unknown currency '%s'. Try again.\n", buf);
         fflush(stdout);
     }
-    int c = ask_int("Select currency index:", 0, MAX_CUR-1);
-    return c;
 }
 
 static void check_criticals(void) {
-    for (int i = 0; i < MAX_CUR; ++i) {
-        if (currencies[i].bal < currencies[i].critical_min) {
-            printf("[-] ALERT: %s reserve below critical minimum (%.2f < %.2f)\n",
-                   currencies[i].name, currencies[i].bal, currencies[i].critical_min);
-        }
+    int low[MAX_CUR];
+    int n = exchange_below_critical(low, MAX_CUR);
+    for (int k = 0; k < n && k < MAX_CUR; ++k) {
+        int i = low[k];
+        char a[32], b[32];
+        printf("[-] ALERT: %s reserve below critical minimum (%s < %s)\n",
+               currencies[i].name, money_fmt(a, currencies[i].bal), money_fmt(b, currencies[i].critical_min));
     }
 }
 
-static double convert_via_local(int from, int to, double amount_from,
-                                double *rate_from_loc, double *rate_to_loc,
-                                double *profit_delta_loc) {
-    double loc_in = amount_from * currencies[from].buy_to_loc;
-    double amount_to = loc_in / currencies[to].sell_to_loc;
+/* Time from the confirmed order to the receipt handed to the writer. */
+static struct {
+    long count;
+    int64_t total_ns;
+    int64_t max_ns;
+} path_lat;
 
-    if (rate_from_loc) *rate_from_loc = currencies[from].buy_to_loc;
-    if (rate_to_loc)   *rate_to_loc   = currencies[to].sell_to_loc;
-
-    double cost_loc = amount_to * currencies[to].buy_to_loc;
-    double profit_delta = loc_in - cost_loc;
-    if (profit_delta_loc) *profit_delta_loc = profit_delta;
-    return amount_to;
+static int64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-static void pay_in_denoms(int cur, double amount) {
-    long long total = (long long)(amount);
-    double fractional = amount - total; 
-    const int *den = DENOMS[cur];
-    int n = D_COUNT[cur];
+static void scenario_exchange(void) {
+    int from = choose_currency("Currency you GIVE to the cashier (from client):");
+    int to   = choose_currency("Currency you WANT to receive (to client):");
+    Money amt_from = ask_money("Enter amount to exchange:", 1, MONEY_MAX);
 
-    if (total <= 0 || !den) {
-        printf("[-] No denomination breakdown available for this amount.\n");
+    ExchangeQuote res;
+    char why[BUF];
+    if (exchange_quote(from, to, amt_from, &res, why, sizeof(why)) != EXCHANGE_OK) {
+        printf("[-] %s\n", why);
         fflush(stdout);
         return;
     }
 
-    printf("\n=== Denomination Breakdown for %s %.2f ===\n", CUR_NAME[cur], amount);
-    printf("Notes/Coins Required:\n");
-    fflush(stdout);
+    int partial;
+    Money part_fixed_to = 0;
 
-    int total_pieces = 0;
-    
-    for (int i = 0; i < n; ++i) {
-        int d = den[i];
-        if (d <= 0) continue;
-        long long cnt = total / d;
-        if (cnt > 0) {
-            printf("  %3d %s x %lld\n", 
-                   d, 
-                   d >= 20 ? "note(s)" : "coin(s)", 
-                   cnt);
-            fflush(stdout);
-            total -= cnt * d;
-            total_pieces += cnt;
+    if (res.payable < res.amt_to) {
+        char a[32], b[32];
+        printf("[*] The %s till can pay %s of %s with the notes and coins in stock;\n"
+               "    the rest would be paid in LOC.\n",
+               currencies[to].name, money_fmt(a, res.payable), money_fmt(b, res.amt_to));
+        if (!ask_int("Accept? 1=Yes, 0=No:", 0, 1)) return;
+        partial = 1;
+        part_fixed_to = res.payable;
+    } else {
+        partial = ask_int("Partial exchange? 1=Yes, 0=No:", 0, 1);
+        if (partial) {
+            part_fixed_to = ask_money("Enter how many units of the target currency to receive now:", 0, res.amt_to);
         }
     }
 
-    if (fractional > 0.009) {  // Check for significant fractional part
-        printf("\nFractional amount: %.2f %s\n", fractional, CUR_NAME[cur]);
+    int64_t t0 = mono_ns(), m0 = metrics_start(MET_EXCHANGE);
+    if (exchange_commit(from, to, amt_from, partial, part_fixed_to, &res, why, sizeof(why)) != EXCHANGE_OK) {
+        metrics_end(MET_EXCHANGE, m0);
+        printf("[-] %s\n", why);
+        fflush(stdout);
+        return;
     }
 
-    if (total > 0) {
-        printf("\nWarning: Remainder of %lld cannot be broken down further\n", total);
+    Money amt_to = res.amt_to;
+    Money remainder_loc_for_client = res.remainder_loc;
+    exchange_record(WRITER_EXCHANGE, from, to, amt_from, partial, &res, NULL);
+    metrics_end(MET_EXCHANGE, m0);
+    int64_t lat = mono_ns() - t0;
+    path_lat.count++;
+    path_lat.total_ns += lat;
+    if (lat > path_lat.max_ns) path_lat.max_ns = lat;
+    char rname[128];
+    make_receipt_name(current_date, rname, sizeof(rname));
+    printf("\nReceipt generated and saved to %s\n", rname);
+
+    if (partial) {
+        char a[32], b[32];
+        printf("Partial payout details: %s %s paid; remainder to client: %s LOC\n",
+               money_fmt(a, amt_to), currencies[to].name, money_fmt(b, remainder_loc_for_client));
+        fflush(stdout);
     }
 
-    printf("\nTotal pieces to handle: %d\n", total_pieces);
-    printf("=======================================\n\n");
-    fflush(stdout);
+    int want_denoms = ask_int("Would you like a denomination breakdown for the payout currency? 1=Yes,0=No:", 0, 1);
+    if (want_denoms) {
+        pay_in_denoms(stdout, to, &res.pay_to);
+        if (partial && remainder_loc_for_client > 0) {
+            int want_loc = ask_int("Breakdown for the LOC remainder as well? 1=Yes,0=No:", 0, 1);
+            if (want_loc) pay_in_denoms(stdout, CUR_LOC, &res.pay_loc);
+        }
+    }
+
+    check_criticals();
 }
 
-/* Print and save a receipt (tx_id must be provided by caller) */
-static void handle_receipt(int tx_id, const char *date_text, int from, int to, double amt_from,
-                         double amt_to, double rate) {
-    time_t t = time(NULL);
-    struct tm *tm_info = localtime(&t);
-    char time_str[9];
-    strftime(time_str, sizeof(time_str), "%H:%M:%S", tm_info);
-    
-    Transaction trans = {
-        .id = tx_id,
-        .from_cur = from,
-        .to_cur = to,
-        .amount_from = amt_from,
-        .amount_to = amt_to,
-        .rate = rate
-    };
-    strncpy(trans.date, date_text, sizeof(trans.date) - 1);
-    trans.date[sizeof(trans.date)-1] = '\0';
-    strncpy(trans.time, time_str, sizeof(trans.time) - 1);
-    trans.time[sizeof(trans.time)-1] = '\0';
-    
-    generate_receipt(&trans, date_text);
+static double elapsed_sec(const struct timespec *a, const struct timespec *b) {
+    return (double)(b->tv_sec - a->tv_sec) + (double)(b->tv_nsec - a->tv_nsec) / 1e9;
 }
 
-static void scenario_exchange(void) {
-    int from = choose_currency("Currency you GIVE to the cashier (from client):");
-    int to   = choose_currency("Currency you WANT to receive (to client):");
-    double amt_from = ask_double("Enter amount to exchange:", 0.01, 1e12);
+static FILE *open_batch_receipts(char *name, size_t cap) {
+    FILE *f = receipt_open(current_date, name, cap);
+    if (!f) return NULL;
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    return f;
+}
 
-    if (from == to) {
-        printf("[-] From and To currencies are the same. Nothing to do.\n");
-        fflush(stdout);
-        return;
+/* Non-interactive exchange mode. Each order line is
+       from,to,amount[,partial_amount]
+   with currencies given by code or index; blank lines, '#' comments and a
+   header line are skipped. Accepted orders go through the same quote/commit
+   path as scenario_exchange; CSV rows go through the journal and receipts
+   through a buffered stream that stays open until the day changes. */
+static int run_batch(const char *path) {
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "Could not open order file %s: %s\n", path, strerror(errno));
+        return 1;
     }
 
-    double rate_from_loc = 0.0, rate_to_loc = 0.0, profit_delta = 0.0;
-    double amt_to = convert_via_local(from, to, amt_from, &rate_from_loc, &rate_to_loc, &profit_delta);
-
-    if (currencies[to].bal < amt_to) {
-        printf("[-] Insufficient reserve of %s. Available: %.2f, Needed: %.2f\n",
-               CUR_NAME[to], currencies[to].bal, amt_to);
-        fflush(stdout);
-        return;
+    char receipt_name[128];
+    FILE *rcp = open_batch_receipts(receipt_name, sizeof(receipt_name));
+    if (!rcp) {
+        if (in != stdin) fclose(in);
+        return 1;
     }
+    int io_err = 0;
+    setvbuf(in, NULL, _IOFBF, 1 << 20);
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
 
-    int partial = ask_int("Partial exchange? 1=Yes, 0=No:", 0, 1);
-    double part_fixed_to = 0.0;
-    double remainder_loc_for_client = 0.0;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
 
-    if (partial) {
-        part_fixed_to = ask_double("Enter how many units of the target currency to receive now:", 0.0, amt_to);
-        double loc_value_total = amt_from * currencies[from].buy_to_loc;
-        double loc_value_given_as_to = part_fixed_to * currencies[to].sell_to_loc;
-        if (loc_value_given_as_to > loc_value_total + 1e-9) {
-            printf("[-] Chosen partial amount exceeds exchangeable value. Aborting.\n");
-            fflush(stdout);
-            return;
-        }
-        remainder_loc_for_client = loc_value_total - loc_value_given_as_to;
+    char line[BUF], why[BUF], timebuf[9] = "";
+    time_t cached_sec = (time_t)-1;
+    long lineno = 0, orders = 0, accepted = 0, rejected = 0, adjusted = 0;
 
-        amt_to = part_fixed_to;
-    }
+    while (fgets(line, sizeof(line), in)) {
+        ++lineno;
+        size_t L = strlen(line);
+        while (L && (line[L-1] == '\n' || line[L-1] == '\r')) line[--L] = '\0';
+        if (L == 0 || line[0] == '#' || strncasecmp(line, "from", 4) == 0) continue;
+        ++orders;
 
-    currencies[from].bal += amt_from;
-    currencies[to].bal   -= amt_to;
-    if (partial) {
-        if (currencies[CUR_LOC].bal < remainder_loc_for_client) {
-            printf("[-] Insufficient LOC reserve for partial payout remainder (need %.2f LOC).\n", remainder_loc_for_client);
-            fflush(stdout);
-            currencies[from].bal -= amt_from;
-            currencies[to].bal   += amt_to;
-            return;
+        time_t now = exchange_now();
+        if (now != cached_sec) {
+            cached_sec = now;
+            exchange_clock_text(NULL, timebuf);
+            if (refresh_current_date()) {
+                io_err |= fclose(rcp) != 0;
+                if (!(rcp = open_batch_receipts(receipt_name, sizeof(receipt_name)))) {
+                    io_err = 1;
+                    break;
+                }
+            }
         }
-        currencies[CUR_LOC].bal -= remainder_loc_for_client;
-    }
 
-    profit_loc += profit_delta;
+        int64_t m0 = metrics_start(MET_EXCHANGE);
+        Order o;
+        ExchangeQuote res;
+        int cut = 0;
+        if (order_parse(line, &o, why, sizeof(why)) != 0 ||
+            exchange_order(&o, &res, &cut, why, sizeof(why)) != EXCHANGE_OK) {
+            metrics_end(MET_EXCHANGE, m0);
+            ++rejected;
+            printf("  line %ld rejected: %s\n", lineno, why);
+            continue;
+        }
+        adjusted += cut;
+        int from = o.from, to = o.to, partial = o.partial;
+        Money amt_from = o.amount;
 
-    double effective_rate = amt_to / amt_from;
-        int tx_id = ++last_transaction_id;
-        handle_receipt(tx_id, current_date, from, to, amt_from, amt_to, effective_rate);
-        save_last_tx_id(last_transaction_id);
-    
-    if (partial) {
-        printf("Partial payout details: %.2f %s paid; remainder to client: %.2f LOC\n",
-               amt_to, CUR_NAME[to], remainder_loc_for_client);
-        fflush(stdout);
+        int tx_id = txid_next();
+        Transaction trans = {
+            .id = tx_id,
+            .from_cur = from,
+            .to_cur = to,
+            .amount_from = amt_from,
+            .amount_to = res.amt_to,
+            .rate = rate_of(res.amt_to, amt_from)
+        };
+        snprintf(trans.date, sizeof(trans.date), "%.10s", current_date);
+        snprintf(trans.time, sizeof(trans.time), "%.8s", timebuf);
+        receipt_write(rcp, &trans);
+        if (csv_log_row(current_date, timebuf, tx_id, currencies[from].name, currencies[to].name,
+                        amt_from, res.amt_to, res.rate_from_loc, res.rate_to_loc,
+                        partial, res.remainder_loc, res.profit_delta) < 0)
+            io_err = 1;
+        metrics_end(MET_EXCHANGE, m0);
+        ++accepted;
+        snapshot_tick();
     }
-    csv_log_transaction(current_date, tx_id, from, to, amt_from, amt_to,
-                    rate_from_loc, rate_to_loc,
-                    partial, remainder_loc_for_client, profit_delta);
 
-    int want_denoms = ask_int("Would you like a denomination breakdown for the payout currency? 1=Yes,0=No:", 0, 1);
-    if (want_denoms) {
-        pay_in_denoms(to, amt_to);
-        if (partial && remainder_loc_for_client > 0.0) {
-            int want_loc = ask_int("Breakdown for the LOC remainder as well? 1=Yes,0=No:", 0, 1);
-            if (want_loc) pay_in_denoms(CUR_LOC, remainder_loc_for_client);
-        }
-    }
+    if (in != stdin) fclose(in);
+    if (rcp) io_err |= fclose(rcp) != 0;
+    io_err |= journal_commit() != 0;
+    io_err |= snapshot_write() != 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = elapsed_sec(&t0, &t1);
 
+    printf("\n=== Batch summary (%s) ===\n", path);
+    printf("Orders read: %ld\n", orders);
+    printf("Accepted:    %ld\n", accepted);
+    printf("Rejected:    %ld\n", rejected);
+    if (adjusted) printf("Adjusted:    %ld (payout reduced to what the till can make)\n", adjusted);
+    printf("Elapsed:     %.3f s (%.0f orders/s)\n", secs, secs > 0 ? orders / secs : 0.0);
+    if (accepted) {
+        char csv[64];
+        make_daily_csv_name(current_date, csv, sizeof(csv));
+        printf("Rows written to %s, receipts to %s\n", csv, receipt_name);
+    }
     check_criticals();
+    fflush(stdout);
+    if (io_err) {
+        fprintf(stderr, "Error writing batch output: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
 }
 
 static void scenario_show_rates(void) {
     printf("\n[*] Current Exchange Rates (relative to LOC)\n");
     printf("Index  Code   BUY->LOC        SELL->LOC\n");
     fflush(stdout);
-    for (int i = 0; i < MAX_CUR; ++i) {
-        printf("%5d  %-5s  %12.6f  %12.6f\n", i, CUR_NAME[i], currencies[i].buy_to_loc, currencies[i].sell_to_loc);
+    for (int i = 0; i < cur_count; ++i) {
+        char b[32], s[32];
+        printf("%5d  %-5s  %12s  %12s\n", i, currencies[i].name,
+               rate_fmt(b, currencies[i].buy_to_loc), rate_fmt(s, currencies[i].sell_to_loc));
         fflush(stdout);
     }
     printf("Note: BUY->LOC is what the desk credits in LOC per 1 unit when client gives that currency.\n");
@@ -208,18 +301,19 @@ static void scenario_show_rates(void) {
 
 static void scenario_mgmt_set_rates(void) {
     printf("\n--- Management: Set Rates (relative to LOC) ---\n");
-    printf("For each currency, enter BUY->LOC then SELL->LOC (must be > 0 and SELL >= BUY).\n");
+    printf("Enter BUY->LOC then SELL->LOC (must be > 0 and SELL >= BUY).\n");
     fflush(stdout);
-    for (int i = 0; i < MAX_CUR; ++i) {
-        double buy = ask_double((char [BUF]){0}, 0.000001, 1e12);
-        printf("Currency %s:\n", CUR_NAME[i]);
+    int i = choose_currency("Select currency to reprice:");
+    if (i == CUR_LOC) {
+        printf("[-] LOC is the base currency; its rates stay 1.\n\n");
         fflush(stdout);
-        buy = ask_double("  BUY->LOC:", 0.000001, 1e12);
-        double sell = ask_double("  SELL->LOC (>= BUY):", buy, 1e12);
-        currencies[i].buy_to_loc = buy;
-        currencies[i].sell_to_loc = sell;
+        return;
     }
-    printf("[*] Rates updated.\n\n");
+    Rate buy = ask_rate("  BUY->LOC:", 1, RATE_MAX);
+    Rate sell = ask_rate("  SELL->LOC (>= BUY):", buy, RATE_MAX);
+    char why[BUF];
+    if (exchange_set_rates(i, buy, sell, why, sizeof(why)) != EXCHANGE_OK) printf("[-] %s\n\n", why);
+    else printf("[*] %s rates updated.\n\n", currencies[i].name);
     fflush(stdout);
 }
 
@@ -227,35 +321,41 @@ static void scenario_mgmt_reserves(void) {
     printf("\n--- Management: Adjust Reserves ---\n");
     fflush(stdout);
     int idx = choose_currency("Select currency to modify:");
-    double delta = ask_double("Positive to add to reserve, negative to remove:", -1e12, 1e12);
-    if (currencies[idx].bal + delta < 0) {
-        printf("[-] Operation would make reserve negative. Aborted.\n");
+    Money delta = ask_money("Positive to add to reserve, negative to remove:", -MONEY_MAX, MONEY_MAX);
+    char why[BUF];
+    int rc = exchange_adjust_reserve(idx, delta, why, sizeof(why));
+    if (rc != EXCHANGE_OK) {
+        printf("[-] %s\n", why);
         fflush(stdout);
         return;
     }
-    currencies[idx].bal += delta;
-    if (delta >= 0) printf("Added %.2f %s to reserves.\n", delta, CUR_NAME[idx]);
-    else            printf("Removed %.2f %s from reserves.\n", -delta, CUR_NAME[idx]);
+    char a[32];
+    if (delta >= 0) printf("Added %s %s to reserves.\n", money_fmt(a, delta), currencies[idx].name);
+    else            printf("Removed %s %s from reserves.\n", money_fmt(a, -delta), currencies[idx].name);
     fflush(stdout);
 }
 
 static void scenario_mgmt_crit(void) {
     printf("\n--- Management: Set Critical Minimums ---\n");
     fflush(stdout);
-    for (int i = 0; i < MAX_CUR; ++i) {
-        printf("Currency %s:\n", CUR_NAME[i]);
-        fflush(stdout);
-        currencies[i].critical_min = ask_double("  Critical minimum:", 0.0, 1e12);
-    }
-    printf("[*] Critical minimums updated.\n\n");
+    int i = choose_currency("Select currency:");
+    if (exchange_set_critical(i, ask_money("  Critical minimum:", 0, MONEY_MAX)) != EXCHANGE_OK)
+        printf("[-] The state snapshot could not be written; the minimum is unchanged.\n\n");
+    else
+        printf("[*] %s critical minimum updated.\n\n", currencies[i].name);
     fflush(stdout);
 }
 
 static void scenario_show_balances(void) {
     printf("\n[*] Current Balances\n");
     fflush(stdout);
-    for (int i = 0; i < MAX_CUR; ++i) {
-        printf("%s: %.2f\n", CUR_NAME[i], currencies[i].bal);
+    for (int i = 0; i < cur_count; ++i) {
+        char a[32], b[32];
+        const Till *t = &currencies[i].till;
+        long pieces = 0;
+        for (int d = 0; d < t->n; ++d) pieces += t->stock[d];
+        printf("%s: %s  (till: %s in %ld notes/coins)\n", currencies[i].name,
+               money_fmt(a, currencies[i].bal), money_fmt(b, till_value(t)), pieces);
     }
     printf("\n");
     fflush(stdout);
@@ -275,7 +375,7 @@ static void scenario_help(void) {
     printf("   - Shows buy and sell rates for all currencies\n\n");
     
     printf("3. Management: Set Rates\n");
-    printf("   - Update buy and sell rates\n");
+    printf("   - Update the buy and sell rates of one currency\n");
     printf("   - Must maintain buy ≤ sell relationship\n\n");
     
     printf("4. Management: Adjust Reserves\n");
@@ -283,7 +383,7 @@ static void scenario_help(void) {
     printf("   - Cannot reduce below zero\n\n");
     
     printf("5. Management: Set Critical Minimums\n");
-    printf("   - Set alert thresholds for each currency\n");
+    printf("   - Set the alert threshold of one currency\n");
     printf("   - System warns when balance falls below minimum\n\n");
     
     printf("6. Show Balances\n");
@@ -305,11 +405,388 @@ static void scenario_help(void) {
     getchar();
 }
 
+static int valid_date(const char *s) {
+    int y, m, d;
+    char extra;
+    return strlen(s) == 10 && sscanf(s, "%4d-%2d-%2d%c", &y, &m, &d, &extra) == 3 &&
+           m >= 1 && m <= 12 && d >= 1 && d <= 31;
+}
+
+static void print_aggregate(const char *label, const char *from_date, const char *to_date, int workers) {
+    DaySummary sum;
+    AggregateStats st;
+    if (exchange_report(from_date, to_date, workers, &sum, &st) != EXCHANGE_OK) {
+        printf("[-] Aggregation failed for %s.\n", label);
+        fflush(stdout);
+        return;
+    }
+    Money bonus = money_percent(sum.profit, 5);
+    char a[32], b[32];
+    printf("\n=== Aggregate report: %s (%s .. %s) ===\n", label, from_date, to_date);
+    printf("Files scanned: %d (%d work items, %d worker thread(s))\n", st.files, st.items, st.workers);
+    printf("Transactions: %ld\n", sum.tx_count);
+    printf("Profit (LOC): %s\n", money_fmt(a, sum.profit));
+    printf("Cashier bonus (5%% of profit): %s\n", money_fmt(b, bonus));
+    printf("Volume by currency (received / paid out):\n");
+    for (int i = 0; i < cur_count; ++i) {
+        if (sum.vol_in[i] == 0 && sum.vol_out[i] == 0) continue;
+        printf("  %-4s %16s / %16s\n", currencies[i].name, money_fmt(a, sum.vol_in[i]), money_fmt(b, sum.vol_out[i]));
+    }
+    printf("Scanned %.1f MB in %.3f s\n\n", st.bytes / 1e6, st.seconds);
+    fflush(stdout);
+}
+
+static void scenario_reports(void) {
+    printf("\n--- Reports ---\n");
+    printf(" 1) Month aggregation (YYYY-MM)\n");
+    printf(" 2) Year aggregation (YYYY)\n");
+    printf(" 3) Date-range aggregation (YYYY-MM-DD .. YYYY-MM-DD)\n");
+    fflush(stdout);
+    int kind = ask_int("Select report:", 1, 3);
+
+    char a[32], b[32], from_date[16], to_date[16];
+    if (kind == 1) {
+        if (!read_line("Month (YYYY-MM):", a, sizeof(a))) return;
+        if (strlen(a) != 7 || !valid_date(strcat(strcpy(from_date, a), "-01"))) {
+            printf("[-] Invalid month.\n");
+            return;
+        }
+        snprintf(to_date, sizeof(to_date), "%.7s-31", a);
+        print_aggregate("month", from_date, to_date, 0);
+    } else if (kind == 2) {
+        if (!read_line("Year (YYYY):", a, sizeof(a))) return;
+        snprintf(from_date, sizeof(from_date), "%.4s-01-01", a);
+        snprintf(to_date, sizeof(to_date), "%.4s-12-31", a);
+        if (strlen(a) != 4 || !valid_date(from_date)) {
+            printf("[-] Invalid year.\n");
+            return;
+        }
+        print_aggregate("year", from_date, to_date, 0);
+    } else {
+        if (!read_line("From date (YYYY-MM-DD):", a, sizeof(a))) return;
+        if (!read_line("To date (YYYY-MM-DD):", b, sizeof(b))) return;
+        if (!valid_date(a) || !valid_date(b) || strcmp(a, b) > 0) {
+            printf("[-] Invalid date range.\n");
+            return;
+        }
+        print_aggregate("range", a, b, 0);
+    }
+}
+
+/* Pair and hourly analytics for a day (YYYY-MM-DD) or a month (YYYY-MM). */
+static int print_analytics(const char *period) {
+    char first[16];
+    int month = strlen(period) == 7 && valid_date(strcat(strcpy(first, period), "-01"));
+    if (!month && !valid_date(period)) {
+        printf("[-] Period must be YYYY-MM-DD or YYYY-MM.\n");
+        fflush(stdout);
+        return -1;
+    }
+    Rollup *r = malloc(sizeof(*r));
+    if (!r || (month ? rollup_month(period, r) : rollup_day(period, r)) < 0) {
+        printf("[-] Analytics failed for %s.\n", period);
+        fflush(stdout);
+        free(r);
+        return -1;
+    }
+    char a[32];
+    printf("\n=== Analytics for %s ===\n", period);
+    printf("Transactions: %ld (%ld partial, %.1f%%)\n", r->tx_count, r->partial,
+           r->tx_count ? 100.0 * (double)r->partial / (double)r->tx_count : 0.0);
+    printf("Profit (LOC): %s\n", money_fmt(a, r->profit));
+    if (r->tx_count) {
+        printf("By currency pair:\n");
+        rollup_print_pairs(stdout, r);
+        printf("By hour:\n");
+        rollup_print_hours(stdout, r);
+    }
+    printf("\n");
+    fflush(stdout);
+    free(r);
+    return 0;
+}
+
+static void scenario_analytics(void) {
+    char period[32];
+    printf("\n--- Analytics ---\n");
+    if (!read_line("Day (YYYY-MM-DD) or month (YYYY-MM), blank = today:", period, sizeof(period))) return;
+    if (!period[0]) snprintf(period, sizeof(period), "%.10s", current_date);
+    print_analytics(period);
+}
+
+#define QUERY_PAGE 20
+
+typedef struct {
+    long shown;
+    int page;            /* rows per page; 0 = no pauses */
+    int stopped;
+} QueryPager;
+
+static int query_show(const CsvRow *row, void *ctx) {
+    QueryPager *pg = ctx;
+    if (pg->shown++ == 0) query_print_header(stdout);
+    query_print_row(stdout, row);
+    if (pg->page > 0 && pg->shown % pg->page == 0) {
+        char buf[16];
+        printf("-- %ld shown: Enter for more, q to stop --\n", pg->shown);
+        fflush(stdout);
+        if (!fgets(buf, sizeof(buf), stdin) || buf[0] == 'q' || buf[0] == 'Q') pg->stopped = 1;
+    }
+    return pg->stopped;
+}
+
+/* Run a filter spec (see query.h) and stream the matches. */
+static int run_query(const char *spec, int page) {
+    QueryStats st;
+    QueryPager pg = { .page = page };
+    char why[BUF];
+    if (exchange_query(spec, query_show, &pg, &st, why, sizeof(why)) != EXCHANGE_OK) {
+        printf("[-] Query: %s\n", why);
+        fflush(stdout);
+        return -1;
+    }
+    printf("%s%ld of %ld row(s) matched; %d file(s) read; %.1f MB in %.1f ms\n\n",
+           pg.stopped ? "(stopped) " : "", st.rows_matched, st.rows_scanned, st.files,
+           st.bytes / 1e6, st.seconds * 1e3);
+    fflush(stdout);
+    return 0;
+}
+
+static void scenario_query(void) {
+    char spec[BUF];
+    printf("\n--- Query transactions ---\n");
+    printf("Filters: date=D | from=D to=D, pair=EUR/USD (* = any), amount=LO..HI,\n");
+    printf("         profit=LO..HI, partial=0|1, time=HH:MM-HH:MM   (blank = today)\n");
+    if (!read_line("Query:", spec, sizeof(spec))) return;
+    if (!spec[0]) snprintf(spec, sizeof(spec), "date=%.10s", current_date);
+    run_query(spec, QUERY_PAGE);
+}
+
+/* Fold closed days before `before` (default and at most today) into
+   monthly archives. */
+static int run_compact(const char *before) {
+    char cutoff[16];
+    snprintf(cutoff, sizeof(cutoff), "%.10s", before && strcmp(before, current_date) < 0 ? before : current_date);
+    ArchiveStats st;
+    int rc = archive_compact(cutoff, &st);
+    printf("Compacted %d day(s) before %s into %d monthly archive(s): %ld row(s), %ld kept verbatim.\n",
+           st.days, cutoff, st.months, st.rows, st.verbatim);
+    if (st.days > 0) {
+        int64_t loose = st.csv_bytes + st.receipt_bytes;
+        printf("%.1f KB of day files (%.1f KB CSV) -> %.1f KB of archives (%.1fx)\n", loose / 1e3,
+               st.csv_bytes / 1e3, st.archive_bytes / 1e3,
+               st.archive_bytes ? (double)loose / (double)st.archive_bytes : 0.0);
+    }
+    fflush(stdout);
+    return rc;
+}
+
+/* A day's receipts, from the receipts file or the day's archive. */
+static int print_receipts(const char *date_text) {
+    char fname[64];
+    make_receipt_name(date_text, fname, sizeof(fname));
+    FILE *f = fopen(fname, "r");
+    if (f) {
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) fwrite(buf, 1, n, stdout);
+        fclose(f);
+        return 0;
+    }
+    char *text = NULL;
+    size_t len = 0;
+    if (archive_day_receipts(date_text, &text, &len) != 0 || len == 0) {
+        printf("[-] No receipts for %s.\n", date_text);
+        free(text);
+        return -1;
+    }
+    fwrite(text, 1, len, stdout);
+    free(text);
+    return 0;
+}
+
+/* Rates of one currency (or all, code "*") in force at a time. */
+static int print_rates_at(const char *code, const char *when) {
+    int64_t at;
+    if (ratehist_parse_time(when, &at) != 0) {
+        printf("[-] Time must be YYYY-MM-DD or \"YYYY-MM-DD HH:MM[:SS]\".\n");
+        return -1;
+    }
+    int one = strcmp(code, "*") != 0 ? currency_from_code(code) : -1;
+    if (strcmp(code, "*") != 0 && one < 0) {
+        printf("[-] Unknown currency '%s'.\n", code);
+        return -1;
+    }
+    char stamp[32];
+    time_t t = (time_t)at;
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    printf("Rates in force at %s\n", stamp);
+    printf("Code       BUY->LOC     SELL->LOC  since\n");
+    for (int i = 0; i < cur_count; ++i) {
+        if (one >= 0 && i != one) continue;
+        RateEvent e;
+        int rc = ratehist_as_of(currencies[i].name, at, &e);
+        if (rc < 0) {
+            printf("%-5s  %12s  %12s  (no history)\n", currencies[i].name, "-", "-");
+            continue;
+        }
+        char b[32], s[32], since[40];
+        time_t et = (time_t)e.at;
+        strftime(since, sizeof(since), "%Y-%m-%d %H:%M:%S", localtime(&et));
+        printf("%-5s  %12s  %12s  %s%s\n", currencies[i].name, rate_fmt(b, e.buy), rate_fmt(s, e.sell),
+               rc == 1 ? "(before the history; first known) " : "", since);
+    }
+    fflush(stdout);
+    return 0;
+}
+
+static int reval_show(const RevalDay *d, void *ctx) {
+    (void)ctx;
+    char a[32], b[32], c[32];
+    printf("%-10s %7ld  %16s  %16s  %16s\n", d->date, d->tx_count, money_fmt(a, d->flow_value),
+           money_fmt(b, d->position_value), money_fmt(c, d->revaluation));
+    return 0;
+}
+
+/* Days from..to marked to market, then the current reserves at the rates
+   in force at `when` (default: the close of `to`). */
+static int run_revalue(const char *from, const char *to, const char *when) {
+    int64_t at;
+    if (!valid_date(from) || !valid_date(to) || strcmp(from, to) > 0 ||
+        ratehist_parse_time(when ? when : to, &at) != 0) {
+        printf("[-] Usage: --revalue <from-date> <to-date> [\"YYYY-MM-DD HH:MM[:SS]\"]\n");
+        return -1;
+    }
+    printf("\n=== Revaluation %s .. %s (buy rates at each day's close, LOC) ===\n", from, to);
+    printf("%-10s %7s  %16s  %16s  %16s\n", "date", "tx", "day flows", "position", "revaluation");
+    RevalStats st;
+    if (ratehist_revalue(from, to, reval_show, NULL, &st) != 0) {
+        printf("[-] Revaluation failed.\n");
+        return -1;
+    }
+    printf("%d day(s), %ld row(s)", st.days, st.rows);
+    if (st.unknown_rows) printf(", %ld with currencies not in the registry (left out)", st.unknown_rows);
+    printf("\n");
+    if (st.unpriced) printf("Note: %d currency(ies) have no rate history and are marked at registry rates.\n", st.unpriced);
+
+    Money *value = calloc((size_t)cur_count, sizeof(*value));
+    if (!value) return -1;
+    Money mark = ratehist_reserves_at(at, value);
+    char stamp[32], a[32];
+    time_t t = (time_t)at;
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    printf("Current reserves at the rates of %s:\n", stamp);
+    for (int i = 0; i < cur_count; ++i)
+        if (currencies[i].bal) printf("  %-4s %16s LOC\n", currencies[i].name, money_fmt(a, value[i]));
+    printf("  total %15s LOC\n\n", money_fmt(a, mark));
+    free(value);
+    fflush(stdout);
+    return 0;
+}
+
+/* End-of-day report: the day's totals, volumes, pairs and hours, and the
+   month to date. */
+static void print_daily_summary(const char *date_text) {
+    int64_t t0 = metrics_start(MET_DAILY_REPORT);
+    Rollup *day = malloc(sizeof(*day));
+    if (!day) {
+        fprintf(stderr, "Out of memory for the end-of-day report\n");
+        metrics_end(MET_DAILY_REPORT, t0);
+        return;
+    }
+    if (daycache_rollup(date_text, 1, day) != 0) rollup_day(date_text, day);
+    int tx_count = (int)day->tx_count;
+    Money total_profit = day->profit;
+    Money vol_in[MAX_CUR] = {0}, vol_out[MAX_CUR] = {0};
+    for (int i = 0; i < day->npairs; ++i) {
+        vol_in[day->pair[i].from] += day->pair[i].vol_from;
+        vol_out[day->pair[i].to] += day->pair[i].vol_to;
+    }
+
+    char year_month[8+1];
+    if (strlen(date_text) >= 7) {
+        strncpy(year_month, date_text, 7);
+        year_month[7] = '\0';
+    } else {
+        year_month[0] = '\0';
+    }
+
+    int month_tx_count = 0;
+    Money month_profit = 0;
+    if (year_month[0]) {
+        month_profit = csv_sum_profit_for_month(year_month, &month_tx_count);
+    }
+
+    Money cashier_bonus = money_percent(month_profit, 5);
+    char m1[32], m2[32];
+
+    printf("\n=== End-of-day report for %s ===\n", date_text);
+    printf("Total Transactions: %d\n", tx_count);
+    printf("Total Profit (LOC): %s\n", money_fmt(m1, total_profit));
+    char csv_name[64];
+    make_daily_csv_name(date_text, csv_name, sizeof(csv_name));
+    printf("(Transactions are read from %s)\n", csv_name);
+    if (tx_count > 0) {
+        printf("Volume by currency (received / paid out):\n");
+        for (int i = 0; i < cur_count; ++i) {
+            if (vol_in[i] == 0 && vol_out[i] == 0) continue;
+            printf("  %-4s %16s / %16s\n", currencies[i].name, money_fmt(m1, vol_in[i]), money_fmt(m2, vol_out[i]));
+        }
+        printf("By currency pair:\n");
+        rollup_print_pairs(stdout, day);
+        printf("By hour:\n");
+        rollup_print_hours(stdout, day);
+    }
+    free(day);
+    if (year_month[0]) {
+        printf("Month-to-date Transactions (%s): %d\n", year_month, month_tx_count);
+        printf("Month-to-date Profit (LOC): %s\n", money_fmt(m1, month_profit));
+        printf("Cashier monthly bonus (5%% of month profit): %s\n", money_fmt(m2, cashier_bonus));
+    }
+    printf("\n");
+    fflush(stdout);
+    metrics_end(MET_DAILY_REPORT, t0);
+}
+
 void scenario_end_of_day(const char *current_date) {
-    generate_daily_summary(current_date);
+    print_daily_summary(current_date);
     check_criticals();
 }
 
+static const char *metrics_file = METRICS_FILE;
+
+static void scenario_metrics(void) {
+    if (!metrics_enabled) {
+        printf("[-] Metrics are off (--no-metrics).\n\n");
+        fflush(stdout);
+        return;
+    }
+    printf("\n=== Metrics since start (latencies of sampled calls) ===\n");
+    metrics_print(stdout);
+    DayCacheStats dc;
+    daycache_stats(&dc);
+    printf("Day cache: %d day(s), %ld row(s), %zu KiB of %zu MiB; %ld hit(s), %ld load(s), %ld extend(s), "
+           "%ld eviction(s)\n", dc.days, dc.rows, dc.bytes >> 10, dc.budget >> 20, dc.hits, dc.loads,
+           dc.extends, dc.evictions);
+    if (metrics_write_prom(metrics_file) == 0)
+        printf("Prometheus text written to %s\n", metrics_file);
+    printf("\n");
+    fflush(stdout);
+}
+
+/* Exchange-path latency next to the writer's hand-off-to-disk latency. */
+static void print_write_latency(void) {
+    WriterStats w;
+    writer_stats(&w);
+    if (path_lat.count == 0 && w.records == 0) return;
+    printf("Exchange path: %ld transaction(s), avg %.1f us, max %.1f us (disk writes excluded)\n",
+           path_lat.count, path_lat.count ? path_lat.total_ns / 1e3 / path_lat.count : 0.0,
+           path_lat.max_ns / 1e3);
+    printf("Writer: %ld record(s) in %ld batch(es), avg %.2f ms, max %.2f ms from hand-off to disk\n",
+           w.records, w.batches, w.records ? w.total_ns / 1e6 / w.records : 0.0, w.max_ns / 1e6);
+    fflush(stdout);
+}
+
 static void show_menu(void) {
     printf("============================================\n");
     printf("   [*] Currency Exchange - Main Menu\n");
@@ -325,44 +802,346 @@ static void show_menu(void) {
     printf(" 8) Help/About\n");
     printf(" 9) Add manual transaction (append to CSV)\n");
     printf("10) List transactions for a date\n");
-    printf("11) Search transaction by ID (today)\n");
+    printf("11) Search transaction by ID (any date)\n");
+    printf("12) Reports: month / year / date-range aggregation\n");
+    printf("13) Metrics: latencies and I/O counters\n");
+    printf("14) Query transactions (date range and filters)\n");
+    printf("15) Analytics: currency pairs and hours\n");
     printf(" 0) Exit\n");
     fflush(stdout);
 }
 
-int main(void) {
-    init_defaults();
-    time_t t = time(NULL);
-    struct tm *tm_info = localtime(&t);
-    strftime(current_date, sizeof(current_date), "%Y-%m-%d", tm_info);
-    
+/* Bulk import of an external transaction file; rejects default to
+   <file>.rejects. */
+static int run_import(const char *path, const char *rejects, int workers) {
+    char def[PATH_MAX];
+    if (!rejects) {
+        snprintf(def, sizeof(def), "%s.rejects", path);
+        rejects = def;
+    }
+    ImportStats st;
+    int rc = import_file(path, rejects, workers, &st);
+    printf("Imported %ld of %ld row(s)", st.accepted, st.lines);
+    if (st.accepted) printf(" as tx ids %d-%d", st.first_id, st.last_id);
+    printf(" into %d day file(s): %d new, %d appended, %d merged.\n",
+           st.created + st.appended + st.rewritten, st.created, st.appended, st.rewritten);
+    printf("%ld row(s) rejected -> %s\n", st.rejected, rejects);
+    printf("Checked with %d worker(s) in %.1f ms; sorted and written in %.1f ms; %.1f ms in all.\n",
+           st.workers, st.validate_seconds * 1e3, st.write_seconds * 1e3, st.seconds * 1e3);
+    if (st.short_rows)
+        printf("Note: %ld row(s) could not be paid exactly from the tills; the reserves were debited anyway.\n",
+               st.short_rows);
+    fflush(stdout);
+    return rc;
+}
+
+/* Serve on a socket; the counts and reserves are printed at the end. */
+static int run_server(const char *sock_path) {
+    int lfd = server_listen(sock_path);
+    if (lfd < 0) return 1;
+    printf("Serving on %s (Ctrl-C to stop)\n", sock_path);
+    fflush(stdout);
+    ServerStats st;
+    int rc = server_run(lfd, sock_path, &st);
+    printf("\nServer stopped: %ld exchanges accepted, %ld rejected.\n", st.accepted, st.rejected);
+    for (int i = 0; i < cur_count; ++i) {
+        char a[32];
+        printf("  %s reserve: %s\n", currencies[i].name, money_fmt(a, currencies[i].bal));
+    }
+    fflush(stdout);
+    return rc;
+}
+
+static int send_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/* Send order lines from stdin to a server and print the replies. */
+static int client_run(const char *sock_path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", sock_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, sock_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Could not connect to %s: %s\n", sock_path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    char line[BUF], reply[SERVER_REPLY_MAX];
+    size_t have = 0;
+    long lineno = 0;
+    int rc = 0;
+    while (fgets(line, sizeof(line), stdin)) {
+        ++lineno;
+        size_t L = strlen(line);
+        while (L && (line[L-1] == '\n' || line[L-1] == '\r')) line[--L] = '\0';
+        if (L == 0 || line[0] == '#' || strncasecmp(line, "from", 4) == 0) continue;
+        if (strcasecmp(line, "QUIT") == 0) break;
+        line[L++] = '\n';
+        if (send_all(fd, line, L) != 0) {
+            rc = 1;
+            break;
+        }
+        /* one reply line per request */
+        char *nl = NULL;
+        while (!(nl = memchr(reply, '\n', have))) {
+            ssize_t n = recv(fd, reply + have, sizeof(reply) - have, 0);
+            if (n <= 0) break;
+            have += (size_t)n;
+        }
+        if (!nl) {
+            fprintf(stderr, "Server closed the connection\n");
+            rc = 1;
+            break;
+        }
+        *nl = '\0';
+        printf("line %ld: %s\n", lineno, reply);
+        have -= (size_t)(nl + 1 - reply);
+        memmove(reply, nl + 1, have);
+    }
+    send_all(fd, "QUIT\n", 5);
+    close(fd);
+    fflush(stdout);
+    return rc;
+}
+
+/* Recover the state and say where it came from. */
+static int recover(void) {
+    RecoverStats st;
+    if (snapshot_recover(&st) != 0) return -1;
+    if (!st.source)
+        printf("No state snapshot: opening balances taken from the registry (%.1f ms).\n", st.ms);
+    else
+        printf("State restored from %s + %ld ledger row(s) in %.1f ms.\n", st.source, st.rows, st.ms);
+    fflush(stdout);
+    return 0;
+}
+
+static void print_row(const char *line, void *ctx) {
+    (void)ctx;
+    printf("%s\n", line);
+}
+
+static void print_built_segment(const char *csv_path, long rows, void *ctx) {
+    (void)ctx;
+    printf("  %s: %ld rows\n", csv_path, rows);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--currencies <file>] [--sync tx|rows:N|ms:T|none] [--batch <orders.csv|->]\n", prog);
+    fprintf(stderr, "       (any mode) [--data-dir <dir>] [--metrics-file <file>] [--no-metrics] [--day-cache <MB>]\n");
+    fprintf(stderr, "       %s [--sync ...] --serve <socket>\n", prog);
+    fprintf(stderr, "       %s --client <socket>   (order lines on stdin)\n", prog);
+    fprintf(stderr, "       %s --build-segments\n", prog);
+    fprintf(stderr, "       %s --rebuild-index\n", prog);
+    fprintf(stderr, "       %s [--workers N] --aggregate <from-date> <to-date>\n", prog);
+    fprintf(stderr, "       %s --analytics <YYYY-MM-DD | YYYY-MM>\n", prog);
+    fprintf(stderr, "       %s --compact [before-date]   (archive closed days by month)\n", prog);
+    fprintf(stderr, "       %s --receipts <YYYY-MM-DD>\n", prog);
+    fprintf(stderr, "       %s --rates-at <CODE|*> <\"YYYY-MM-DD[ HH:MM[:SS]]\">\n", prog);
+    fprintf(stderr, "       %s --revalue <from-date> <to-date> [\"YYYY-MM-DD HH:MM[:SS]\"]\n", prog);
+    fprintf(stderr, "       %s --migrate-data   (move flat day files into YYYY/MM partitions)\n", prog);
+    fprintf(stderr, "       %s [--workers N] --import <file.csv> [rejects-file]\n", prog);
+    fprintf(stderr, "       %s --query \"from=D to=D pair=EUR/USD amount=LO..HI profit=LO..HI partial=0|1 time=HH:MM-HH:MM\"\n", prog);
+}
+
+/* Library diagnostics go to stderr, one per line. */
+static void print_diag(const char *msg, void *ctx) {
+    (void)ctx;
+    fprintf(stderr, "%s\n", msg);
+}
+
+static char launch_dir[PATH_MAX];   /* set when a data root is entered */
+
+/* A path from the command line, relative to where the program was started. */
+static const char *from_launch(const char *path) {
+    if (!launch_dir[0] || path[0] == '/' || strcmp(path, "-") == 0) return path;
+    char *p = malloc(strlen(launch_dir) + strlen(path) + 2);
+    if (!p) return path;
+    sprintf(p, "%s/%s", launch_dir, path);
+    return p;
+}
+
+int main(int argc, char **argv) {
+    diag_set_sink(print_diag, NULL);
+    const char *currency_file = NULL;
+    const char *data_dir = getenv(DATA_DIR_ENV);
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (strcmp(argv[i], "--currencies") == 0) currency_file = argv[i+1];
+        if (strcmp(argv[i], "--data-dir") == 0) data_dir = argv[i+1];
+    }
+    if (data_dir && data_dir[0]) {
+        if (!getcwd(launch_dir, sizeof(launch_dir))) launch_dir[0] = '\0';
+        if (currency_file) currency_file = from_launch(currency_file);
+        if (data_root_open(data_dir) != 0) return 1;
+    }
+    init_defaults(currency_file);
+    refresh_current_date();
+    atexit(metrics_dump);
+    atexit(txindex_close);
+    atexit(journal_close);
+    atexit(txid_release);
+    atexit(ratehist_close);
+
+    const char *batch_path = NULL;
+    const char *serve_path = NULL;
+    int have_sync = 0;
+    int workers = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--build-segments") == 0) {
+            printf("Building columnar segments for sales_*.csv...\n");
+            int built = segment_build_all(print_built_segment, NULL);
+            printf("%d segment(s) written.\n", built < 0 ? 0 : built);
+            return built < 0 ? 1 : 0;
+        } else if (strcmp(argv[i], "--rebuild-index") == 0) {
+            long n = txindex_rebuild();
+            if (n < 0) return 1;
+            printf("Transaction index rebuilt: %ld entries.\n", n);
+            return 0;
+        } else if ((strcmp(argv[i], "--currencies") == 0 || strcmp(argv[i], "--data-dir") == 0) && i + 1 < argc) {
+            ++i;                          /* handled above */
+        } else if (strcmp(argv[i], "--migrate-data") == 0) {
+            MigrateStats ms;
+            int rc = data_migrate(&ms);
+            printf("Moved %d flat file(s) into YYYY/MM partitions (%d kept in place); "
+                   "%d partition manifest(s) written.\n", ms.moved, ms.kept, ms.partitions);
+            return rc != 0;
+        } else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+            metrics_file = from_launch(argv[++i]);
+            metrics_set_file(metrics_file);
+        } else if (strcmp(argv[i], "--no-metrics") == 0) {
+            metrics_enabled = 0;
+        } else if (strcmp(argv[i], "--day-cache") == 0 && i + 1 < argc) {
+            daycache_set_budget((size_t)atol(argv[++i]) << 20);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--aggregate") == 0 && i + 2 < argc) {
+            if (!valid_date(argv[i+1]) || !valid_date(argv[i+2])) {
+                fprintf(stderr, "Dates must be YYYY-MM-DD\n");
+                return 2;
+            }
+            print_aggregate("range", argv[i+1], argv[i+2], workers);
+            return 0;
+        } else if (strcmp(argv[i], "--analytics") == 0 && i + 1 < argc) {
+            return print_analytics(argv[i+1]) != 0;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            const char *before = i + 1 < argc && argv[i+1][0] != '-' ? argv[i+1] : NULL;
+            if (before && !valid_date(before)) {
+                fprintf(stderr, "Dates must be YYYY-MM-DD\n");
+                return 2;
+            }
+            if (data_root_lock(1) != 0) return 1;      /* archiving removes day files */
+            if (recover() != 0) return 1;     /* replayed rows land before archiving */
+            return run_compact(before) != 0;
+        } else if (strcmp(argv[i], "--rates-at") == 0 && i + 2 < argc) {
+            return print_rates_at(argv[i+1], argv[i+2]) != 0;
+        } else if (strcmp(argv[i], "--revalue") == 0 && i + 2 < argc) {
+            const char *when = i + 3 < argc && argv[i+3][0] != '-' ? argv[i+3] : NULL;
+            if (data_root_lock(1) != 0) return 1;      /* recovery may cut a torn tail */
+            if (recover() != 0) return 1;     /* current reserves */
+            return run_revalue(argv[i+1], argv[i+2], when) != 0;
+        } else if (strcmp(argv[i], "--import") == 0 && i + 1 < argc) {
+            const char *rejects = i + 2 < argc && argv[i+2][0] != '-' ? from_launch(argv[i+2]) : NULL;
+            if (data_root_lock(1) != 0) return 1;      /* no session may hold the day files */
+            if (recover() != 0) return 1;     /* imported rows move the restored reserves */
+            return run_import(from_launch(argv[i+1]), rejects, workers) != 0;
+        } else if (strcmp(argv[i], "--receipts") == 0 && i + 1 < argc) {
+            return print_receipts(argv[i+1]) != 0;
+        } else if (strcmp(argv[i], "--query") == 0 && i + 1 < argc) {
+            return run_query(argv[i+1], 0) != 0;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_path = from_launch(argv[++i]);
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = from_launch(argv[++i]);
+        } else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+            return client_run(from_launch(argv[i+1]));
+        } else if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc) {
+            JournalPolicy p;
+            if (journal_parse_policy(argv[++i], &p) != 0) {
+                fprintf(stderr, "Invalid --sync policy: %s\n", argv[i]);
+                return 2;
+            }
+            journal_set_policy(&p);
+            have_sync = 1;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    int flat = data_root_flat_files();
+    if (flat > 0)
+        fprintf(stderr, "Note: %d day file(s) are still outside the YYYY/MM partitions and are not "
+                        "read; run --migrate-data to move them.\n", flat);
+    if (data_root_lock(0) != 0) return 1;
+    if (recover() != 0) return 1;
+    if (ratehist_sync() < 0) return 1;      /* registry rates that differ from the history */
+    if (batch_path || serve_path) {
+        if (!have_sync) {
+            JournalPolicy group = { .every_rows = 1000, .every_ms = 200, .fsync_on = 1 };
+            journal_set_policy(&group);
+        }
+        return serve_path ? run_server(serve_path) : run_batch(batch_path);
+    }
+
+    if (writer_start() != 0) return 1;
+    atexit(writer_stop);
     while (1) {
+        refresh_current_date();
+        if (writer_idle()) snapshot_tick();   /* the journal is the writer's while it works */
         show_menu();
-        int choice = ask_int("Choose option:", 0, 11);
+        int choice = ask_int("Choose option:", 0, 15);
+        if (choice >= 7 && choice != 8 && choice != 9) writer_drain();   /* reads the files */
         switch (choice) {
-            case 0: return 0;
+            case 0:
+                writer_stop();
+                return snapshot_write() != 0;
             case 1: scenario_exchange(); break;
             case 2: scenario_show_rates(); break;
             case 3: scenario_mgmt_set_rates(); break;
             case 4: scenario_mgmt_reserves(); break;
             case 5: scenario_mgmt_crit(); break;
             case 6: scenario_show_balances(); break;
-            case 7: scenario_end_of_day(current_date); break;
+            case 7:
+                writer_sync();
+                scenario_end_of_day(current_date);
+                print_write_latency();
+                break;
             case 8: scenario_help(); break;
             case 9: {
-                int from = choose_currency("From currency index:");
-                int to = choose_currency("To currency index:");
-                double amt_from = ask_double("Amount from:", 0.0, 1e12);
-                double amt_to = ask_double("Amount to:", 0.0, 1e12);
-                time_t tt = time(NULL);
-                struct tm *tm2 = localtime(&tt);
-                char timestr[16];
-                strftime(timestr, sizeof(timestr), "%H:%M:%S", tm2);
-                int txid = ++last_transaction_id;
-                csv_append_manual_transaction(current_date, txid, timestr, CUR_NAME[from], CUR_NAME[to],
-                                              amt_from, amt_to, currencies[from].buy_to_loc, currencies[to].sell_to_loc,
-                                              0, 0.0, 0.0);
-                save_last_tx_id(last_transaction_id);
+                int from = choose_currency("From currency:");
+                int to = choose_currency("To currency:");
+                Money amt_from = ask_money("Amount from:", 0, MONEY_MAX);
+                Money amt_to = ask_money("Amount to:", 0, MONEY_MAX);
+                ExchangeQuote q = { .amt_to = amt_to, .rate_from_loc = currencies[from].buy_to_loc,
+                                    .rate_to_loc = currencies[to].sell_to_loc };
+                int txid = exchange_record(WRITER_ROW, from, to, amt_from, 0, &q, NULL);
+                if (txid < 0) {
+                    printf("No transaction id could be leased; nothing was recorded.\n");
+                    break;
+                }
+                /* Moves reserves and tills as replaying the row at startup will. */
+                CsvRow row = { .tx_id = txid, .has_tx_id = 1, .amount_from = amt_from, .amount_to = amt_to };
+                snprintf(row.from, sizeof(row.from), "%s", currencies[from].name);
+                snprintf(row.to, sizeof(row.to), "%s", currencies[to].name);
+                char a[32];
+                if (ledger_apply_row(&row) != 0)
+                    printf("Note: the %s till could not hand out exactly %s; the reserve was debited anyway.\n",
+                           currencies[to].name, money_fmt(a, amt_to));
                 printf("Added transaction id %d\n", txid);
                 break;
             }
@@ -371,16 +1150,30 @@ int main(void) {
                 printf("Enter date (YYYY-MM-DD) or press Enter for today: ");
                 if (!fgets(datebuf, sizeof(datebuf), stdin)) break;
                 size_t L = strlen(datebuf); while (L && (datebuf[L-1]=='\n' || datebuf[L-1]=='\r')) datebuf[--L] = '\0';
-                if (L == 0) strncpy(datebuf, current_date, sizeof(datebuf));
-                csv_list_transactions_for_date(datebuf);
+                if (L == 0) snprintf(datebuf, sizeof(datebuf), "%.10s", current_date);
+                char csv[64];
+                make_daily_csv_name(datebuf, csv, sizeof(csv));
+                printf("Transactions in %s:\n", csv);
+                csv_list_transactions_for_date(datebuf, print_row, NULL);
                 break;
             }
             case 11: {
                 int qid = ask_int("Enter transaction ID to search:", 1, 1000000000);
-                int found = csv_find_transaction_by_id(current_date, qid);
-                if (!found) printf("Transaction %d not found for %s\n", qid, current_date);
+                TxHit hits[16];
+                int found = csv_find_transaction_any_date(qid, hits, 16);
+                for (int k = 0; k < found && k < 16; ++k)
+                    printf("%s: %s%s\n", hits[k].file, hits[k].line,
+                           hits[k].legacy ? "  (legacy row without tx_id)" : "");
+                if (found < 0)
+                    printf("The transaction index could not be read or built; run --rebuild-index.\n");
+                else if (!found)
+                    printf("Transaction %d not found\n", qid);
                 break;
             }
+            case 12: scenario_reports(); break;
+            case 13: scenario_metrics(); break;
+            case 14: scenario_query(); break;
+            case 15: scenario_analytics(); break;
             default: printf("Unknown option\n"); break;
         }
     }
@@ -400,7 +1193,7 @@ int main(void) {
             case 0:
                 printf("[*] Goodbye!\n");
                 fflush(stdout);
-                free(currencies);  
+                currency_free();
                 return 0;
             default:
                 printf("[-] Unknown option.\n");
@@ -0,0 +1,514 @@
+#define _GNU_SOURCE
+
+#include "manifest.h"
+#include "diag.h"
+#include "utils.h"
+#include "codec.h"
+#include "archive.h"
+#include "metrics.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    ManifestEntry *v;
+    int n, cap;
+    int scanned;                /* built from the directory: rows are current */
+} Manifest;
+
+/* Names */
+
+static int digits(const char *s, int n) {
+    for (int i = 0; i < n; ++i)
+        if (s[i] < '0' || s[i] > '9') return 0;
+    return 1;
+}
+
+static int is_month(const char *s) {            /* YYYY-MM */
+    return digits(s, 4) && s[4] == '-' && digits(s + 5, 2);
+}
+
+static int is_date(const char *s) {             /* YYYY-MM-DD */
+    return is_month(s) && s[7] == '-' && digits(s + 8, 2);
+}
+
+/* Kind of a listed file name and its date; 0 for anything else. */
+static int classify(const char *name, char *date) {
+    size_t len = strlen(name);
+    if (len == 20 && strncmp(name, "sales_", 6) == 0 && is_date(name + 6) && strcmp(name + 16, ".csv") == 0) {
+        snprintf(date, 11, "%.10s", name + 6);
+        return MAN_SALES;
+    }
+    if (len == 23 && strncmp(name, "receipts_", 9) == 0 && is_date(name + 9) && strcmp(name + 19, ".txt") == 0) {
+        snprintf(date, 11, "%.10s", name + 9);
+        return MAN_RECEIPTS;
+    }
+    if (len == 17 && strncmp(name, "sales_", 6) == 0 && is_month(name + 6) && strcmp(name + 13, ".arc") == 0) {
+        snprintf(date, 11, "%.7s", name + 6);
+        return MAN_ARCHIVE;
+    }
+    return 0;
+}
+
+/* Day files, sidecars and archives that belong in a partition; the
+   partition's month goes to ym. */
+static int partition_file(const char *name, char *ym) {
+    static const char *const day_ext[] = { ".csv", ".sum", ".seg", ".rollup", ".txt" };
+    const char *d = strncmp(name, "sales_", 6) == 0 ? name + 6
+                  : strncmp(name, "receipts_", 9) == 0 ? name + 9 : NULL;
+    if (!d || !is_month(d)) return 0;
+    snprintf(ym, 8, "%.7s", d);
+    if (strcmp(d + 7, ".arc") == 0) return d == name + 6;
+    if (strnlen(d, 11) < 11 || !is_date(d)) return 0;
+    for (size_t i = 0; i < sizeof(day_ext) / sizeof(day_ext[0]); ++i)
+        if (strcmp(d + 10, day_ext[i]) == 0) return (i == 4) == (d == name + 9);
+    return 0;
+}
+
+void make_partition_name(const char *date_text, char *out, size_t cap) {
+    snprintf(out, cap, "%.4s/%.2s", date_text, date_text + 5);
+}
+
+/* Partition "YYYY/MM" and file name of a path below the root. */
+static int split_path(const char *path, char *part, const char **name) {
+    const char *slash = strrchr(path, '/');
+    if (!slash || slash - path != 7) return -1;
+    snprintf(part, 8, "%.7s", path);
+    *name = slash + 1;
+    return 0;
+}
+
+/* Data root */
+
+int data_root_open(const char *dir) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        diag("Could not create data directory %s: %s", dir, strerror(errno));
+        return -1;
+    }
+    if (chdir(dir) != 0) {
+        diag("Could not enter data directory %s: %s", dir, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int data_root_lock(int exclusive) {
+    static int fd = -1;
+    if (fd >= 0) return 0;
+    fd = open(SESSION_LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        diag("Could not open %s: %s", SESSION_LOCK_FILE, strerror(errno));
+        return -1;
+    }
+    if (flock(fd, (exclusive ? LOCK_EX : LOCK_SH) | LOCK_NB) != 0) {
+        if (errno == EWOULDBLOCK)
+            diag(exclusive ? "A desk or server session is using the data root; "
+                             "stop it first."
+                           : "An import, compaction or revaluation is running on the data "
+                             "root; try again when it has finished.");
+        else
+            diag("Could not lock %s: %s", SESSION_LOCK_FILE, strerror(errno));
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+    return 0;                       /* held until exit */
+}
+
+int data_root_flat_files(void) {
+    DIR *d = opendir(".");
+    if (!d) return 0;
+    int n = 0;
+    char ym[8];
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
+        if (partition_file(e->d_name, ym)) n++;
+    closedir(d);
+    return n;
+}
+
+int partition_prepare(const char *date_text) {
+    char part[16];
+    make_partition_name(date_text, part, sizeof(part));
+    if (access(part, F_OK) == 0) return 0;
+    part[4] = '\0';
+    if (mkdir(part, 0755) != 0 && errno != EEXIST) return -1;
+    part[4] = '/';
+    if (mkdir(part, 0755) != 0 && errno != EEXIST) {
+        diag("Could not create partition %s: %s", part, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Manifest files */
+
+static ManifestEntry *find(Manifest *m, const char *path) {
+    for (int i = 0; i < m->n; ++i)
+        if (strcmp(m->v[i].path, path) == 0) return &m->v[i];
+    return NULL;
+}
+
+static ManifestEntry *add(Manifest *m, const char *path, int kind, const char *date) {
+    if (m->n == m->cap) {
+        int cap = m->cap ? m->cap * 2 : 64;
+        ManifestEntry *g = realloc(m->v, (size_t)cap * sizeof(*g));
+        if (!g) return NULL;
+        m->v = g;
+        m->cap = cap;
+    }
+    ManifestEntry *e = &m->v[m->n++];
+    memset(e, 0, sizeof(*e));
+    snprintf(e->path, sizeof(e->path), "%s", path);
+    snprintf(e->date, sizeof(e->date), "%s", date);
+    e->kind = kind;
+    return e;
+}
+
+/* Well-formed rows of a sales file, or the rows an archive holds. */
+static long count_rows(const char *path, int kind) {
+    if (kind == MAN_ARCHIVE) return archive_file_rows(path);
+    if (kind != MAN_SALES) return 0;
+    CsvReader rd;
+    CsvRow row;
+    if (csv_reader_open(&rd, path) != 0) return 0;
+    while (csv_reader_next(&rd, &row, NULL)) {}
+    long rows = rd.rows;
+    csv_reader_close(&rd);
+    return rows;
+}
+
+/* Read a partition's manifest. Returns 0, 1 if there is none, -1 on error. */
+static int load(const char *part, Manifest *m) {
+    char fname[32], line[256];
+    snprintf(fname, sizeof(fname), "%s/" MANIFEST_FILE, part);
+    FILE *f = fopen(fname, "r");
+    if (!f) return errno == ENOENT ? 1 : -1;
+    metrics_add(MET_FILES_OPENED, 1);
+    int rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), f)) {
+        char name[64], date[11];
+        long rows;
+        long long bytes;
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, "%63s %ld %lld", name, &rows, &bytes) != 3) continue;
+        int kind = classify(name, date);
+        if (!kind) continue;
+        char path[80];
+        snprintf(path, sizeof(path), "%s/%s", part, name);
+        ManifestEntry *e = add(m, path, kind, date);
+        if (!e) rc = -1;
+        else e->rows = rows, e->bytes = bytes;
+    }
+    fclose(f);
+    return rc;
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    const ManifestEntry *x = a, *y = b;
+    int c = strcmp(x->date, y->date);
+    return c ? c : x->kind - y->kind;
+}
+
+static int save(const char *part, Manifest *m) {
+    char fname[32], tmp[40];
+    snprintf(fname, sizeof(fname), "%s/" MANIFEST_FILE, part);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+    if (m->n > 1) qsort(m->v, (size_t)m->n, sizeof(*m->v), cmp_entry);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    int ok = fprintf(f, "# file rows bytes\n") > 0;
+    for (int i = 0; ok && i < m->n; ++i)
+        ok = fprintf(f, "%s %ld %lld\n", m->v[i].path + 8, m->v[i].rows, (long long)m->v[i].bytes) > 0;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, fname) != 0) {
+        diag("Could not write %s: %s", fname, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* The partition's entries from its directory. */
+static int scan(const char *part, Manifest *m) {
+    DIR *d = opendir(part);
+    if (!d) return -1;
+    int rc = 0;
+    struct dirent *e;
+    while (rc == 0 && (e = readdir(d)) != NULL) {
+        char date[11], path[80];
+        int kind = classify(e->d_name, date);
+        struct stat st;
+        if (!kind) continue;
+        snprintf(path, sizeof(path), "%s/%.32s", part, e->d_name);
+        if (stat(path, &st) != 0) continue;
+        ManifestEntry *me = add(m, path, kind, date);
+        if (!me) rc = -1;
+        else me->rows = count_rows(path, kind), me->bytes = st.st_size;
+    }
+    closedir(d);
+    return rc;
+}
+
+static int lock_partition(const char *part) {
+    int fd = open(part, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void unlock_partition(int fd) {
+    if (fd < 0) return;
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/* Load (or build) a partition's manifest under its lock. Returns the lock
+   fd, or -1. */
+static int open_locked(const char *part, Manifest *m) {
+    memset(m, 0, sizeof(*m));
+    int lk = lock_partition(part);
+    if (lk < 0) return -1;
+    int rc = load(part, m);
+    if (rc == 1) rc = scan(part, m), m->scanned = 1;
+    if (rc != 0) {
+        unlock_partition(lk);
+        free(m->v);
+        return -1;
+    }
+    return lk;
+}
+
+static int close_locked(const char *part, Manifest *m, int lk, int dirty) {
+    int rc = dirty || m->scanned ? save(part, m) : 0;
+    unlock_partition(lk);
+    free(m->v);
+    return rc;
+}
+
+/* Update */
+
+int manifest_set(const char *path, long rows, int64_t bytes) {
+    char part[8], date[11];
+    const char *name;
+    int kind;
+    if (split_path(path, part, &name) != 0 || !(kind = classify(name, date))) return -1;
+    if (rows < 0) rows = count_rows(path, kind);
+    Manifest m;
+    int lk = open_locked(part, &m);
+    if (lk < 0) return -1;
+    ManifestEntry *e = find(&m, path);
+    if (!e) e = add(&m, path, kind, date);
+    if (e) e->rows = rows, e->bytes = bytes;
+    return close_locked(part, &m, lk, e != NULL) == 0 && e ? 0 : -1;
+}
+
+int manifest_note_day(const char *date_text, long rows, int64_t csv_bytes) {
+    char part[16], csv[64], rec[64];
+    make_partition_name(date_text, part, sizeof(part));
+    make_daily_csv_name(date_text, csv, sizeof(csv));
+    make_receipt_name(date_text, rec, sizeof(rec));
+    Manifest m;
+    int lk = open_locked(part, &m);
+    if (lk < 0) return -1;
+    ManifestEntry *e = find(&m, csv);
+    if (!e && (e = add(&m, csv, MAN_SALES, date_text)) != NULL)
+        e->rows = count_rows(csv, MAN_SALES) - rows;    /* rows already there */
+    else if (e && m.scanned)
+        e->rows -= rows;                                /* the scan counted them */
+    if (e) e->rows += rows, e->bytes = csv_bytes;
+    struct stat st;
+    if (e && stat(rec, &st) == 0) {
+        ManifestEntry *r = find(&m, rec);
+        if (!r) r = add(&m, rec, MAN_RECEIPTS, date_text);
+        if (r) r->bytes = st.st_size;
+    }
+    return close_locked(part, &m, lk, e != NULL) == 0 && e ? 0 : -1;
+}
+
+int manifest_sync(const char *path) {
+    char part[8], date[11];
+    const char *name;
+    int kind;
+    if (split_path(path, part, &name) != 0 || !(kind = classify(name, date))) return -1;
+    struct stat st;
+    int gone = stat(path, &st) != 0;
+    Manifest m;
+    int lk = open_locked(part, &m);
+    if (lk < 0) return -1;
+    ManifestEntry *e = find(&m, path);
+    int dirty = 0;
+    if (gone && e) {
+        *e = m.v[--m.n];
+        dirty = 1;
+    } else if (!gone && (!e || e->bytes != (int64_t)st.st_size)) {
+        if (!e) e = add(&m, path, kind, date);
+        if (e) e->rows = count_rows(path, kind), e->bytes = st.st_size;
+        dirty = e != NULL;
+    }
+    return close_locked(part, &m, lk, dirty);
+}
+
+int manifest_drop(const char *path) {
+    char part[8];
+    const char *name;
+    if (split_path(path, part, &name) != 0) return -1;
+    Manifest m;
+    int lk = open_locked(part, &m);
+    if (lk < 0) return -1;
+    ManifestEntry *e = find(&m, path);
+    if (e) *e = m.v[--m.n];
+    return close_locked(part, &m, lk, e != NULL);
+}
+
+/* Listing */
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+/* Entries (all-digit names of the given length) of a directory within
+   [lo, hi] by their first len characters, sorted. */
+static int list_dirs(const char *dir, int len, const char *lo, const char *hi, char (**out)[8]) {
+    DIR *d = opendir(dir);
+    if (!d) return errno == ENOENT ? 0 : -1;
+    char (*v)[8] = NULL;
+    int n = 0, cap = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        const char *name = e->d_name;
+        if ((int)strlen(name) != len || !digits(name, len)) continue;
+        if (strncmp(name, lo, (size_t)len) < 0 || strncmp(name, hi, (size_t)len) > 0) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            char (*g)[8] = realloc(v, (size_t)cap * sizeof(*v));
+            if (!g) {
+                free(v);
+                closedir(d);
+                return -1;
+            }
+            v = g;
+        }
+        snprintf(v[n++], sizeof(*v), "%s", name);
+    }
+    closedir(d);
+    if (n > 1) qsort(v, (size_t)n, sizeof(*v), cmp_name);
+    *out = v;
+    return n;
+}
+
+static int in_range(const ManifestEntry *e, const char *from, const char *to) {
+    size_t len = strlen(e->date);      /* archives match by month */
+    return strncmp(e->date, from, len) >= 0 && strncmp(e->date, to, len) <= 0;
+}
+
+int manifest_list(const char *from_date, const char *to_date, int kinds, ManifestEntry **out) {
+    *out = NULL;
+    Manifest all = { 0 };
+    char (*years)[8] = NULL;
+    int ny = list_dirs(".", 4, from_date, to_date, &years), rc = ny < 0 ? -1 : 0;
+    for (int y = 0; rc == 0 && y < ny; ++y) {
+        /* Months bound only in the first and last year of the range. */
+        const char *lo = strlen(from_date) >= 7 && strncmp(years[y], from_date, 4) == 0 ? from_date + 5 : "00";
+        const char *hi = strlen(to_date) >= 7 && strncmp(years[y], to_date, 4) == 0 ? to_date + 5 : "99";
+        char (*months)[8] = NULL;
+        int nm = list_dirs(years[y], 2, lo, hi, &months);
+        if (nm < 0) rc = -1;
+        for (int k = 0; rc == 0 && k < nm; ++k) {
+            char part[16];
+            Manifest m = { 0 };
+            snprintf(part, sizeof(part), "%s/%s", years[y], months[k]);
+            int got = load(part, &m);
+            if (got == 1) {                 /* no manifest yet: build it from the directory */
+                free(m.v);
+                int lk = open_locked(part, &m);
+                got = lk < 0 ? -1 : close_locked(part, &m, lk, 1);
+                memset(&m, 0, sizeof(m));
+                if (got == 0) got = load(part, &m);
+            }
+            for (int i = 0; got == 0 && i < m.n; ++i) {
+                const ManifestEntry *e = &m.v[i];
+                if (!(e->kind & kinds) || !in_range(e, from_date, to_date)) continue;
+                ManifestEntry *c = add(&all, e->path, e->kind, e->date);
+                if (!c) got = -1;
+                else *c = *e;
+            }
+            if (got < 0) rc = -1;
+            free(m.v);
+        }
+        free(months);
+    }
+    free(years);
+    if (rc != 0) {
+        free(all.v);
+        return -1;
+    }
+    if (all.n > 1) qsort(all.v, (size_t)all.n, sizeof(*all.v), cmp_entry);
+    *out = all.v;
+    return all.n;
+}
+
+/* Migration */
+
+int data_migrate(MigrateStats *st) {
+    memset(st, 0, sizeof(*st));
+    DIR *d = opendir(".");
+    if (!d) {
+        diag("Could not open directory: %s", strerror(errno));
+        return -1;
+    }
+    int rc = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        char ym[8], target[96];
+        const char *name = e->d_name;
+        if (!partition_file(name, ym)) continue;
+        if (partition_prepare(ym) != 0) {
+            rc = -1;
+            continue;
+        }
+        snprintf(target, sizeof(target), "%.4s/%.2s/%.64s", ym, ym + 5, name);
+        if (access(target, F_OK) == 0) {
+            diag("Kept %s: %s already exists", name, target);
+            st->kept++;
+        } else if (rename(name, target) != 0) {
+            diag("Could not move %s: %s", name, strerror(errno));
+            rc = -1;
+        } else {
+            st->moved++;
+        }
+    }
+    closedir(d);
+
+    char (*years)[8] = NULL;
+    int ny = list_dirs(".", 4, "0000", "9999", &years);
+    for (int y = 0; y < ny; ++y) {
+        char (*months)[8] = NULL;
+        int nm = list_dirs(years[y], 2, "00", "99", &months);
+        for (int k = 0; k < nm; ++k) {
+            char part[16];
+            Manifest m = { 0 };
+            snprintf(part, sizeof(part), "%s/%s", years[y], months[k]);
+            int lk = lock_partition(part);
+            if (lk < 0 || scan(part, &m) != 0) {
+                unlock_partition(lk);
+                free(m.v);
+                rc = -1;
+                continue;
+            }
+            if (close_locked(part, &m, lk, 1) == 0) st->partitions++;
+            else rc = -1;
+        }
+        free(months);
+    }
+    free(years);
+    return ny < 0 ? -1 : rc;
+}
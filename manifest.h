@@ -0,0 +1,83 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Data root, month partitions and their manifests.
+ *
+ * Day files live under the data root (--data-dir, $EXCHANGE_DATA_DIR, or
+ * the working directory) in YYYY/MM/ partitions: sales_<date>.csv, its
+ * sidecars, receipts_<date>.txt and the month's archive. State files
+ * (state.snap, tx_id.lease, the tx index, session.lock) stay at the root.
+ *
+ * Each partition has a text manifest listing its day files with row
+ * counts and byte sizes. Readers list files through the manifests of the
+ * partitions in their date range instead of scanning directories; the
+ * journal updates the open day's entry at every commit. An update takes
+ * an flock on the partition, rewrites the manifest to a temporary file
+ * and renames it over the old one. A partition without a manifest gets
+ * one built from its directory the first time it is listed. */
+
+#define DATA_DIR_ENV "EXCHANGE_DATA_DIR"
+#define MANIFEST_FILE "manifest"
+#define SESSION_LOCK_FILE "session.lock"
+
+enum {
+    MAN_SALES = 1,              /* sales_<date>.csv */
+    MAN_RECEIPTS = 2,           /* receipts_<date>.txt */
+    MAN_ARCHIVE = 4             /* sales_<YYYY-MM>.arc */
+};
+
+typedef struct {
+    char path[48];              /* YYYY/MM/<name>, relative to the data root */
+    char date[11];              /* YYYY-MM-DD; YYYY-MM for an archive */
+    int kind;
+    long rows;                  /* CSV rows (archive: rows archived; receipts: 0) */
+    int64_t bytes;
+} ManifestEntry;
+
+/* Create the data root if needed and make it the working directory.
+   Returns 0, or -1 with a message. */
+int data_root_open(const char *dir);
+/* Take the data root's session lock (SESSION_LOCK_FILE) for the rest of
+   the process: shared for a desk, batch or server session, exclusive for
+   the commands that recover and rewrite state or day files outside one
+   (--import, --compact, --revalue). Never waits. Returns 0, or -1
+   with a message when the other kind holds it. */
+int data_root_lock(int exclusive);
+/* Sales or receipt files still at the root, from before partitions. */
+int data_root_flat_files(void);
+
+/* "YYYY/MM" of a date or a month. */
+void make_partition_name(const char *date_text, char *out, size_t cap);
+/* Create the partition directory of a date. Returns 0 or -1. */
+int partition_prepare(const char *date_text);
+
+/* Entry of a file: set rows and bytes outright (rows < 0: count the
+   file's rows). Returns 0 or -1. */
+int manifest_set(const char *path, long rows, int64_t bytes);
+/* Journal commit: add rows to the day's sales entry and set its size, and
+   take the receipts entry's size from the file. Returns 0 or -1. */
+int manifest_note_day(const char *date_text, long rows, int64_t csv_bytes);
+/* Bring the entry in line with the file when its size differs (rows are
+   counted again); drops it if the file is gone. */
+int manifest_sync(const char *path);
+int manifest_drop(const char *path);
+
+/* Entries of the given kinds dated from..to (archives: by month), by date
+   then kind. Returns the count (*out malloc'd) or -1. */
+int manifest_list(const char *from_date, const char *to_date, int kinds, ManifestEntry **out);
+
+typedef struct {
+    int moved;                  /* flat files moved into partitions */
+    int kept;                   /* left in place: the partition has the file */
+    int partitions;             /* manifests rebuilt */
+} MigrateStats;
+
+/* Move flat day files, sidecars and archives at the root into their
+   partitions, then rebuild every partition's manifest from its directory.
+   Returns 0, or -1 if a move failed. */
+int data_migrate(MigrateStats *st);
+
+#endif /* MANIFEST_H */
@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+
+#include "metrics.h"
+#include "diag.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Buckets: values below 16 ns exactly, then 16 per power of two up to 2^36 ns. */
+#define SUB_BITS 4
+#define SUB (1 << SUB_BITS)
+#define MAX_EXP 36
+#define BUCKETS ((MAX_EXP - SUB_BITS + 1) * SUB)
+
+static const char *const op_name[MET_OPS] = {
+    "exchange", "csv_log_row", "receipt", "journal_commit", "day_summary", "month_profit",
+    "list_date", "find_by_id", "find_any_date", "daily_report", "aggregate",
+    "snapshot_write", "recover", "txid_lease", "query", "rollup", "archive_read"
+};
+
+static const struct { const char *name, *help; } counter_info[MET_COUNTERS] = {
+    { "rows_read", "Sales rows read" },
+    { "bytes_read", "Sales file bytes read" },
+    { "rows_written", "Sales rows appended" },
+    { "bytes_written", "Sales row and receipt bytes written" },
+    { "files_opened", "Data files opened" },
+    { "parse_failures", "Malformed rows skipped by readers" },
+};
+
+/* Written only by the owning thread, read by anyone. */
+typedef _Atomic uint64_t Cell;
+
+typedef struct Shard {
+    MetricsHot hot;                   /* first: a MetricsHot * is a Shard * */
+    Cell timed[MET_OPS];
+    Cell sum_ns[MET_OPS];
+    Cell max_ns[MET_OPS];
+    Cell hist[MET_OPS][BUCKETS];
+    struct Shard *next;
+    int in_use;
+} Shard;
+
+int metrics_enabled = 1;
+
+static Shard *shards;                 /* never freed; reused after their thread exits */
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t shard_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+_Thread_local MetricsHot *metrics_hot;
+static const char *dump_file = METRICS_FILE;
+
+static inline uint64_t get(const Cell *c) {
+    return atomic_load_explicit((Cell *)c, memory_order_relaxed);
+}
+
+static void shard_release(void *p) {
+    pthread_mutex_lock(&shards_lock);
+    ((Shard *)p)->in_use = 0;
+    pthread_mutex_unlock(&shards_lock);
+}
+
+static void make_key(void) {
+    pthread_key_create(&shard_key, shard_release);
+}
+
+MetricsHot *metrics_attach(void) {
+    if (metrics_hot) return metrics_hot;
+    pthread_once(&key_once, make_key);
+    pthread_mutex_lock(&shards_lock);
+    Shard *s = shards;
+    while (s && s->in_use) s = s->next;
+    if (!s && (s = calloc(1, sizeof(*s))) != NULL) {
+        s->next = shards;
+        shards = s;
+    }
+    if (s) s->in_use = 1;
+    pthread_mutex_unlock(&shards_lock);
+    if (s) pthread_setspecific(shard_key, s);
+    return metrics_hot = s ? &s->hot : NULL;
+}
+
+int64_t metrics_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bucket_of(uint64_t v) {
+    if (v < SUB) return (int)v;
+    if (v >> MAX_EXP) return BUCKETS - 1;
+    int e = 63 - __builtin_clzll(v);
+    return (e - SUB_BITS + 1) * SUB + (int)((v >> (e - SUB_BITS)) & (SUB - 1));
+}
+
+/* Middle of a bucket, the value reported for everything in it. */
+static double bucket_mid(int b) {
+    if (b < SUB) return b;
+    int e = b / SUB + SUB_BITS - 1;
+    uint64_t width = 1ULL << (e - SUB_BITS);
+    return (double)((uint64_t)(SUB + b % SUB) * width) + (width - 1) / 2.0;
+}
+
+void metrics_record(MetricOp op, int64_t start) {
+    Shard *s = (Shard *)metrics_hot;
+    uint64_t d = (uint64_t)(metrics_clock() - start);
+    metrics_bump(&s->timed[op], 1);
+    metrics_bump(&s->sum_ns[op], d);
+    if (d > get(&s->max_ns[op])) atomic_store_explicit(&s->max_ns[op], d, memory_order_relaxed);
+    metrics_bump(&s->hist[op][bucket_of(d)], 1);
+}
+
+/* Totals over every shard. */
+typedef struct {
+    uint64_t calls[MET_OPS], timed[MET_OPS], sum_ns[MET_OPS], max_ns[MET_OPS];
+    uint64_t hist[MET_OPS][BUCKETS];
+    uint64_t counter[MET_COUNTERS];
+} Totals;
+
+static Totals *collect(void) {
+    Totals *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    pthread_mutex_lock(&shards_lock);
+    for (const Shard *s = shards; s; s = s->next) {
+        for (int op = 0; op < MET_OPS; ++op) {
+            t->calls[op] += get(&s->hot.calls[op]);
+            t->timed[op] += get(&s->timed[op]);
+            t->sum_ns[op] += get(&s->sum_ns[op]);
+            if (get(&s->max_ns[op]) > t->max_ns[op]) t->max_ns[op] = get(&s->max_ns[op]);
+            for (int b = 0; b < BUCKETS; ++b) t->hist[op][b] += get(&s->hist[op][b]);
+        }
+        for (int c = 0; c < MET_COUNTERS; ++c) t->counter[c] += get(&s->hot.counter[c]);
+    }
+    pthread_mutex_unlock(&shards_lock);
+    return t;
+}
+
+static double percentile_ns(const Totals *t, int op, int p) {
+    uint64_t want = (t->timed[op] * (uint64_t)p + 99) / 100, seen = 0;
+    if (want == 0) want = 1;
+    for (int b = 0; b < BUCKETS; ++b) {
+        seen += t->hist[op][b];
+        if (seen >= want) {
+            double v = bucket_mid(b);
+            return v < (double)t->max_ns[op] ? v : (double)t->max_ns[op];
+        }
+    }
+    return (double)t->max_ns[op];
+}
+
+uint64_t metrics_counter(MetricCounter c) {
+    uint64_t n = 0;
+    pthread_mutex_lock(&shards_lock);
+    for (const Shard *s = shards; s; s = s->next) n += get(&s->hot.counter[c]);
+    pthread_mutex_unlock(&shards_lock);
+    return n;
+}
+
+void metrics_print(FILE *out) {
+    Totals *t = collect();
+    if (!t) return;
+    fprintf(out, "%-16s %10s %10s %10s %10s %10s\n", "operation", "calls", "p50 us", "p90 us", "p99 us", "max us");
+    for (int op = 0; op < MET_OPS; ++op) {
+        if (t->calls[op] == 0) continue;
+        fprintf(out, "%-16s %10llu %10.1f %10.1f %10.1f %10.1f\n", op_name[op],
+                (unsigned long long)t->calls[op], percentile_ns(t, op, 50) / 1e3,
+                percentile_ns(t, op, 90) / 1e3, percentile_ns(t, op, 99) / 1e3, t->max_ns[op] / 1e3);
+    }
+    for (int c = 0; c < MET_COUNTERS; ++c)
+        fprintf(out, "%s%s %llu", c ? ", " : "", counter_info[c].name, (unsigned long long)t->counter[c]);
+    fprintf(out, "\n");
+    free(t);
+}
+
+static void write_prom(FILE *f, const Totals *t) {
+    fprintf(f, "# HELP exchange_op_duration_seconds Latency of store and exchange operations (sampled).\n");
+    fprintf(f, "# TYPE exchange_op_duration_seconds histogram\n");
+    for (int op = 0; op < MET_OPS; ++op) {
+        if (t->calls[op] == 0) continue;
+        /* Powers of 4 from 256 ns to 16 s: exact bucket boundaries. */
+        uint64_t cum = 0;
+        int b = 0;
+        for (int e = 8; e <= 34; e += 2) {
+            for (; b < (e - SUB_BITS + 1) * SUB; ++b) cum += t->hist[op][b];
+            fprintf(f, "exchange_op_duration_seconds_bucket{op=\"%s\",le=\"%.9g\"} %llu\n",
+                    op_name[op], (double)(1ULL << e) / 1e9, (unsigned long long)cum);
+        }
+        fprintf(f, "exchange_op_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n",
+                op_name[op], (unsigned long long)t->timed[op]);
+        fprintf(f, "exchange_op_duration_seconds_sum{op=\"%s\"} %.9f\n", op_name[op], t->sum_ns[op] / 1e9);
+        fprintf(f, "exchange_op_duration_seconds_count{op=\"%s\"} %llu\n",
+                op_name[op], (unsigned long long)t->timed[op]);
+    }
+    fprintf(f, "# HELP exchange_op_calls_total Calls of each operation, timed or not.\n");
+    fprintf(f, "# TYPE exchange_op_calls_total counter\n");
+    for (int op = 0; op < MET_OPS; ++op)
+        if (t->calls[op])
+            fprintf(f, "exchange_op_calls_total{op=\"%s\"} %llu\n", op_name[op], (unsigned long long)t->calls[op]);
+    for (int c = 0; c < MET_COUNTERS; ++c) {
+        fprintf(f, "# HELP exchange_%s_total %s.\n", counter_info[c].name, counter_info[c].help);
+        fprintf(f, "# TYPE exchange_%s_total counter\n", counter_info[c].name);
+        fprintf(f, "exchange_%s_total %llu\n", counter_info[c].name, (unsigned long long)t->counter[c]);
+    }
+}
+
+int metrics_write_prom(const char *path) {
+    Totals *t = collect();
+    if (!t) return -1;
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        diag("Could not write %s: %s", tmp, strerror(errno));
+        free(t);
+        return -1;
+    }
+    write_prom(f, t);
+    free(t);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        diag("Could not write %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_set_file(const char *path) {
+    dump_file = path ? path : METRICS_FILE;
+}
+
+void metrics_dump(void) {
+    if (metrics_enabled && shards) metrics_write_prom(dump_file);
+}
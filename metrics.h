@@ -0,0 +1,108 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Operation latency histograms and I/O counters.
+ *
+ * Each thread records into its own shard, so the hot path takes no lock
+ * and no locked instruction; readers add the shards up. Latencies go into
+ * log-linear buckets (HDR style: 16 sub-buckets per power of two, reported
+ * at the bucket middle, so every value is kept to within about 3%). The first METRICS_FULL calls of an
+ * operation on a thread are all timed, later ones one in METRICS_SAMPLE;
+ * call counts and I/O counters are always exact.
+ *
+ * The totals can be printed or written as a Prometheus text file. */
+
+#define METRICS_FULL 1024
+#define METRICS_SAMPLE 256            /* a power of two */
+#define METRICS_FILE "metrics.prom"
+
+typedef enum {
+    MET_EXCHANGE,          /* one exchange: quote, commit and record */
+    MET_CSV_LOG_ROW,       /* csv_log_row / csv_log_transaction */
+    MET_RECEIPT,           /* receipt_write / generate_receipt */
+    MET_JOURNAL_COMMIT,
+    MET_DAY_SUMMARY,       /* csv_sum_profit_for_date */
+    MET_MONTH_PROFIT,      /* csv_sum_profit_for_month */
+    MET_LIST_DATE,         /* csv_list_transactions_for_date */
+    MET_FIND_BY_ID,        /* csv_find_transaction_by_id */
+    MET_FIND_ANY_DATE,     /* csv_find_transaction_any_date */
+    MET_DAILY_REPORT,      /* generate_daily_summary */
+    MET_AGGREGATE,         /* aggregate_range */
+    MET_SNAPSHOT_WRITE,
+    MET_RECOVER,           /* snapshot_recover */
+    MET_TXID_LEASE,
+    MET_QUERY,             /* query_run */
+    MET_ROLLUP,            /* rollup_day */
+    MET_ARCHIVE_READ,      /* archive_day_text */
+    MET_OPS
+} MetricOp;
+
+typedef enum {
+    MET_ROWS_READ,
+    MET_BYTES_READ,
+    MET_ROWS_WRITTEN,
+    MET_BYTES_WRITTEN,
+    MET_FILES_OPENED,
+    MET_PARSE_FAILURES,    /* malformed rows skipped by readers */
+    MET_COUNTERS
+} MetricCounter;
+
+/* 0 turns recording off (--no-metrics). */
+extern int metrics_enabled;
+
+/* A thread's call counts and I/O counters, bumped inline by their owner
+   (relaxed load + store, no lock prefix) and added up by readers. */
+typedef struct {
+    _Atomic uint64_t calls[MET_OPS];
+    _Atomic uint64_t counter[MET_COUNTERS];
+} MetricsHot;
+
+extern _Thread_local MetricsHot *metrics_hot;
+/* The calling thread's shard, created on first use; NULL if out of memory. */
+MetricsHot *metrics_attach(void);
+int64_t metrics_clock(void);
+void metrics_record(MetricOp op, int64_t start);
+
+static inline void metrics_bump(_Atomic uint64_t *c, uint64_t n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/* Start timing a call of `op`: a timestamp, or 0 if this call is not timed. */
+static inline int64_t metrics_start(MetricOp op) {
+    MetricsHot *h = metrics_hot;
+    if (!metrics_enabled || (!h && !(h = metrics_attach()))) return 0;
+    uint64_t n = atomic_load_explicit(&h->calls[op], memory_order_relaxed) + 1;
+    atomic_store_explicit(&h->calls[op], n, memory_order_relaxed);
+    if (n > METRICS_FULL && (n & (METRICS_SAMPLE - 1))) return 0;
+    return metrics_clock();
+}
+
+/* Record the call started at `start` (nothing if start is 0). */
+static inline void metrics_end(MetricOp op, int64_t start) {
+    if (start) metrics_record(op, start);
+}
+
+static inline void metrics_add(MetricCounter c, long n) {
+    MetricsHot *h = metrics_hot;
+    if (!metrics_enabled || n <= 0 || (!h && !(h = metrics_attach()))) return;
+    metrics_bump(&h->counter[c], (uint64_t)n);
+}
+
+/* An I/O counter added up over every thread. */
+uint64_t metrics_counter(MetricCounter c);
+/* Calls, p50/p90/p99/max and the I/O counters, human readable. */
+void metrics_print(FILE *out);
+/* Write the Prometheus text format to `path` (temporary file + rename).
+   Returns 0 or -1. */
+int metrics_write_prom(const char *path);
+/* File written by metrics_dump(); NULL keeps METRICS_FILE. */
+void metrics_set_file(const char *path);
+/* metrics_write_prom() to the configured file if anything was recorded;
+   registered with atexit(). */
+void metrics_dump(void);
+
+#endif /* METRICS_H */
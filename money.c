@@ -0,0 +1,116 @@
+#include "money.h"
+#include <string.h>
+
+static const int64_t POW10_I64[] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL,
+    100000000LL, 1000000000LL, 10000000000LL
+};
+
+/* num / den rounded half away from zero; den > 0. A quotient outside
+   int64 saturates to INT64_MAX or -INT64_MAX. */
+static int64_t div_round(__int128 num, int64_t den) {
+    __int128 q = num / den, r = num % den;
+    if (r < 0) r = -r;
+    if (2 * r >= den) q += num < 0 ? -1 : 1;
+    if (q > INT64_MAX) return INT64_MAX;
+    if (q < -INT64_MAX) return -INT64_MAX;
+    return (int64_t)q;
+}
+
+Money money_mul_rate(Money amount, Rate rate) {
+    return div_round((__int128)amount * rate, RATE_SCALE);
+}
+
+Money money_div_rate(Money amount, Rate rate) {
+    if (rate <= 0) return 0;
+    return div_round((__int128)amount * RATE_SCALE, rate);
+}
+
+Rate rate_of(Money to, Money from) {
+    if (from == 0) return 0;
+    if (from < 0) {
+        from = -from;
+        to = -to;
+    }
+    return div_round((__int128)to * RATE_SCALE, from);
+}
+
+Money money_percent(Money amount, int pct) {
+    return div_round((__int128)amount * pct, 100);
+}
+
+static int is_blank(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+int fixed_parse(const char *s, const char *end, int decimals, int64_t *out) {
+    while (s < end && is_blank(*s)) s++;
+    while (end > s && is_blank(end[-1])) end--;
+    int neg = 0;
+    if (s < end && (*s == '-' || *s == '+')) neg = *s++ == '-';
+
+    int64_t ip = 0;
+    int digits = 0;
+    while (s < end && *s >= '0' && *s <= '9') {
+        if (ip > (INT64_MAX / POW10_I64[decimals]) / 10) return 0;
+        ip = ip * 10 + (*s++ - '0');
+        digits++;
+    }
+    int64_t fp = 0;
+    int fd = 0, dropped = 0, rounded = 0, round_up = 0;
+    if (s < end && *s == '.') {
+        s++;
+        while (s < end && *s >= '0' && *s <= '9') {
+            if (fd < decimals) {
+                fp = fp * 10 + (*s - '0');
+                fd++;
+            } else {
+                if (dropped++ == 0) round_up = *s >= '5';
+                if (*s != '0') rounded = 1;
+            }
+            s++;
+            digits++;
+        }
+    }
+    if (digits == 0 || s != end) return 0;
+    int64_t v = ip * POW10_I64[decimals] + fp * POW10_I64[decimals - fd];
+    if (round_up) v++;
+    *out = neg ? -v : v;
+    return rounded ? 2 : 1;
+}
+
+char *fixed_put(char *p, int64_t v, int decimals) {
+    uint64_t a;
+    if (v < 0) {
+        *p++ = '-';
+        a = (uint64_t)0 - (uint64_t)v;
+    } else {
+        a = (uint64_t)v;
+    }
+    uint64_t scale = (uint64_t)POW10_I64[decimals];
+    uint64_t ip = a / scale, fp = a % scale;
+    char tmp[24];
+    int n = 0;
+    do {
+        tmp[n++] = (char)('0' + ip % 10);
+        ip /= 10;
+    } while (ip);
+    while (n) *p++ = tmp[--n];
+    if (decimals > 0) {
+        *p++ = '.';
+        for (int i = decimals - 1; i >= 0; --i) {
+            p[i] = (char)('0' + fp % 10);
+            fp /= 10;
+        }
+        p += decimals;
+    }
+    return p;
+}
+
+const char *fixed_fmt(char *buf, size_t cap, int64_t v, int decimals) {
+    char tmp[48];
+    char *end = fixed_put(tmp, v, decimals);
+    size_t n = (size_t)(end - tmp);
+    if (n >= cap) n = cap - 1;
+    memcpy(buf, tmp, n);
+    buf[n] = '\0';
+    return buf;
+}
@@ -0,0 +1,50 @@
+#ifndef MONEY_H
+#define MONEY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fixed-point money.
+ *
+ * Amounts, balances and profit are int64 minor units (1/100 of a unit, for
+ * every currency). Rates are LOC per unit scaled by 10^6. Products and
+ * quotients are computed in 128-bit and rounded half away from zero, so
+ * every figure in the ledger is exact and sums do not depend on order.
+ * A MONEY_MAX amount at a RATE_MAX rate does not fit in int64: results
+ * saturate at +-INT64_MAX, and exchange_quote refuses an exchange worth
+ * more than MONEY_MAX. */
+
+typedef int64_t Money;
+typedef int64_t Rate;
+
+#define MONEY_DECIMALS 2
+#define MONEY_SCALE 100
+#define RATE_DECIMALS 6
+#define RATE_SCALE 1000000
+
+#define MONEY_UNITS(u) ((Money)(u) * MONEY_SCALE)
+#define MONEY_MAX MONEY_UNITS(1000000000000LL)      /* 1e12 units */
+#define RATE_MAX ((Rate)1000000000000LL * RATE_SCALE)
+
+/* amount * rate (e.g. foreign amount to LOC). */
+Money money_mul_rate(Money amount, Rate rate);
+/* amount / rate (e.g. LOC to foreign amount); rate must be > 0. */
+Money money_div_rate(Money amount, Rate rate);
+/* to / from as a rate; 0 if from is 0. */
+Rate rate_of(Money to, Money from);
+/* pct percent of amount. */
+Money money_percent(Money amount, int pct);
+
+/* Parse "[-]digits[.digits]" into a value with `decimals` fixed decimals.
+   Returns 1 if exact, 2 if extra digits were rounded off, 0 if malformed
+   or out of range. Surrounding blanks are allowed. */
+int fixed_parse(const char *s, const char *end, int decimals, int64_t *out);
+/* Write v with `decimals` decimals at p (no terminator); returns the end. */
+char *fixed_put(char *p, int64_t v, int decimals);
+/* Format into buf and return it. */
+const char *fixed_fmt(char *buf, size_t cap, int64_t v, int decimals);
+
+#define money_fmt(buf, m) fixed_fmt((buf), sizeof(buf), (m), MONEY_DECIMALS)
+#define rate_fmt(buf, r) fixed_fmt((buf), sizeof(buf), (r), RATE_DECIMALS)
+
+#endif /* MONEY_H */
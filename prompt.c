@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+
+#include "prompt.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void clear_input(void) {
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF) { /* discard */ }
+}
+
+int ask_int(const char *prompt, int min, int max) {
+    char buffer[256];
+    long val;
+    do {
+        printf("%s ", prompt);
+        fflush(stdout);
+        if (!fgets(buffer, sizeof(buffer), stdin)) {
+            printf("Error reading input. Please try again.\n");
+            fflush(stdout);
+            continue;
+        }
+        if (buffer[0] == '\n') {
+            printf("Empty input not allowed. Please enter a number.\n");
+            fflush(stdout);
+            continue;
+        }
+        errno = 0;
+        char *endptr;
+        val = strtol(buffer, &endptr, 10);
+        if (endptr == buffer || (*endptr != '\n' && *endptr != '\0')) {
+            printf("Invalid input. Try again.\n");
+            fflush(stdout);
+            continue;
+        }
+        if (errno == ERANGE) {
+            printf("Integer overflow error: value is too large or too small. Please try again.\n");
+            fflush(stdout);
+            continue;
+        }
+        if (val < min || val > max) {
+            printf("Please enter a number in [%d..%d]\n", min, max);
+            fflush(stdout);
+            continue;
+        }
+        break;
+    } while (1);
+    return (int)val;
+}
+
+double ask_double(const char *prompt, double min, double max) {
+    double x;
+    char buffer[256];
+    do {
+        printf("%s ", prompt);
+        fflush(stdout);
+        if (!fgets(buffer, sizeof(buffer), stdin)) {
+            printf("Error reading input. Please try again.\n");
+            fflush(stdout);
+            continue;
+        }
+        if (buffer[0] == '\n') {
+            printf("Empty input not allowed. Please enter a number.\n");
+            fflush(stdout);
+            continue;
+        }
+            errno = 0;
+            char *endptr_int;
+            long long li = strtoll(buffer, &endptr_int, 10);
+            if (endptr_int != buffer && (*endptr_int == '\n' || *endptr_int == '\0')) {
+                if (errno == ERANGE) {
+                    printf("Integer overflow error: value is too large or too small. Please try again.\n");
+                    fflush(stdout);
+                    continue;
+                }
+                x = (double)li;
+            } else {
+                errno = 0;
+                char *endptr;
+                x = strtod(buffer, &endptr);
+                if (endptr == buffer || (*endptr != '\n' && *endptr != '\0')) {
+                    printf("Invalid input: Please enter a valid number.\n");
+                    fflush(stdout);
+                    continue;
+                }
+                if (errno == ERANGE) {
+                    printf("Integer overflow error: value is too large or too small. Please try again.\n");
+                    fflush(stdout);
+                    continue;
+                }
+            }
+        if (x < min || x > max) {
+            printf("Value must be between %.2f and %.2f. Please try again.\n", min, max);
+            fflush(stdout);
+            continue;
+        }
+        break;
+    } while (1);
+    return x;
+}
+
+static int64_t ask_fixed(const char *prompt, int decimals, int64_t min, int64_t max) {
+    char buffer[256], lo[48], hi[48];
+    int64_t v;
+    do {
+        printf("%s ", prompt);
+        fflush(stdout);
+        if (!fgets(buffer, sizeof(buffer), stdin)) {
+            printf("Error reading input. Please try again.\n");
+            fflush(stdout);
+            continue;
+        }
+        if (buffer[0] == '\n') {
+            printf("Empty input not allowed. Please enter a number.\n");
+            fflush(stdout);
+            continue;
+        }
+        int rc = fixed_parse(buffer, buffer + strlen(buffer), decimals, &v);
+        if (rc == 0) {
+            printf("Invalid input: Please enter a valid number.\n");
+            fflush(stdout);
+            continue;
+        }
+        if (rc == 2) {
+            printf("At most %d decimal places are allowed. Please try again.\n", decimals);
+            fflush(stdout);
+            continue;
+        }
+        if (v < min || v > max) {
+            printf("Value must be between %s and %s. Please try again.\n",
+                   fixed_fmt(lo, sizeof(lo), min, decimals), fixed_fmt(hi, sizeof(hi), max, decimals));
+            fflush(stdout);
+            continue;
+        }
+        break;
+    } while (1);
+    return v;
+}
+
+Money ask_money(const char *prompt, Money min, Money max) {
+    return ask_fixed(prompt, MONEY_DECIMALS, min, max);
+}
+
+Rate ask_rate(const char *prompt, Rate min, Rate max) {
+    return ask_fixed(prompt, RATE_DECIMALS, min, max);
+}
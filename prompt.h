@@ -0,0 +1,15 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include "money.h"
+
+/* Terminal prompts of the interactive menu. They re-ask until the input is
+   valid and are not part of libexchange. */
+int ask_int(const char *prompt, int min, int max);
+double ask_double(const char *prompt, double min, double max);
+/* Amount with at most MONEY_DECIMALS decimals / rate with at most RATE_DECIMALS. */
+Money ask_money(const char *prompt, Money min, Money max);
+Rate ask_rate(const char *prompt, Rate min, Rate max);
+void clear_input(void);
+
+#endif /* PROMPT_H */
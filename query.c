@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+
+#include "query.h"
+#include "diag.h"
+#include "journal.h"
+#include "codec.h"
+#include "metrics.h"
+#include "archive.h"
+#include "manifest.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void query_init(Query *q) {
+    memset(q, 0, sizeof(*q));
+    snprintf(q->from_date, sizeof(q->from_date), "0000-00-00");
+    snprintf(q->to_date, sizeof(q->to_date), "9999-99-99");
+    q->min_amount = q->min_profit = -MONEY_MAX;
+    q->max_amount = q->max_profit = MONEY_MAX;
+    q->partial = -1;
+    q->time_from = 0;
+    q->time_to = 24 * 3600 - 1;
+}
+
+static int valid_date(const char *s) {
+    int y, m, d;
+    char extra;
+    return strlen(s) == 10 && sscanf(s, "%4d-%2d-%2d%c", &y, &m, &d, &extra) == 3 &&
+           m >= 1 && m <= 12 && d >= 1 && d <= 31;
+}
+
+/* "HH:MM" or "HH:MM:SS" to seconds after midnight; -1 if malformed. */
+static int parse_clock(const char *s, size_t len) {
+    int h, m, sec = 0, n = 0, k = 0;
+    char buf[16];
+    if (len == 0 || len >= sizeof(buf)) return -1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    if (sscanf(buf, "%2d:%2d%n", &h, &m, &n) != 2) return -1;
+    if (buf[n] == ':') {
+        if (sscanf(buf + n + 1, "%2d%n", &sec, &k) != 1) return -1;
+        n += 1 + k;
+    }
+    if (buf[n] != '\0' || h < 0 || h > 23 || m < 0 || m > 59 || sec < 0 || sec > 59) return -1;
+    return h * 3600 + m * 60 + sec;
+}
+
+/* "LO..HI" with either side optional. */
+static int parse_range(const char *s, Money *lo, Money *hi) {
+    const char *dots = strstr(s, "..");
+    if (!dots) return -1;
+    const char *end = s + strlen(s);
+    if (dots > s && fixed_parse(s, dots, MONEY_DECIMALS, lo) == 0) return -1;
+    if (dots + 2 < end && fixed_parse(dots + 2, end, MONEY_DECIMALS, hi) == 0) return -1;
+    return *lo <= *hi ? 0 : -1;
+}
+
+static int parse_code(const char *s, size_t len, char *out, size_t cap) {
+    if (len == 1 && s[0] == '*') {
+        out[0] = '\0';
+        return 0;
+    }
+    if (len == 0 || len >= cap) return -1;
+    for (size_t i = 0; i < len; ++i) {
+        if (!isalnum((unsigned char)s[i])) return -1;
+        out[i] = (char)toupper((unsigned char)s[i]);
+    }
+    out[len] = '\0';
+    return 0;
+}
+
+static int parse_term(const char *key, const char *val, Query *q) {
+    if (strcmp(key, "date") == 0 || strcmp(key, "from") == 0 || strcmp(key, "to") == 0) {
+        if (!valid_date(val)) return -1;
+        if (strcmp(key, "to") != 0) snprintf(q->from_date, sizeof(q->from_date), "%s", val);
+        if (strcmp(key, "from") != 0) snprintf(q->to_date, sizeof(q->to_date), "%s", val);
+        return 0;
+    }
+    if (strcmp(key, "pair") == 0) {
+        const char *slash = strchr(val, '/');
+        if (!slash) return -1;
+        return parse_code(val, (size_t)(slash - val), q->from_cur, sizeof(q->from_cur)) == 0 &&
+               parse_code(slash + 1, strlen(slash + 1), q->to_cur, sizeof(q->to_cur)) == 0 ? 0 : -1;
+    }
+    if (strcmp(key, "amount") == 0) return parse_range(val, &q->min_amount, &q->max_amount);
+    if (strcmp(key, "profit") == 0) return parse_range(val, &q->min_profit, &q->max_profit);
+    if (strcmp(key, "partial") == 0) {
+        if (strcmp(val, "0") != 0 && strcmp(val, "1") != 0) return -1;
+        q->partial = val[0] - '0';
+        return 0;
+    }
+    if (strcmp(key, "time") == 0) {
+        const char *dash = strchr(val, '-');
+        if (!dash) return -1;
+        int a = parse_clock(val, (size_t)(dash - val)), b = parse_clock(dash + 1, strlen(dash + 1));
+        if (a < 0 || b < a) return -1;
+        q->time_from = a;
+        q->time_to = b;
+        return 0;
+    }
+    return -1;
+}
+
+int query_parse(const char *spec, Query *q, char *why, size_t why_cap) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *save = NULL, *tok = strtok_r(buf, " \t\r\n", &save); tok;
+         tok = strtok_r(NULL, " \t\r\n", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            snprintf(why, why_cap, "'%s' is not key=value", tok);
+            return -1;
+        }
+        *eq = '\0';
+        if (parse_term(tok, eq + 1, q) != 0) {
+            snprintf(why, why_cap, "invalid %s=%s", tok, eq + 1);
+            return -1;
+        }
+    }
+    if (strcmp(q->from_date, q->to_date) > 0) {
+        snprintf(why, why_cap, "from date %s is after to date %s", q->from_date, q->to_date);
+        return -1;
+    }
+    return 0;
+}
+
+/* Seconds after midnight of "HH:MM:SS"; -1 if it is not in that form. */
+static int row_clock(const char *t) {
+    if (strnlen(t, 8) < 8 || t[2] != ':' || t[5] != ':') return -1;
+    for (int i = 0; i < 8; ++i)
+        if (i != 2 && i != 5 && (t[i] < '0' || t[i] > '9')) return -1;
+    return ((t[0] - '0') * 10 + (t[1] - '0')) * 3600 + ((t[3] - '0') * 10 + (t[4] - '0')) * 60 +
+           (t[6] - '0') * 10 + (t[7] - '0');
+}
+
+static int time_filtered(const Query *q) {
+    return q->time_from > 0 || q->time_to < 24 * 3600 - 1;
+}
+
+int query_match(const Query *q, const CsvRow *row) {
+    if (q->from_cur[0] && strcmp(row->from, q->from_cur) != 0) return 0;
+    if (q->to_cur[0] && strcmp(row->to, q->to_cur) != 0) return 0;
+    if (row->amount_from < q->min_amount || row->amount_from > q->max_amount) return 0;
+    if (row->profit_loc < q->min_profit || row->profit_loc > q->max_profit) return 0;
+    if (q->partial >= 0 && (row->partial != 0) != q->partial) return 0;
+    if (time_filtered(q)) {
+        int t = row_clock(row->time);
+        if (t < q->time_from || t > q->time_to) return 0;
+    }
+    return 1;
+}
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+static int push_name(char (**names)[32], int *n, int *cap, const char *name) {
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        char (*p)[32] = realloc(*names, (size_t)*cap * sizeof(*p));
+        if (!p) return -1;
+        *names = p;
+    }
+    snprintf((*names)[(*n)++], sizeof((*names)[0]), "%s", name);
+    return 0;
+}
+
+/* Sales files in the date range from the partition manifests, sorted.
+   Archived days in range are listed under their day file's name. */
+static int list_files(const Query *q, char (**out)[32]) {
+    ManifestEntry *files = NULL;
+    int nf = manifest_list(q->from_date, q->to_date, MAN_SALES, &files);
+    if (nf < 0) return -1;
+    char (*names)[32] = NULL;
+    int n = 0, cap = 0, rc = 0;
+    for (int i = 0; rc == 0 && i < nf; ++i) rc = push_name(&names, &n, &cap, files[i].path);
+    free(files);
+    ArchiveDayInfo *arch = NULL;
+    int na = rc == 0 ? archive_list_days(q->from_date, q->to_date, &arch) : 0;
+    for (int i = 0; rc == 0 && i < na; ++i) {
+        char name[32];
+        make_daily_csv_name(arch[i].date, name, sizeof(name));
+        rc = push_name(&names, &n, &cap, name);
+    }
+    free(arch);
+    if (rc != 0 || na < 0) {
+        free(names);
+        return -1;
+    }
+    if (n > 1) qsort(names, (size_t)n, sizeof(*names), cmp_name);
+    *out = names;
+    return n;
+}
+
+/* Rows of one file: the time of day is checked on the raw line before the
+   row is parsed, so a narrow time window skips most of the parsing. */
+static int scan_file(const Query *q, const char *fname, QueryEmit emit, void *ctx, QueryStats *st) {
+    CsvReader rd;
+    if (csv_reader_open(&rd, fname) != 0) {
+        diag("Could not open %s for reading: %s", fname, strerror(errno));
+        return 0;
+    }
+    int by_time = time_filtered(q), stop = 0;
+    CsvRow row;
+    char *line;
+    size_t len;
+    long off;
+    while (!stop && csv_reader_next_line(&rd, &line, &len, &off)) {
+        if (len == 0 || (len == 1 && line[0] == '\r')) continue;
+        st->rows_scanned++;
+        if (by_time && len > 19 && line[10] == ',') {
+            int t = row_clock(line + 11);
+            if (t >= 0 && (t < q->time_from || t > q->time_to)) continue;
+        }
+        if (!codec_parse_row(line, len, rd.fmt, &row)) {
+            rd.malformed++;
+            continue;
+        }
+        rd.rows++;
+        if (!query_match(q, &row)) continue;
+        st->rows_matched++;
+        stop = emit(&row, ctx) != 0;
+    }
+    st->bytes += csv_reader_tell(&rd);
+    csv_reader_close(&rd);
+    return stop;
+}
+
+int query_run(const Query *q, QueryEmit emit, void *ctx, QueryStats *st) {
+    journal_flush();
+    int64_t m0 = metrics_start(MET_QUERY);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    memset(st, 0, sizeof(*st));
+
+    char (*names)[32] = NULL;
+    int n = list_files(q, &names);
+    if (n < 0) return -1;
+    for (int i = 0; i < n; ++i) {
+        st->files++;
+        if (scan_file(q, names[i], emit, ctx, st)) break;
+    }
+    free(names);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    st->seconds = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    metrics_end(MET_QUERY, m0);
+    return 0;
+}
+
+void query_print_header(FILE *out) {
+    fprintf(out, "%-10s %-8s %9s  %-4s %14s  %-4s %14s  %-7s %12s %12s\n", "date", "time", "tx_id",
+            "from", "amount", "to", "amount", "partial", "rem LOC", "profit LOC");
+}
+
+void query_print_row(FILE *out, const CsvRow *row) {
+    char id[16], a[32], b[32], r[32], p[32];
+    if (row->has_tx_id) snprintf(id, sizeof(id), "%d", row->tx_id);
+    else snprintf(id, sizeof(id), "-");
+    fprintf(out, "%-10s %-8s %9s  %-4s %14s  %-4s %14s  %-7s %12s %12s\n", row->date, row->time, id,
+            row->from, money_fmt(a, row->amount_from), row->to, money_fmt(b, row->amount_to),
+            row->partial ? "yes" : "no", money_fmt(r, row->remainder_loc), money_fmt(p, row->profit_loc));
+}
@@ -0,0 +1,61 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "utils.h"
+
+/* Transaction queries over the sales files.
+ *
+ * A query is a date range plus optional filters on the currency pair, the
+ * amount given, the profit, the partial flag and the time of day. The
+ * files of the date range come from the manifests of its partitions, so
+ * nothing outside it is opened or listed; they are read with the shared
+ * CSV reader into one row buffer, and
+ * every matching row is handed to a callback as it is found, in date and
+ * file order. */
+
+typedef struct {
+    char from_date[11];          /* inclusive, YYYY-MM-DD */
+    char to_date[11];
+    char from_cur[8];            /* currency code; "" = any */
+    char to_cur[8];
+    Money min_amount, max_amount;   /* amount_from */
+    Money min_profit, max_profit;
+    int partial;                 /* -1 = any, 0 or 1 */
+    int time_from, time_to;      /* seconds after midnight, inclusive */
+} Query;
+
+typedef struct {
+    int files;                   /* files read */
+    long rows_scanned;
+    long rows_matched;
+    long bytes;
+    double seconds;
+} QueryStats;
+
+/* Called for each match; return nonzero to stop the query. */
+typedef int (*QueryEmit)(const CsvRow *row, void *ctx);
+
+/* Every date, every row. */
+void query_init(Query *q);
+
+/* Apply "key=value" terms separated by blanks on top of *q:
+     date=D  from=D  to=D          (D = YYYY-MM-DD)
+     pair=EUR/USD                  (either code may be *)
+     amount=LO..HI  profit=LO..HI  (either side may be empty)
+     partial=0|1
+     time=HH:MM[:SS]-HH:MM[:SS]
+   Returns 0, or -1 with the reason in why. */
+int query_parse(const char *spec, Query *q, char *why, size_t why_cap);
+
+/* 1 if the row passes every filter of q except the date range. */
+int query_match(const Query *q, const CsvRow *row);
+
+/* Run the query. Returns 0 (also when emit stopped it), or -1 if the
+   directory could not be read. */
+int query_run(const Query *q, QueryEmit emit, void *ctx, QueryStats *st);
+
+/* One match as a table line (with '\n'); see query_print_header(). */
+void query_print_row(FILE *out, const CsvRow *row);
+void query_print_header(FILE *out);
+
+#endif /* QUERY_H */
@@ -0,0 +1,465 @@
+#define _GNU_SOURCE
+
+#include "ratehist.h"
+#include "diag.h"
+#include "utils.h"
+#include "exchange.h"
+#include "query.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RATE_MAGIC "EXRATE1"
+
+typedef struct {
+    char magic[8];
+    uint64_t log_bytes;         /* log prefix the index was built from */
+    uint32_t currencies;
+    uint32_t reserved;
+    uint64_t count;
+} RateIdxHeader;
+
+typedef struct {
+    char code[8];
+    uint64_t first;             /* first point of the currency's run */
+    uint64_t n;
+} RateDirEntry;
+
+typedef struct {
+    int64_t at;
+    Rate buy;
+    Rate sell;
+} RatePoint;
+
+static struct {
+    void *map;
+    size_t map_len;
+    const RateIdxHeader *hdr;
+    const RateDirEntry *dir;
+    const RatePoint *pts;
+    RateEvent *delta;           /* log records after the index, in log order */
+    size_t delta_n, delta_cap;
+    long log_seen;              /* log size the above reflect; -1 = not loaded */
+} R = { .log_seen = -1 };
+
+static void unmap_index(void) {
+    if (R.map) munmap(R.map, R.map_len);
+    R.map = NULL;
+    R.hdr = NULL;
+    R.dir = NULL;
+    R.pts = NULL;
+}
+
+static void map_index(void) {
+    int fd = open(RATE_IDX, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(RateIdxHeader)) {
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (m != MAP_FAILED) {
+            const RateIdxHeader *h = m;
+            size_t need = sizeof(*h) + h->currencies * sizeof(RateDirEntry) + h->count * sizeof(RatePoint);
+            if (memcmp(h->magic, RATE_MAGIC, sizeof(RATE_MAGIC)) == 0 && need <= (size_t)st.st_size) {
+                R.map = m;
+                R.map_len = (size_t)st.st_size;
+                R.hdr = h;
+                R.dir = (const RateDirEntry *)(h + 1);
+                R.pts = (const RatePoint *)(R.dir + h->currencies);
+            } else {
+                diag("Ignoring invalid %s; it is rebuilt from %s", RATE_IDX, RATE_LOG);
+                munmap(m, (size_t)st.st_size);
+            }
+        }
+    }
+    close(fd);
+}
+
+/* Read whole log records from byte `from` on into R.delta. */
+static int read_log(long from, long to) {
+    R.delta_n = 0;
+    if (to <= from) return 0;
+    size_t n = (size_t)(to - from) / sizeof(RateEvent);
+    if (n > R.delta_cap) {
+        RateEvent *p = realloc(R.delta, n * sizeof(*p));
+        if (!p) return -1;
+        R.delta = p;
+        R.delta_cap = n;
+    }
+    int fd = open(RATE_LOG, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t got = pread(fd, R.delta, n * sizeof(RateEvent), from);
+    close(fd);
+    if (got < 0) return -1;
+    R.delta_n = (size_t)got / sizeof(RateEvent);
+    return 0;
+}
+
+/* Bring the mapping and the unindexed tail in line with the log. */
+static int refresh(void) {
+    struct stat st;
+    long size = stat(RATE_LOG, &st) == 0 ? (long)st.st_size : 0;
+    size -= size % (long)sizeof(RateEvent);               /* a torn last record */
+    if (size == R.log_seen) return 0;
+    unmap_index();
+    map_index();
+    long covered = R.hdr && (long)R.hdr->log_bytes <= size ? (long)R.hdr->log_bytes : 0;
+    if (!R.hdr || (long)R.hdr->log_bytes > size) unmap_index();   /* log replaced: index is stale */
+    if (read_log(covered, size) != 0) {
+        diag("Could not read %s: %s", RATE_LOG, strerror(errno));
+        return -1;
+    }
+    R.log_seen = size;
+    if (R.delta_n > RATE_MERGE_AT) return ratehist_rebuild() < 0 ? -1 : refresh();
+    return 0;
+}
+
+/* Events through pointers into one array: by code, time, then log order. */
+static int cmp_event_ptr(const void *a, const void *b) {
+    const RateEvent *x = *(RateEvent *const *)a, *y = *(RateEvent *const *)b;
+    int c = strncmp(x->code, y->code, sizeof(x->code));
+    if (c) return c;
+    if (x->at != y->at) return x->at < y->at ? -1 : 1;
+    return (x > y) - (x < y);
+}
+
+long ratehist_rebuild(void) {
+    struct stat st;
+    long size = stat(RATE_LOG, &st) == 0 ? (long)st.st_size : 0;
+    size -= size % (long)sizeof(RateEvent);
+    unmap_index();
+    if (read_log(0, size) != 0) {
+        diag("Could not read %s: %s", RATE_LOG, strerror(errno));
+        return -1;
+    }
+    size_t n = R.delta_n;
+    RateEvent *ev = R.delta;
+    RateEvent **order = malloc((n ? n : 1) * sizeof(*order));
+    RatePoint *pts = malloc((n ? n : 1) * sizeof(*pts));
+    RateDirEntry *dir = malloc((n ? n : 1) * sizeof(*dir));
+    if (!order || !pts || !dir) {
+        free(order);
+        free(pts);
+        free(dir);
+        return -1;
+    }
+    for (size_t i = 0; i < n; ++i) order[i] = &ev[i];
+    qsort(order, n, sizeof(*order), cmp_event_ptr);
+    uint32_t ndir = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const RateEvent *e = order[i];
+        if (ndir == 0 || strncmp(dir[ndir - 1].code, e->code, sizeof(e->code)) != 0) {
+            memset(&dir[ndir], 0, sizeof(dir[ndir]));
+            memcpy(dir[ndir].code, e->code, sizeof(e->code));
+            dir[ndir].first = i;
+            ndir++;
+        }
+        dir[ndir - 1].n++;
+        pts[i] = (RatePoint){ .at = e->at, .buy = e->buy, .sell = e->sell };
+    }
+    free(order);
+
+    const char *tmp = RATE_IDX ".tmp";
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        diag("Could not create %s: %s", tmp, strerror(errno));
+        free(pts);
+        free(dir);
+        return -1;
+    }
+    RateIdxHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RATE_MAGIC, sizeof(RATE_MAGIC));
+    h.log_bytes = (uint64_t)size;
+    h.currencies = ndir;
+    h.count = n;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(dir, sizeof(*dir), ndir, f) == ndir &&
+             fwrite(pts, sizeof(*pts), n, f) == n;
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = (fclose(f) == 0) && ok;
+    free(pts);
+    free(dir);
+    if (!ok || rename(tmp, RATE_IDX) != 0) {
+        diag("Could not write %s: %s", RATE_IDX, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    R.delta_n = 0;
+    R.log_seen = -1;                         /* remap on next use */
+    return (long)n;
+}
+
+void ratehist_close(void) {
+    unmap_index();
+    free(R.delta);
+    R.delta = NULL;
+    R.delta_n = R.delta_cap = 0;
+    R.log_seen = -1;
+}
+
+/* Lookup */
+
+static const RateDirEntry *find_dir(const char *code) {
+    if (!R.hdr) return NULL;
+    size_t lo = 0, hi = R.hdr->currencies;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strncmp(R.dir[mid].code, code, sizeof(R.dir[mid].code));
+        if (c == 0) return &R.dir[mid];
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+/* Points of a run with at <= t: the upper bound of t. */
+static size_t count_upto(const RatePoint *p, size_t n, int64_t t) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (p[mid].at <= t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void fill(RateEvent *out, const char *code, int64_t at, Rate buy, Rate sell) {
+    memset(out, 0, sizeof(*out));
+    snprintf(out->code, sizeof(out->code), "%s", code);
+    out->at = at;
+    out->buy = buy;
+    out->sell = sell;
+}
+
+int ratehist_as_of(const char *code, int64_t at, RateEvent *out) {
+    if (refresh() != 0) return -1;
+    int found = 0, before = 0;
+    RateEvent first;
+    const RateDirEntry *d = find_dir(code);
+    if (d && d->n) {
+        const RatePoint *p = R.pts + d->first;
+        size_t k = count_upto(p, (size_t)d->n, at);
+        if (k > 0) {
+            fill(out, code, p[k - 1].at, p[k - 1].buy, p[k - 1].sell);
+            found = 1;
+        } else {
+            fill(&first, code, p[0].at, p[0].buy, p[0].sell);
+            before = 1;
+        }
+    }
+    /* Unindexed records are later in the log: they win ties. */
+    for (size_t i = 0; i < R.delta_n; ++i) {
+        const RateEvent *e = &R.delta[i];
+        if (strncmp(e->code, code, sizeof(e->code)) != 0) continue;
+        if (e->at <= at) {
+            if (!found || e->at >= out->at) *out = *e;
+            found = 1;
+        } else if (!before || e->at < first.at) {
+            first = *e;
+            before = 1;
+        }
+    }
+    if (found) return 0;
+    if (!before) return -1;
+    *out = first;
+    return 1;
+}
+
+/* Recording */
+
+int ratehist_record(int cur) {
+    if (cur < 0 || cur >= cur_count) return -1;
+    RateEvent e;
+    fill(&e, currencies[cur].name, (int64_t)exchange_now(), currencies[cur].buy_to_loc,
+         currencies[cur].sell_to_loc);
+    int fd = open(RATE_LOG, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        diag("Could not open %s: %s", RATE_LOG, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size % (off_t)sizeof(e) != 0 &&
+        ftruncate(fd, st.st_size - st.st_size % (off_t)sizeof(e)) != 0) {   /* torn last record */
+        close(fd);
+        return -1;
+    }
+    int ok = write(fd, &e, sizeof(e)) == (ssize_t)sizeof(e) && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok) {
+        diag("Could not append to %s: %s", RATE_LOG, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int ratehist_sync(void) {
+    int n = 0;
+    for (int i = 0; i < cur_count; ++i) {
+        RateEvent e;
+        if (ratehist_as_of(currencies[i].name, INT64_MAX, &e) == 0 &&
+            e.buy == currencies[i].buy_to_loc && e.sell == currencies[i].sell_to_loc)
+            continue;
+        if (ratehist_record(i) != 0) return -1;
+        ++n;
+    }
+    return n;
+}
+
+int ratehist_parse_time(const char *text, int64_t *out) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int n = 0;
+    if (sscanf(text, "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &n) != 3 || n != 10)
+        return -1;
+    if (text[10] == '\0') {
+        tm.tm_hour = 23;
+        tm.tm_min = 59;
+        tm.tm_sec = 59;
+    } else {
+        int k = 0;
+        if ((text[10] != ' ' && text[10] != 'T') ||
+            sscanf(text + 11, "%2d:%2d%n", &tm.tm_hour, &tm.tm_min, &k) != 2)
+            return -1;
+        if (text[11 + k] == ':' && sscanf(text + 12 + k, "%2d", &tm.tm_sec) != 1) return -1;
+        if (tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 59) return -1;
+    }
+    if (tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31) return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    *out = (int64_t)mktime(&tm);
+    return 0;
+}
+
+/* Revaluation */
+
+/* A currency's buy rates as a run that a cursor walks forward in time. */
+typedef struct {
+    const RatePoint *p;
+    size_t n, k;                /* k: points with at <= the last time asked */
+    Rate fallback;              /* no history: the registry's rate */
+} RateCursor;
+
+static Rate cursor_at(RateCursor *c, int64_t t) {
+    while (c->k < c->n && c->p[c->k].at <= t) c->k++;
+    if (c->n == 0) return c->fallback;
+    return c->p[c->k ? c->k - 1 : 0].buy;        /* before the first change: the first rate */
+}
+
+typedef struct {
+    RevalEmit emit;
+    void *ctx;
+    RevalStats *st;
+    RateCursor *cur;
+    Money *pos, *flow;
+    Rate *rate;                 /* at the previous close */
+    RevalDay day;
+    int stopped;
+} Reval;
+
+static int64_t day_close(const char *date) {
+    int64_t t = 0;
+    ratehist_parse_time(date, &t);
+    return t;
+}
+
+/* Mark the day's flows and the position at the day's close and emit it. */
+static int close_day(Reval *v) {
+    if (!v->day.date[0]) return 0;
+    int64_t t = day_close(v->day.date);
+    v->day.flow_value = v->day.position_value = v->day.revaluation = 0;
+    for (int i = 0; i < cur_count; ++i) {
+        Rate r = i == CUR_LOC ? RATE_SCALE : cursor_at(&v->cur[i], t);
+        Money open = v->pos[i] - v->flow[i];
+        v->day.flow_value += money_mul_rate(v->flow[i], r);
+        v->day.position_value += money_mul_rate(v->pos[i], r);
+        v->day.revaluation += money_mul_rate(open, r - v->rate[i]);
+        v->rate[i] = r;
+        v->flow[i] = 0;
+    }
+    v->st->days++;
+    int stop = v->emit(&v->day, v->ctx);
+    memset(&v->day, 0, sizeof(v->day));
+    return stop;
+}
+
+static int reval_row(const CsvRow *row, void *ctx) {
+    Reval *v = ctx;
+    if (strncmp(row->date, v->day.date, 10) != 0) {
+        if (close_day(v)) return v->stopped = 1;
+        snprintf(v->day.date, sizeof(v->day.date), "%.10s", row->date);
+    }
+    v->st->rows++;
+    int from = currency_from_code(row->from), to = currency_from_code(row->to);
+    if (from < 0 || to < 0) {
+        v->st->unknown_rows++;
+        return 0;
+    }
+    v->day.tx_count++;
+    v->flow[from] += row->amount_from;
+    v->pos[from] += row->amount_from;
+    v->flow[to] -= row->amount_to;
+    v->pos[to] -= row->amount_to;
+    if (row->partial) {
+        v->flow[CUR_LOC] -= row->remainder_loc;
+        v->pos[CUR_LOC] -= row->remainder_loc;
+    }
+    return 0;
+}
+
+int ratehist_revalue(const char *from_date, const char *to_date, RevalEmit emit, void *ctx,
+                     RevalStats *st) {
+    memset(st, 0, sizeof(*st));
+    if (refresh() != 0) return -1;
+    if (R.delta_n > 0 && (ratehist_rebuild() < 0 || refresh() != 0)) return -1;   /* one run per currency */
+    Reval v = { .emit = emit, .ctx = ctx, .st = st };
+    v.cur = calloc((size_t)cur_count, sizeof(*v.cur));
+    v.pos = calloc((size_t)cur_count, sizeof(*v.pos));
+    v.flow = calloc((size_t)cur_count, sizeof(*v.flow));
+    v.rate = calloc((size_t)cur_count, sizeof(*v.rate));
+    int rc = -1;
+    if (v.cur && v.pos && v.flow && v.rate) {
+        int64_t start = 0;
+        char first[32];
+        snprintf(first, sizeof(first), "%.10s 00:00:00", from_date);
+        ratehist_parse_time(first, &start);
+        for (int i = 0; i < cur_count; ++i) {
+            const RateDirEntry *d = find_dir(currencies[i].name);
+            v.cur[i].p = d ? R.pts + d->first : NULL;
+            v.cur[i].n = d ? (size_t)d->n : 0;
+            v.cur[i].fallback = currencies[i].buy_to_loc;
+            if (i != CUR_LOC && v.cur[i].n == 0) st->unpriced++;
+            v.rate[i] = i == CUR_LOC ? RATE_SCALE : cursor_at(&v.cur[i], start - 1);
+        }
+        Query q;
+        QueryStats qs;
+        query_init(&q);
+        snprintf(q.from_date, sizeof(q.from_date), "%.10s", from_date);
+        snprintf(q.to_date, sizeof(q.to_date), "%.10s", to_date);
+        rc = query_run(&q, reval_row, &v, &qs);
+        if (rc == 0 && !v.stopped) close_day(&v);
+    }
+    free(v.cur);
+    free(v.pos);
+    free(v.flow);
+    free(v.rate);
+    return rc;
+}
+
+Money ratehist_reserves_at(int64_t at, Money *value) {
+    Money total = 0;
+    for (int i = 0; i < cur_count; ++i) {
+        RateEvent e;
+        Rate r = i == CUR_LOC ? RATE_SCALE
+               : ratehist_as_of(currencies[i].name, at, &e) >= 0 ? e.buy : currencies[i].buy_to_loc;
+        Money m = money_mul_rate(currencies[i].bal, r);
+        if (value) value[i] = m;
+        total += m;
+    }
+    return total;
+}
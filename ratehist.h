@@ -0,0 +1,82 @@
+#ifndef RATEHIST_H
+#define RATEHIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "money.h"
+
+/* Rate history: every change of a currency's rates, with its time.
+ *
+ * rates.log at the data root is append-only: one fixed-size record per
+ * change (time, code, buy, sell), fsynced as it is written. rates.idx holds
+ * the same events sorted by time within each currency, behind a directory
+ * of currencies sorted by code, and is probed through mmap: an as-of
+ * lookup is a binary search in one currency's run. Records appended after
+ * the index was built are kept in memory and searched as well; past
+ * RATE_MERGE_AT of them the index is rebuilt from the log.
+ *
+ * Changes are recorded by exchange_set_rates, and by ratehist_sync at
+ * startup for registry rates that differ from the history (the first start
+ * records every currency). Times come from exchange_now(). */
+
+#define RATE_LOG "rates.log"
+#define RATE_IDX "rates.idx"
+#define RATE_MERGE_AT 256
+
+typedef struct {
+    int64_t at;                 /* seconds since the epoch */
+    char code[8];
+    Rate buy;
+    Rate sell;
+} RateEvent;
+
+/* Append a change of `cur` to its current rates. Returns 0 or -1. */
+int ratehist_record(int cur);
+/* Record every currency whose rates differ from its latest event. Returns
+   the number recorded, or -1. */
+int ratehist_sync(void);
+
+/* Rates of `code` in force at `at`. Returns 0, 1 if `at` is before the
+   first change of that currency (out gets the first one), -1 if it has no
+   history. */
+int ratehist_as_of(const char *code, int64_t at, RateEvent *out);
+
+/* Rewrite rates.idx from the log. Returns the number of events or -1. */
+long ratehist_rebuild(void);
+void ratehist_close(void);
+
+/* "YYYY-MM-DD[ HH:MM[:SS]]" in local time to seconds; the date alone is
+   its end (23:59:59). Returns 0 or -1. */
+int ratehist_parse_time(const char *text, int64_t *out);
+
+/* Revaluation of the days from..to: the day's flows by currency from the
+   sales rows, the position built up from `from` on, and both marked at
+   the buy rates in force at the day's close. */
+typedef struct {
+    char date[11];
+    long tx_count;
+    Money flow_value;           /* the day's flows at the close */
+    Money position_value;       /* position since `from`, at the close */
+    Money revaluation;          /* rate moves on the opening position */
+} RevalDay;
+
+typedef struct {
+    int days;
+    long rows;
+    long unknown_rows;          /* currencies not in the registry */
+    int unpriced;               /* currencies without history, marked at registry rates */
+} RevalStats;
+
+/* Called per day with a row; return nonzero to stop. */
+typedef int (*RevalEmit)(const RevalDay *day, void *ctx);
+
+/* One pass over the rows of the range merged with the rate history.
+   Returns 0 or -1. */
+int ratehist_revalue(const char *from_date, const char *to_date, RevalEmit emit, void *ctx,
+                     RevalStats *st);
+
+/* Current reserves marked at the buy rates in force at `at`; per
+   currency into value[] (cur_count entries, may be NULL). Returns the total. */
+Money ratehist_reserves_at(int64_t at, Money *value);
+
+#endif /* RATEHIST_H */
@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+
+#include "rollup.h"
+#include "diag.h"
+#include "daysum.h"
+#include "segment.h"
+#include "archive.h"
+#include "manifest.h"
+#include "journal.h"
+#include "codec.h"
+#include "metrics.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define ROLL_MAGIC "EXROL01"
+
+typedef struct {
+    char magic[8];
+    int64_t src_size;        /* CSV bytes folded in (complete lines only) */
+    int64_t file_size;       /* CSV size and mtime when the sidecar was written */
+    int64_t file_mtime;
+    uint64_t tail_hash;      /* day_file_tail_hash() at src_size */
+    uint32_t registry;       /* currency_fingerprint() */
+    uint32_t npairs;
+    int64_t tx_count;
+    int64_t partial;
+    int64_t unpaired;
+    int64_t profit;
+    int64_t hour_count[ROLLUP_HOURS];
+    int64_t hour_loc[ROLLUP_HOURS];
+} RollHeader;
+
+typedef struct {
+    char from[8];
+    char to[8];
+    int64_t count;
+    int64_t partial;
+    int64_t vol_from;
+    int64_t vol_to;
+    int64_t profit;
+    int64_t hour_count[ROLLUP_HOURS];
+    int64_t hour_vol[ROLLUP_HOURS];
+} RollPair;
+
+void make_rollup_name(const char *date_text, char *out, size_t cap) {
+    snprintf(out, cap, "%.4s/%.2s/sales_%s.rollup", date_text, date_text + 5, date_text);
+}
+
+void rollup_init(Rollup *r) {
+    memset(r, 0, sizeof(*r));
+}
+
+/* The pair's accumulator, created on first sight; NULL past ROLLUP_MAX_PAIRS. */
+static PairRollup *pair_of(Rollup *r, int from, int to) {
+    uint32_t key = (uint32_t)from << 8 | (uint32_t)to;
+    uint32_t h = (key * 2654435761u) >> (32 - ROLLUP_SLOT_BITS);
+    for (;; h = (h + 1) & (ROLLUP_SLOTS - 1)) {
+        uint16_t s = r->slot[h];
+        if (s == 0) break;
+        PairRollup *p = &r->pair[s - 1];
+        if (p->from == from && p->to == to) return p;
+    }
+    if (r->npairs == ROLLUP_MAX_PAIRS) return NULL;
+    PairRollup *p = &r->pair[r->npairs++];
+    p->from = (uint8_t)from;
+    p->to = (uint8_t)to;
+    r->slot[h] = (uint16_t)r->npairs;
+    return p;
+}
+
+void rollup_add(Rollup *r, int from, int to, int hour, Money amount_from, Money amount_to,
+                Rate rate_from_loc, int partial, Money profit) {
+    r->tx_count++;
+    r->partial += partial != 0;
+    r->profit += profit;
+    if (hour >= 0) {
+        r->hour_count[hour]++;
+        r->hour_loc[hour] += money_mul_rate(amount_from, rate_from_loc);
+    }
+    PairRollup *p = from >= 0 && to >= 0 ? pair_of(r, from, to) : NULL;
+    if (!p) {
+        r->unpaired++;
+        return;
+    }
+    p->count++;
+    p->partial += partial != 0;
+    p->vol_from += amount_from;
+    p->vol_to += amount_to;
+    p->profit += profit;
+    if (hour >= 0) {
+        p->hour_count[hour]++;
+        p->hour_vol[hour] += amount_from;
+    }
+}
+
+static int row_hour(const char *t) {
+    if (t[0] < '0' || t[0] > '9' || t[1] < '0' || t[1] > '9' || t[2] != ':') return -1;
+    int h = (t[0] - '0') * 10 + (t[1] - '0');
+    return h < ROLLUP_HOURS ? h : -1;
+}
+
+void rollup_add_row(Rollup *r, const CsvRow *row) {
+    rollup_add(r, currency_from_code(row->from), currency_from_code(row->to), row_hour(row->time),
+        row->amount_from, row->amount_to, row->rate_from_loc, row->partial, row->profit_loc);
+}
+
+void rollup_merge(Rollup *dst, const Rollup *src) {
+    dst->tx_count += src->tx_count;
+    dst->partial += src->partial;
+    dst->unpaired += src->unpaired;
+    dst->profit += src->profit;
+    for (int h = 0; h < ROLLUP_HOURS; ++h) {
+        dst->hour_count[h] += src->hour_count[h];
+        dst->hour_loc[h] += src->hour_loc[h];
+    }
+    for (int i = 0; i < src->npairs; ++i) {
+        const PairRollup *s = &src->pair[i];
+        PairRollup *p = pair_of(dst, s->from, s->to);
+        if (!p) {
+            dst->unpaired += s->count;
+            continue;
+        }
+        p->count += s->count;
+        p->partial += s->partial;
+        p->vol_from += s->vol_from;
+        p->vol_to += s->vol_to;
+        p->profit += s->profit;
+        for (int h = 0; h < ROLLUP_HOURS; ++h) {
+            p->hour_count[h] += s->hour_count[h];
+            p->hour_vol[h] += s->hour_vol[h];
+        }
+    }
+}
+
+static int load_sidecar(const char *date_text, RollHeader *h, Rollup *r) {
+    char fname[128];
+    make_rollup_name(date_text, fname, sizeof(fname));
+    FILE *f = fopen(fname, "rb");
+    if (!f) return -1;
+    metrics_add(MET_FILES_OPENED, 1);
+    int ok = fread(h, sizeof(*h), 1, f) == 1 && memcmp(h->magic, ROLL_MAGIC, sizeof(ROLL_MAGIC)) == 0 &&
+             h->registry == currency_fingerprint() && h->npairs <= ROLLUP_MAX_PAIRS;
+    rollup_init(r);
+    if (ok) {
+        r->tx_count = (long)h->tx_count;
+        r->partial = (long)h->partial;
+        r->unpaired = (long)h->unpaired;
+        r->profit = h->profit;
+        for (int i = 0; i < ROLLUP_HOURS; ++i) {
+            r->hour_count[i] = (long)h->hour_count[i];
+            r->hour_loc[i] = h->hour_loc[i];
+        }
+    }
+    for (uint32_t i = 0; ok && i < h->npairs; ++i) {
+        RollPair c;
+        ok = fread(&c, sizeof(c), 1, f) == 1;
+        c.from[sizeof(c.from) - 1] = c.to[sizeof(c.to) - 1] = '\0';
+        int from = ok ? currency_from_code(c.from) : -1, to = ok ? currency_from_code(c.to) : -1;
+        PairRollup *p = from >= 0 && to >= 0 ? pair_of(r, from, to) : NULL;
+        if (!p) {
+            ok = 0;
+            break;
+        }
+        p->count = (long)c.count;
+        p->partial = (long)c.partial;
+        p->vol_from = c.vol_from;
+        p->vol_to = c.vol_to;
+        p->profit = c.profit;
+        for (int k = 0; k < ROLLUP_HOURS; ++k) {
+            p->hour_count[k] = (long)c.hour_count[k];
+            p->hour_vol[k] = c.hour_vol[k];
+        }
+    }
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+static void save_sidecar(const char *date_text, const RollHeader *h, const Rollup *r) {
+    char fname[128], tmp[160];
+    make_rollup_name(date_text, fname, sizeof(fname));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        diag("Could not create %s: %s", tmp, strerror(errno));
+        return;
+    }
+    RollHeader out = *h;
+    out.registry = currency_fingerprint();
+    out.npairs = (uint32_t)r->npairs;
+    out.tx_count = r->tx_count;
+    out.partial = r->partial;
+    out.unpaired = r->unpaired;
+    out.profit = r->profit;
+    for (int i = 0; i < ROLLUP_HOURS; ++i) {
+        out.hour_count[i] = r->hour_count[i];
+        out.hour_loc[i] = r->hour_loc[i];
+    }
+    int ok = fwrite(&out, sizeof(out), 1, f) == 1;
+    for (int i = 0; ok && i < r->npairs; ++i) {
+        const PairRollup *p = &r->pair[i];
+        RollPair c;
+        memset(&c, 0, sizeof(c));
+        snprintf(c.from, sizeof(c.from), "%s", currencies[p->from].name);
+        snprintf(c.to, sizeof(c.to), "%s", currencies[p->to].name);
+        c.count = p->count;
+        c.partial = p->partial;
+        c.vol_from = p->vol_from;
+        c.vol_to = p->vol_to;
+        c.profit = p->profit;
+        for (int k = 0; k < ROLLUP_HOURS; ++k) {
+            c.hour_count[k] = p->hour_count[k];
+            c.hour_vol[k] = p->hour_vol[k];
+        }
+        ok = fwrite(&c, sizeof(c), 1, f) == 1;
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, fname) != 0) {
+        diag("Could not write %s: %s", fname, strerror(errno));
+        unlink(tmp);
+    }
+}
+
+/* Start from the columnar segment when it covers a prefix of the CSV;
+   returns the number of CSV bytes it accounts for. */
+static int64_t fold_segment(const char *date_text, int fd, const struct stat *st, Rollup *r) {
+    LedgerSegment seg;
+    if (segment_open(date_text, &seg) != 0) return 0;
+    int64_t covered = 0;
+    if (segment_covers(&seg, fd, st)) {
+        for (size_t i = 0; i < seg.rows; ++i) {
+            uint8_t from = seg.cur_map[seg.from_cur[i]], to = seg.cur_map[seg.to_cur[i]];
+            int64_t secs = seg.ts[i] % 86400;
+            rollup_add(r, from == SEG_NO_CUR ? -1 : from, to == SEG_NO_CUR ? -1 : to,
+                (int)((secs < 0 ? secs + 86400 : secs) / 3600), seg.amount_from[i], seg.amount_to[i],
+                seg.rate_from[i], seg.partial[i], seg.profit[i]);
+        }
+        covered = seg.hdr->src_size;
+    }
+    segment_close(&seg);
+    return covered;
+}
+
+int rollup_day(const char *date_text, Rollup *out) {
+    journal_flush();
+    int64_t m0 = metrics_start(MET_ROLLUP);
+    rollup_init(out);
+
+    char csv_name[128];
+    make_daily_csv_name(date_text, csv_name, sizeof(csv_name));
+    CsvReader rd;
+    if (csv_reader_open(&rd, csv_name) != 0) {
+        metrics_end(MET_ROLLUP, m0);
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (rd.mem) {                       /* archived day: closed, no sidecar */
+        CsvRow row;
+        while (csv_reader_next(&rd, &row, NULL)) rollup_add_row(out, &row);
+        csv_reader_close(&rd);
+        metrics_end(MET_ROLLUP, m0);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(rd.fd, &st) != 0) {
+        csv_reader_close(&rd);
+        metrics_end(MET_ROLLUP, m0);
+        return -1;
+    }
+
+    RollHeader h;
+    int64_t offset = 0;
+    if (load_sidecar(date_text, &h, out) == 0) {
+        if (h.file_size == (int64_t)st.st_size && h.file_mtime == (int64_t)st.st_mtime) {
+            csv_reader_close(&rd);
+            metrics_end(MET_ROLLUP, m0);
+            return 0;
+        }
+        if (h.src_size <= (int64_t)st.st_size && day_file_tail_hash(rd.fd, h.src_size) == h.tail_hash)
+            offset = h.src_size;          /* rows were appended: extend */
+    }
+    if (offset == 0) {
+        rollup_init(out);
+        offset = fold_segment(date_text, rd.fd, &st, out);
+    }
+    if (offset == 0 || csv_reader_seek(&rd, (long)offset) == 0) {
+        CsvRow row;
+        while (csv_reader_next(&rd, &row, NULL)) rollup_add_row(out, &row);
+        offset = csv_reader_tell(&rd);  /* stops before a row still being written */
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ROLL_MAGIC, sizeof(ROLL_MAGIC));
+    h.src_size = offset;
+    h.file_size = (int64_t)st.st_size;
+    h.file_mtime = (int64_t)st.st_mtime;
+    h.tail_hash = day_file_tail_hash(rd.fd, offset);
+    csv_reader_close(&rd);
+    save_sidecar(date_text, &h, out);
+    metrics_end(MET_ROLLUP, m0);
+    return 0;
+}
+
+int rollup_month(const char *year_month, Rollup *out) {
+    rollup_init(out);
+    char from[16], to[16];
+    snprintf(from, sizeof(from), "%.7s-01", year_month);
+    snprintf(to, sizeof(to), "%.7s-31", year_month);
+    ManifestEntry *files = NULL;
+    int nf = manifest_list(from, to, MAN_SALES, &files);
+    if (nf < 0) return -1;
+    Rollup *day = malloc(sizeof(*day));
+    if (!day) {
+        free(files);
+        return -1;
+    }
+    int days = 0, failed = 0;
+    for (int i = 0; i < nf; ++i) {
+        if (rollup_day(files[i].date, day) != 0) {
+            failed = 1;
+            continue;
+        }
+        rollup_merge(out, day);
+        days++;
+    }
+    free(files);
+    ArchiveDayInfo *arch = NULL;
+    int na = archive_list_days(from, to, &arch);
+    for (int i = 0; i < na; ++i) {
+        if (rollup_day(arch[i].date, day) != 0) {
+            failed = 1;
+            continue;
+        }
+        rollup_merge(out, day);
+        days++;
+    }
+    free(arch);
+    free(day);
+    return failed || na < 0 ? -1 : days;
+}
+
+static const Rollup *sort_src;
+
+/* Busiest pair first; ties by codes, so the order does not depend on the
+   order the pairs were met in. */
+static int cmp_pair(const void *a, const void *b) {
+    const PairRollup *x = &sort_src->pair[*(const int *)a], *y = &sort_src->pair[*(const int *)b];
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    int c = strcmp(currencies[x->from].name, currencies[y->from].name);
+    return c ? c : strcmp(currencies[x->to].name, currencies[y->to].name);
+}
+
+void rollup_print_pairs(FILE *out, const Rollup *r) {
+    int order[ROLLUP_MAX_PAIRS];
+    for (int i = 0; i < r->npairs; ++i) order[i] = i;
+    sort_src = r;
+    qsort(order, (size_t)r->npairs, sizeof(order[0]), cmp_pair);
+    fprintf(out, "%-9s %8s %8s %16s %16s %14s %14s\n", "pair", "count", "partial", "received",
+            "paid out", "avg rate", "profit LOC");
+    for (int i = 0; i < r->npairs; ++i) {
+        const PairRollup *p = &r->pair[order[i]];
+        char pair[24], a[32], b[32], rate[32], prof[32];
+        snprintf(pair, sizeof(pair), "%s/%s", currencies[p->from].name, currencies[p->to].name);
+        fprintf(out, "%-9s %8ld %7.1f%% %16s %16s %14s %14s\n", pair, p->count,
+                100.0 * (double)p->partial / (double)p->count, money_fmt(a, p->vol_from),
+                money_fmt(b, p->vol_to), rate_fmt(rate, rate_of(p->vol_to, p->vol_from)),
+                money_fmt(prof, p->profit));
+    }
+    if (r->unpaired)
+        fprintf(out, "(%ld row(s) with an unknown currency or past %d pairs are in the totals only)\n",
+                r->unpaired, ROLLUP_MAX_PAIRS);
+}
+
+void rollup_print_hours(FILE *out, const Rollup *r) {
+    int first = -1, last = -1;
+    long peak = 0;
+    for (int h = 0; h < ROLLUP_HOURS; ++h) {
+        if (!r->hour_count[h]) continue;
+        if (first < 0) first = h;
+        last = h;
+        if (r->hour_count[h] > peak) peak = r->hour_count[h];
+    }
+    if (first < 0) return;
+    fprintf(out, "%-5s %8s %16s\n", "hour", "count", "volume LOC");
+    for (int h = first; h <= last; ++h) {
+        char v[32];
+        int bar = (int)((r->hour_count[h] * 30 + peak - 1) / peak);
+        fprintf(out, "%02d    %8ld %16s%s%.*s\n", h, r->hour_count[h], money_fmt(v, r->hour_loc[h]),
+                bar ? "  " : "", bar, "##############################");
+    }
+}
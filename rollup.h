@@ -0,0 +1,71 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "utils.h"
+
+/* Per-pair and intraday analytics, stored as sales_<date>.rollup next to
+ * the CSV.
+ *
+ * One pass over a day's rows fills fixed-size accumulators: totals per
+ * hour, and per currency pair the count, partial count, volumes, profit
+ * and count/volume per hour. Pairs get slots in the order they are first
+ * seen, found through a small open-addressing table keyed by (from, to).
+ * The sidecar is kept up to date like the .sum one: reused while the CSV
+ * is unchanged, extended when rows were appended, rebuilt otherwise. A
+ * month is the sum of its days' rollups. */
+
+#define ROLLUP_HOURS 24
+#define ROLLUP_MAX_PAIRS 512      /* rows of further pairs count as unpaired */
+#define ROLLUP_SLOT_BITS 10
+#define ROLLUP_SLOTS (1 << ROLLUP_SLOT_BITS)   /* pair lookup table, at most half full */
+
+typedef struct {
+    uint8_t from, to;             /* registry indexes */
+    long count;
+    long partial;
+    Money vol_from;               /* amount_from received */
+    Money vol_to;                 /* amount_to paid out */
+    Money profit;                 /* LOC */
+    long hour_count[ROLLUP_HOURS];
+    Money hour_vol[ROLLUP_HOURS]; /* amount_from */
+} PairRollup;
+
+typedef struct {
+    long tx_count;
+    long partial;
+    long unpaired;                /* rows with an unknown currency, or past the pair limit */
+    Money profit;
+    long hour_count[ROLLUP_HOURS];
+    Money hour_loc[ROLLUP_HOURS]; /* amount_from in LOC at the row's rate */
+    int npairs;
+    uint16_t slot[ROLLUP_SLOTS];  /* pair index + 1; 0 = empty */
+    PairRollup pair[ROLLUP_MAX_PAIRS];
+} Rollup;
+
+void make_rollup_name(const char *date_text, char *out, size_t cap);
+
+/* Empty rollup. */
+void rollup_init(Rollup *r);
+/* Fold one row in. */
+void rollup_add_row(Rollup *r, const CsvRow *row);
+/* The same by fields: from/to are registry indexes or -1, hour 0..23 or -1. */
+void rollup_add(Rollup *r, int from, int to, int hour, Money amount_from, Money amount_to,
+                Rate rate_from_loc, int partial, Money profit);
+/* Add src's figures to dst. */
+void rollup_merge(Rollup *dst, const Rollup *src);
+
+/* The rollup of a day (YYYY-MM-DD), refreshing its sidecar if needed. A
+   missing CSV yields an empty rollup. Returns 0, or -1 on read error. */
+int rollup_day(const char *date_text, Rollup *out);
+/* The rollup of a month (YYYY-MM), from its days' rollups. Returns the
+   number of days with a sales file, or -1. */
+int rollup_month(const char *year_month, Rollup *out);
+
+/* Pair table: count, partial share, volumes, average rate, profit. */
+void rollup_print_pairs(FILE *out, const Rollup *r);
+/* Transactions and LOC volume per hour, from the first to the last busy hour. */
+void rollup_print_hours(FILE *out, const Rollup *r);
+
+#endif /* ROLLUP_H */
@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+
+#include "segment.h"
+#include "diag.h"
+#include "utils.h"
+#include "journal.h"
+#include "codec.h"
+#include "metrics.h"
+#include "manifest.h"
+#include "daysum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define SEG_ALIGN 64
+#define SEG_CODE 8        /* bytes per code table entry */
+
+static const size_t COL_WIDTH[SEG_NCOLS] = {
+    [SEG_COL_TX_ID] = 8, [SEG_COL_TS] = 8,
+    [SEG_COL_FROM] = 1, [SEG_COL_TO] = 1,
+    [SEG_COL_AMOUNT_FROM] = 8, [SEG_COL_AMOUNT_TO] = 8,
+    [SEG_COL_RATE_FROM] = 8, [SEG_COL_RATE_TO] = 8,
+    [SEG_COL_PARTIAL] = 1, [SEG_COL_REMAINDER] = 8, [SEG_COL_PROFIT] = 8,
+};
+
+static size_t align_up(size_t n) { return (n + SEG_ALIGN - 1) & ~(size_t)(SEG_ALIGN - 1); }
+
+void make_segment_name(const char *date_text, char *out, size_t cap) {
+    snprintf(out, cap, "%.4s/%.2s/sales_%s.seg", date_text, date_text + 5, date_text);
+}
+
+int segment_open(const char *date_text, LedgerSegment *seg) {
+    char fname[128];
+    make_segment_name(date_text, fname, sizeof(fname));
+    memset(seg, 0, sizeof(*seg));
+
+    int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    metrics_add(MET_FILES_OPENED, 1);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SegHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const SegHeader *h = map;
+    int ok = memcmp(h->magic, SEG_MAGIC, sizeof(SEG_MAGIC)) == 0 && h->version == SEG_VERSION;
+    for (int c = 0; ok && c < SEG_NCOLS; ++c)
+        ok = h->col_off[c] % SEG_ALIGN == 0 &&
+             h->col_off[c] + (uint64_t)h->rows * COL_WIDTH[c] <= (uint64_t)st.st_size;
+    ok = ok && h->ncur < SEG_NO_CUR && h->cur_off + (uint64_t)h->ncur * SEG_CODE <= (uint64_t)st.st_size;
+    if (!ok) {
+        diag("Ignoring invalid segment %s", fname);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    const char *base = map;
+    seg->map = map;
+    seg->map_len = (size_t)st.st_size;
+    seg->hdr = h;
+    seg->rows = h->rows;
+    seg->tx_id       = (const int64_t *)(base + h->col_off[SEG_COL_TX_ID]);
+    seg->ts          = (const int64_t *)(base + h->col_off[SEG_COL_TS]);
+    seg->from_cur    = (const uint8_t *)(base + h->col_off[SEG_COL_FROM]);
+    seg->to_cur      = (const uint8_t *)(base + h->col_off[SEG_COL_TO]);
+    seg->amount_from = (const int64_t *)(base + h->col_off[SEG_COL_AMOUNT_FROM]);
+    seg->amount_to   = (const int64_t *)(base + h->col_off[SEG_COL_AMOUNT_TO]);
+    seg->rate_from   = (const int64_t *)(base + h->col_off[SEG_COL_RATE_FROM]);
+    seg->rate_to     = (const int64_t *)(base + h->col_off[SEG_COL_RATE_TO]);
+    seg->partial     = (const uint8_t *)(base + h->col_off[SEG_COL_PARTIAL]);
+    seg->remainder   = (const int64_t *)(base + h->col_off[SEG_COL_REMAINDER]);
+    seg->profit      = (const int64_t *)(base + h->col_off[SEG_COL_PROFIT]);
+    memset(seg->cur_map, SEG_NO_CUR, sizeof(seg->cur_map));
+    for (uint32_t i = 0; i < h->ncur; ++i) {
+        char code[SEG_CODE + 1];
+        memcpy(code, base + h->cur_off + (size_t)i * SEG_CODE, SEG_CODE);
+        code[SEG_CODE] = '\0';
+        int idx = currency_from_code(code);
+        if (idx >= 0) seg->cur_map[i] = (uint8_t)idx;
+    }
+    return 0;
+}
+
+void segment_close(LedgerSegment *seg) {
+    if (seg->map) munmap(seg->map, seg->map_len);
+    memset(seg, 0, sizeof(*seg));
+}
+
+int segment_covers(const LedgerSegment *seg, int csv_fd, const struct stat *csv_st) {
+    if (seg->hdr->src_size > (int64_t)csv_st->st_size) return 0;   /* file was rewritten */
+    return day_file_tail_hash(csv_fd, seg->hdr->src_size) == seg->hdr->tail_hash;
+}
+
+typedef int64_t v4di __attribute__((vector_size(32)));
+
+/* Column sum with two independent 4-lane accumulators; the column start is
+   64-byte aligned so the main loop uses aligned vector loads. Integer adds
+   are associative, so the result equals a sequential sum. */
+static int64_t sum_i64(const int64_t *x, size_t n) {
+    v4di acc0 = { 0, 0, 0, 0 }, acc1 = { 0, 0, 0, 0 };
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 += *(const v4di *)(x + i);
+        acc1 += *(const v4di *)(x + i + 4);
+    }
+    acc0 += acc1;
+    int64_t s = acc0[0] + acc0[1] + acc0[2] + acc0[3];
+    for (; i < n; ++i) s += x[i];
+    return s;
+}
+
+int64_t segment_sum_profit(const LedgerSegment *seg) {
+    return sum_i64(seg->profit, seg->rows);
+}
+
+static int64_t row_timestamp(const CsvRow *r) {
+    struct tm tm = { 0 };
+    if (sscanf(r->date, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3) return 0;
+    sscanf(r->time, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return (int64_t)timegm(&tm);
+}
+
+/* The segment's own code table: every code met in the CSV gets an entry,
+   registry currency or not, so the segment reads the same under any registry. */
+typedef struct {
+    char code[SEG_NO_CUR][SEG_CODE];
+    int n;
+    int16_t by_reg[MAX_CUR];   /* registry index -> entry, -1 until seen */
+} CodeTable;
+
+static uint8_t seg_cur(CodeTable *t, const char *code) {
+    int reg = currency_from_code(code);
+    if (reg >= 0 && t->by_reg[reg] >= 0) return (uint8_t)t->by_reg[reg];
+    const char *name = reg >= 0 ? currencies[reg].name : code;
+    if (reg < 0) {
+        for (int i = 0; i < t->n; ++i)
+            if (strncmp(t->code[i], name, SEG_CODE) == 0) return (uint8_t)i;
+    }
+    if (t->n == SEG_NO_CUR || strlen(name) > SEG_CODE) return SEG_NO_CUR;
+    memcpy(t->code[t->n], name, strlen(name));
+    if (reg >= 0) t->by_reg[reg] = (int16_t)t->n;
+    return (uint8_t)t->n++;
+}
+
+long segment_build(const char *date_text) {
+    journal_flush();
+    char csv_name[128], seg_name[128], tmp_name[160];
+    make_daily_csv_name(date_text, csv_name, sizeof(csv_name));
+    make_segment_name(date_text, seg_name, sizeof(seg_name));
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", seg_name);
+
+    CsvReader rd;
+    if (csv_reader_open(&rd, csv_name) != 0) {
+        diag("Could not open %s for reading: %s", csv_name, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(rd.fd, &st) != 0) {
+        csv_reader_close(&rd);
+        return -1;
+    }
+
+    size_t cap = 1024, n = 0;
+    char *cols[SEG_NCOLS];
+    long result = -1;
+    FILE *out = NULL;
+    for (int c = 0; c < SEG_NCOLS; ++c) cols[c] = malloc(cap * COL_WIDTH[c]);
+    for (int c = 0; c < SEG_NCOLS; ++c) {
+        if (!cols[c]) {
+            diag("Out of memory building %s", seg_name);
+            csv_reader_close(&rd);
+            goto done;
+        }
+    }
+
+    CodeTable codes;
+    memset(codes.code, 0, sizeof(codes.code));
+    memset(codes.by_reg, 0xFF, sizeof(codes.by_reg));
+    codes.n = 0;
+
+    /* The reader stops before a torn or in-progress last line. */
+    CsvRow r;
+    while (csv_reader_next(&rd, &r, NULL)) {
+        if (n == cap) {
+            cap *= 2;
+            for (int c = 0; c < SEG_NCOLS; ++c) {
+                char *p = realloc(cols[c], cap * COL_WIDTH[c]);
+                if (!p) {
+                    diag("Out of memory building %s", seg_name);
+                    csv_reader_close(&rd);
+                    goto done;
+                }
+                cols[c] = p;
+            }
+        }
+        ((int64_t *)cols[SEG_COL_TX_ID])[n]      = r.tx_id;
+        ((int64_t *)cols[SEG_COL_TS])[n]         = row_timestamp(&r);
+        ((uint8_t *)cols[SEG_COL_FROM])[n]       = seg_cur(&codes, r.from);
+        ((uint8_t *)cols[SEG_COL_TO])[n]         = seg_cur(&codes, r.to);
+        ((int64_t *)cols[SEG_COL_AMOUNT_FROM])[n] = r.amount_from;
+        ((int64_t *)cols[SEG_COL_AMOUNT_TO])[n]   = r.amount_to;
+        ((int64_t *)cols[SEG_COL_RATE_FROM])[n]   = r.rate_from_loc;
+        ((int64_t *)cols[SEG_COL_RATE_TO])[n]     = r.rate_to_loc;
+        ((uint8_t *)cols[SEG_COL_PARTIAL])[n]    = r.partial ? 1 : 0;
+        ((int64_t *)cols[SEG_COL_REMAINDER])[n]   = r.remainder_loc;
+        ((int64_t *)cols[SEG_COL_PROFIT])[n]      = r.profit_loc;
+        n++;
+    }
+    long covered = csv_reader_tell(&rd);
+    uint64_t tail_hash = day_file_tail_hash(rd.fd, covered);
+    csv_reader_close(&rd);
+
+    SegHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SEG_MAGIC, sizeof(SEG_MAGIC));
+    h.version = SEG_VERSION;
+    h.rows = (uint32_t)n;
+    h.src_size = covered;
+    h.src_mtime = (int64_t)st.st_mtime;
+    h.tail_hash = tail_hash;
+    h.ncur = (uint32_t)codes.n;
+    h.cur_off = sizeof(h);
+    size_t pos = align_up(sizeof(h) + (size_t)codes.n * SEG_CODE);
+    for (int c = 0; c < SEG_NCOLS; ++c) {
+        h.col_off[c] = pos;
+        pos = align_up(pos + n * COL_WIDTH[c]);
+    }
+
+    out = fopen(tmp_name, "wb");
+    if (!out) {
+        diag("Could not create %s: %s", tmp_name, strerror(errno));
+        goto done;
+    }
+    static const char zeros[SEG_ALIGN];
+    int ok = fwrite(&h, sizeof(h), 1, out) == 1;
+    ok = ok && fwrite(codes.code, SEG_CODE, (size_t)codes.n, out) == (size_t)codes.n;
+    size_t written = sizeof(h) + (size_t)codes.n * SEG_CODE;
+    for (int c = 0; ok && c < SEG_NCOLS; ++c) {
+        ok = fwrite(zeros, 1, h.col_off[c] - written, out) == h.col_off[c] - written &&
+             fwrite(cols[c], COL_WIDTH[c], n, out) == n;
+        written = h.col_off[c] + n * COL_WIDTH[c];
+    }
+    ok = ok && fwrite(zeros, 1, pos - written, out) == pos - written;
+    ok = ok && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    ok = (fclose(out) == 0) && ok;
+    if (!ok || rename(tmp_name, seg_name) != 0) {
+        diag("Could not write segment %s: %s", seg_name, strerror(errno));
+        unlink(tmp_name);
+        goto done;
+    }
+    result = (long)n;
+
+done:
+    for (int c = 0; c < SEG_NCOLS; ++c) free(cols[c]);
+    return result;
+}
+
+int segment_build_all(SegmentBuilt built_fn, void *ctx) {
+    ManifestEntry *files = NULL;
+    int nf = manifest_list("0000-00-00", "9999-99-99", MAN_SALES, &files);
+    if (nf < 0) return -1;
+    int built = 0;
+    for (int i = 0; i < nf; ++i) {
+        const char *name = files[i].path, *date = files[i].date;
+        struct stat st;
+        LedgerSegment seg;
+        if (stat(name, &st) != 0) continue;
+        if (segment_open(date, &seg) == 0) {
+            int fresh = seg.hdr->src_size == (int64_t)st.st_size &&
+                        seg.hdr->src_mtime == (int64_t)st.st_mtime;
+            segment_close(&seg);
+            if (fresh) continue;
+        }
+        long rows = segment_build(date);
+        if (rows >= 0) {
+            if (built_fn) built_fn(name, rows, ctx);
+            built++;
+        }
+    }
+    free(files);
+    return built;
+}
@@ -0,0 +1,90 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* Binary columnar ledger segment, stored as sales_<date>.seg next to the CSV.
+ *
+ * A segment holds the rows of the first `src_size` bytes of the CSV, one
+ * fixed-width column per field, each column 64-byte aligned so it can be
+ * mmap'ed and scanned with vector loads. Rows appended to the CSV after the
+ * segment was built are read from the CSV tail. Currency columns hold
+ * indexes into the segment's own code table, which is mapped onto the
+ * registry when the segment is opened. */
+
+#define SEG_MAGIC "EXSEG01"
+#define SEG_VERSION 4   /* 2: fixed-point money columns, 3: currency code table, 4: tail hash */
+#define SEG_NO_CUR 0xFF   /* currency code not in the registry */
+
+enum {
+    SEG_COL_TX_ID,        /* int64, 0 for legacy rows */
+    SEG_COL_TS,           /* int64, wall-clock date+time as seconds since epoch */
+    SEG_COL_FROM,         /* uint8 index into the code table */
+    SEG_COL_TO,           /* uint8 index into the code table */
+    SEG_COL_AMOUNT_FROM,  /* int64 Money */
+    SEG_COL_AMOUNT_TO,    /* int64 Money */
+    SEG_COL_RATE_FROM,    /* int64 Rate */
+    SEG_COL_RATE_TO,      /* int64 Rate */
+    SEG_COL_PARTIAL,      /* uint8 */
+    SEG_COL_REMAINDER,    /* int64 Money */
+    SEG_COL_PROFIT,       /* int64 Money */
+    SEG_NCOLS
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t rows;
+    int64_t src_size;     /* CSV bytes covered by this segment */
+    int64_t src_mtime;    /* CSV mtime when the segment was built */
+    uint64_t col_off[SEG_NCOLS];
+    uint64_t cur_off;     /* code table: ncur entries of char[8] */
+    uint32_t ncur;
+    uint32_t reserved;
+    uint64_t tail_hash;   /* day_file_tail_hash() of the CSV at src_size */
+} SegHeader;
+
+typedef struct {
+    void *map;
+    size_t map_len;
+    const SegHeader *hdr;
+    size_t rows;
+    const int64_t *tx_id;
+    const int64_t *ts;
+    const uint8_t *from_cur;
+    const uint8_t *to_cur;
+    const int64_t *amount_from;
+    const int64_t *amount_to;
+    const int64_t *rate_from;
+    const int64_t *rate_to;
+    const uint8_t *partial;
+    const int64_t *remainder;
+    const int64_t *profit;
+    uint8_t cur_map[256]; /* column value -> registry index or SEG_NO_CUR */
+} LedgerSegment;
+
+void make_segment_name(const char *date_text, char *out, size_t cap);
+
+/* Map the segment for a date. Returns 0 on success, -1 if missing or invalid. */
+int segment_open(const char *date_text, LedgerSegment *seg);
+void segment_close(LedgerSegment *seg);
+
+/* 1 if the segment describes a prefix of the open CSV `csv_fd` whose stat
+   is given: the CSV is at least src_size bytes long and the bytes ending
+   there still hash to tail_hash, so a rewrite to the same or a larger size
+   is not taken for an append. */
+int segment_covers(const LedgerSegment *seg, int csv_fd, const struct stat *csv_st);
+
+/* Sum of the profit column in minor units. */
+int64_t segment_sum_profit(const LedgerSegment *seg);
+
+/* Build (or rebuild) the segment for a date from its CSV. Returns rows or -1. */
+long segment_build(const char *date_text);
+/* Build segments for every sales_*.csv whose segment is missing or stale;
+   built (may be NULL) is told of each one. Returns the number written. */
+typedef void (*SegmentBuilt)(const char *csv_path, long rows, void *ctx);
+int segment_build_all(SegmentBuilt built, void *ctx);
+
+#endif /* SEGMENT_H */
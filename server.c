@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "diag.h"
+#include "utils.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "txid.h"
+#include "metrics.h"
+#include "exchange.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CONN 256
+#define IO_BUF 8192
+#define HOUSEKEEP_MS 200
+
+/* Ledger state: tx ids, journal, receipts and the date. */
+static pthread_mutex_t ledger_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *receipts;
+static char receipt_name[128];
+static long accepted, rejected;
+
+/* Held shared from an exchange's commit until its row is appended,
+   exclusively while a state snapshot is taken. */
+static pthread_rwlock_t state_lock;
+
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t conn_gone = PTHREAD_COND_INITIALIZER;
+static int conn_fd[MAX_CONN];
+static int conn_count;
+
+static volatile sig_atomic_t stopping;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static FILE *open_receipts(void) {
+    return receipt_open(current_date, receipt_name, sizeof(receipt_name));
+}
+
+/* Number the exchange and append it to the ledger. Returns the tx id. */
+static int record(const Order *o, const ExchangeQuote *x) {
+    pthread_mutex_lock(&ledger_lock);
+    if (refresh_current_date()) {
+        if (receipts) fclose(receipts);
+        receipts = open_receipts();
+    }
+    char timebuf[16];
+    exchange_clock_text(NULL, timebuf);
+
+    int tx_id = txid_next();
+    Transaction trans = {
+        .id = tx_id,
+        .from_cur = o->from,
+        .to_cur = o->to,
+        .amount_from = o->amount,
+        .amount_to = x->amt_to,
+        .rate = rate_of(x->amt_to, o->amount)
+    };
+    snprintf(trans.date, sizeof(trans.date), "%.10s", current_date);
+    snprintf(trans.time, sizeof(trans.time), "%.8s", timebuf);
+    if (receipts) receipt_write(receipts, &trans);
+    csv_log_row(current_date, timebuf, tx_id, currencies[o->from].name, currencies[o->to].name,
+                o->amount, x->amt_to, x->rate_from_loc, x->rate_to_loc,
+                o->partial, x->remainder_loc, x->profit_delta);
+    ++accepted;
+    pthread_mutex_unlock(&ledger_lock);
+    return tx_id;
+}
+
+/* Handle one request line; writes the reply (with '\n') to out. Returns 1
+   when the client asked to close. */
+static int handle_line(char *line, char *out, size_t cap) {
+    size_t L = strlen(line);
+    while (L && (line[L-1] == '\r' || line[L-1] == ' ')) line[--L] = '\0';
+    out[0] = '\0';
+    if (strcasecmp(line, "QUIT") == 0) return 1;
+    if (strcasecmp(line, "BAL") == 0) {
+        size_t n = (size_t)snprintf(out, cap, "OK");
+        for (int i = 0; i < cur_count && n < cap; ++i) {
+            char a[32];
+            n += (size_t)snprintf(out + n, cap - n, " %s=%s", currencies[i].name, money_fmt(a, currencies[i].bal));
+        }
+        if (n < cap) snprintf(out + n, cap - n, "\n");
+        return 0;
+    }
+
+    Order o;
+    ExchangeQuote x;
+    char why[BUF];
+    if (order_parse(line, &o, why, sizeof(why)) != 0) {
+        pthread_mutex_lock(&ledger_lock);
+        ++rejected;
+        pthread_mutex_unlock(&ledger_lock);
+        snprintf(out, cap, "ERR %s\n", why);
+        return 0;
+    }
+    int64_t t0 = metrics_start(MET_EXCHANGE);
+    pthread_rwlock_rdlock(&state_lock);
+    int rc = exchange_order(&o, &x, NULL, why, sizeof(why));
+    if (rc != EXCHANGE_OK) {
+        pthread_rwlock_unlock(&state_lock);
+        metrics_end(MET_EXCHANGE, t0);
+        pthread_mutex_lock(&ledger_lock);
+        ++rejected;
+        pthread_mutex_unlock(&ledger_lock);
+        snprintf(out, cap, "ERR %s\n", why);
+        return 0;
+    }
+    int tx_id = record(&o, &x);
+    pthread_rwlock_unlock(&state_lock);
+    metrics_end(MET_EXCHANGE, t0);
+    char a[32], b[32];
+    snprintf(out, cap, "OK %d %s %s %s\n", tx_id, money_fmt(a, x.amt_to), currencies[o.to].name,
+             money_fmt(b, x.remainder_loc));
+    return 0;
+}
+
+static int send_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+static int conn_add(int fd) {
+    pthread_mutex_lock(&conn_lock);
+    int ok = conn_count < MAX_CONN && !stopping;
+    if (ok) conn_fd[conn_count++] = fd;
+    pthread_mutex_unlock(&conn_lock);
+    return ok ? 0 : -1;
+}
+
+static void conn_remove(int fd) {
+    pthread_mutex_lock(&conn_lock);
+    for (int i = 0; i < conn_count; ++i) {
+        if (conn_fd[i] == fd) {
+            conn_fd[i] = conn_fd[--conn_count];
+            break;
+        }
+    }
+    pthread_cond_signal(&conn_gone);
+    pthread_mutex_unlock(&conn_lock);
+}
+
+/* Requests may be pipelined: every complete line in a read is answered, and
+   the replies go back in one write. */
+static void *serve_conn(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    char in[IO_BUF], out[IO_BUF + SERVER_REPLY_MAX];
+    size_t have = 0;
+    int quit = 0;
+    while (!quit) {
+        ssize_t n = recv(fd, in + have, sizeof(in) - have, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        have += (size_t)n;
+
+        size_t used = 0, olen = 0;
+        char *nl;
+        while (!quit && (nl = memchr(in + used, '\n', have - used))) {
+            *nl = '\0';
+            if (olen + SERVER_REPLY_MAX > sizeof(out)) {
+                if (send_all(fd, out, olen) != 0) quit = 1;
+                olen = 0;
+            }
+            quit = handle_line(in + used, out + olen, sizeof(out) - olen) || quit;
+            olen += strlen(out + olen);
+            used = (size_t)(nl - in) + 1;
+        }
+        if (have == sizeof(in) && used == 0) {
+            olen += (size_t)snprintf(out + olen, sizeof(out) - olen, "ERR line too long\n");
+            used = have;
+        }
+        if (olen && send_all(fd, out, olen) != 0) break;
+        memmove(in, in + used, have - used);
+        have -= used;
+    }
+    conn_remove(fd);
+    close(fd);
+    return NULL;
+}
+
+/* Commit the journal and, when due, snapshot the state between requests. */
+static void housekeep(void) {
+    pthread_mutex_lock(&ledger_lock);
+    journal_commit();
+    if (receipts) fflush(receipts);
+    int due = snapshot_due();
+    pthread_mutex_unlock(&ledger_lock);
+    if (due) {
+        pthread_rwlock_wrlock(&state_lock);
+        snapshot_write();
+        pthread_rwlock_unlock(&state_lock);
+    }
+}
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int make_addr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        diag("Socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int server_listen(const char *sock_path) {
+    struct sockaddr_un addr;
+    if (make_addr(sock_path, &addr) != 0) return -1;
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0) {
+        diag("socket: %s", strerror(errno));
+        return -1;
+    }
+    /* Refuse to steal the socket of a running server; remove a stale one. */
+    if (connect(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        diag("A server is already listening on %s", sock_path);
+        close(lfd);
+        return -1;
+    }
+    unlink(sock_path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 128) != 0) {
+        diag("Could not listen on %s: %s", sock_path, strerror(errno));
+        close(lfd);
+        return -1;
+    }
+    return lfd;
+}
+
+int server_run(int lfd, const char *sock_path, ServerStats *st) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_rwlockattr_t rwa;
+    pthread_rwlockattr_init(&rwa);
+    pthread_rwlockattr_setkind_np(&rwa, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&state_lock, &rwa);
+    pthread_rwlockattr_destroy(&rwa);
+    receipts = open_receipts();
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    long last = now_ms();
+    while (!stopping) {
+        struct pollfd p = { .fd = lfd, .events = POLLIN };
+        if (poll(&p, 1, HOUSEKEEP_MS) > 0) {
+            int c = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            if (c >= 0) {
+                pthread_t th;
+                if (conn_add(c) != 0) {
+                    send_all(c, "ERR server busy\n", 16);
+                    close(c);
+                } else if (pthread_create(&th, &attr, serve_conn, (void *)(intptr_t)c) != 0) {
+                    conn_remove(c);
+                    close(c);
+                }
+            }
+        }
+        if (now_ms() - last >= HOUSEKEEP_MS) {
+            housekeep();
+            last = now_ms();
+        }
+    }
+
+    /* Stop reading from every client, let in-flight requests finish. */
+    close(lfd);
+    unlink(sock_path);
+    pthread_mutex_lock(&conn_lock);
+    for (int i = 0; i < conn_count; ++i) shutdown(conn_fd[i], SHUT_RD);
+    while (conn_count > 0) pthread_cond_wait(&conn_gone, &conn_lock);
+    pthread_mutex_unlock(&conn_lock);
+    pthread_attr_destroy(&attr);
+
+    housekeep();
+    snapshot_write();
+    journal_close();
+    if (receipts) fclose(receipts);
+    receipts = NULL;
+    if (st) {
+        st->accepted = accepted;
+        st->rejected = rejected;
+    }
+    return 0;
+}
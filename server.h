@@ -0,0 +1,39 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/* Multi-cashier server on a Unix domain socket.
+ *
+ * Each connection is served by its own thread. Requests and replies are
+ * single lines:
+ *
+ *   from,to,amount[,partial_amount]   exchange, same fields as a --batch order
+ *       -> OK <tx_id> <amount_to> <to> <remainder_loc>
+ *       -> ERR <reason>
+ *   BAL                               reserves
+ *       -> OK LOC=<bal> USD=<bal> ...
+ *   QUIT                              close the connection
+ *
+ * Orders are priced and committed by exchange_order, as for --batch; two
+ * orders only wait on each other when they share a currency. The slow
+ * part, numbering and logging the accepted exchange to the one day
+ * journal, runs under a separate ledger lock. */
+
+#include "utils.h"
+
+#define SERVER_REPLY_MAX (64 + 32 * MAX_CUR)   /* longest reply: BAL with every currency */
+
+typedef struct {
+    long accepted;
+    long rejected;
+} ServerStats;
+
+/* Bind and listen on the socket (a stale one is replaced, a live one is
+   not). Returns the listening fd, or -1 with a message. */
+int server_listen(const char *sock_path);
+
+/* Serve on lfd until SIGINT/SIGTERM, then finish the open requests, write
+   a snapshot and remove the socket. st (may be NULL) gets the counts.
+   Returns 0 on a clean shutdown. */
+int server_run(int lfd, const char *sock_path, ServerStats *st);
+
+#endif /* SERVER_H */
@@ -0,0 +1,487 @@
+#define _GNU_SOURCE
+
+#include "snapshot.h"
+#include "diag.h"
+#include "journal.h"
+#include "writer.h"
+#include "txid.h"
+#include "codec.h"
+#include "metrics.h"
+#include "manifest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SNAP_MAGIC "EXSNAP1"
+#define SNAP_VERSION 1
+#define SNAP_PREV SNAP_FILE ".prev"
+#define SNAP_TAIL 64         /* ledger bytes before the position that must not change */
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t ncur;
+    char date[16];           /* day file of the position, "" before the first row */
+    int64_t offset;          /* bytes of that file whose rows are included */
+    uint64_t tail_hash;      /* FNV-1a of the SNAP_TAIL bytes ending at offset */
+    int64_t profit;          /* minor units */
+    int64_t last_tx_id;
+    int64_t written;         /* time() of the snapshot */
+    uint64_t checksum;       /* FNV-1a of the currency records */
+} SnapHeader;
+
+typedef struct {
+    char code[8];
+    int64_t bal;
+    int64_t critical_min;
+    int64_t buy;
+    int64_t sell;
+    int64_t conf_buy;        /* registry values the ones above started from */
+    int64_t conf_sell;
+    int64_t conf_critical;
+    int32_t n;
+    int32_t reserved;
+    int64_t denom[TILL_MAX_DENOMS];
+    int64_t stock[TILL_MAX_DENOMS];
+} SnapCurrency;
+
+/* Registry values at load, to tell runtime changes from config edits. */
+static Rate conf_buy[MAX_CUR], conf_sell[MAX_CUR];
+static Money conf_crit[MAX_CUR];
+
+static int active;           /* recovery ran: snapshots are on */
+static char snap_date[16];   /* position of the last snapshot */
+static long snap_off;
+static time_t snap_time;
+static char end_date[16];    /* ledger end found by recovery */
+static long end_off;
+
+static uint64_t fnv(uint64_t h, const void *p, size_t n) {
+    const unsigned char *b = p;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= b[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t tail_hash(const char *date_text, int64_t end) {
+    char fname[128];
+    unsigned char buf[SNAP_TAIL];
+    make_daily_csv_name(date_text, fname, sizeof(fname));
+    int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    int64_t start = end > SNAP_TAIL ? end - SNAP_TAIL : 0;
+    ssize_t n = end > start ? pread(fd, buf, (size_t)(end - start), start) : 0;
+    close(fd);
+    return fnv(1469598103934665603ULL, buf, n > 0 ? (size_t)n : 0);
+}
+
+static void position(char *date, size_t cap, long *off) {
+    if (journal_position(date, cap, off) != 0) {
+        snprintf(date, cap, "%s", end_date);
+        *off = end_off;
+    }
+}
+
+static void pay_out(int cur, Money amount, int *short_pay) {
+    Payout p;
+    currencies[cur].bal -= amount;
+    if (amount > 0 && (!till_plan(&currencies[cur].till, amount, &p) ||
+                       till_remove(&currencies[cur].till, &p) != 0))
+        *short_pay = 1;
+}
+
+/* Same order as an exchange: payouts first, then the amount handed in. */
+int ledger_apply_row(const CsvRow *row) {
+    int from = currency_from_code(row->from);
+    int to = currency_from_code(row->to);
+    int short_pay = 0;
+    profit_loc += row->profit_loc;
+    if (row->has_tx_id) txid_observe(row->tx_id);
+    if (from < 0 || to < 0) return -1;
+
+    pay_out(to, row->amount_to, &short_pay);
+    pay_out(CUR_LOC, row->remainder_loc, &short_pay);
+    Payout in;
+    currencies[from].bal += row->amount_from;
+    till_split(&currencies[from].till, row->amount_from, &in);
+    till_add(&currencies[from].till, &in);
+    return short_pay ? -1 : 0;
+}
+
+static int write_state(void) {
+    writer_drain();                     /* queued rows belong before the position */
+    if (journal_commit() != 0) return -1;
+
+    SnapHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    h.version = SNAP_VERSION;
+    h.ncur = (uint32_t)cur_count;
+    long off;
+    position(h.date, sizeof(h.date), &off);
+    h.offset = off;
+    h.tail_hash = h.date[0] ? tail_hash(h.date, h.offset) : 0;
+    h.profit = profit_loc;
+    h.last_tx_id = last_transaction_id;
+    h.written = (int64_t)time(NULL);
+
+    SnapCurrency *sc = calloc((size_t)cur_count, sizeof(SnapCurrency));
+    if (!sc) {
+        diag("Memory allocation failed for the state snapshot!");
+        return -1;
+    }
+    uint64_t sum = 1469598103934665603ULL;
+    for (int i = 0; i < cur_count; ++i) {
+        const Currency *c = &currencies[i];
+        SnapCurrency *s = &sc[i];
+        snprintf(s->code, sizeof(s->code), "%s", c->name);
+        s->bal = c->bal;
+        s->critical_min = c->critical_min;
+        s->buy = c->buy_to_loc;
+        s->sell = c->sell_to_loc;
+        s->conf_buy = conf_buy[i];
+        s->conf_sell = conf_sell[i];
+        s->conf_critical = conf_crit[i];
+        s->n = c->till.n;
+        for (int k = 0; k < c->till.n; ++k) {
+            s->denom[k] = c->till.denom[k];
+            s->stock[k] = c->till.stock[k];
+        }
+        sum = fnv(sum, s, sizeof(*s));
+    }
+    h.checksum = sum;
+
+    const char *tmp = SNAP_FILE ".tmp";
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        diag("Could not create %s: %s", tmp, strerror(errno));
+        free(sc);
+        return -1;
+    }
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(sc, sizeof(*sc), (size_t)cur_count, f) == (size_t)cur_count;
+    free(sc);
+    ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+    ok = (fclose(f) == 0) && ok;
+    if (ok) {
+        if (rename(SNAP_FILE, SNAP_PREV) != 0 && errno != ENOENT) ok = 0;
+        else ok = rename(tmp, SNAP_FILE) == 0;
+    }
+    if (!ok) {
+        diag("Could not write %s: %s", SNAP_FILE, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    int dir = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);   /* make the rename durable */
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+    snprintf(snap_date, sizeof(snap_date), "%s", h.date);
+    snap_off = off;
+    snap_time = time(NULL);
+    return 0;
+}
+
+int snapshot_write(void) {
+    if (!active) return 0;
+    int64_t t0 = metrics_start(MET_SNAPSHOT_WRITE);
+    int rc = write_state();
+    metrics_end(MET_SNAPSHOT_WRITE, t0);
+    return rc;
+}
+
+int snapshot_due(void) {
+    if (!active) return 0;
+    char date[16];
+    long off;
+    position(date, sizeof(date), &off);
+    if (strcmp(date, snap_date) != 0) return 1;
+    if (off == snap_off) return 0;
+    return off - snap_off >= SNAP_EVERY_BYTES || time(NULL) - snap_time >= SNAP_EVERY_SEC;
+}
+
+void snapshot_tick(void) {
+    if (snapshot_due()) snapshot_write();
+}
+
+/* Read a snapshot. Returns 0, 1 if valid but the ledger no longer matches
+   its position, or -1 if missing or damaged. */
+static int load_snapshot(const char *fname, SnapHeader *h, SnapCurrency **out) {
+    FILE *f = fopen(fname, "rb");
+    if (!f) return -1;
+    metrics_add(MET_FILES_OPENED, 1);
+    SnapCurrency *sc = NULL;
+    int ok = fread(h, sizeof(*h), 1, f) == 1 && memcmp(h->magic, SNAP_MAGIC, 8) == 0 &&
+             h->version == SNAP_VERSION && h->ncur <= MAX_CUR &&
+             h->date[sizeof(h->date) - 1] == '\0';
+    if (ok && h->ncur > 0) {
+        sc = calloc(h->ncur, sizeof(*sc));
+        ok = sc && fread(sc, sizeof(*sc), h->ncur, f) == h->ncur;
+    }
+    fclose(f);
+    if (ok && fnv(1469598103934665603ULL, sc, (size_t)h->ncur * sizeof(*sc)) != h->checksum) ok = 0;
+    for (uint32_t i = 0; ok && i < h->ncur; ++i)
+        ok = sc[i].code[sizeof(sc[i].code) - 1] == '\0' && sc[i].n > 0 && sc[i].n <= TILL_MAX_DENOMS;
+    if (!ok) {
+        diag("Ignoring damaged state snapshot %s", fname);
+        free(sc);
+        return -1;
+    }
+    *out = sc;
+    if (!h->date[0]) return 0;
+    char csv[128];
+    struct stat st;
+    make_daily_csv_name(h->date, csv, sizeof(csv));
+    if (stat(csv, &st) != 0 || st.st_size < h->offset || tail_hash(h->date, h->offset) != h->tail_hash)
+        return 1;
+    return 0;
+}
+
+/* Put a snapshot's figures into the registry. Rates and critical minimums
+   edited in the config file since the snapshot win over the snapshot's. */
+static void apply_snapshot(const SnapHeader *h, const SnapCurrency *sc) {
+    int seen[MAX_CUR] = {0};
+    profit_loc = h->profit;
+    txid_observe((int)h->last_tx_id);
+    for (uint32_t k = 0; k < h->ncur; ++k) {
+        const SnapCurrency *s = &sc[k];
+        int i = currency_from_code(s->code);
+        if (i < 0 || seen[i]) {
+            char a[32];
+            diag("Warning: %s is no longer in the registry; its reserve of %s is dropped.",
+                    s->code, money_fmt(a, s->bal));
+            continue;
+        }
+        seen[i] = 1;
+        Currency *c = &currencies[i];
+        c->bal = s->bal;
+        if (i != CUR_LOC && s->conf_buy == c->buy_to_loc && s->conf_sell == c->sell_to_loc) {
+            c->buy_to_loc = s->buy;
+            c->sell_to_loc = s->sell;
+        }
+        if (s->conf_critical == c->critical_min) c->critical_min = s->critical_min;
+
+        /* Stock by denomination value, so a changed denomination list keeps
+           what still exists; moved as counts, the table refreshes lazily. */
+        Payout give, take;
+        memset(&give, 0, sizeof(give));
+        memset(&take, 0, sizeof(take));
+        for (int d = 0; d < c->till.n; ++d) {
+            long want = 0;
+            for (int e = 0; e < s->n; ++e)
+                if (s->denom[e] == c->till.denom[d]) want = (long)s->stock[e];
+            if (want > c->till.stock[d]) give.count[d] = want - c->till.stock[d];
+            else take.count[d] = c->till.stock[d] - want;
+        }
+        till_remove(&c->till, &take);
+        till_add(&c->till, &give);
+        if (till_value(&c->till) != c->bal) {
+            char a[32], b[32];
+            diag("Warning: the %s till holds %s against a reserve of %s.",
+                    c->name, money_fmt(a, till_value(&c->till)), money_fmt(b, c->bal));
+        }
+    }
+}
+
+/* Dates of the sales files at or after `from`, oldest first. */
+static int list_days(const char *from, char (**out)[16]) {
+    ManifestEntry *files = NULL;
+    int n = manifest_list(from, "9999-99-99", MAN_SALES, &files);
+    if (n < 0) return -1;
+    char (*days)[16] = malloc((size_t)(n ? n : 1) * sizeof(*days));
+    if (!days) {
+        free(files);
+        return -1;
+    }
+    for (int i = 0; i < n; ++i) snprintf(days[i], sizeof(*days), "%s", files[i].date);
+    free(files);
+    *out = days;
+    return n;
+}
+
+/* Cut off a last line without '\n': a row torn by a crash mid-write. */
+static int repair_torn_tail(const char *date_text) {
+    char fname[128];
+    make_daily_csv_name(date_text, fname, sizeof(fname));
+    int fd = open(fname, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return 0;
+    struct stat st;
+    char buf[4096];
+    off_t end = fstat(fd, &st) == 0 ? st.st_size : 0, keep = end;
+    while (keep > 0) {
+        off_t start = keep > (off_t)sizeof(buf) ? keep - (off_t)sizeof(buf) : 0;
+        ssize_t n = pread(fd, buf, (size_t)(keep - start), start);
+        if (n <= 0) break;
+        char *nl = memrchr(buf, '\n', (size_t)n);
+        if (nl) {
+            keep = start + (nl - buf) + 1;
+            break;
+        }
+        keep = start;
+    }
+    int repaired = 0;
+    if (keep < end) {
+        if (ftruncate(fd, keep) == 0 && fsync(fd) == 0) {
+            diag("Repaired %s: dropped a torn last row (%ld bytes).",
+                    fname, (long)(end - keep));
+            repaired = 1;
+        } else {
+            diag("Could not repair %s: %s", fname, strerror(errno));
+        }
+    }
+    close(fd);
+    return repaired;
+}
+
+/* Apply the rows of one day file from `offset` and note the ledger end. */
+static long replay_day(const char *date_text, long offset, long *short_rows) {
+    char fname[128];
+    make_daily_csv_name(date_text, fname, sizeof(fname));
+    CsvReader rd;
+    if (csv_reader_open(&rd, fname) != 0) return 0;
+    if (offset > 0) csv_reader_seek_line(&rd, offset);
+    long rows = 0;
+    CsvRow row;
+    while (csv_reader_next(&rd, &row, NULL)) {
+        if (ledger_apply_row(&row) != 0) ++*short_rows;
+        ++rows;
+    }
+    snprintf(end_date, sizeof(end_date), "%s", date_text);
+    end_off = csv_reader_tell(&rd);
+    csv_reader_close(&rd);
+    return rows;
+}
+
+int snapshot_recover(RecoverStats *st) {
+    int64_t m0 = metrics_start(MET_RECOVER);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < cur_count; ++i) {
+        conf_buy[i] = currencies[i].buy_to_loc;
+        conf_sell[i] = currencies[i].sell_to_loc;
+        conf_crit[i] = currencies[i].critical_min;
+    }
+
+    char (*days)[16] = NULL;
+    int ndays = list_days("", &days);
+    if (ndays < 0) return -1;
+    int repaired = ndays > 0 && repair_torn_tail(days[ndays - 1]);
+    if (ndays > 0) {                    /* the manifest may lag the last day after a crash */
+        char csv[128];
+        make_daily_csv_name(days[ndays - 1], csv, sizeof(csv));
+        manifest_sync(csv);
+    }
+
+    SnapHeader h;
+    SnapCurrency *sc = NULL;
+    const char *src = SNAP_FILE;
+    int rc = load_snapshot(SNAP_FILE, &h, &sc);
+    if (rc != 0) {
+        SnapHeader h2;
+        SnapCurrency *sc2 = NULL;
+        int rc2 = load_snapshot(SNAP_PREV, &h2, &sc2);
+        if (rc2 == 0 || (rc2 == 1 && rc < 0)) {
+            free(sc);
+            h = h2, sc = sc2, rc = rc2, src = SNAP_PREV;
+        } else {
+            free(sc2);
+        }
+    }
+    if (rc < 0 && (access(SNAP_FILE, F_OK) == 0 || access(SNAP_PREV, F_OK) == 0)) {
+        /* Snapshots were kept but none loads: the registry's opening figures
+           are not the state at any point of this ledger, and reserve changes
+           are not in it, so there is nothing sound to start from. */
+        diag("Neither %s nor %s can be loaded; not starting from the registry's "
+             "opening balances. Restore a good snapshot, or remove both files to take "
+             "the registry's figures as the state at the end of the ledger.",
+                SNAP_FILE, SNAP_PREV);
+        free(days);
+        metrics_end(MET_RECOVER, m0);
+        return -1;
+    }
+    if (rc == 1) {
+        char csv[128];
+        struct stat st;
+        make_daily_csv_name(h.date, csv, sizeof(csv));
+        if (stat(csv, &st) == 0 && st.st_size < h.offset) h.offset = st.st_size;
+        diag("Warning: %s changed before the position in %s; "
+             "replaying from that position anyway.", csv, src);
+    }
+
+    long rows = 0, short_rows = 0;
+    end_date[0] = '\0';
+    end_off = 0;
+    if (rc >= 0) {
+        apply_snapshot(&h, sc);
+        snprintf(end_date, sizeof(end_date), "%s", h.date);
+        end_off = (long)h.offset;
+        for (int i = 0; i < ndays; ++i) {
+            int same = strcmp(days[i], h.date) == 0;
+            if (same || strcmp(days[i], h.date) > 0)
+                rows += replay_day(days[i], same ? (long)h.offset : 0, &short_rows);
+        }
+    } else if (ndays > 0) {
+        /* First run with snapshots: the opening state stands at the ledger's end. */
+        CsvReader rd;
+        char fname[128];
+        make_daily_csv_name(days[ndays - 1], fname, sizeof(fname));
+        snprintf(end_date, sizeof(end_date), "%s", days[ndays - 1]);
+        if (csv_reader_open(&rd, fname) == 0) {
+            CsvRow row;
+            while (csv_reader_next(&rd, &row, NULL))
+                if (row.has_tx_id) txid_observe(row.tx_id);
+            end_off = csv_reader_tell(&rd);
+            csv_reader_close(&rd);
+        }
+    }
+    free(sc);
+    free(days);
+
+    active = 1;
+    if (rc != 0 || rows > 0 || repaired) snapshot_write();
+    else {
+        snprintf(snap_date, sizeof(snap_date), "%s", end_date);
+        snap_off = end_off;
+        snap_time = time(NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = (double)(t1.tv_sec - t0.tv_sec) * 1e3 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6;
+    if (st) {
+        st->source = rc < 0 ? NULL : src;
+        st->rows = rows;
+        st->ms = ms;
+    }
+    if (short_rows)
+        diag("Warning: %ld replayed row(s) could not be paid exactly from the tills "
+             "or name an unknown currency.", short_rows);
+    metrics_end(MET_RECOVER, m0);
+    return 0;
+}
+
+int snapshot_rebase(void) {
+    if (!active) return 0;
+    journal_close();
+    char (*days)[16] = NULL;
+    int ndays = list_days("", &days);
+    if (ndays < 0) return -1;
+    end_date[0] = '\0';
+    end_off = 0;
+    if (ndays > 0) {
+        char csv[128];
+        struct stat st;
+        make_daily_csv_name(days[ndays - 1], csv, sizeof(csv));
+        snprintf(end_date, sizeof(end_date), "%s", days[ndays - 1]);
+        end_off = stat(csv, &st) == 0 ? (long)st.st_size : 0;
+    }
+    free(days);
+    return snapshot_write();
+}
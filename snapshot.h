@@ -0,0 +1,53 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "utils.h"
+
+/* Desk state snapshots and ledger-tail recovery.
+ *
+ * state.snap holds every reserve, till, rate and critical minimum, the
+ * profit and the tx counter, tagged with the ledger position (day file and
+ * byte offset) it includes. Startup loads the snapshot and replays only the
+ * sales rows written after that position; a torn last row left by a crash
+ * is cut off first. Snapshots are written to a temporary file, fsynced and
+ * renamed over the old one, which is kept as state.snap.prev.
+ *
+ * Rates, reserve adjustments and critical minimums are not in the ledger,
+ * so management changes are snapshotted as they are made. */
+
+#define SNAP_FILE "state.snap"
+#define SNAP_EVERY_BYTES (1L << 20)   /* ledger bytes between periodic snapshots */
+#define SNAP_EVERY_SEC 30             /* or this much time, if any row was written */
+
+typedef struct {
+    const char *source;         /* snapshot restored, NULL: registry opening state */
+    long rows;                  /* ledger rows replayed after it */
+    double ms;
+} RecoverStats;
+
+/* Load the latest snapshot and replay the ledger after it. Without a
+   snapshot the registry's opening state is taken as the state at the
+   current end of the ledger. st (may be NULL) gets what was done. Returns
+   0, or -1 with a message when snapshot files exist but none of them
+   loads. */
+int snapshot_recover(RecoverStats *st);
+
+/* Commit the journal and write a snapshot at its end. Returns 0 or -1. */
+int snapshot_write(void);
+
+/* The ledger was rewritten outside the journal (bulk import): close the
+   journal, take the ledger end from the last day file and write a snapshot
+   there. The caller has applied the new rows already. Returns 0 or -1. */
+int snapshot_rebase(void);
+
+/* 1 if enough rows or time have passed since the last snapshot. */
+int snapshot_due(void);
+/* snapshot_write() if snapshot_due(). */
+void snapshot_tick(void);
+
+/* Move reserves, tills, profit and the tx counter as one ledger row does.
+   Returns -1 if a payout could not be taken from the till exactly (the
+   reserves still move) or a currency is unknown, else 0. */
+int ledger_apply_row(const CsvRow *row);
+
+#endif /* SNAPSHOT_H */
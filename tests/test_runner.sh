@@ -23,20 +23,22 @@ cat > "$ROOT/tests/data/sales_2025-09-23.csv" <<'CSV'
 2025-09-23,09:00:00,1,USD,LOC,500.000000,12.091234,1.000000,41.400000,0,0.000000,10.123456
 CSV
 
-# Copy test CSVs into project root (simulate daily files)
-cp "$ROOT/tests/data/sales_2025-09-22.csv" "$ROOT/sales_2025-09-22.csv"
-cp "$ROOT/tests/data/sales_2025-09-23.csv" "$ROOT/sales_2025-09-23.csv"
+# Copy test CSVs into a scratch data root (simulate flat daily files) and
+# move them into its YYYY/MM partitions
+DATA_DIR=$(mktemp -d)
+cp "$ROOT/tests/data/sales_2025-09-22.csv" "$ROOT/tests/data/sales_2025-09-23.csv" "$DATA_DIR/"
+"$ROOT/build/exchange_store_cp1" --data-dir "$DATA_DIR" --migrate-data
 
 # Run summary for 2025-09-22
 echo "--- Summary for 2025-09-22 ---"
-"$ROOT/build/exchange_store_cp1" <<'EOF'
+"$ROOT/build/exchange_store_cp1" --data-dir "$DATA_DIR" <<'EOF'
 7
 0
 EOF
 
 # List transactions for 2025-09-22 using CSV helper (we'll call the binary's menu option 10)
 echo "--- List transactions (menu option 10) for 2025-09-22 ---"
-"$ROOT/build/exchange_store_cp1" <<'EOF'
+"$ROOT/build/exchange_store_cp1" --data-dir "$DATA_DIR" <<'EOF'
 10
 2025-09-22
 0
@@ -44,10 +46,361 @@ EOF
 
 # Search for a tx_id that won't exist (menu option 11)
 echo "--- Search for tx id 1 (menu option 11) ---"
-"$ROOT/build/exchange_store_cp1" <<'EOF'
+"$ROOT/build/exchange_store_cp1" --data-dir "$DATA_DIR" <<'EOF'
 11
 1
 0
 EOF
 
+rm -rf "$DATA_DIR"
+
+# Batch mode in a scratch directory so the project's ledger is left alone
+echo "--- Batch mode (--batch -) ---"
+BATCH_DIR=$(mktemp -d)
+(cd "$BATCH_DIR" && "$ROOT/build/exchange_store_cp1" --batch - <<'EOF'
+from,to,amount,partial_amount
+USD,LOC,100
+EUR,USD,50,20
+XXX,USD,10
+GBP,GBP,5
+EOF
+)
+# a 1 KiB file size limit fails the day file's writes part way: the partial
+# bytes are cut off again, so the file still ends on a whole row
+(cd "$BATCH_DIR" && rm -rf 20?? && seq 40 | sed 's/^/USD,LOC,/' |
+  (trap '' XFSZ; ulimit -f 1; exec "$ROOT/build/exchange_store_cp1" --batch - >/dev/null 2>&1) ||
+  echo "batch with a full disk: exit $?, day file ends on a row: $(tail -c1 */*/sales_*.csv | od -An -c | tr -d ' ')")
+# no id block can be leased (the lease file cannot be replaced): the order
+# is refused before any money moves
+(cd "$BATCH_DIR" && rm -rf 20?? tx_id.lease && mkdir tx_id.lease.tmp &&
+  echo 'USD,LOC,100' | "$ROOT/build/exchange_store_cp1" --batch - 2>&1 | grep -E 'lease|Accepted' &&
+  echo "rows logged: $(cat */*/sales_*.csv 2>/dev/null | wc -l)")
+rm -rf "$BATCH_DIR"
+
+# a reserve change whose state snapshot cannot be written is undone
+MG_DIR=$(mktemp -d)
+(cd "$MG_DIR" && mkdir state.snap.tmp &&
+  { printf '4\nUSD\n100\n6\n0\n' | "$ROOT/build/exchange_store_cp1" > out.txt 2>&1 || true; } &&
+  grep -o '\[-\].*\|^USD: [0-9.]*' out.txt)
+rm -rf "$MG_DIR"
+
+# Currency registry: currencies.conf in the working directory adds CHF and
+# drops EUR; a malformed file is refused
+echo "--- Currency registry (currencies.conf) ---"
+REG_DIR=$(mktemp -d)
+cat > "$REG_DIR/currencies.conf" <<'CONF'
+# code  buy    sell   reserve  critical  note_min  denominations
+LOC     1      1        50000     10000        10  200 100 50 20 10 5 2 1 0.50 0.20 0.10 0.05 0.02 0.01
+USD    41.36  41.45     10000      2000         1  100 50 20 10 5 2 1 0.25 0.10 0.05 0.01
+CHF    46.20  46.40      5000      1000        10  1000 200 100 50 20 10 5 2 1 0.50 0.20 0.10 0.05
+CONF
+(cd "$REG_DIR" && "$ROOT/build/exchange_store_cp1" --batch - <<'EOF'
+CHF,LOC,100
+usd,chf,50
+EUR,LOC,10
+EOF
+)
+printf 'LOC 1 1 50000 10000 10 1 0.50\nUSD 41.36 41.45 10000 2000 1 1 5\n' > "$REG_DIR/bad.conf"
+"$ROOT/build/exchange_store_cp1" --currencies "$REG_DIR/bad.conf" --batch - </dev/null || echo "(malformed registry refused)"
+# a rate near RATE_MAX: the order's LOC value does not fit in int64 and is
+# refused rather than wrapped around
+printf 'LOC 1 1 50000 10000 10 1 0.50\nXAU 1000000000 1000000000 10 1 1 1\n' > "$REG_DIR/xau.conf"
+(cd "$REG_DIR" && echo 'XAU,LOC,100000000' |
+  "$ROOT/build/exchange_store_cp1" --currencies xau.conf --batch - 2>&1 | grep rejected)
+rm -rf "$REG_DIR"
+
+# Snapshot recovery: restore the snapshot taken after the first batch, as
+# if the process died before snapshotting the second, tear the last row,
+# and check the replayed reserves against the ones before the "crash"
+echo "--- State snapshot and ledger-tail recovery ---"
+SNAP_DIR=$(mktemp -d)
+(cd "$SNAP_DIR" && "$ROOT/build/exchange_store_cp1" --batch - >/dev/null <<'EOF'
+USD,LOC,100
+EUR,USD,50,20
+EOF
+cp state.snap first.snap
+"$ROOT/build/exchange_store_cp1" --batch - >/dev/null <<'EOF'
+LOC,GBP,1000
+JPY,EUR,25000
+USD,LOC,40,1000
+EOF
+printf '6\n0\n' | "$ROOT/build/exchange_store_cp1" | grep -E '^[A-Z]+: ' | cut -d' ' -f1-2 > before.txt
+mv first.snap state.snap
+rm -f state.snap.prev
+printf '2099-01-01,10:00:00,99,USD,LOC,1' >> "$(date +%Y/%m)/sales_$(date +%F).csv"
+printf '6\n0\n' | "$ROOT/build/exchange_store_cp1" > after_full.txt
+grep -E '^(Repaired|State restored)' after_full.txt || true
+grep -E '^[A-Z]+: ' after_full.txt | cut -d' ' -f1-2 > after.txt
+cat after.txt
+cmp -s before.txt after.txt && echo "(recovered reserves match)" || echo "(recovered reserves DIFFER)"
+# both snapshots damaged: refuse rather than restart from the registry
+printf 'garbage' > state.snap
+printf 'garbage' > state.snap.prev
+printf '0\n' | "$ROOT/build/exchange_store_cp1" >/dev/null 2>err.txt || echo "start refused (exit $?)"
+grep -c '^Neither state.snap' err.txt
+)
+rm -rf "$SNAP_DIR"
+
+# Background writer: two menu exchanges and a manual row, then the
+# end-of-day barrier; rows, receipts and the tx counter are on disk
+echo "--- Background writer (menu exchanges) ---"
+WR_DIR=$(mktemp -d)
+(cd "$WR_DIR" && printf '1\nUSD\nLOC\n100\n0\n0\n1\nEUR\nUSD\n50\n0\n0\n9\nGBP\nLOC\n10\n500\n7\n0\n' \
+  | "$ROOT/build/exchange_store_cp1" | grep -E '^(Total Transactions|Exchange path|Writer):' | sed 's/ in [0-9]* batch.*//; s/, avg.*//'
+echo "rows: $(grep -vc '^date,' */*/sales_*.csv)  receipts: $(grep -c 'Transaction ID' */*/receipts_*.txt)  next tx_id: $(cat tx_id.lease)"
+# --sync ms:100: the second of two quick exchanges is committed (and listed
+# in the manifest) while the desk still waits for the next input
+rm -rf 20??
+{ printf '1\nUSD\nLOC\n100\n0\n0\n'; sleep 0.5; printf '1\nUSD\nLOC\n50\n0\n0\n1\nEUR\nLOC\n50\n0\n0\n'; sleep 1
+  echo "ms:100 rows committed before the next input: $(awk '/^sales_/ { print $2 }' */*/manifest)" >&2
+  printf '0\n'; } | "$ROOT/build/exchange_store_cp1" --sync ms:100 >/dev/null
+)
+rm -rf "$WR_DIR"
+
+# Transaction ids: the old counter file is picked up once, a clean exit
+# hands back the unused block, and a block left leased by a crashed
+# process is skipped, never reused
+echo "--- Leased transaction ids ---"
+ID_DIR=$(mktemp -d)
+(cd "$ID_DIR" && echo 41 > last_tx_id.txt
+printf 'USD,LOC,10\nEUR,LOC,10\n' | "$ROOT/build/exchange_store_cp1" --batch - >/dev/null
+echo "after migration: next tx_id $(cat tx_id.lease)"
+echo 2068 > tx_id.lease
+printf 'USD,LOC,10\n' | "$ROOT/build/exchange_store_cp1" --batch - >/dev/null
+echo "ids: $(grep -v '^date,' */*/sales_*.csv | cut -d, -f3 | tr '\n' ' ')next tx_id: $(cat tx_id.lease)"
+)
+rm -rf "$ID_DIR"
+
+# Metrics: an exchange, a malformed row and the end-of-day report, then
+# the metrics page; calls and counters are exact, latencies vary
+echo "--- Metrics ---"
+MET_DIR=$(mktemp -d)
+(cd "$MET_DIR" && printf '1\nUSD\nLOC\n100\n0\n0\n0\n' | "$ROOT/build/exchange_store_cp1" >/dev/null
+printf 'not,a,row\n' >> "$(date +%Y/%m)/sales_$(date +%F).csv"
+printf '7\n13\n0\n' | "$ROOT/build/exchange_store_cp1" | sed -n '/^operation/,/^rows_read/p' | awk '/^rows_read/ {print; next} {print $1, $2}'
+echo "prometheus: $(grep -c '^exchange_op_duration_seconds_bucket{op="daily_report"' metrics.prom) daily_report buckets, $(grep '^exchange_parse_failures_total' metrics.prom)"
+)
+rm -rf "$MET_DIR"
+
+# Query engine: two days of rows; the day outside the range is skipped by
+# name, the filters pick the partial EUR rows of the morning
+echo "--- Query engine ---"
+Q_DIR=$(mktemp -d)
+(cd "$Q_DIR" && printf 'EUR,LOC,100\nUSD,LOC,50\nEUR,USD,20\n' | "$ROOT/build/exchange_store_cp1" --batch - >/dev/null
+mkdir -p 2025/01 && cat > 2025/01/sales_2025-01-02.csv <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-02,09:15:00,7,EUR,LOC,100.00,4838.00,48.380000,1.000000,1,0.40,1.60
+2025-01-02,10:30:00,8,EUR,LOC,250.00,12095.00,48.380000,1.000000,0,0.00,4.00
+2025-01-02,14:00:00,9,EUR,USD,80.00,90.00,48.380000,43.000000,1,0.30,1.20
+2025-01-02,09:45:00,10,USD,LOC,60.00,2580.00,43.000000,1.000000,1,0.20,0.90
+CSV
+"$ROOT/build/exchange_store_cp1" --query "date=2025-01-02 pair=EUR/* partial=1 time=08:00-12:00" | sed 's/ in [0-9.]* ms$//'
+"$ROOT/build/exchange_store_cp1" --query "from=2025-01-01 to=2025-01-31 amount=..100 profit=1.. " | sed 's/ in [0-9.]* ms$//'
+"$ROOT/build/exchange_store_cp1" --query "pair=EUR" 2>&1 || echo "(query refused)"
+)
+rm -rf "$Q_DIR"
+
+# Analytics rollups: a fixed day, then a row appended (the rollup sidecar
+# is extended) and the month made of two days
+echo "--- Analytics rollups ---"
+R_DIR=$(mktemp -d)
+(cd "$R_DIR" && mkdir -p 2025/01 && cat > 2025/01/sales_2025-01-02.csv <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-02,09:15:00,7,EUR,LOC,100.00,4838.00,48.380000,1.000000,1,0.40,1.60
+2025-01-02,10:30:00,8,EUR,LOC,250.00,12095.00,48.380000,1.000000,0,0.00,4.00
+2025-01-02,14:00:00,9,EUR,USD,80.00,90.00,48.380000,43.000000,1,0.30,1.20
+CSV
+cat > 2025/01/sales_2025-01-03.csv <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-03,11:00:00,11,USD,LOC,60.00,2580.00,43.000000,1.000000,0,0.00,0.90
+CSV
+"$ROOT/build/exchange_store_cp1" --analytics 2025-01-02
+echo '2025-01-02,10:45:00,10,EUR,LOC,50.00,2419.00,48.380000,1.000000,0,0.00,0.80' >> 2025/01/sales_2025-01-02.csv
+"$ROOT/build/exchange_store_cp1" --analytics 2025-01-02 | sed -n '2,6p'
+"$ROOT/build/exchange_store_cp1" --analytics 2025-01
+"$ROOT/build/exchange_store_cp1" --analytics 2025-13 2>&1 || echo "(period refused)"
+ls 2025/01/*.rollup
+# a segment is not trusted once the rows it ends on were rewritten, even
+# when the file grew
+"$ROOT/build/exchange_store_cp1" --build-segments > /dev/null
+sed -i 's/,0\.80$/,5.80/' 2025/01/sales_2025-01-02.csv
+echo '2025-01-02,16:00:00,12,USD,LOC,10.00,430.00,43.000000,1.000000,0,0.00,0.10' >> 2025/01/sales_2025-01-02.csv
+rm -f 2025/01/*.rollup 2025/01/*.sum
+"$ROOT/build/exchange_store_cp1" --analytics 2025-01-02 | sed -n '3,4p'
+)
+rm -rf "$R_DIR"
+
+# Monthly archives: two closed January days (one row in an odd layout is
+# kept verbatim) folded into sales_2025-01.arc; the newest day stays loose
+# and every reader gives the same answers from the archive
+echo "--- Monthly archives ---"
+A_DIR=$(mktemp -d)
+(cd "$A_DIR" && cat > sales_2025-01-02.csv <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-02,09:15:00,7,EUR,LOC,100.00,4838.00,48.380000,1.000000,1,0.40,1.60
+2025-01-02,10:30:00,8,EUR,LOC,250.00,12095.00,48.380000,1.000000,0,0.00,4.00
+2025-01-02,14:00:00,9,EUR,USD,80.00,90.00,48.380000,43.000000,1,0.30,1.20
+CSV
+cat > sales_2025-01-03.csv <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-03,11:00:00,11,USD,LOC,60.00,2580.00,43.000000,1.000000,0,0.00,0.90
+2025-01-03,12:00:00,12,USD,LOC,10.0,430.00,43.000000,1.000000,0,0.00,0.15
+CSV
+cat > sales_2025-02-01.csv <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-02-01,09:00:00,13,EUR,LOC,10.00,483.80,48.380000,1.000000,0,0.00,0.16
+CSV
+printf 'Receipt\nTransaction ID: 7\n' > receipts_2025-01-02.txt
+"$ROOT/build/exchange_store_cp1" --migrate-data
+"$ROOT/build/exchange_store_cp1" --query "from=2025-01-01 to=2025-01-31" | head -n -2 > before.txt
+"$ROOT/build/exchange_store_cp1" --analytics 2025-01 > before_rollup.txt
+flock -s session.lock "$ROOT/build/exchange_store_cp1" --compact 2025-03-01 2>&1 ||
+  echo "compaction refused during a session (exit $?)"
+"$ROOT/build/exchange_store_cp1" --compact 2025-03-01 | grep -v KB
+find . -name '*.arc' -o -name 'sales_*.csv' -o -name 'receipts_*' | sort
+"$ROOT/build/exchange_store_cp1" --query "from=2025-01-01 to=2025-01-31" | head -n -2 > after.txt
+"$ROOT/build/exchange_store_cp1" --analytics 2025-01 > after_rollup.txt
+cmp before.txt after.txt && cmp before_rollup.txt after_rollup.txt && echo "query and analytics unchanged"
+"$ROOT/build/exchange_store_cp1" --aggregate 2025-01-01 2025-02-28 | sed -n '1,4p'
+"$ROOT/build/exchange_store_cp1" --rebuild-index
+"$ROOT/build/exchange_store_cp1" --receipts 2025-01-02
+"$ROOT/build/exchange_store_cp1" --receipts 2025-01-03 || echo "(no receipts)"
+)
+rm -rf "$A_DIR"
+
+echo "--- Data root and partitions ---"
+P_DIR=$(mktemp -d)
+(cd "$P_DIR" && printf 'USD,LOC,10\nEUR,LOC,20\n' \
+  | "$ROOT/build/exchange_store_cp1" --data-dir data --batch - | grep Accepted
+DAY=$(date +%F) PART=$(date +%Y/%m)
+(cd data && find . -name 'sales_*' -o -name 'receipts_*' -o -name manifest | sed "s|$PART|YYYY/MM|; s/$DAY/DAY/" | sort)
+sed "s/$DAY/DAY/; s/ [0-9]*$/ N/" "data/$PART/manifest"
+cp "data/$(date +%Y/%m)/sales_$DAY.csv" data/
+cat > data/sales_2025-01-05.csv <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-05,09:15:00,7,EUR,LOC,100.00,4838.00,48.380000,1.000000,1,0.40,1.60
+CSV
+EXCHANGE_DATA_DIR=data "$ROOT/build/exchange_store_cp1" --batch - </dev/null 2>&1 | grep '^Note'
+EXCHANGE_DATA_DIR=data "$ROOT/build/exchange_store_cp1" --migrate-data 2>&1 | sed "s|$PART|YYYY/MM|; s/$DAY/DAY/g"
+cat data/2025/01/manifest
+"$ROOT/build/exchange_store_cp1" --data-dir data --query "date=2025-01-05" 2>&1 | grep matched | sed 's/ in .*//'
+ls data/sales_* | sed "s/$DAY/DAY/"
+# no tx_index.bin yet: the first lookup builds it and finds the migrated row
+printf '11\n7\n0\n' | "$ROOT/build/exchange_store_cp1" --data-dir data 2>&1 | grep 'sales_2025\|not found\|searching'
+)
+rm -rf "$P_DIR"
+
+echo "--- libexchange (engine in-process, injected clock) ---"
+(cd "$ROOT" && make -s libexchange build/bench_engine >/dev/null)
+E_DIR=$(mktemp -d)
+"$ROOT/build/bench_engine" "$E_DIR/data" 300 2>/dev/null | grep -v "^No state snapshot"
+ls "$E_DIR/data/2025/03"
+sed -n '2p;$p' "$E_DIR/data/2025/03/sales_2025-03-10.csv"
+rm -rf "$E_DIR"
+
+echo "--- Rate history and revaluation ---"
+R_DIR=$(mktemp -d)
+(cd "$R_DIR" && mkdir -p 2025/01
+le64() { for i in 0 1 2 3 4 5 6 7; do printf "\\x$(printf %02x $(( ($1 >> (8 * i)) & 255 )))"; done; }
+rate_event() { le64 "$(date -d "$1" +%s)"; printf '%s\0\0\0\0\0' "$2"; le64 "$3"; le64 "$4"; }
+{ rate_event "2025-01-01 09:00" USD 43000000 43500000
+  rate_event "2025-01-01 09:00" EUR 48380000 48600000
+  rate_event "2025-01-03 08:00" EUR 50000000 50200000
+  rate_event "2025-01-03 12:00" USD 42000000 42500000; } > rates.log
+cat > 2025/01/sales_2025-01-02.csv <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-02,09:15:00,7,EUR,LOC,100.00,4838.00,48.380000,1.000000,1,0.40,1.60
+2025-01-02,14:00:00,9,EUR,USD,80.00,90.00,48.380000,43.000000,1,0.30,1.20
+CSV
+cat > 2025/01/sales_2025-01-03.csv <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-03,11:00:00,11,USD,LOC,60.00,2580.00,43.000000,1.000000,0,0.00,0.90
+CSV
+"$ROOT/build/exchange_store_cp1" --rates-at EUR "2025-01-03 07:59"
+"$ROOT/build/exchange_store_cp1" --rates-at '*' 2025-01-03 | head -n 5
+"$ROOT/build/exchange_store_cp1" --revalue 2025-01-01 2025-01-31 "2025-01-02 12:00" | sed -n '3,$p'
+ls rates.*
+printf 'USD,LOC,10\n' | "$ROOT/build/exchange_store_cp1" --batch - >/dev/null
+"$ROOT/build/exchange_store_cp1" --rates-at GBP "$(date +%F)" | tail -n 1 | sed "s/$(date +%F) [0-9:]*/TODAY/"
+)
+rm -rf "$R_DIR"
+
+echo "--- Till payouts against exhaustive search ---"
+(cd "$ROOT" && make -s build/till_check >/dev/null)
+"$ROOT/build/till_check" 2000 || { echo "till planner not minimal"; exit 1; }
+
+echo "--- Load simulation with invariant checks ---"
+(cd "$ROOT" && make -s libexchange build/simulate >/dev/null)
+S_DIR=$(mktemp -d)
+if ! "$ROOT/build/simulate" "$S_DIR/data" cashiers=12 rate=40 hours=3 seed=3 > "$S_DIR/run1.txt" 2>/dev/null; then
+  cat "$S_DIR/run1.txt"; echo "simulation invariants FAILED"; exit 1
+fi
+grep -v "^No state snapshot" "$S_DIR/run1.txt"
+if ! "$ROOT/build/simulate" "$S_DIR/data" hours=1 mix=USD-EUR:2,GBP-LOC > "$S_DIR/run2.txt" 2>/dev/null; then
+  cat "$S_DIR/run2.txt"; echo "simulation invariants FAILED"; exit 1
+fi
+grep -c "^  .* ok" "$S_DIR/run2.txt"
+"$ROOT/build/simulate" "$S_DIR/data" mix=USD-USD 2>&1 || echo "exit $?"
+rm -rf "$S_DIR"
+
+echo "--- Day cache (menu 7, 10, 11 from memory) ---"
+DC_DIR=$(mktemp -d)
+mkdir -p "$DC_DIR/cached/2025/01"
+(cd "$DC_DIR/cached" && printf 'USD,LOC,10\nEUR,LOC,20\nEUR,USD,5\n' | "$ROOT/build/exchange_store_cp1" --batch - >/dev/null
+cat > 2025/01/sales_2025-01-05.csv <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-05,09:00:00,7,USD,LOC,10,413.6,41.36,1,0,0,0.5
+CSV
+)
+cp -a "$DC_DIR/cached" "$DC_DIR/files"
+DC_IN='10\n\n1\nUSD\nLOC\n100\n0\n0\n10\n\n11\n2\n11\n4\n11\n99\n10\n2025-01-05\n7\n13\n0\n'
+(cd "$DC_DIR/cached" && printf "$DC_IN" | "$ROOT/build/exchange_store_cp1" > "$DC_DIR/cached.txt" 2>&1)
+(cd "$DC_DIR/files" && printf "$DC_IN" | "$ROOT/build/exchange_store_cp1" --day-cache 0 > "$DC_DIR/files.txt" 2>&1)
+mask() { sed 's/[0-9.]* ms//g; s/[0-9.]* us//g; s/[0-9:]\{8\}//g' "$1" | grep -v '^Day cache\|^[a-z_]\+ \+[0-9]'; }
+if diff <(mask "$DC_DIR/cached.txt") <(mask "$DC_DIR/files.txt") >/dev/null; then
+  echo "menu output identical with and without the day cache"
+else
+  echo "menu output differs with the day cache"
+  diff <(mask "$DC_DIR/cached.txt") <(mask "$DC_DIR/files.txt") || true
+  exit 1
+fi
+grep -A1 'sales_2025-01-05.csv:' "$DC_DIR/cached.txt" | tail -n 1
+grep '^Day cache' "$DC_DIR/cached.txt" "$DC_DIR/files.txt" | sed "s|$DC_DIR/||"
+rm -rf "$DC_DIR"
+
+echo "--- Bulk import (parallel checks, sorted merge, rejects) ---"
+IM_DIR=$(mktemp -d)
+mkdir -p "$IM_DIR/2025/01"
+cat > "$IM_DIR/2025/01/sales_2025-01-05.csv" <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-05,09:00:00,1,USD,LOC,10.00,413.60,41.360000,1.000000,0,0.00,0.00
+2025-01-05,12:00:00,2,EUR,LOC,20.00,967.60,48.380000,1.000000,0,0.00,0.00
+CSV
+cat > "$IM_DIR/paper.csv" <<'CSV'
+date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc
+2025-01-06,10:30:00,0,USD,LOC,5.00,206.80,41.360000,1.000000,0,0.00,0.00
+2025-01-05,10:15:00,0,EUR,USD,5.00,5.84,48.380000,41.450000,0,0.00,0.36
+2025-01-06,08:00:00,0,EUR,LOC,1.00,48.38,48.380000,1.000000,0,0.00,0.00
+2025-01-05,11:00:00,0,XYZ,LOC,1.00,1.00,1.000000,1.000000,0,0.00,0.00
+2025-01-05,11:00:00,0,USD,USD,1.00,1.00,41.360000,41.450000,0,0.00,0.00
+2025-01-05,11:00:00,0,USD,LOC,0.00,0.00,41.360000,1.000000,0,0.00,0.00
+2025-01-05,11:00:00,0,USD,LOC,1.00,90.00,90.000000,1.000000,0,0.00,0.00
+2025-01-32,11:00:00,0,USD,LOC,1.00,41.36,41.360000,1.000000,0,0.00,0.00
+2999-01-05,11:00:00,0,USD,LOC,1.00,41.36,41.360000,1.000000,0,0.00,0.00
+
+not,a,row
+2025-01-05,11:00:00,0,USD,LOC,1.00,90000.00,41.360000,1.000000,0,0.00,0.00
+2025-01-05,11:00:00,0,LOC,USD,90000000000000000.00,1.00,1.000000,41.450000,0,0.00,0.00
+2025-01-05,11:30:00,0,LOC,USD,829000.00,20000.00,1.000000,41.450000,0,0.00,0.00
+CSV
+(cd "$IM_DIR" && "$ROOT/build/exchange_store_cp1" --workers 2 --import paper.csv | grep -v '^Checked with\|^No state')
+cat "$IM_DIR/paper.csv.rejects"
+cat "$IM_DIR/2025/01/sales_2025-01-05.csv" "$IM_DIR/2025/01/sales_2025-01-06.csv"
+(cd "$IM_DIR" && printf '11\n4\n0\n' | "$ROOT/build/exchange_store_cp1" 2>&1 | grep 'sales_2025\|ledger row' |
+  sed 's/.*search: //; s/ in [0-9.]* ms//')
+# a running session holds the data root: the import is refused and writes nothing
+(cd "$IM_DIR" && flock -s session.lock sh -c \
+  '"$0/build/exchange_store_cp1" --import paper.csv 2>&1 >/dev/null || echo "import refused (exit $?)"' "$ROOT")
+rm -rf "$IM_DIR"
+
 echo "Tests completed. Check outputs above."
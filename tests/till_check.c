@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+
+/* The till planner against an exhaustive bounded search.
+ *
+ *   build/till_check [sets] [seed]      (default 2000 sets, seed 1)
+ *
+ * For each set of denominations and random stock, every amount up to the
+ * stock value is solved by a bounded knapsack (each count split in powers
+ * of two), then sampled amounts go through till_plan and
+ * till_max_payable: the payout must come from stock, pay the amount and
+ * use the fewest pieces; the largest payable amount must match. Each set
+ * is also walked through payouts and deposits between plans. Prints
+ * the counts and exits 1 on the first mismatch. */
+
+#include "../till.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INF 0x3FFFFFFF
+
+static unsigned long long rng;
+
+static unsigned rnd(unsigned n) {
+    rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned)(rng >> 33) % n;
+}
+
+/* best[v] = fewest pieces making v from stock, INF if none. */
+static int *brute(const Money *den, const long *stock, int n, long total) {
+    int *best = malloc(((size_t)total + 1) * sizeof(*best));
+    if (!best) return NULL;
+    best[0] = 0;
+    for (long v = 1; v <= total; ++v) best[v] = INF;
+    for (int i = 0; i < n; ++i) {
+        long left = stock[i];
+        for (long c = 1; left > 0; c *= 2) {
+            long k = c < left ? c : left;
+            left -= k;
+            long w = k * den[i];
+            for (long v = total; v >= w; --v)
+                if (best[v - w] + k < best[v]) best[v] = best[v - w] + (int)k;
+        }
+    }
+    return best;
+}
+
+static int fail(const char *what, const Money *den, const long *stock, int n, long amount,
+                long got, long want) {
+    printf("MISMATCH %s: amount %ld, till %ld, exhaustive %ld, stock", what, amount, got, want);
+    for (int i = 0; i < n; ++i) printf(" %ldx%lld", stock[i], (long long)den[i]);
+    printf("\n");
+    return 1;
+}
+
+/* Check `samples` amounts (all of them if 0) plus the ones in `extra`
+   against the till as it stands. */
+static int check_till(Till *tp, int samples, const long *extra, long *plans) {
+    Till t = *tp;
+    const Money *den = t.denom;
+    const long *stock = t.stock;
+    int n = t.n;
+    long total = 0;
+    for (int i = 0; i < n; ++i) total += stock[i] * den[i];
+    int *best = brute(den, stock, n, total);
+    if (!best) return 1;
+    int bad = 0;
+    int count = samples ? samples : (int)total + 1;
+    for (int s = 0; !bad && (s < count || (extra && *extra >= 0)); ++s) {
+        long amount = s < count ? (samples ? (long)rnd((unsigned)total + 2) : s) : *extra++;
+        Payout p;
+        int ok = till_plan(&t, amount, &p);
+        long want = amount <= total ? best[amount] : INF;
+        if (ok != (want < INF))
+            bad = fail("payable", den, stock, n, amount, ok, want < INF);
+        else if (ok) {
+            long sum = 0;
+            for (int i = 0; i < n; ++i) {
+                if (p.count[i] < 0 || p.count[i] > stock[i]) bad = 1;
+                sum += p.count[i] * den[i];
+            }
+            if (bad || sum != amount || p.total != amount)
+                bad = fail("payout", den, stock, n, amount, sum, amount);
+            else if (p.pieces != want)
+                bad = fail("pieces", den, stock, n, amount, p.pieces, want);
+        } else {
+            long v = amount < total ? amount : total;
+            while (v > 0 && best[v] == INF) v--;
+            Money m = till_max_payable(&t, amount, &p);
+            if (m != v) bad = fail("max payable", den, stock, n, amount, (long)m, v);
+            else if (m > 0 && p.pieces != best[v])
+                bad = fail("max payable pieces", den, stock, n, amount, p.pieces, best[v]);
+        }
+        (*plans)++;
+    }
+    free(best);
+    *tp = t;
+    return bad;
+}
+
+static int check(const Money *den, const long *stock, int n, int samples, const long *extra,
+                 long *plans) {
+    Till t;
+    if (till_init(&t, den, n, stock) != 0) {
+        printf("till_init failed\n");
+        return 1;
+    }
+    int bad = check_till(&t, samples, extra, plans);
+    till_free(&t);
+    return bad;
+}
+
+/* Pay out and take in between plans, so the table is refreshed from
+   changed stock rather than built fresh. */
+static int walk(const Money *den, const long *stock, int n, int steps, long *plans) {
+    Till t;
+    if (till_init(&t, den, n, stock) != 0) {
+        printf("till_init failed\n");
+        return 1;
+    }
+    int bad = 0;
+    for (int s = 0; s < steps && !bad; ++s) {
+        bad = check_till(&t, 3, NULL, plans);
+        Payout p;
+        if (till_plan(&t, (Money)rnd((unsigned)till_value(&t) / 2 + 1), &p)) till_remove(&t, &p);
+        memset(&p, 0, sizeof(p));
+        for (int i = 0; i < n; ++i) p.count[i] = rnd(3) == 0 ? (long)rnd(4) : 0;
+        till_add(&t, &p);
+    }
+    till_free(&t);
+    return bad;
+}
+
+static const Money SYSTEMS[][8] = {
+    { 25, 10, 5, 1 },
+    { 100, 40, 2, 1 },
+    { 200, 100, 50, 20, 10, 5, 2, 1 },
+    { 100, 50, 25, 10, 5, 1 },
+    { 60, 45, 14, 9, 4 },
+};
+static const int SYSTEM_N[] = { 4, 4, 8, 6, 5 };
+
+int main(int argc, char **argv) {
+    int sets = argc > 1 ? atoi(argv[1]) : 2000;
+    rng = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    long plans = 0;
+
+    /* the reported cases: 9 pieces for 210, and 331 is payable */
+    const long ex1[] = { 210, -1 }, ex2[] = { 331, -1 };
+    if (check((const Money[]){ 25, 10, 5, 1 }, (const long[]){ 24, 1, 4, 1 }, 4, 0, ex1, &plans) ||
+        check((const Money[]){ 100, 40, 2, 1 }, (const long[]){ 14, 5, 5, 3 }, 4, 0, ex2, &plans))
+        return 1;
+
+    for (int s = 0; s < sets; ++s) {
+        Money den[8];
+        long stock[8];
+        int n;
+        if (s % 2 == 0) {
+            int sys = (int)rnd(sizeof(SYSTEM_N) / sizeof(SYSTEM_N[0]));
+            n = SYSTEM_N[sys];
+            memcpy(den, SYSTEMS[sys], sizeof(den));
+        } else {
+            /* distinct random values, largest first */
+            n = 2 + (int)rnd(5);
+            for (int i = 0; i < n;) {
+                Money d = 1 + rnd(60);
+                int dup = 0;
+                for (int k = 0; k < i; ++k) dup |= den[k] == d;
+                if (!dup) den[i++] = d;
+            }
+            for (int i = 1; i < n; ++i)
+                for (int k = i; k > 0 && den[k] > den[k - 1]; --k) {
+                    Money tmp = den[k];
+                    den[k] = den[k - 1];
+                    den[k - 1] = tmp;
+                }
+        }
+        for (int i = 0; i < n; ++i) stock[i] = rnd(4) == 0 ? (long)rnd(3) : (long)rnd(30);
+        if (check(den, stock, n, 20, NULL, &plans) || walk(den, stock, n, 10, &plans)) return 1;
+    }
+
+    /* EUR in cents with thin stock, every amount */
+    const Money eur[] = { 50000, 20000, 10000, 5000, 2000, 1000, 500, 200, 100, 50, 20, 10, 5, 2, 1 };
+    for (int s = 0; s < 3; ++s) {
+        long stock[15];
+        for (int i = 0; i < 15; ++i) stock[i] = (long)rnd(4);
+        if (check(eur, stock, 15, 0, NULL, &plans)) return 1;
+    }
+
+    printf("till: %ld amounts checked against exhaustive search, all minimal\n", plans);
+    return 0;
+}
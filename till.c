@@ -0,0 +1,350 @@
+#include "till.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NONE 0xFFFF
+#define MAX_WINDOW (1 << 22)
+
+static int64_t gcd64(int64_t a, int64_t b) {
+    while (b) {
+        int64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+typedef uint16_t v8hu __attribute__((vector_size(16)));
+
+/* dst[v] = min(src[v], src[v - w] + k): one lot of k pieces worth w. 8
+   entries per step; src + k saturates at NONE, so a missing entry never
+   wins the min. */
+static void add_lot(const uint16_t *src, uint16_t *dst, size_t W1, size_t w, uint16_t k) {
+    size_t v = w < W1 ? w : W1;
+    memcpy(dst, src, v * sizeof(*dst));
+    const uint16_t *lo = src - w;
+    v8hu kk = (v8hu){ 0 } + k;
+    for (; v + 8 <= W1; v += 8) {
+        v8hu p, b;
+        memcpy(&p, lo + v, 16);
+        memcpy(&b, src + v, 16);
+        v8hu cand = p + kk;
+        cand |= (v8hu)(cand < p);                 /* wrapped: stays NONE */
+        v8hu better = (v8hu)(cand < b);
+        b = (cand & better) | (b & ~better);
+        memcpy(dst + v, &b, 16);
+    }
+    for (; v < W1; ++v) {
+        unsigned cand = lo[v] + (unsigned)k;
+        dst[v] = cand < src[v] ? (uint16_t)cand : src[v];
+    }
+}
+
+/* Layer extension with at most c pieces of d. Any count up to c is a sum
+   of distinct lots of 1, 2, 4, ... pieces (the last one the rest), so
+   each lot is one pass, alternating with tmp so the last lands in cur. */
+static void extend(const uint16_t *prev, uint16_t *cur, uint16_t *tmp, size_t W1, int64_t d,
+                   long c) {
+    if (!prev) {
+        for (size_t v = 0; v < W1; ++v) {
+            int64_t k = (int64_t)v / d;
+            cur[v] = (int64_t)v % d == 0 && k <= c && k < NONE ? (uint16_t)k : NONE;
+        }
+        return;
+    }
+    if ((size_t)c > (W1 - 1) / (size_t)d) c = (long)((W1 - 1) / (size_t)d);
+    long lots[64];
+    int m = 0;
+    for (long left = c, k = 1; left > 0; k *= 2) {
+        lots[m++] = k < left ? k : left;
+        left -= lots[m - 1];
+    }
+    const uint16_t *src = prev;
+    if (m == 0) memcpy(cur, prev, W1 * sizeof(*cur));
+    for (int i = 0; i < m; ++i) {
+        uint16_t *dst = (m - 1 - i) % 2 == 0 ? cur : tmp;
+        if (lots[i] < NONE) add_lot(src, dst, W1, (size_t)(lots[i] * d), (uint16_t)lots[i]);
+        else memcpy(dst, src, W1 * sizeof(*dst));
+        src = dst;
+    }
+}
+
+#define SEARCH_COMBOS 64
+
+static uint16_t *layer(const Till *t, int j) {
+    return t->best + (size_t)(j - 1) * t->stride;
+}
+
+/* Fewest pieces making v from denominations j..n-1 within the lent
+   counts, -1 if none. */
+static int64_t table_at(const Till *t, int j, int64_t v) {
+    if (v < 0) return -1;
+    if (j >= t->n) return v == 0 ? 0 : -1;
+    if (v > t->win[j]) return -1;
+    uint16_t b = layer(t, j)[v];
+    return b == NONE ? -1 : b;
+}
+
+/* Pieces of j a payout can need below the first well stocked
+   denomination: fewer than b(i,j) for the nearest well stocked i above
+   it. The ones in between are nearly exhausted there, which needs fewer
+   than reach + keep - 1 pieces in stock. */
+static int64_t lend_bound(const Till *t, int j) {
+    int64_t lim = 0;
+    for (int i = j - 1; i >= 0; --i) {
+        int64_t b = t->swap[i][j] - 1;
+        if (b > lim) lim = b;
+        if (t->stock[i] >= t->reach[i] + t->keep[i] - 1) break;
+    }
+    return lim;
+}
+
+/* Bring the lent counts in line with the stock and rebuild the layers
+   from the deepest one whose count changed. Returns -1 if the table could
+   not grow. */
+static int refresh(Till *t) {
+    int n = t->n, deepest = 0, split = t->split;
+    long lent[TILL_MAX_DENOMS] = { 0 };
+    int64_t win[TILL_MAX_DENOMS + 1] = { 0 };
+    for (int j = n - 1; j >= 1; --j) {
+        int64_t lim = lend_bound(t, j);
+        lent[j] = t->stock[j] < lim ? t->stock[j] : (long)lim;
+        win[j] = win[j + 1] + lent[j] * t->du[j];
+        if (j >= split && lent[j] != t->lent[j] && !deepest) deepest = j;
+    }
+    size_t need = (size_t)win[split] + 1;
+    for (int j = n - 1; j > deepest; --j)
+        if (t->span[j] < need) deepest = j;   /* built for a smaller table */
+    if (need > t->stride) {
+        deepest = n - 1;
+        size_t layers = n > 1 ? (size_t)(n - 1) : 1;
+        uint16_t *best = realloc(t->best, layers * need * sizeof(*best));
+        if (!best) return -1;
+        t->best = best;
+        uint16_t *tmp = realloc(t->tmp, need * sizeof(*tmp));
+        if (!tmp) return -1;
+        t->tmp = tmp;
+        t->stride = need;
+    }
+    memcpy(t->lent, lent, sizeof(lent));
+    memcpy(t->win, win, sizeof(win));
+    for (int j = deepest; j >= split; --j) {
+        const uint16_t *prev = j + 1 < n ? layer(t, j + 1) : NULL;
+        extend(prev, layer(t, j), t->tmp, need, t->du[j], t->lent[j]);
+        t->span[j] = need;
+    }
+    return 0;
+}
+
+int till_init(Till *t, const Money *denoms, int n, const long *stock) {
+    memset(t, 0, sizeof(*t));
+    if (n <= 0 || n > TILL_MAX_DENOMS) return -1;
+    int64_t g = 0;
+    for (int i = 0; i < n; ++i) {
+        if (denoms[i] <= 0 || (i > 0 && denoms[i] >= denoms[i - 1])) return -1;
+        t->denom[i] = denoms[i];
+        t->stock[i] = stock ? stock[i] : 0;
+        g = gcd64(denoms[i], g);
+    }
+    t->n = n;
+    t->unit = g;
+    for (int i = 0; i < n; ++i) t->du[i] = denoms[i] / g;
+
+    int64_t window = 0;
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            t->swap[i][j] = t->du[i] / gcd64(t->du[i], t->du[j]);
+            if (i < j && t->swap[i][j] > t->reach[j]) t->reach[j] = t->swap[i][j];
+            if (i > j && t->swap[i][j] > t->keep[j]) t->keep[j] = t->swap[i][j];
+        }
+        /* the table never needs more than every bound at once */
+        if (j > 0 && t->reach[j] - 1 > (MAX_WINDOW - window) / t->du[j]) return -1;
+        if (j > 0) window += (t->reach[j] - 1) * t->du[j];
+    }
+    /* Search the denominations from 1 while their combinations, with the
+       usual stock, stay within SEARCH_COMBOS; the rest go to the table. */
+    int64_t combos = 1;
+    for (t->split = 1; t->split < n; t->split++) {
+        int64_t c = t->swap[t->split - 1][t->split];
+        if (c > SEARCH_COMBOS / combos) break;
+        combos *= c;
+    }
+    if (refresh(t) != 0) {
+        till_free(t);
+        return -1;
+    }
+    return 0;
+}
+
+void till_free(Till *t) {
+    free(t->best);
+    free(t->tmp);
+    t->best = NULL;
+    t->tmp = NULL;
+    t->stride = 0;
+    memset(t->span, 0, sizeof(t->span));
+}
+
+static void finish(const Till *t, Payout *p) {
+    p->total = 0;
+    p->pieces = 0;
+    for (int i = 0; i < t->n; ++i) {
+        p->total += p->count[i] * t->denom[i];
+        p->pieces += (int)p->count[i];
+    }
+}
+
+/* Read the counts of denominations j..n-1 making r back off the table. */
+static void take_table(const Till *t, int j, int64_t r, Payout *p) {
+    for (; j < t->n; ++j) {
+        int64_t want = table_at(t, j, r);
+        long k = 0;
+        for (; k < t->lent[j]; ++k) {
+            int64_t rest = table_at(t, j + 1, r - k * t->du[j]);
+            if (rest >= 0 && rest + k == want) break;
+        }
+        p->count[j] = k;
+        r -= k * t->du[j];
+    }
+}
+
+typedef struct {
+    int64_t pieces;                   /* INT64_MAX until a payout is found */
+    long count[TILL_MAX_DENOMS];      /* denominations above `from` */
+    int from;                         /* first denomination the table pays */
+    int64_t rest;                     /* units it pays */
+} Search;
+
+/* Counts for the searched denominations from j on, below the first well
+   stocked one: each up to its lent count, then the table for the rest. */
+static void below(const Till *t, int j, int64_t r, long *x, int64_t pieces, Search *s) {
+    if (j >= t->split) {
+        int64_t rest = table_at(t, j, r);
+        if (rest < 0 || pieces + rest >= s->pieces) return;
+        s->pieces = pieces + rest;
+        memcpy(s->count, x, (size_t)j * sizeof(*x));
+        s->from = j;
+        s->rest = r;
+        return;
+    }
+    int64_t d = t->du[j], w = t->win[j + 1];
+    if (pieces + (r + d - 1) / d >= s->pieces) return;
+    int64_t hi = r / d < t->lent[j] ? r / d : t->lent[j];
+    for (int64_t k = hi; k >= 0 && r - k * d <= w; --k) {
+        x[j] = (long)k;
+        below(t, j + 1, r - k * d, x, pieces + k, s);
+    }
+}
+
+/* Fewest pieces for r units from denominations i..n-1, the ones above
+   being nearly exhausted with counts x[0..i-1] (`pieces` in all). */
+static void search(const Till *t, int i, int64_t r, long *x, int64_t pieces, Search *s) {
+    int64_t d = t->du[i];
+    if (pieces + (r + d - 1) / d >= s->pieces) return;
+    /* i is the first well stocked one: keep[i] pieces or more stay */
+    int64_t w = t->win[i + 1];
+    int64_t hi = r / d, lo = r > w ? (r - w + d - 1) / d : 0;
+    if (hi > t->stock[i] - t->keep[i]) hi = t->stock[i] - t->keep[i];
+    for (int64_t k = hi; k >= lo; --k) {
+        x[i] = (long)k;
+        below(t, i + 1, r - k * d, x, pieces + k, s);
+    }
+    /* or it is nearly exhausted */
+    long lo_n = t->stock[i] - t->keep[i] + 1;
+    for (long k = t->stock[i]; k >= lo_n && k >= 0; --k) {
+        if (k * d > r) continue;
+        x[i] = k;
+        search(t, i + 1, r - k * d, x, pieces + k, s);
+    }
+}
+
+int till_plan(Till *t, Money amount, Payout *p) {
+    memset(p, 0, sizeof(*p));
+    if (amount < 0 || amount % t->unit != 0 || refresh(t) != 0) return 0;
+    Search s = { .pieces = INT64_MAX };
+    long x[TILL_MAX_DENOMS] = { 0 };
+    search(t, 0, amount / t->unit, x, 0, &s);
+    if (s.pieces == INT64_MAX) return 0;
+    memcpy(p->count, s.count, (size_t)s.from * sizeof(*p->count));
+    take_table(t, s.from, s.rest, p);
+    finish(t, p);
+    return 1;
+}
+
+/* Largest makeable v <= cap from denominations j..n-1 (j in the table).
+   All lent pieces together make win[j], so the scan stops there. */
+static int64_t table_floor(const Till *t, int j, int64_t cap) {
+    if (j >= t->n) return 0;
+    if (cap > t->win[j]) cap = t->win[j];
+    while (cap > 0 && table_at(t, j, cap) < 0) cap--;
+    return cap;
+}
+
+/* Largest amount <= r units the cases of below() and search() reach (a
+   payout with fewest pieces for the best amount has their shape). Fewer
+   pieces of a denomination cannot win once the rest exceeds what the
+   smaller ones make together. */
+static void below_max(const Till *t, int j, int64_t r, int64_t got, int64_t *best) {
+    if (j >= t->split) {
+        int64_t v = got + table_floor(t, j, r);
+        if (v > *best) *best = v;
+        return;
+    }
+    int64_t d = t->du[j], w = t->win[j + 1];
+    int64_t hi = r / d < t->lent[j] ? r / d : t->lent[j];
+    for (int64_t k = hi; k >= 0 && *best < got + r; --k) {
+        below_max(t, j + 1, r - k * d, got + k * d, best);
+        if (r - k * d > w) break;
+    }
+}
+
+static void search_max(const Till *t, int i, int64_t r, int64_t got, int64_t *best) {
+    int64_t d = t->du[i], w = t->win[i + 1];
+    int64_t hi = r / d;
+    if (hi > t->stock[i] - t->keep[i]) hi = t->stock[i] - t->keep[i];
+    for (int64_t k = hi; k >= 0 && *best < got + r; --k) {
+        below_max(t, i + 1, r - k * d, got + k * d, best);
+        if (r - k * d > w) break;
+    }
+    long lo_n = t->stock[i] - t->keep[i] + 1;
+    for (long k = t->stock[i]; k >= lo_n && k >= 0 && *best < got + r; --k)
+        if (k * d <= r) search_max(t, i + 1, r - k * d, got + k * d, best);
+}
+
+Money till_max_payable(Till *t, Money amount, Payout *p) {
+    memset(p, 0, sizeof(*p));
+    if (amount <= 0) return 0;
+    if (till_plan(t, amount - amount % t->unit, p)) return p->total;
+    int64_t best = 0;
+    search_max(t, 0, amount / t->unit, 0, &best);
+    if (best > 0 && till_plan(t, best * t->unit, p)) return p->total;
+    memset(p, 0, sizeof(*p));
+    return 0;
+}
+
+void till_split(const Till *t, Money amount, Payout *p) {
+    memset(p, 0, sizeof(*p));
+    int64_t r = amount > 0 ? amount / t->unit : 0;
+    for (int i = 0; i < t->n; ++i) {
+        p->count[i] = r / t->du[i];
+        r %= t->du[i];
+    }
+    finish(t, p);
+}
+
+int till_remove(Till *t, const Payout *p) {
+    for (int i = 0; i < t->n; ++i)
+        if (p->count[i] > t->stock[i]) return -1;
+    for (int i = 0; i < t->n; ++i) t->stock[i] -= p->count[i];
+    return 0;
+}
+
+void till_add(Till *t, const Payout *p) {
+    for (int i = 0; i < t->n; ++i) t->stock[i] += p->count[i];
+}
+
+Money till_value(const Till *t) {
+    Money v = 0;
+    for (int i = 0; i < t->n; ++i) v += t->stock[i] * t->denom[i];
+    return v;
+}
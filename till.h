@@ -0,0 +1,78 @@
+#ifndef TILL_H
+#define TILL_H
+
+#include <stdint.h>
+#include "money.h"
+
+/* Cash drawer for one currency: note/coin stock per denomination and an
+ * exact planner for minimum-piece payouts that respect the stock.
+ *
+ * In a minimum-piece payout, for denominations i > j (in value) either
+ * fewer than b(i,j) = lcm/j pieces of j are used or fewer than
+ * a(i,j) = lcm/i pieces of i stay in the drawer; otherwise trading b(i,j)
+ * pieces of j for a(i,j) of i would save pieces. So, largest first, each
+ * denomination is either nearly exhausted (fewer than keep[i] pieces left)
+ * or it is the first one left well stocked, and below that one every
+ * denomination j needs fewer than b(i,j) pieces for the nearest well
+ * stocked i above it; lent[j] is that bound, or the stock if smaller. The
+ * planner searches those cases: nearly exhausted counts for the large
+ * denominations, any count of the first well stocked one, then up to
+ * lent[j] of each denomination below it while the combinations stay few,
+ * and the rest from a table of the fewest pieces for every amount (layer
+ * j uses denominations j..n-1 with at most lent pieces each).
+ *
+ * The table is brought up to date before each plan, from the deepest
+ * layer whose lent count changed. It holds the smaller denominations,
+ * whose stock normally sits above the bound, so payouts and deposits
+ * rarely change it. Entries are 16 bits: a payout whose part from the
+ * table would need more than 65534 pieces is refused. */
+
+#define TILL_MAX_DENOMS 16
+
+typedef struct {
+    int n;                            /* denominations, largest first */
+    Money denom[TILL_MAX_DENOMS];
+    long stock[TILL_MAX_DENOMS];
+    Money unit;                       /* gcd of the denominations */
+    int64_t du[TILL_MAX_DENOMS];      /* denominations in units */
+    int64_t swap[TILL_MAX_DENOMS][TILL_MAX_DENOMS]; /* lcm / du[j] */
+    int64_t keep[TILL_MAX_DENOMS];    /* max a(i,j) over smaller j */
+    int64_t reach[TILL_MAX_DENOMS];   /* max b(i,j) over larger i */
+    long lent[TILL_MAX_DENOMS];       /* pieces allowed below the first well stocked */
+    int64_t win[TILL_MAX_DENOMS + 1]; /* value of lent[j..n-1] in units */
+    int split;                        /* first denomination in the table */
+    size_t stride;                    /* entries per layer */
+    size_t span[TILL_MAX_DENOMS];     /* entries up to date in layer j */
+    uint16_t *best;                   /* [n-1][stride] fewest pieces, layer j at j-1 */
+    uint16_t *tmp;                    /* rebuild scratch, stride entries */
+} Till;
+
+typedef struct {
+    long count[TILL_MAX_DENOMS];
+    Money total;
+    int pieces;
+} Payout;
+
+/* Set up a till with the given denominations (largest first) and stock.
+   Returns 0, or -1 on bad input or allocation failure. */
+int till_init(Till *t, const Money *denoms, int n, const long *stock);
+void till_free(Till *t);
+
+/* Fewest pieces paying exactly `amount` from stock. Returns 1 and fills p,
+   or 0 if the stock cannot make that amount. May rebuild the table. */
+int till_plan(Till *t, Money amount, Payout *p);
+/* Largest amount <= `amount` the stock can pay, with its payout. */
+Money till_max_payable(Till *t, Money amount, Payout *p);
+/* Unbounded greedy split of an amount handed in (e.g. by a client); the
+   part below the smallest denomination is left out of p->total. */
+void till_split(const Till *t, Money amount, Payout *p);
+
+/* Move pieces out of / into the drawer (the table follows at the next
+   plan). till_remove fails (-1, no change) if the stock is short. */
+int till_remove(Till *t, const Payout *p);
+void till_add(Till *t, const Payout *p);
+
+/* Value of the notes and coins in stock. */
+Money till_value(const Till *t);
+
+#endif /* TILL_H */
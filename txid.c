@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+
+#include "txid.h"
+#include "diag.h"
+#include "utils.h"
+#include "metrics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+static long next_id = 1;        /* next id to hand out */
+static long lease_end;          /* first id past the current block; 0 = none */
+static long held;               /* ids promised to committed exchanges (txid_hold) */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* First unleased id from the lease file: 0 if there is none, -1 if it is unreadable. */
+static long read_lease(void) {
+    FILE *f = fopen(TXID_LEASE_FILE, "r");
+    if (!f) {
+        if (errno != ENOENT) return -1;
+        f = fopen(TXID_LEGACY_FILE, "r");   /* last id of the old one-file counter */
+        long last = 0;
+        if (f && fscanf(f, "%ld", &last) != 1) last = 0;
+        if (f) fclose(f);
+        return last > 0 ? last + 1 : 0;
+    }
+    long v = -1;
+    if (fscanf(f, "%ld", &v) != 1 || v < 1) v = -1;
+    fclose(f);
+    return v;
+}
+
+static int write_lease(long first_free) {
+    const char *tmp = TXID_LEASE_FILE ".tmp";
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    int ok = fprintf(f, "%ld\n", first_free) > 0;
+    ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, TXID_LEASE_FILE) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    int dir = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+    return 0;
+}
+
+static int lock_lease(void) {
+    int fd = open(TXID_LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void unlock_lease(int fd) {
+    if (fd < 0) return;
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/* Take a block of n ids at or after next_id. Returns 0, or -1 with a
+   message when the lease file could not be locked or written: the block is
+   not used, since another process may lease the same ids. */
+static int lease_block(long n) {
+    int64_t t0 = metrics_start(MET_TXID_LEASE);
+    int lk = lock_lease();
+    if (lk < 0) {
+        diag("Could not lock %s: %s", TXID_LOCK_FILE, strerror(errno));
+        metrics_end(MET_TXID_LEASE, t0);
+        return -1;
+    }
+    long first = read_lease();
+    if (first < 0)
+        diag("Warning: %s is unreadable; continuing after the last id in the ledger (%d).",
+                TXID_LEASE_FILE, last_transaction_id);
+    long start = first > next_id ? first : next_id;
+    int rc = 0;
+    if (start + n - 1 > INT_MAX) {
+        diag("Could not lease %ld ids: the tx_id range is used up.", n);
+        rc = -1;
+    } else if (write_lease(start + n) != 0) {
+        diag("Could not lease ids %ld-%ld in %s: %s",
+                start, start + n - 1, TXID_LEASE_FILE, strerror(errno));
+        rc = -1;
+    }
+    unlock_lease(lk);
+    if (rc == 0) {
+        next_id = start;
+        lease_end = start + n;
+    }
+    metrics_end(MET_TXID_LEASE, t0);
+    return rc;
+}
+
+/* Make room for n more ids besides the held ones. */
+static int ensure(long n) {
+    if (lease_end - next_id >= held + n) return 0;
+    return lease_block(held + n > TXID_BLOCK ? held + n : TXID_BLOCK);
+}
+
+int txid_hold(void) {
+    pthread_mutex_lock(&lock);
+    int rc = ensure(1);
+    if (rc == 0) held++;
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+void txid_unhold(void) {
+    pthread_mutex_lock(&lock);
+    if (held > 0) held--;
+    pthread_mutex_unlock(&lock);
+}
+
+int txid_next(void) {
+    pthread_mutex_lock(&lock);
+    int id = -1;
+    if (held > 0) held--;
+    if (ensure(1) == 0) {
+        id = (int)next_id++;
+        if (id > last_transaction_id) last_transaction_id = id;
+    }
+    pthread_mutex_unlock(&lock);
+    return id;
+}
+
+int txid_reserve(int n) {
+    if (n < 1) n = 1;
+    pthread_mutex_lock(&lock);
+    int first = -1;
+    if (ensure(n) == 0) {
+        first = (int)next_id;
+        next_id += n;
+        if (next_id - 1 > last_transaction_id) last_transaction_id = (int)(next_id - 1);
+    }
+    pthread_mutex_unlock(&lock);
+    return first;
+}
+
+void txid_observe(int id) {
+    pthread_mutex_lock(&lock);
+    if (id > last_transaction_id) last_transaction_id = id;
+    if (id >= next_id) next_id = (long)id + 1;
+    pthread_mutex_unlock(&lock);
+}
+
+void txid_release(void) {
+    pthread_mutex_lock(&lock);
+    if (next_id < lease_end) {
+        int lk = lock_lease();
+        if (lk >= 0 && read_lease() == lease_end && write_lease(next_id) == 0)
+            lease_end = next_id;
+        unlock_lease(lk);
+    }
+    pthread_mutex_unlock(&lock);
+}
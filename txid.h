@@ -0,0 +1,41 @@
+#ifndef TXID_H
+#define TXID_H
+
+/* Transaction id allocator.
+ *
+ * Ids are handed out from memory within a block of TXID_BLOCK ids leased
+ * from TXID_LEASE_FILE, which holds the first id nobody has leased yet.
+ * Taking a block advances it with a write to a temporary file, fsync and
+ * rename, under an flock on TXID_LOCK_FILE, so processes sharing the
+ * directory get disjoint blocks. A crash skips the rest of a block; its ids
+ * are never reused. A clean exit hands the rest back if nobody leased a
+ * block after it. If a block cannot be leased (the lock or the write
+ * fails) no id is handed out. exchange_commit takes a hold on one id before
+ * it moves any money, so numbering a committed exchange does not fail.
+ * Calls are serialized by a mutex of the allocator.
+ *
+ * last_transaction_id (utils.h) is the last id handed out or seen. */
+
+#define TXID_LEASE_FILE "tx_id.lease"
+#define TXID_LOCK_FILE "tx_id.lock"
+#define TXID_LEGACY_FILE "last_tx_id.txt"   /* read once when there is no lease yet */
+#define TXID_BLOCK 1024
+
+/* Next unused id; leases a new block when the current one is used up.
+   Returns -1 with a message if no block could be leased; uses up a hold
+   when there is one, and then cannot fail. */
+int txid_next(void);
+/* Make sure one more id is leased for a txid_next to come. Returns 0, or
+   -1 with a message if no block could be leased. */
+int txid_hold(void);
+/* Drop a hold whose exchange did not go ahead. */
+void txid_unhold(void);
+/* n consecutive unused ids, leased with one write when the current block
+   is too short (bulk import). Returns the first, or -1 as txid_next. */
+int txid_reserve(int n);
+/* Ids up to `id` are taken (ledger rows, snapshots). */
+void txid_observe(int id);
+/* Hand the unused part of the current block back to the lease file. */
+void txid_release(void);
+
+#endif /* TXID_H */
@@ -0,0 +1,355 @@
+#define _GNU_SOURCE
+
+#include "txindex.h"
+#include "diag.h"
+#include "utils.h"
+#include "journal.h"
+#include "codec.h"
+#include "txid.h"
+#include "archive.h"
+#include "manifest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TXI_MAGIC "EXTXI01"
+#define TXI_MERGE_AT 65536   /* merge the log into the main file past this many entries */
+
+typedef struct {
+    char magic[8];
+    uint64_t count;
+} TxIndexHeader;
+
+typedef struct {
+    TxIndexEntry *v;
+    size_t n, cap;
+} EntryVec;
+
+static struct {
+    int loaded;                 /* log read into `delta` */
+    int built;                  /* a missing main file was rebuilt (txindex_lookup) */
+    EntryVec delta;             /* log entries plus pending ones, sorted lazily */
+    int delta_sorted;
+    EntryVec pending;           /* not yet appended to the log */
+    void *map;                  /* main file mapping */
+    size_t map_len;
+    const TxIndexEntry *main;
+    size_t main_n;
+} X = { .delta_sorted = 1 };
+
+/* Guards X: rows are added and the log merged on the writer thread (or a
+   server connection) while the main thread looks ids up. Taken after the
+   journal's lock, never before it. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int vec_push(EntryVec *vec, const TxIndexEntry *e) {
+    if (vec->n == vec->cap) {
+        size_t cap = vec->cap ? vec->cap * 2 : 256;
+        TxIndexEntry *p = realloc(vec->v, cap * sizeof(*p));
+        if (!p) return -1;
+        vec->v = p;
+        vec->cap = cap;
+    }
+    vec->v[vec->n++] = *e;
+    return 0;
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    const TxIndexEntry *x = a, *y = b;
+    if (x->tx_id != y->tx_id) return x->tx_id < y->tx_id ? -1 : 1;
+    if (x->date != y->date) return x->date < y->date ? -1 : 1;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static int32_t date_key(const char *date_text) {
+    int y, m, d;
+    if (sscanf(date_text, "%d-%d-%d", &y, &m, &d) != 3) return 0;
+    return y * 10000 + m * 100 + d;
+}
+
+void txindex_date_text(int32_t date, char *out, size_t cap) {
+    snprintf(out, cap, "%04d-%02d-%02d", date / 10000, date / 100 % 100, date % 100);
+}
+
+static void unmap_main(void) {
+    if (X.map) munmap(X.map, X.map_len);
+    X.map = NULL;
+    X.main = NULL;
+    X.main_n = 0;
+}
+
+static void map_main(void) {
+    if (X.map) return;
+    int fd = open(TXI_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TxIndexHeader)) {
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (m != MAP_FAILED) {
+            const TxIndexHeader *h = m;
+            if (memcmp(h->magic, TXI_MAGIC, sizeof(TXI_MAGIC)) == 0 &&
+                sizeof(*h) + h->count * sizeof(TxIndexEntry) <= (size_t)st.st_size) {
+                X.map = m;
+                X.map_len = (size_t)st.st_size;
+                X.main = (const TxIndexEntry *)((const char *)m + sizeof(*h));
+                X.main_n = (size_t)h->count;
+            } else {
+                diag("Ignoring invalid %s; run --rebuild-index", TXI_FILE);
+                munmap(m, (size_t)st.st_size);
+            }
+        }
+    }
+    close(fd);
+}
+
+static void load_log(void) {
+    if (X.loaded) return;
+    X.loaded = 1;
+    FILE *f = fopen(TXI_LOG, "rb");
+    if (!f) return;
+    TxIndexEntry e;
+    while (fread(&e, sizeof(e), 1, f) == 1) {   /* a torn trailing entry is dropped */
+        if (X.delta.n && cmp_entry(&X.delta.v[X.delta.n - 1], &e) > 0) X.delta_sorted = 0;
+        if (vec_push(&X.delta, &e) != 0) break;
+    }
+    fclose(f);
+}
+
+void txindex_add(int tx_id, const char *date_text, long offset) {
+    pthread_mutex_lock(&lock);
+    load_log();
+    TxIndexEntry e = { .tx_id = tx_id, .date = date_key(date_text), .flags = 0, .offset = offset };
+    if (X.delta.n && cmp_entry(&X.delta.v[X.delta.n - 1], &e) > 0) X.delta_sorted = 0;
+    if (vec_push(&X.delta, &e) != 0 || vec_push(&X.pending, &e) != 0)
+        diag("Out of memory in transaction index; run --rebuild-index later");
+    pthread_mutex_unlock(&lock);
+}
+
+static int write_main(const TxIndexEntry *v, size_t n) {
+    const char *tmp = TXI_FILE ".tmp";
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        diag("Could not create %s: %s", tmp, strerror(errno));
+        return -1;
+    }
+    TxIndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TXI_MAGIC, sizeof(TXI_MAGIC));
+    h.count = n;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(v, sizeof(*v), n, f) == n;
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, TXI_FILE) != 0) {
+        diag("Could not write %s: %s", TXI_FILE, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    unmap_main();
+    return 0;
+}
+
+/* Fold the log into the main file: merge two sorted runs, rewrite, drop the log. */
+static int merge_log(void) {
+    map_main();
+    if (!X.delta_sorted) {
+        qsort(X.delta.v, X.delta.n, sizeof(TxIndexEntry), cmp_entry);
+        X.delta_sorted = 1;
+    }
+    size_t n = X.main_n + X.delta.n;
+    TxIndexEntry *out = malloc((n ? n : 1) * sizeof(*out));
+    if (!out) return -1;
+    size_t i = 0, j = 0, k = 0;
+    while (i < X.main_n || j < X.delta.n) {
+        if (j == X.delta.n || (i < X.main_n && cmp_entry(&X.main[i], &X.delta.v[j]) <= 0))
+            out[k++] = X.main[i++];
+        else
+            out[k++] = X.delta.v[j++];
+    }
+    int rc = write_main(out, n);
+    free(out);
+    if (rc == 0) {
+        unlink(TXI_LOG);
+        X.delta.n = 0;
+    }
+    return rc;
+}
+
+static int flush_log(void) {
+    if (X.pending.n == 0) return 0;
+    FILE *f = fopen(TXI_LOG, "ab");
+    if (!f) {
+        diag("Could not open %s: %s", TXI_LOG, strerror(errno));
+        return -1;
+    }
+    int ok = fwrite(X.pending.v, sizeof(TxIndexEntry), X.pending.n, f) == X.pending.n;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        diag("Could not append to %s: %s", TXI_LOG, strerror(errno));
+        return -1;
+    }
+    X.pending.n = 0;
+    return X.delta.n >= TXI_MERGE_AT ? merge_log() : 0;
+}
+
+int txindex_flush(void) {
+    pthread_mutex_lock(&lock);
+    int rc = flush_log();
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+void txindex_close(void) {
+    pthread_mutex_lock(&lock);
+    flush_log();
+    unmap_main();
+    free(X.delta.v);
+    free(X.pending.v);
+    memset(&X.delta, 0, sizeof(X.delta));
+    memset(&X.pending, 0, sizeof(X.pending));
+    X.loaded = 0;
+    X.delta_sorted = 1;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Index of the first entry with id >= tx_id. */
+static size_t lower_bound(const TxIndexEntry *v, size_t n, int64_t tx_id) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (v[mid].tx_id < tx_id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int txindex_lookup(int tx_id, TxIndexEntry *out, int cap) {
+    pthread_mutex_lock(&lock);
+    load_log();
+    map_main();
+    if (!X.map && !X.built && access(TXI_FILE, F_OK) != 0) {
+        X.built = 1;                    /* rows from before the index, or a copied data root */
+        pthread_mutex_unlock(&lock);    /* the rebuild flushes the journal first */
+        if (txindex_rebuild() < 0) return -1;
+        pthread_mutex_lock(&lock);
+    }
+    if (!X.delta_sorted) {
+        qsort(X.delta.v, X.delta.n, sizeof(TxIndexEntry), cmp_entry);
+        X.delta_sorted = 1;
+    }
+    int found = 0;
+    for (size_t i = lower_bound(X.main, X.main_n, tx_id);
+         i < X.main_n && X.main[i].tx_id == tx_id && found < cap; ++i)
+        out[found++] = X.main[i];
+    for (size_t i = lower_bound(X.delta.v, X.delta.n, tx_id);
+         i < X.delta.n && X.delta.v[i].tx_id == tx_id && found < cap; ++i)
+        out[found++] = X.delta.v[i];
+    pthread_mutex_unlock(&lock);
+    return found;
+}
+
+/* Legacy assignments from the current index, sorted by (date, offset). */
+static int cmp_position(const void *a, const void *b) {
+    const TxIndexEntry *x = a, *y = b;
+    if (x->date != y->date) return x->date < y->date ? -1 : 1;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static int collect_legacy(EntryVec *legacy) {
+    for (size_t i = 0; i < X.main_n; ++i)
+        if ((X.main[i].flags & TXI_LEGACY) && vec_push(legacy, &X.main[i]) != 0) return -1;
+    for (size_t i = 0; i < X.delta.n; ++i)
+        if ((X.delta.v[i].flags & TXI_LEGACY) && vec_push(legacy, &X.delta.v[i]) != 0) return -1;
+    qsort(legacy->v, legacy->n, sizeof(TxIndexEntry), cmp_position);
+    return 0;
+}
+
+static int index_file(const char *fname, int32_t date, const EntryVec *legacy,
+                      EntryVec *out, int *assigned) {
+    CsvReader rd;
+    if (csv_reader_open(&rd, fname) != 0) {
+        diag("Could not open %s for indexing: %s", fname, strerror(errno));
+        return -1;
+    }
+    int rc = 0;
+    long here;
+    CsvRow row;
+    while (csv_reader_next(&rd, &row, &here)) {
+        TxIndexEntry e = { .tx_id = row.tx_id, .date = date, .flags = 0, .offset = here };
+        if (!row.has_tx_id) {
+            e.flags = TXI_LEGACY;
+            const TxIndexEntry *prev = bsearch(&e, legacy->v, legacy->n, sizeof(e), cmp_position);
+            if (prev) {
+                e.tx_id = prev->tx_id;
+            } else {
+                e.tx_id = txid_next();
+                if (e.tx_id < 0) { rc = -1; break; }
+                (*assigned)++;
+            }
+        }
+        if (vec_push(out, &e) != 0) { rc = -1; break; }
+    }
+    csv_reader_close(&rd);
+    return rc;
+}
+
+static long rebuild(void) {
+    flush_log();
+    load_log();
+    map_main();
+
+    EntryVec legacy = { 0 }, all = { 0 };
+    if (collect_legacy(&legacy) != 0) {
+        free(legacy.v);
+        return -1;
+    }
+
+    ManifestEntry *files = NULL;
+    int nf = manifest_list("0000-00-00", "9999-99-99", MAN_SALES, &files);
+    if (nf < 0) {
+        free(legacy.v);
+        return -1;
+    }
+    int assigned = 0, rc = 0;
+    for (int i = 0; rc == 0 && i < nf; ++i)
+        rc = index_file(files[i].path, date_key(files[i].date), &legacy, &all, &assigned);
+    free(files);
+    ArchiveDayInfo *arch = NULL;
+    int na = rc == 0 ? archive_list_days("0000-00-00", "9999-99-99", &arch) : 0;
+    for (int i = 0; rc == 0 && i < na; ++i) {      /* offsets into the decoded day files */
+        char name[32];
+        make_daily_csv_name(arch[i].date, name, sizeof(name));
+        rc = index_file(name, date_key(arch[i].date), &legacy, &all, &assigned);
+    }
+    free(arch);
+    if (na < 0) rc = -1;
+    free(legacy.v);
+
+    if (rc == 0) {
+        qsort(all.v, all.n, sizeof(TxIndexEntry), cmp_entry);
+        rc = write_main(all.v, all.n);
+    }
+    free(all.v);
+    if (rc != 0) return -1;
+
+    unlink(TXI_LOG);
+    X.delta.n = 0;
+    X.delta_sorted = 1;
+    if (assigned)
+        diag("Note: assigned ids to %d legacy row(s) without tx_id.", assigned);
+    map_main();
+    return (long)X.main_n;
+}
+
+long txindex_rebuild(void) {
+    journal_flush();
+    pthread_mutex_lock(&lock);
+    long n = rebuild();
+    pthread_mutex_unlock(&lock);
+    return n;
+}
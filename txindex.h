@@ -0,0 +1,46 @@
+#ifndef TXINDEX_H
+#define TXINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Persistent transaction-ID index across all sales_<date>.csv files.
+ *
+ * tx_index.bin holds entries sorted by tx_id and is probed by binary search
+ * through mmap; tx_index.log collects entries for rows written since the
+ * last merge. The write path adds an entry per row and the log is appended
+ * whenever the journal commits, possibly on the writer thread; a mutex
+ * keeps lookups on other threads off the arrays while they are sorted,
+ * merged or remapped. */
+
+#define TXI_FILE "tx_index.bin"
+#define TXI_LOG  "tx_index.log"
+
+#define TXI_LEGACY 0x1   /* row has no tx_id column; the id was assigned by a rebuild */
+
+typedef struct {
+    int64_t tx_id;
+    int32_t date;        /* yyyymmdd of the sales file */
+    uint32_t flags;
+    int64_t offset;      /* byte offset of the row in that file */
+} TxIndexEntry;
+
+/* Record a row written by this process. */
+void txindex_add(int tx_id, const char *date_text, long offset);
+/* Append pending entries to the log (merging it into the main file when large). */
+int txindex_flush(void);
+void txindex_close(void);
+
+/* Find up to `cap` entries for tx_id. Builds the index first (once per
+   process) when tx_index.bin does not exist. Returns the number found, -1
+   on error. */
+int txindex_lookup(int tx_id, TxIndexEntry *out, int cap);
+
+/* Rescan every sales_*.csv and rewrite the index. Legacy rows get ids
+   allocated by txid_next() (kept stable across rebuilds).
+   Returns the number of entries indexed, -1 on error. */
+long txindex_rebuild(void);
+
+void txindex_date_text(int32_t date, char *out, size_t cap);
+
+#endif /* TXINDEX_H */
@@ -1,482 +1,429 @@
 #define _GNU_SOURCE
 
 #include "utils.h"
+#include "diag.h"
+#include "journal.h"
+#include "daysum.h"
+#include "daycache.h"
+#include "rollup.h"
+#include "archive.h"
+#include "manifest.h"
+#include "codec.h"
+#include "txindex.h"
+#include "metrics.h"
+#include "exchange.h"
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <dirent.h>
 #include <time.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-#define MAX_CUR_LOCAL 5
-
-const char *CUR_NAME[MAX_CUR_LOCAL] = { "LOC", "USD", "EUR", "GBP", "JPY" };
-const int D_COUNT[MAX_CUR_LOCAL] =  { 9, 7, 7, 7, 7 };
-const int DENOMS_LOC[] = { 200, 100, 50, 20, 10, 5, 2, 1, 0 };
-const int DENOMS_USD[] = { 100, 50, 20, 10, 5, 2, 1 };
-const int DENOMS_EUR[] = { 500, 200, 100, 50, 20, 10, 5 };
-const int DENOMS_GBP[] = { 50, 20, 10, 5, 2, 1, 0 };
-const int DENOMS_JPY[] = { 10000, 5000, 2000, 1000, 500, 100, 50 };
-const int *DENOMS[MAX_CUR_LOCAL] = { DENOMS_LOC, DENOMS_USD, DENOMS_EUR, DENOMS_GBP, DENOMS_JPY };
-
-Currency *currencies = NULL;
-
-double profit_loc = 0.0;
+_Atomic Money profit_loc = 0;
 char current_date[64] = "N/A";
 int last_transaction_id = 0;
 
-static const char *RECEIPT_FILE = "receipts_%s.txt";
+static const char *RECEIPT_FILE = "%.4s/%.2s/receipts_%s.txt";   /* in the day's partition */
 
-int load_last_tx_id(void) {
-    FILE *f = fopen("last_tx_id.txt", "r");
-    if (!f) return 0;
-    int id = 0;
-    if (fscanf(f, "%d", &id) != 1) id = 0;
-    fclose(f);
-    return id;
+void init_defaults(const char *currency_file) {
+    if (currency_load(currency_file) != 0) {
+        diag("Could not load the currency registry.");
+        exit(1);
+    }
 }
 
-void save_last_tx_id(int id) {
-    FILE *f = fopen("last_tx_id.txt", "w");
-    if (!f) return;
-    fprintf(f, "%d\n", id);
-    fclose(f);
+int refresh_current_date(void) {
+    char buf[sizeof(current_date)] = "";
+    exchange_clock_text(buf, NULL);
+    if (strcmp(buf, current_date) == 0) return 0;
+    memcpy(current_date, buf, sizeof(buf));
+    return 1;
 }
 
-void clear_input(void) {
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF) { /* discard */ }
+void make_daily_csv_name(const char *date_text, char *out, size_t cap) {
+    snprintf(out, cap, "%.4s/%.2s/sales_%s.csv", date_text, date_text + 5, date_text);
 }
 
-int ask_int(const char *prompt, int min, int max) {
-    char buffer[256];
-    long val;
-    do {
-        printf("%s ", prompt);
-        fflush(stdout);
-        if (!fgets(buffer, sizeof(buffer), stdin)) {
-            printf("Error reading input. Please try again.\n");
-            fflush(stdout);
-            continue;
-        }
-        if (buffer[0] == '\n') {
-            printf("Empty input not allowed. Please enter a number.\n");
-            fflush(stdout);
-            continue;
-        }
-        errno = 0;
-        char *endptr;
-        val = strtol(buffer, &endptr, 10);
-        if (endptr == buffer || (*endptr != '\n' && *endptr != '\0')) {
-            printf("Invalid input. Try again.\n");
-            fflush(stdout);
-            continue;
-        }
-        if (errno == ERANGE) {
-            printf("Integer overflow error: value is too large or too small. Please try again.\n");
-            fflush(stdout);
-            continue;
-        }
-        if (val < min || val > max) {
-            printf("Please enter a number in [%d..%d]\n", min, max);
-            fflush(stdout);
-            continue;
-        }
-        break;
-    } while (1);
-    return (int)val;
+void receipt_write(FILE *f, const Transaction *t) {
+    int64_t t0 = metrics_start(MET_RECEIPT);
+    char a[32], b[32], rate[32];
+    int n = fprintf(f, "\n========= CURRENCY EXCHANGE RECEIPT =========\n"
+                       "Transaction ID: %d\nDate: %s %s\nFrom: %s %s\nTo: %s %s\nRate: 1 %s = %s %s\n"
+                       "==========================================\n\n",
+                    t->id, t->date, t->time,
+                    money_fmt(a, t->amount_from), currencies[t->from_cur].name,
+                    money_fmt(b, t->amount_to), currencies[t->to_cur].name,
+                    currencies[t->from_cur].name, fixed_fmt(rate, sizeof(rate), (t->rate + 50) / 100, 4),
+                    currencies[t->to_cur].name);
+    metrics_add(MET_BYTES_WRITTEN, n);
+    metrics_end(MET_RECEIPT, t0);
 }
 
-double ask_double(const char *prompt, double min, double max) {
-    double x;
-    char buffer[256];
-    do {
-        printf("%s ", prompt);
-        fflush(stdout);
-        if (!fgets(buffer, sizeof(buffer), stdin)) {
-            printf("Error reading input. Please try again.\n");
-            fflush(stdout);
-            continue;
-        }
-        if (buffer[0] == '\n') {
-            printf("Empty input not allowed. Please enter a number.\n");
-            fflush(stdout);
-            continue;
-        }
-            errno = 0;
-            char *endptr_int;
-            long long li = strtoll(buffer, &endptr_int, 10);
-            if (endptr_int != buffer && (*endptr_int == '\n' || *endptr_int == '\0')) {
-                if (errno == ERANGE) {
-                    printf("Integer overflow error: value is too large or too small. Please try again.\n");
-                    fflush(stdout);
-                    continue;
-                }
-                x = (double)li;
-            } else {
-                errno = 0;
-                char *endptr;
-                x = strtod(buffer, &endptr);
-                if (endptr == buffer || (*endptr != '\n' && *endptr != '\0')) {
-                    printf("Invalid input: Please enter a valid number.\n");
-                    fflush(stdout);
-                    continue;
-                }
-                if (errno == ERANGE) {
-                    printf("Integer overflow error: value is too large or too small. Please try again.\n");
-                    fflush(stdout);
-                    continue;
-                }
-            }
-        if (x < min || x > max) {
-            printf("Value must be between %.2f and %.2f. Please try again.\n", min, max);
-            fflush(stdout);
-            continue;
-        }
-        break;
-    } while (1);
-    return x;
+void make_receipt_name(const char *date_text, char *out, size_t cap) {
+    snprintf(out, cap, RECEIPT_FILE, date_text, date_text + 5, date_text);
 }
 
-void init_defaults(void) {
-    if (currencies) free(currencies);
-    currencies = calloc(MAX_CUR_LOCAL, sizeof(Currency));
-    if (!currencies) {
-        fprintf(stderr, "Memory allocation failed for currencies!\n");
-        fflush(stdout);
-        exit(1);
+FILE *receipt_open(const char *date_text, char *name, size_t cap) {
+    make_receipt_name(date_text, name, cap);
+    FILE *f = partition_prepare(date_text) == 0 ? fopen(name, "a") : NULL;
+    if (!f) {
+        diag("Error opening receipt file: %s", name);
+        return NULL;
     }
+    metrics_add(MET_FILES_OPENED, 1);
+    return f;
+}
 
-    for (int i = 0; i < MAX_CUR_LOCAL; ++i) {
-        const char *src = CUR_NAME[i];
-        int j = 0;
-        for (; src[j] && j < MAX_NAME-1; ++j)
-            currencies[i].name[j] = src[j];
-        currencies[i].name[j] = '\0';
-        currencies[i].d_count = D_COUNT[i];
-        currencies[i].denoms = DENOMS[i];
+int order_parse(char *line, Order *o, char *why, size_t why_cap) {
+    char *fields[4] = { 0 };
+    int nf = 0;
+    for (char *tok = line; tok && nf < 4; ++nf) {
+        fields[nf] = tok;
+        tok = strchr(tok, ',');
+        if (tok) *tok++ = '\0';
     }
-
-    currencies[CUR_LOC].start_bal = 50000.0;
-    currencies[CUR_USD].start_bal = 10000.0;
-    currencies[CUR_EUR].start_bal = 8000.0;
-    currencies[CUR_GBP].start_bal = 3000.0;
-    currencies[CUR_JPY].start_bal = 1000000.0;
-
-    for (int i = 0; i < MAX_CUR_LOCAL; ++i)
-        currencies[i].bal = currencies[i].start_bal;
-
-    currencies[CUR_LOC].critical_min = 10000.0;
-    currencies[CUR_USD].critical_min = 2000.0;
-    currencies[CUR_EUR].critical_min = 1500.0;
-    currencies[CUR_GBP].critical_min = 500.0;
-    currencies[CUR_JPY].critical_min = 200000.0;
-
-    currencies[CUR_LOC].buy_to_loc = 1.0;   currencies[CUR_LOC].sell_to_loc = 1.0;
-    currencies[CUR_USD].buy_to_loc = 41.36; currencies[CUR_USD].sell_to_loc = 41.45;
-    currencies[CUR_EUR].buy_to_loc = 48.38; currencies[CUR_EUR].sell_to_loc = 48.60;
-    currencies[CUR_GBP].buy_to_loc = 55.91; currencies[CUR_GBP].sell_to_loc = 56.26;
-    currencies[CUR_JPY].buy_to_loc = 0.27;  currencies[CUR_JPY].sell_to_loc = 0.28;
-
-    last_transaction_id = load_last_tx_id();
+    memset(o, 0, sizeof(*o));
+    if (nf < 3) {
+        snprintf(why, why_cap, "expected from,to,amount[,partial_amount]");
+        return -1;
+    }
+    o->from = currency_from_code(fields[0]);
+    o->to = currency_from_code(fields[1]);
+    if (o->from < 0 || o->to < 0) {
+        snprintf(why, why_cap, "unknown currency '%s'", o->from < 0 ? fields[0] : fields[1]);
+        return -1;
+    }
+    if (fixed_parse(fields[2], fields[2] + strlen(fields[2]), MONEY_DECIMALS, &o->amount) != 1 ||
+        o->amount < 1 || o->amount > MONEY_MAX) {
+        snprintf(why, why_cap, "amount must be a number in [0.01..1e12] with at most 2 decimals");
+        return -1;
+    }
+    if (nf == 4 && fields[3][0]) {
+        o->partial = 1;
+        if (fixed_parse(fields[3], fields[3] + strlen(fields[3]), MONEY_DECIMALS, &o->part_to) != 1 ||
+            o->part_to < 0) {
+            snprintf(why, why_cap, "invalid partial amount '%s'", fields[3]);
+            return -1;
+        }
+    }
+    return 0;
 }
 
-void make_daily_csv_name(const char *date_text, char *out, size_t cap) {
-    snprintf(out, cap, "sales_%s.csv", date_text);
+/* Each step is rounded to the minor unit (half away from zero): the LOC
+   value received, the payout, and the LOC cost of that payout. Profit is the
+   difference of the rounded figures, so it sums exactly in the ledger. */
+Money convert_via_local(int from, int to, Money amount_from,
+                        Rate *rate_from_loc, Rate *rate_to_loc,
+                        Money *profit_delta_loc) {
+    Money loc_in = money_mul_rate(amount_from, currencies[from].buy_to_loc);
+    Money amount_to = money_div_rate(loc_in, currencies[to].sell_to_loc);
+
+    if (rate_from_loc) *rate_from_loc = currencies[from].buy_to_loc;
+    if (rate_to_loc)   *rate_to_loc   = currencies[to].sell_to_loc;
+
+    Money cost_loc = money_mul_rate(amount_to, currencies[to].buy_to_loc);
+    Money profit_delta = loc_in - cost_loc;
+    if (profit_delta_loc) *profit_delta_loc = profit_delta;
+    return amount_to;
 }
 
-void generate_receipt(const Transaction *t, const char *date_text) {
-    char fname[128];
-    snprintf(fname, sizeof(fname), RECEIPT_FILE, date_text);
+/* Print the notes and coins of a payout planned by the till. */
+void pay_in_denoms(FILE *out, int cur, const Payout *p) {
+    char buf[32];
+    const Till *t = &currencies[cur].till;
 
-    FILE *f = fopen(fname, "a");
-    if (!f) {
-        fprintf(stderr, "Error opening receipt file: %s\n", fname);
+    if (p->pieces <= 0) {
+        fprintf(out, "[-] No denomination breakdown available for this amount.\n");
+        fflush(out);
         return;
     }
 
-    fprintf(f, "\n========= CURRENCY EXCHANGE RECEIPT =========\n");
-    fprintf(f, "Transaction ID: %d\n", t->id);
-    fprintf(f, "Date: %s %s\n", t->date, t->time);
-    fprintf(f, "From: %.2f %s\n", t->amount_from, CUR_NAME[t->from_cur]);
-    fprintf(f, "To: %.2f %s\n", t->amount_to, CUR_NAME[t->to_cur]);
-    fprintf(f, "Rate: 1 %s = %.4f %s\n", 
-            CUR_NAME[t->from_cur], t->rate, CUR_NAME[t->to_cur]);
-    fprintf(f, "==========================================\n\n");
-
-    fclose(f);
-
-    printf("\nReceipt generated and saved to %s\n", fname);
-}
-
-double csv_sum_profit_for_date(const char *date_text, int *tx_count_out) {
-    char fname[128];
-    make_daily_csv_name(date_text, fname, sizeof(fname));
-
-    FILE *f = fopen(fname, "r");
-    if (!f) {
-        if (tx_count_out) *tx_count_out = 0;
-        return 0.0;
-    }
-
-    char line[512];
-    if (!fgets(line, sizeof(line), f)) {
-        fclose(f);
-        if (tx_count_out) *tx_count_out = 0;
-        return 0.0;
+    fprintf(out, "\n=== Denomination Breakdown for %s %s ===\n", currencies[cur].name, money_fmt(buf, p->total));
+    fprintf(out, "Notes/Coins Required:\n");
+    for (int i = 0; i < t->n; ++i) {
+        if (p->count[i] == 0) continue;
+        fprintf(out, "  %9s %s x %ld\n", money_fmt(buf, t->denom[i]),
+                     t->denom[i] >= currencies[cur].note_min ? "note(s)" : "coin(s)", p->count[i]);
     }
+    fprintf(out, "\nTotal pieces to handle: %d\n", p->pieces);
+    fprintf(out, "=======================================\n\n");
+    fflush(out);
+}
 
-    double total_profit = 0.0;
-    int count = 0;
-
-    while (fgets(line, sizeof(line), f)) {
-        char date[16], timebuf[16], fromc[32], toc[32];
-        int txid = 0;
-        double a_from=0, a_to=0, r_from=0, r_to=0, rem_loc=0, prof=0;
-        int partial_flag=0;
-
-        int n = sscanf(line, "%15[^,],%15[^,],%d,%31[^,],%31[^,],%lf,%lf,%lf,%lf,%d,%lf,%lf",
-                       date, timebuf, &txid, fromc, toc,
-                       &a_from, &a_to, &r_from, &r_to,
-                       &partial_flag, &rem_loc, &prof);
-
-        if (n == 12) {
-            total_profit += prof;
-            count++;
-            continue;
-        }
-
-        n = sscanf(line, "%15[^,],%15[^,],%31[^,],%31[^,],%lf,%lf,%lf,%lf,%d,%lf,%lf",
-                   date, timebuf, fromc, toc,
-                   &a_from, &a_to, &r_from, &r_to,
-                   &partial_flag, &rem_loc, &prof);
-        if (n == 11) {
-            total_profit += prof;
-            count++;
-            continue;
-        }
-
+int csv_parse_row(const char *line, CsvRow *row) {
+    char buf[512];
+    size_t len = strlen(line);
+    if (len < sizeof(buf)) {
+        memcpy(buf, line, len + 1);
+        if (codec_parse_row(buf, len, CSV_FMT_UNKNOWN, row)) return 1;
     }
-    fclose(f);
-
-    if (tx_count_out) *tx_count_out = count;
-    return total_profit;
+    metrics_add(MET_PARSE_FAILURES, 1);
+    return 0;
 }
 
-double csv_sum_profit_for_month(const char *year_month, int *tx_count_out) {
-    DIR *d = opendir(".");
-    if (!d) {
-        if (tx_count_out) *tx_count_out = 0;
-        return 0.0;
+Money csv_sum_profit_for_date(const char *date_text, int *tx_count_out) {
+    int64_t t0 = metrics_start(MET_DAY_SUMMARY);
+    DaySummary s;
+    ArchiveDayInfo a;
+    if (archive_find_day(date_text, &a) == 0) {     /* compacted: the archive directory has it */
+        s.tx_count = a.tx_count;
+        s.profit = a.profit;
+    } else if (daycache_summary(date_text, 0, &s) != 0) {   /* a day read in this session */
+        day_summary_get(date_text, &s);
     }
+    if (tx_count_out) *tx_count_out = (int)s.tx_count;
+    metrics_end(MET_DAY_SUMMARY, t0);
+    return s.profit;
+}
 
-    char prefix[64];
-    snprintf(prefix, sizeof(prefix), "sales_%s-", year_month); 
-    size_t prefix_len = strlen(prefix);
-
-    struct dirent *entry;
-    double total_profit = 0.0;
+Money csv_sum_profit_for_month(const char *year_month, int *tx_count_out) {
+    journal_flush();
+    int64_t t0 = metrics_start(MET_MONTH_PROFIT);
+    Money total_profit = 0;
     int count = 0;
 
-    while ((entry = readdir(d)) != NULL) {
-        const char *name = entry->d_name;
-        if (strncmp(name, prefix, prefix_len) != 0) continue;
-        size_t namelen = strlen(name);
-        if (namelen < 5) continue;
-        if (strcmp(name + namelen - 4, ".csv") != 0) continue;
-
-        FILE *f = fopen(name, "r");
-        if (!f) continue;
-
-        char line[512];
-        if (!fgets(line, sizeof(line), f)) { fclose(f); continue; }
-
-        while (fgets(line, sizeof(line), f)) {
-            char date[16], timebuf[16], fromc[32], toc[32];
-            int txid = 0;
-            double a_from=0, a_to=0, r_from=0, r_to=0, rem_loc=0, prof=0;
-            int partial_flag=0;
-
-            int n = sscanf(line, "%15[^,],%15[^,],%d,%31[^,],%31[^,],%lf,%lf,%lf,%lf,%d,%lf,%lf",
-                           date, timebuf, &txid, fromc, toc,
-                           &a_from, &a_to, &r_from, &r_to,
-                           &partial_flag, &rem_loc, &prof);
-
-            if (n == 12) {
-                total_profit += prof;
-                count++;
-                continue;
-            }
-
-            n = sscanf(line, "%15[^,],%15[^,],%31[^,],%31[^,],%lf,%lf,%lf,%lf,%d,%lf,%lf",
-                       date, timebuf, fromc, toc,
-                       &a_from, &a_to, &r_from, &r_to,
-                       &partial_flag, &rem_loc, &prof);
-            if (n == 11) {
-                total_profit += prof;
-                count++;
-                continue;
-            }
-        }
-        fclose(f);
+    /* The month's day files, from its partition manifest. */
+    char from[16], to[16];
+    snprintf(from, sizeof(from), "%.7s-01", year_month);
+    snprintf(to, sizeof(to), "%.7s-31", year_month);
+    ManifestEntry *files = NULL;
+    int nf = manifest_list(from, to, MAN_SALES, &files);
+    for (int i = 0; i < nf; ++i) {
+        int day_count = 0;
+        total_profit += csv_sum_profit_for_date(files[i].date, &day_count);
+        count += day_count;
+    }
+    free(files);
+
+    /* Compacted days: one archive directory for the whole month. */
+    ArchiveDayInfo *arch = NULL;
+    int na = archive_list_days(from, to, &arch);
+    for (int i = 0; i < na; ++i) {
+        total_profit += arch[i].profit;
+        count += (int)arch[i].tx_count;
     }
+    free(arch);
 
-    closedir(d);
     if (tx_count_out) *tx_count_out = count;
+    metrics_end(MET_MONTH_PROFIT, t0);
     return total_profit;
 }
 
 void ensure_csv_header(FILE *f) {
     long pos = ftell(f);
     if (pos == 0) {
-        fprintf(f,
-            "date,time,tx_id,from_currency,to_currency,amount_from,amount_to,rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc\n");
+        fprintf(f, "%s", CSV_HEADER);
         fflush(f);
     }
 }
 
+int csv_format_row(char *out, size_t cap, const char *date_text, const char *time_text, int tx_id,
+                   const char *from_code, const char *to_code,
+                   Money amt_from, Money amt_to,
+                   Rate rate_from_loc, Rate rate_to_loc,
+                   int partial, Money remainder_loc, Money profit_loc_delta) {
+    return codec_format_row(out, cap, date_text, time_text, tx_id, from_code, to_code,
+                            amt_from, amt_to, rate_from_loc, rate_to_loc,
+                            partial, remainder_loc, profit_loc_delta);
+}
+
+long csv_log_row(const char *date_text, const char *time_text, int tx_id,
+                 const char *from_code, const char *to_code,
+                 Money amt_from, Money amt_to,
+                 Rate rate_from_loc, Rate rate_to_loc,
+                 int partial, Money remainder_loc, Money profit_loc_delta) {
+    int64_t t0 = metrics_start(MET_CSV_LOG_ROW);
+    char row[512];
+    int n = csv_format_row(row, sizeof(row), date_text, time_text, tx_id, from_code, to_code,
+                           amt_from, amt_to, rate_from_loc, rate_to_loc,
+                           partial, remainder_loc, profit_loc_delta);
+    if (n < 0 || (size_t)n >= sizeof(row)) {
+        diag("CSV row for tx %d too long, not logged", tx_id);
+        metrics_end(MET_CSV_LOG_ROW, t0);
+        return -1;
+    }
+    long offset = journal_append(date_text, row, (size_t)n);
+    if (offset >= 0) {
+        txindex_add(tx_id, date_text, offset);
+        daycache_note_row(date_text, row, (size_t)n, offset);
+    }
+    metrics_end(MET_CSV_LOG_ROW, t0);
+    return offset;
+}
+
 void csv_log_transaction(
     const char *date_text,
     int tx_id,
     int from, int to,
-    double amt_from, double amt_to,
-    double rate_from_loc, double rate_to_loc,
-    int partial, double remainder_loc_for_client,
-    double profit_delta_loc
+    Money amt_from, Money amt_to,
+    Rate rate_from_loc, Rate rate_to_loc,
+    int partial, Money remainder_loc_for_client,
+    Money profit_delta_loc
 ) {
-    char fname[128];
-    make_daily_csv_name(date_text, fname, sizeof(fname));
-
-    FILE *f = fopen(fname, "a");
-    if (!f) {
-        fprintf(stderr, "CSV open failed (%s): %s\n", fname, strerror(errno));
-        return;
-    }
-    ensure_csv_header(f);
-
-    time_t t = time(NULL);
-    struct tm *tm_info = localtime(&t);
     char timebuf[16];
-    strftime(timebuf, sizeof(timebuf), "%H:%M:%S", tm_info);
-
-    fprintf(f, "%s,%s,%d,%s,%s,%.6f,%.6f,%.6f,%.6f,%d,%.6f,%.6f\n",
-        date_text, timebuf, tx_id,
-        CUR_NAME[from], CUR_NAME[to],
-        amt_from, amt_to,
-        rate_from_loc, rate_to_loc,
-        partial ? 1 : 0, remainder_loc_for_client,
-        profit_delta_loc
-    );
-    fclose(f);
+    exchange_clock_text(NULL, timebuf);
+
+    csv_log_row(date_text, timebuf, tx_id, currencies[from].name, currencies[to].name,
+                amt_from, amt_to, rate_from_loc, rate_to_loc,
+                partial, remainder_loc_for_client, profit_delta_loc);
 }
 
-int csv_list_transactions_for_date(const char *date_text) {
+int csv_list_transactions_for_date(const char *date_text, RowEmit emit, void *ctx) {
+    journal_flush();
+    int64_t t0 = metrics_start(MET_LIST_DATE);
+    int cached = daycache_list(date_text, emit, ctx);
+    if (cached >= 0) {
+        metrics_end(MET_LIST_DATE, t0);
+        return cached;
+    }
     char fname[128];
     make_daily_csv_name(date_text, fname, sizeof(fname));
-    FILE *f = fopen(fname, "r");
-    if (!f) {
-        fprintf(stderr, "Could not open %s for reading: %s\n", fname, strerror(errno));
+    CsvReader rd;
+    if (csv_reader_open(&rd, fname) != 0) {
+        diag("Could not open %s for reading: %s", fname, strerror(errno));
+        metrics_end(MET_LIST_DATE, t0);
         return -1;
     }
 
-    char line[512];
-    if (!fgets(line, sizeof(line), f)) { fclose(f); return 0; }
-
-    printf("Transactions in %s:\n", fname);
-    int printed = 0;
-    while (fgets(line, sizeof(line), f)) {
-        size_t L = strlen(line);
-        while (L && (line[L-1] == '\n' || line[L-1] == '\r')) { line[--L] = '\0'; }
+    int rows = 0;
+    char *line;
+    size_t L;
+    long off;
+    while (csv_reader_next_line(&rd, &line, &L, &off)) {
+        while (L && line[L-1] == '\r') line[--L] = '\0';
         if (L == 0) continue;
-        printf("%s\n", line);
-        printed++;
+        emit(line, ctx);
+        rows++;
     }
-    fclose(f);
-    return printed;
+    csv_reader_close(&rd);
+    metrics_add(MET_ROWS_READ, rows);
+    metrics_end(MET_LIST_DATE, t0);
+    return rows;
 }
 
-int csv_find_transaction_by_id(const char *date_text, int tx_id) {
+int csv_find_transaction_by_id(const char *date_text, int tx_id, char *out, size_t cap) {
+    journal_flush();
+    int64_t t0 = metrics_start(MET_FIND_BY_ID);
+    int cached = daycache_find(date_text, tx_id, 1, out, cap);
+    if (cached >= 0) {
+        metrics_end(MET_FIND_BY_ID, t0);
+        return cached;
+    }
     char fname[128];
     make_daily_csv_name(date_text, fname, sizeof(fname));
-    FILE *f = fopen(fname, "r");
-    if (!f) {
-        fprintf(stderr, "Could not open %s for searching: %s\n", fname, strerror(errno));
-        return -1;
+    CsvReader rd;
+    if (csv_reader_open(&rd, fname) != 0) {
+        int missing = errno == ENOENT;      /* no rows that day */
+        if (!missing) diag("Could not open %s for searching: %s", fname, strerror(errno));
+        metrics_end(MET_FIND_BY_ID, t0);
+        return missing ? 0 : -1;
     }
 
-    char line[512];
-    if (!fgets(line, sizeof(line), f)) { fclose(f); return 0; }
-
     int found = 0;
-    while (fgets(line, sizeof(line), f)) {
-        int id = 0;
-        char date[16], timebuf[16], fromc[32], toc[32];
-        double a_from=0, a_to=0, r_from=0, r_to=0, rem_loc=0, prof=0;
-        int partial_flag=0;
-        int n = sscanf(line, "%15[^,],%15[^,],%d,%31[^,],%31[^,],%lf,%lf,%lf,%lf,%d,%lf,%lf",
-                       date, timebuf, &id, fromc, toc,
-                       &a_from, &a_to, &r_from, &r_to,
-                       &partial_flag, &rem_loc, &prof);
-        if (n == 12) {
-            if (id == tx_id) { printf("%s", line); found = 1; break; }
-            continue;
+    long rows = 0;
+    CsvRow row;
+    char *line;
+    size_t L;
+    long off;
+    while (csv_reader_next_line(&rd, &line, &L, &off)) {
+        if (L == 0 || (L == 1 && line[0] == '\r')) continue;
+        rows++;
+        if (csv_parse_row(line, &row) && row.has_tx_id && row.tx_id == tx_id) {
+            snprintf(out, cap, "%s", line);
+            found = 1;
+            break;
         }
     }
-    fclose(f);
+    csv_reader_close(&rd);
+    metrics_add(MET_ROWS_READ, rows);
+    metrics_end(MET_FIND_BY_ID, t0);
     return found;
 }
 
-int csv_append_manual_transaction(const char *date_text, int tx_id,
-                                  const char *time_text,
-                                  const char *from_code, const char *to_code,
-                                  double amt_from, double amt_to,
-                                  double rate_from_loc, double rate_to_loc,
-                                  int partial, double remainder_loc, double profit_loc_delta) {
-    char fname[128];
-    make_daily_csv_name(date_text, fname, sizeof(fname));
-    FILE *f = fopen(fname, "a");
-    if (!f) {
-        fprintf(stderr, "Could not open %s for appending: %s\n", fname, strerror(errno));
-        return -1;
-    }
-    ensure_csv_header(f);
-    fprintf(f, "%s,%s,%d,%s,%s,%.6f,%.6f,%.6f,%.6f,%d,%.6f,%.6f\n",
-            date_text, time_text, tx_id, from_code, to_code,
-            amt_from, amt_to, rate_from_loc, rate_to_loc, partial ? 1 : 0, remainder_loc, profit_loc_delta);
-    fclose(f);
-    return 0;
+/* The same from an archived day, decoded whole. */
+static int archived_row_at(const char *fname, long offset, char *line, size_t cap) {
+    CsvReader rd;
+    char *text;
+    size_t len;
+    long off;
+    if (csv_reader_open(&rd, fname) != 0) return -1;
+    int rc = csv_reader_seek(&rd, offset) == 0 && csv_reader_next_line(&rd, &text, &len, &off) ? 0 : -1;
+    if (rc == 0) snprintf(line, cap, "%s", text);
+    csv_reader_close(&rd);
+    return rc;
 }
 
-void generate_daily_summary(const char *date_text) {
-    int tx_count = 0;
-    double total_profit = csv_sum_profit_for_date(date_text, &tx_count);
+/* Read the row at a byte offset of a sales file into line (without newline). */
+static int csv_read_row_at(const char *fname, long offset, char *line, size_t cap) {
+    int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT ? archived_row_at(fname, offset, line, cap) : -1;
+    metrics_add(MET_FILES_OPENED, 1);
+    ssize_t n = pread(fd, line, cap - 1, offset);
+    close(fd);
+    if (n <= 0) return -1;
+    metrics_add(MET_BYTES_READ, n);
+    metrics_add(MET_ROWS_READ, 1);
+    line[n] = '\0';
+    char *nl = strchr(line, '\n');
+    if (nl) *nl = '\0';
+    return 0;
+}
 
-    char year_month[8+1];
-    if (strlen(date_text) >= 7) {
-        strncpy(year_month, date_text, 7);
-        year_month[7] = '\0';
-    } else {
-        year_month[0] = '\0';
+int csv_find_transaction_any_date(int tx_id, TxHit *out, int cap) {
+    journal_flush();
+    int64_t t0 = metrics_start(MET_FIND_ANY_DATE);
+    TxIndexEntry hits[16];
+    int n = txindex_lookup(tx_id, hits, 16);
+    if (n < 0) {
+        metrics_end(MET_FIND_ANY_DATE, t0);
+        return -1;
     }
+    int found = 0;
 
-    int month_tx_count = 0;
-    double month_profit = 0.0;
-    if (year_month[0]) {
-        month_profit = csv_sum_profit_for_month(year_month, &month_tx_count);
+    for (int i = 0; i < n; ++i) {
+        char date[16], fname[128], line[512];
+        txindex_date_text(hits[i].date, date, sizeof(date));
+        make_daily_csv_name(date, fname, sizeof(fname));
+        int legacy = (hits[i].flags & TXI_LEGACY) != 0;
+        CsvRow row;
+        if (legacy || daycache_find(date, tx_id, 0, line, sizeof(line)) != 1) {
+            if (csv_read_row_at(fname, (long)hits[i].offset, line, sizeof(line)) != 0 ||
+                !csv_parse_row(line, &row) || (!legacy && row.tx_id != tx_id)) {
+                diag("Index entry for tx %d in %s is stale; run --rebuild-index", tx_id, fname);
+                continue;
+            }
+        }
+        if (found < cap) {
+            TxHit *h = &out[found];
+            snprintf(h->file, sizeof(h->file), "%s", fname);
+            snprintf(h->line, sizeof(h->line), "%s", line);
+            h->legacy = legacy;
+        }
+        found++;
     }
 
-    double cashier_bonus = month_profit * 0.05; 
-
-    printf("\n=== End-of-day report for %s ===\n", date_text);
-    printf("Total Transactions: %d\n", tx_count);
-    printf("Total Profit (LOC): %.6f\n", total_profit);
-    printf("(Transactions are read from sales_%s.csv)\n", date_text);
-    if (year_month[0]) {
-        printf("Month-to-date Transactions (%s): %d\n", year_month, month_tx_count);
-        printf("Month-to-date Profit (LOC): %.6f\n", month_profit);
-        printf("Cashier monthly bonus (5%% of month profit): %.6f\n", cashier_bonus);
+    /* Rows committed to today's file but missing from the index (e.g. after a crash). */
+    if (!found && cap > 0 &&
+        csv_find_transaction_by_id(current_date, tx_id, out[0].line, sizeof(out[0].line)) > 0) {
+        make_daily_csv_name(current_date, out[0].file, sizeof(out[0].file));
+        out[0].legacy = 0;
+        found = 1;
     }
-    printf("\n");
-    fflush(stdout);
+    metrics_end(MET_FIND_ANY_DATE, t0);
+    return found;
+}
+
+int csv_append_manual_transaction(const char *date_text, int tx_id,
+                                  const char *time_text,
+                                  const char *from_code, const char *to_code,
+                                  Money amt_from, Money amt_to,
+                                  Rate rate_from_loc, Rate rate_to_loc,
+                                  int partial, Money remainder_loc, Money profit_loc_delta) {
+    long off = csv_log_row(date_text, time_text, tx_id, from_code, to_code,
+                           amt_from, amt_to, rate_from_loc, rate_to_loc,
+                           partial, remainder_loc, profit_loc_delta);
+    return off < 0 ? -1 : 0;
 }
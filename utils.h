@@ -3,12 +3,14 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include "money.h"
+#include "till.h"
+#include "currency.h"
 
-#define MAX_CUR 5
-#define MAX_NAME 8
 #define BUF 256
 
-enum { CUR_LOC = 0, CUR_USD = 1, CUR_EUR = 2, CUR_GBP = 3, CUR_JPY = 4 };
+#define CSV_HEADER "date,time,tx_id,from_currency,to_currency,amount_from,amount_to," \
+                   "rate_from_loc,rate_to_loc,partial,remainder_loc,profit_loc\n"
 
 typedef struct {
     int id;
@@ -16,67 +18,115 @@ typedef struct {
     char time[9];
     int from_cur;
     int to_cur;
-    double amount_from;
-    double amount_to;
-    double rate;
-    double profit;
+    Money amount_from;
+    Money amount_to;
+    Rate rate;              /* effective to/from rate */
+    Money profit;
 } Transaction;
 
+/* One parsed sales CSV row. Legacy rows (11 fields) have no tx_id. */
 typedef struct {
-    char name[MAX_NAME];
-    int d_count;
-    const int *denoms;
-    double start_bal;
-    double bal;
-    double critical_min;
-    double buy_to_loc;
-    double sell_to_loc;
-} Currency;
+    char date[16];
+    char time[16];
+    int tx_id;
+    int has_tx_id;
+    char from[32];
+    char to[32];
+    Money amount_from;
+    Money amount_to;
+    Rate rate_from_loc;
+    Rate rate_to_loc;
+    int partial;
+    Money remainder_loc;
+    Money profit_loc;
+} CsvRow;
 
 /* Externs for globals defined in utils.c */
-extern Currency *currencies;
-extern const char *CUR_NAME[5];
-extern const int *DENOMS[5];
-extern const int D_COUNT[5];
-extern double profit_loc;
+extern _Atomic Money profit_loc;   /* added to by concurrent exchanges */
 extern char current_date[64];
-extern int last_transaction_id;
+extern int last_transaction_id;     /* maintained by txid.c */
 
 /* Initialization */
-void init_defaults(void);
+/* Load the currency registry (see currency_load); exits if it cannot be loaded. */
+void init_defaults(const char *currency_file);
+/* Re-read the wall clock into current_date; returns 1 if the day changed. */
+int refresh_current_date(void);
 
-/* Input helpers */
-int ask_int(const char *prompt, int min, int max);
-double ask_double(const char *prompt, double min, double max);
-void clear_input(void);
+/* One exchange order: "from,to,amount[,partial_amount]" with currencies
+   by code or index (--batch files and server requests). */
+typedef struct {
+    int from;
+    int to;
+    Money amount;
+    int partial;            /* partial_amount given */
+    Money part_to;
+} Order;
+
+/* Parse an order line in place. Returns 0, or -1 with the reason in why. */
+int order_parse(char *line, Order *o, char *why, size_t why_cap);
+
+/* Exchange helpers */
+/* LOC-routed conversion at the current rates; fills the rates used and the
+   profit in LOC (all optional). Returns the amount of `to`. */
+Money convert_via_local(int from, int to, Money amount_from,
+                        Rate *rate_from_loc, Rate *rate_to_loc,
+                        Money *profit_delta_loc);
+/* Print the notes and coins of a payout planned by the till. */
+void pay_in_denoms(FILE *out, int cur, const Payout *p);
 
 /* CSV and receipt helpers */
+/* Parse a new-format or legacy sales row; returns 1 on success, 0 if malformed. */
+int csv_parse_row(const char *line, CsvRow *row);
 void make_daily_csv_name(const char *date_text, char *out, size_t cap);
-void generate_receipt(const Transaction *t, const char *date_text);
-void generate_daily_summary(const char *date_text);
-double csv_sum_profit_for_date(const char *date_text, int *tx_count_out);
+void make_receipt_name(const char *date_text, char *out, size_t cap);
+/* Open the day's receipts file for appending (its name goes to name), creating
+   the partition if needed; NULL with a message on error. */
+FILE *receipt_open(const char *date_text, char *name, size_t cap);
+void receipt_write(FILE *f, const Transaction *t);
+Money csv_sum_profit_for_date(const char *date_text, int *tx_count_out);
+Money csv_sum_profit_for_month(const char *year_month, int *tx_count_out);
 void ensure_csv_header(FILE *f);
+int csv_format_row(char *out, size_t cap, const char *date_text, const char *time_text, int tx_id,
+                   const char *from_code, const char *to_code,
+                   Money amt_from, Money amt_to,
+                   Rate rate_from_loc, Rate rate_to_loc,
+                   int partial, Money remainder_loc, Money profit_loc_delta);
+/* Format a row and append it to the day's journal; returns its byte offset or -1. */
+long csv_log_row(const char *date_text, const char *time_text, int tx_id,
+                 const char *from_code, const char *to_code,
+                 Money amt_from, Money amt_to,
+                 Rate rate_from_loc, Rate rate_to_loc,
+                 int partial, Money remainder_loc, Money profit_loc_delta);
 void csv_log_transaction(const char *date_text, int tx_id, int from, int to,
-                         double amt_from, double amt_to, double rate_from_loc, double rate_to_loc,
-                         int partial, double remainder_loc_for_client, double profit_delta_loc);
+                         Money amt_from, Money amt_to, Rate rate_from_loc, Rate rate_to_loc,
+                         int partial, Money remainder_loc_for_client, Money profit_delta_loc);
+
+/* Called with each row of a listing (the CSV line, no newline). */
+typedef void (*RowEmit)(const char *line, void *ctx);
+
+/* Pass every row of the day's file to emit. Returns the rows, or -1 with
+   a message if the file cannot be read. */
+int csv_list_transactions_for_date(const char *date_text, RowEmit emit, void *ctx);
+/* The row of tx_id in the day's file into line (no newline). Returns 1 if
+   found, 0 if not (also when the day has no file), -1 with a message if
+   the file cannot be read. */
+int csv_find_transaction_by_id(const char *date_text, int tx_id, char *line, size_t cap);
+
+typedef struct {
+    char file[128];             /* day file, relative to the data root */
+    char line[512];             /* the row, no newline */
+    int legacy;                 /* a legacy row without tx_id */
+} TxHit;
 
-int csv_list_transactions_for_date(const char *date_text);
-int csv_find_transaction_by_id(const char *date_text, int tx_id);
+/* Look tx_id up in the transaction index (any date), falling back to
+   today's file; at most cap matching rows go to hits. Returns how many
+   there are, or -1 if the index could not be read or built. */
+int csv_find_transaction_any_date(int tx_id, TxHit *hits, int cap);
 int csv_append_manual_transaction(const char *date_text, int tx_id,
                                   const char *time_text,
                                   const char *from_code, const char *to_code,
-                                  double amt_from, double amt_to,
-                                  double rate_from_loc, double rate_to_loc,
-                                  int partial, double remainder_loc, double profit_loc_delta);
-
-void save_last_tx_id(int id);
-int load_last_tx_id(void);
-
-/* Denominations */
-extern const int DENOMS_LOC[];
-extern const int DENOMS_USD[];
-extern const int DENOMS_EUR[];
-extern const int DENOMS_GBP[];
-extern const int DENOMS_JPY[];
+                                  Money amt_from, Money amt_to,
+                                  Rate rate_from_loc, Rate rate_to_loc,
+                                  int partial, Money remainder_loc, Money profit_loc_delta);
 
 #endif /* UTILS_H */
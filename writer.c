@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+
+#include "writer.h"
+#include "diag.h"
+#include "journal.h"
+#include "metrics.h"
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static WriterRecord ring[WRITER_RING];
+/* Free-running counters: records [tail, head) are queued. The producer
+   publishes a slot by advancing head, the writer frees a batch by advancing
+   tail once it is written, so tail == head means nothing is in flight. */
+static _Atomic size_t head, tail;
+static _Atomic int sleeping;      /* writer waits on `wake` */
+static _Atomic int waiting;       /* producer waits on `done` */
+static _Atomic int stopping;
+static sem_t wake, done;
+static pthread_t thread;
+static int running;
+static int batch_commit;          /* commit once per batch ("tx" policy) */
+
+/* Owned by whoever writes: the writer thread, or the caller when it is not running. */
+static FILE *receipts;
+static char receipt_date[16];
+static WriterStats stats;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void write_receipt(const Transaction *t) {
+    if (!receipts || strcmp(receipt_date, t->date) != 0) {
+        char fname[128];
+        if (receipts) fclose(receipts);
+        receipts = receipt_open(t->date, fname, sizeof(fname));
+        if (!receipts) return;
+        snprintf(receipt_date, sizeof(receipt_date), "%s", t->date);
+    }
+    receipt_write(receipts, t);
+}
+
+/* Write records [from, to) of the ring, then commit them as one group. */
+static void write_batch(size_t from, size_t to) {
+    for (size_t i = from; i != to; ++i) {
+        const WriterRecord *r = &ring[i & (WRITER_RING - 1)];
+        const Transaction *t = &r->t;
+        if (r->kind == WRITER_EXCHANGE) write_receipt(t);
+        csv_log_row(t->date, t->time, t->id, currencies[t->from_cur].name, currencies[t->to_cur].name,
+                    t->amount_from, t->amount_to, r->rate_from_loc, r->rate_to_loc,
+                    r->partial, r->remainder_loc, r->profit_delta);
+    }
+    if (batch_commit) journal_commit();
+    if (receipts) fflush(receipts);
+
+    int64_t now = now_ns();
+    for (size_t i = from; i != to; ++i) {
+        int64_t lat = now - ring[i & (WRITER_RING - 1)].queued_ns;
+        stats.total_ns += lat;
+        if (lat > stats.max_ns) stats.max_ns = lat;
+    }
+    stats.records += (long)(to - from);
+    stats.batches++;
+}
+
+/* Sleep until woken, or at most `ms` when it is not negative. */
+static void idle_wait(long ms) {
+    if (ms < 0) {
+        sem_wait(&wake);
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    sem_timedwait(&wake, &ts);
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+        size_t h = atomic_load_explicit(&head, memory_order_acquire);
+        if (t == h) {
+            if (atomic_load(&stopping)) break;
+            /* ms:T holds for the last rows too, not only until the next append */
+            long due = journal_commit_due();
+            if (due == 0) {
+                if (journal_commit() == 0) continue;
+                JournalPolicy p;             /* retry a failed commit a period later */
+                journal_get_policy(&p);
+                due = p.every_ms;
+            }
+            atomic_store(&sleeping, 1);
+            if (atomic_load(&head) == t && !atomic_load(&stopping)) idle_wait(due);
+            atomic_store(&sleeping, 0);
+            continue;
+        }
+        write_batch(t, h);
+        atomic_store(&tail, h);
+        if (atomic_exchange(&waiting, 0)) sem_post(&done);
+    }
+    return NULL;
+}
+
+/* Wait until the writer has freed everything before `want`. */
+static void wait_tail(size_t want) {
+    while (atomic_load_explicit(&tail, memory_order_acquire) < want) {
+        atomic_store(&waiting, 1);
+        if (atomic_load(&tail) >= want) break;
+        sem_wait(&done);
+    }
+}
+
+int writer_start(void) {
+    if (running) return 0;
+    JournalPolicy p;
+    journal_get_policy(&p);
+    batch_commit = p.every_rows == 1;
+    if (batch_commit) {
+        p.every_rows = 0;
+        journal_set_policy(&p);
+    }
+    sem_init(&wake, 0, 0);
+    sem_init(&done, 0, 0);
+    atomic_store(&stopping, 0);
+    if (pthread_create(&thread, NULL, writer_main, NULL) != 0) {
+        diag("Could not start the writer thread: %s", strerror(errno));
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+void writer_push(const WriterRecord *r) {
+    size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+    if (!running) {
+        ring[h & (WRITER_RING - 1)] = *r;
+        ring[h & (WRITER_RING - 1)].queued_ns = now_ns();
+        write_batch(h, h + 1);
+        atomic_store(&head, h + 1);
+        atomic_store(&tail, h + 1);
+        return;
+    }
+    if (h - atomic_load_explicit(&tail, memory_order_acquire) == WRITER_RING)
+        wait_tail(h - WRITER_RING + 1);
+    WriterRecord *slot = &ring[h & (WRITER_RING - 1)];
+    *slot = *r;
+    slot->queued_ns = now_ns();
+    atomic_store(&head, h + 1);
+    if (atomic_exchange(&sleeping, 0)) sem_post(&wake);
+}
+
+void writer_drain(void) {
+    if (running) wait_tail(atomic_load_explicit(&head, memory_order_relaxed));
+}
+
+int writer_idle(void) {
+    return atomic_load_explicit(&tail, memory_order_acquire) ==
+           atomic_load_explicit(&head, memory_order_relaxed);
+}
+
+int writer_sync(void) {
+    writer_drain();
+    int rc = journal_commit();
+    if (receipts && (fflush(receipts) != 0 || fsync(fileno(receipts)) != 0)) {
+        diag("Receipt fsync failed: %s", strerror(errno));
+        rc = -1;
+    }
+    return rc;
+}
+
+void writer_stop(void) {
+    if (running) {
+        writer_drain();
+        atomic_store(&stopping, 1);
+        sem_post(&wake);
+        pthread_join(thread, NULL);
+        sem_destroy(&wake);
+        sem_destroy(&done);
+        running = 0;
+        if (batch_commit) {
+            JournalPolicy p;
+            journal_get_policy(&p);
+            p.every_rows = 1;
+            journal_set_policy(&p);
+            batch_commit = 0;
+        }
+        journal_commit();
+    }
+    if (receipts) fclose(receipts);
+    receipts = NULL;
+}
+
+void writer_stats(WriterStats *out) {
+    *out = stats;
+}
@@ -0,0 +1,55 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdint.h>
+#include "utils.h"
+
+/* Background writer for the interactive exchange path.
+ *
+ * The menu hands each finished transaction to a writer thread through a
+ * single-producer/single-consumer ring and goes back to the customer; the
+ * thread appends receipts and CSV rows a whole batch at a time, so a slow
+ * disk never stalls the counter. While it runs, the journal, the
+ * transaction index and the receipts file belong to the writer: the menu
+ * drains the ring before reading them. */
+
+#define WRITER_RING 1024          /* records; a power of two */
+
+enum { WRITER_EXCHANGE, WRITER_ROW };
+
+typedef struct {
+    int kind;                     /* WRITER_EXCHANGE: receipt + row, WRITER_ROW: row only */
+    Transaction t;                /* id, date, time, currencies, amounts, effective rate */
+    Rate rate_from_loc;
+    Rate rate_to_loc;
+    int partial;
+    Money remainder_loc;
+    Money profit_delta;
+    int64_t queued_ns;            /* set by writer_push */
+} WriterRecord;
+
+typedef struct {
+    long records;
+    long batches;
+    int64_t total_ns;             /* hand-off to written (and committed), summed */
+    int64_t max_ns;
+} WriterStats;
+
+/* Start the thread. A per-row ("tx") journal policy becomes one commit per
+   batch. Returns 0 or -1. */
+int writer_start(void);
+/* Queue a record; waits only while the ring is full. Falls back to writing
+   inline when the writer is not running. */
+void writer_push(const WriterRecord *r);
+/* Wait until every queued record has been written. */
+void writer_drain(void);
+/* Durability barrier: drain, commit the journal and fsync the receipts. */
+int writer_sync(void);
+/* 1 if nothing is queued or being written. */
+int writer_idle(void);
+/* Drain, stop the thread and close the receipts file. Safe to call more than once. */
+void writer_stop(void);
+/* Figures since the start; read after writer_drain(). */
+void writer_stats(WriterStats *out);
+
+#endif /* WRITER_H */